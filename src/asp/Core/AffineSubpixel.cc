@@ -0,0 +1,346 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file AffineSubpixel.cc
+///
+
+#include <asp/Core/AffineSubpixel.h>
+
+#include <vw/Image/EdgeExtension.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  // Independent partial sums per row sum. Eight floats fill a vector
+  // register on the widest machines we build for.
+  const int32 lanes = 8;
+
+  // Sums over a window row of the weighted products that make up the
+  // normal equations, for gradients gx and gy, residual e, weight w
+  // and column offset u.
+  enum RowSum { GXX, GXX_U, GXX_UU, GXY, GXY_U, GXY_UU, GYY, GYY_U, GYY_UU,
+                EX, EX_U, EY, EY_U, EE, W, NUM_ROW_SUMS };
+
+  // Central differences, one sided at the edges.
+  void gradients( float const* image, int32 cols, int32 rows,
+                  std::vector<float>& gx, std::vector<float>& gy ) {
+    gx.resize( size_t( cols ) * rows );
+    gy.resize( size_t( cols ) * rows );
+    for ( int32 j = 0; j < rows; j++ ) {
+      float const* row = image + size_t( j ) * cols;
+      float const* up = image + size_t( std::max( j - 1, 0 ) ) * cols;
+      float const* down = image + size_t( std::min( j + 1, rows - 1 ) ) * cols;
+      float* x = &gx[ size_t( j ) * cols ];
+      float* y = &gy[ size_t( j ) * cols ];
+      const float y_scale = j > 0 && j < rows - 1 ? 0.5f : 1.0f;
+      for ( int32 i = 0; i < cols; i++ )
+        y[i] = ( down[i] - up[i] ) * y_scale;
+      x[0] = row[1] - row[0];
+      for ( int32 i = 1; i < cols - 1; i++ )
+        x[i] = ( row[i + 1] - row[i - 1] ) * 0.5f;
+      x[cols - 1] = row[cols - 1] - row[cols - 2];
+    }
+  }
+
+  inline void add_sample( float (*sums)[lanes], int32 l, float left, float r,
+                          float gx, float gy, float u, float window, float inv_noise ) {
+    const float e = left - r;
+    const float w = window / ( 1 + e * e * inv_noise );
+    const float wxx = w * gx * gx, wxy = w * gx * gy, wyy = w * gy * gy;
+    const float wex = w * e * gx, wey = w * e * gy;
+    sums[GXX][l] += wxx; sums[GXX_U][l] += wxx * u; sums[GXX_UU][l] += wxx * u * u;
+    sums[GXY][l] += wxy; sums[GXY_U][l] += wxy * u; sums[GXY_UU][l] += wxy * u * u;
+    sums[GYY][l] += wyy; sums[GYY_U][l] += wyy * u; sums[GYY_UU][l] += wyy * u * u;
+    sums[EX][l] += wex; sums[EX_U][l] += wex * u;
+    sums[EY][l] += wey; sums[EY_U][l] += wey * u;
+    sums[EE][l] += w * e * e; sums[W][l] += w;
+  }
+
+  // The row sums over n contiguous samples. Each lane sums every
+  // lanes-th sample on its own, so the inner loop has no dependency
+  // between iterations for the vectorizer to respect. The first
+  // iteration has no noise estimate yet and weighs by the window alone.
+  void accumulate_row( float const* left, float const* r, float const* gx, float const* gy,
+                       float const* u, float const* window, int32 n, float inv_noise,
+                       double* row_sums ) {
+    float sums[NUM_ROW_SUMS][lanes];
+    std::fill( &sums[0][0], &sums[0][0] + NUM_ROW_SUMS * lanes, 0.0f );
+    int32 k = 0;
+    for ( ; k + lanes <= n; k += lanes )
+      for ( int32 l = 0; l < lanes; l++ )
+        add_sample( sums, l, left[k + l], r[k + l], gx[k + l], gy[k + l], u[k + l],
+                    window[k + l], inv_noise );
+    for ( ; k < n; k++ )
+      add_sample( sums, 0, left[k], r[k], gx[k], gy[k], u[k], window[k], inv_noise );
+    for ( int32 s = 0; s < NUM_ROW_SUMS; s++ ) {
+      float total = 0;
+      for ( int32 l = 0; l < lanes; l++ )
+        total += sums[s][l];
+      row_sums[s] = total;
+    }
+  }
+
+  // Bilinear samples of the image and its gradients at n points a
+  // constant step apart, clamped to the image.
+  void sample_row( float const* image, float const* gx, float const* gy,
+                   int32 cols, int32 rows, double x, double y, double dx, double dy,
+                   int32 n, float* r, float* rx, float* ry ) {
+    for ( int32 k = 0; k < n; k++, x += dx, y += dy ) {
+      const double cx = std::min( std::max( x, 0.0 ), double( cols - 1 ) );
+      const double cy = std::min( std::max( y, 0.0 ), double( rows - 1 ) );
+      const int32 i = std::min( int32( cx ), cols - 2 ), j = std::min( int32( cy ), rows - 2 );
+      const float fx = float( cx - i ), fy = float( cy - j );
+      const size_t p = size_t( j ) * cols + i, q = p + cols;
+      const float w00 = ( 1 - fx ) * ( 1 - fy ), w10 = fx * ( 1 - fy ),
+        w01 = ( 1 - fx ) * fy, w11 = fx * fy;
+      r[k]  = w00 * image[p] + w10 * image[p + 1] + w01 * image[q] + w11 * image[q + 1];
+      rx[k] = w00 * gx[p] + w10 * gx[p + 1] + w01 * gx[q] + w11 * gx[q + 1];
+      ry[k] = w00 * gy[p] + w10 * gy[p + 1] + w01 * gy[q] + w11 * gy[q + 1];
+    }
+  }
+
+  // Solves h x = b in place by Gaussian elimination with partial
+  // pivoting. False when h is singular next to its own scale.
+  bool solve( double h[6][6], double b[6] ) {
+    double scale = 0;
+    for ( int32 i = 0; i < 6; i++ )
+      scale = std::max( scale, std::fabs( h[i][i] ) );
+    if ( !( scale > 0 ) )
+      return false;
+    for ( int32 c = 0; c < 6; c++ ) {
+      int32 pivot = c;
+      for ( int32 r = c + 1; r < 6; r++ )
+        if ( std::fabs( h[r][c] ) > std::fabs( h[pivot][c] ) )
+          pivot = r;
+      if ( std::fabs( h[pivot][c] ) <= 1e-9 * scale )
+        return false;
+      if ( pivot != c ) {
+        for ( int32 k = 0; k < 6; k++ )
+          std::swap( h[c][k], h[pivot][k] );
+        std::swap( b[c], b[pivot] );
+      }
+      for ( int32 r = c + 1; r < 6; r++ ) {
+        const double f = h[r][c] / h[c][c];
+        for ( int32 k = c; k < 6; k++ )
+          h[r][k] -= f * h[c][k];
+        b[r] -= f * b[c];
+      }
+    }
+    for ( int32 c = 5; c >= 0; c-- ) {
+      for ( int32 k = c + 1; k < 6; k++ )
+        b[c] -= h[c][k] * b[k];
+      b[c] /= h[c][c];
+    }
+    return true;
+  }
+
+  // Takes parameter p out of the system, so that it doesn't change.
+  void hold( double h[6][6], double b[6], int32 p ) {
+    for ( int32 k = 0; k < 6; k++ )
+      h[p][k] = h[k][p] = 0;
+    h[p][p] = 1;
+    b[p] = 0;
+  }
+}
+
+void asp::IterationHistogram::add( std::vector<uint64> const& counts ) {
+  Mutex::Lock lock( m_mutex );
+  if ( m_counts.size() < counts.size() )
+    m_counts.resize( counts.size(), 0 );
+  for ( size_t k = 0; k < counts.size(); k++ )
+    m_counts[k] += counts[k];
+}
+
+std::vector<uint64> asp::IterationHistogram::counts() const {
+  Mutex::Lock lock( m_mutex );
+  return m_counts;
+}
+
+std::ostream& asp::operator<<( std::ostream& os, IterationHistogram const& histogram ) {
+  std::vector<uint64> counts = histogram.counts();
+  std::ios_base::fmtflags flags = os.flags();
+  std::streamsize precision = os.precision();
+  uint64 total = 0;
+  for ( size_t k = 0; k < counts.size(); k++ )
+    total += counts[k];
+  for ( size_t k = 1; k < counts.size(); k++ )
+    os << "\t    " << std::setw( 3 ) << k << " steps: " << std::setw( 12 ) << counts[k]
+       << " (" << std::fixed << std::setprecision( 1 )
+       << ( total ? 100.0 * counts[k] / total : 0.0 ) << "%)\n";
+  os.flags( flags );
+  os.precision( precision );
+  return os;
+}
+
+ImageView<PixelMask<Vector2f> >
+asp::affine_subpixel_block( ImageView<float> const& left,
+                            ImageView<float> const& right,
+                            Vector2i const& right_offset,
+                            ImageView<PixelMask<Vector2f> > const& disparity,
+                            AffineSubpixelSettings const& settings,
+                            std::vector<uint64>* iterations ) {
+  const int32 hx = settings.kernel.x() / 2, hy = settings.kernel.y() / 2;
+  const int32 kx = 2 * hx + 1, ky = 2 * hy + 1;
+  VW_ASSERT( left.cols() == disparity.cols() + 2 * hx && left.rows() == disparity.rows() + 2 * hy,
+             ArgumentErr() << "affine_subpixel_block: left must be the tile plus half the kernel." );
+  VW_ASSERT( right.cols() >= 2 && right.rows() >= 2,
+             ArgumentErr() << "affine_subpixel_block: right window is too small." );
+
+  const int32 rcols = right.cols(), rrows = right.rows(), lcols = left.cols();
+  float const* image = &right(0,0);
+  std::vector<float> gx, gy;
+  gradients( image, rcols, rrows, gx, gy );
+
+  // Gaussian weights over the window, with a standard deviation of a
+  // quarter of its size.
+  std::vector<float> window( size_t( kx ) * ky ), u( kx );
+  const double sx = std::max( kx / 4.0, 1.0 ), sy = std::max( ky / 4.0, 1.0 );
+  for ( int32 v = -hy; v <= hy; v++ )
+    for ( int32 c = -hx; c <= hx; c++ )
+      window[ size_t( v + hy ) * kx + c + hx ] =
+        float( exp( -0.5 * ( c * c / ( sx * sx ) + v * v / ( sy * sy ) ) ) );
+  for ( int32 k = 0; k < kx; k++ )
+    u[k] = float( k - hx );
+
+  std::vector<float> r( kx ), rx( kx ), ry( kx );
+  ImageView<PixelMask<Vector2f> > result( disparity.cols(), disparity.rows() );
+  for ( int32 j = 0; j < disparity.rows(); j++ ) {
+    for ( int32 i = 0; i < disparity.cols(); i++ ) {
+      result(i,j) = disparity(i,j);
+      if ( !is_valid( disparity(i,j) ) )
+        continue;
+      const Vector2f start = disparity(i,j).child();
+
+      // Translation, then the derivatives of the warp along u and v.
+      double a[6] = { start.x(), start.y(), 0, 0, 0, 0 };
+      float inv_noise = 0;
+      bool valid = true;
+      int32 steps = 0;
+      while ( steps < settings.max_iterations && valid ) {
+        steps++;
+        // Row sums, and the same times v and times v squared.
+        double total[3][NUM_ROW_SUMS];
+        std::fill( &total[0][0], &total[0][0] + 3 * NUM_ROW_SUMS, 0.0 );
+        double row_sums[NUM_ROW_SUMS];
+        for ( int32 v = -hy; v <= hy; v++ ) {
+          const double x = i - right_offset.x() - hx + a[0] - a[2] * hx + a[3] * v;
+          const double y = j - right_offset.y() + v + a[1] - a[4] * hx + a[5] * v;
+          sample_row( image, &gx[0], &gy[0], rcols, rrows, x, y, 1 + a[2], a[4], kx,
+                      &r[0], &rx[0], &ry[0] );
+          accumulate_row( &left(0,0) + size_t( j + hy + v ) * lcols + i,
+                          &r[0], &rx[0], &ry[0], &u[0], &window[ size_t( v + hy ) * kx ],
+                          kx, inv_noise, row_sums );
+          for ( int32 s = 0; s < NUM_ROW_SUMS; s++ ) {
+            total[0][s] += row_sums[s];
+            total[1][s] += v * row_sums[s];
+            total[2][s] += v * v * row_sums[s];
+          }
+        }
+
+        // Normal equations for the Jacobian
+        // ( gx, gy, gx u, gx v, gy u, gy v ).
+        double const* t0 = total[0];
+        double const* t1 = total[1];
+        double const* t2 = total[2];
+        double h[6][6] = {
+          { t0[GXX],   t0[GXY],   t0[GXX_U],  t1[GXX],   t0[GXY_U],  t1[GXY]   },
+          { 0,         t0[GYY],   t0[GXY_U],  t1[GXY],   t0[GYY_U],  t1[GYY]   },
+          { 0,         0,         t0[GXX_UU], t1[GXX_U], t0[GXY_UU], t1[GXY_U] },
+          { 0,         0,         0,          t2[GXX],   t1[GXY_U],  t2[GXY]   },
+          { 0,         0,         0,          0,         t0[GYY_UU], t1[GYY_U] },
+          { 0,         0,         0,          0,         0,          t2[GYY]   } };
+        for ( int32 p = 1; p < 6; p++ )
+          for ( int32 q = 0; q < p; q++ )
+            h[p][q] = h[q][p];
+        double b[6] = { t0[EX], t0[EY], t0[EX_U], t1[EX], t0[EY_U], t1[EY] };
+        if ( !settings.do_h )
+          hold( h, b, 0 );
+        if ( !settings.do_v )
+          hold( h, b, 1 );
+
+        if ( !solve( h, b ) ) {
+          valid = false;
+          break;
+        }
+        for ( int32 p = 0; p < 6; p++ )
+          a[p] += b[p];
+        if ( settings.max_move > 0 &&
+             !( std::fabs( a[0] - start.x() ) <= settings.max_move &&
+                std::fabs( a[1] - start.y() ) <= settings.max_move ) ) {
+          valid = false;
+          break;
+        }
+
+        // Done when no corner of the window moved further than the
+        // tolerance.
+        if ( std::fabs( b[0] ) + std::fabs( b[2] ) * hx + std::fabs( b[3] ) * hy < settings.tolerance &&
+             std::fabs( b[1] ) + std::fabs( b[4] ) * hx + std::fabs( b[5] ) * hy < settings.tolerance )
+          break;
+
+        // Samples that disagree by more than the weighted RMS residual
+        // count less in the next iteration.
+        if ( t0[EE] > 0 && t0[W] > 0 )
+          inv_noise = float( 0.125 * t0[W] / t0[EE] );
+      }
+      if ( iterations ) {
+        if ( iterations->size() <= size_t( steps ) )
+          iterations->resize( steps + 1, 0 );
+        ( *iterations )[steps]++;
+      }
+
+      if ( valid )
+        result(i,j) = PixelMask<Vector2f>( Vector2f( float( a[0] ), float( a[1] ) ) );
+      else
+        invalidate( result(i,j) );
+    }
+  }
+  return result;
+}
+
+asp::AffineSubpixelView::prerasterize_type
+asp::AffineSubpixelView::prerasterize( BBox2i const& bbox ) const {
+  ImageView<pixel_type> disparity = crop( m_disparity, bbox );
+  const Vector2i half = m_settings.kernel / 2;
+
+  // The right window must hold every valid pixel's window at its
+  // integer disparity, plus room for the moves allowed. Without a
+  // limit, moves within half a kernel stay inside it and windows that
+  // warp further see its edge pixels repeated.
+  BBox2f range;
+  for ( int32 j = 0; j < disparity.rows(); j++ )
+    for ( int32 i = 0; i < disparity.cols(); i++ )
+      if ( is_valid( disparity(i,j) ) )
+        range.grow( disparity(i,j).child() );
+  if ( range.empty() )
+    return prerasterize_type( disparity, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+
+  const Vector2i slack = m_settings.max_move > 0 ?
+    Vector2i( int32( ceil( m_settings.max_move ) ) + 2, int32( ceil( m_settings.max_move ) ) + 2 ) :
+    half + Vector2i( 2, 2 );
+  BBox2i right_box( bbox.min() + Vector2i( int32( floor( range.min().x() ) ),
+                                           int32( floor( range.min().y() ) ) ) - half - slack,
+                    bbox.max() + Vector2i( int32( ceil( range.max().x() ) ),
+                                           int32( ceil( range.max().y() ) ) ) + half + slack );
+  ImageView<float>
+    left = select_channel( crop( edge_extend( m_left, ZeroEdgeExtension() ),
+                                 BBox2i( bbox.min() - half, bbox.max() + half ) ), 0 ),
+    right = select_channel( crop( edge_extend( m_right, ZeroEdgeExtension() ), right_box ), 0 );
+
+  std::vector<uint64> iterations;
+  ImageView<pixel_type> result =
+    affine_subpixel_block( left, right, right_box.min() - bbox.min(), disparity, m_settings,
+                           m_histogram ? &iterations : 0 );
+  if ( m_histogram )
+    m_histogram->add( iterations );
+  return prerasterize_type( result, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+}
@@ -0,0 +1,140 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file AffineSubpixel.h
+///
+/// Affine adaptive window subpixel refinement. Each pixel's window in
+/// the right image is warped by an affine transform that starts at the
+/// integer disparity, and Gauss-Newton (Lucas-Kanade) steps fit the
+/// transform to the left window. Samples are weighted by a Gaussian
+/// over the window and by how well they already agree, so that
+/// occlusions and outliers within the window don't pull the match.
+///
+/// The right image gradients are computed once per tile instead of
+/// once per pixel and iteration. Each iteration first resamples a
+/// window row into contiguous buffers and then accumulates the normal
+/// equations over them in independent lanes, which the compiler turns
+/// into vector instructions.
+///
+/// Each pixel stops as soon as a step moves no corner of its window by
+/// more than the tolerance, so flat and easy areas take one or two
+/// steps and only difficult ones use the whole budget. The steps taken
+/// can be counted into a histogram to tune that budget from data.
+
+#ifndef __ASP_CORE_AFFINESUBPIXEL_H__
+#define __ASP_CORE_AFFINESUBPIXEL_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <ostream>
+#include <vector>
+
+namespace asp {
+
+  struct AffineSubpixelSettings {
+    vw::Vector2i kernel;       // Window, odd sizes
+    vw::int32 max_iterations;  // Gauss-Newton steps per pixel
+    float tolerance;           // Window corner move that ends the steps, 0 for none
+    float max_move;            // Move from the integer disparity that invalidates, 0 for none
+    bool do_h, do_v;           // Which disparity components to refine
+
+    AffineSubpixelSettings() : kernel( 35, 35 ), max_iterations( 5 ), tolerance( 0.01f ),
+                               max_move( 2 ), do_h( true ), do_v( true ) {}
+  };
+
+  // Number of pixels by the number of steps they took, gathered from
+  // the tiles of a view as they are rendered.
+  class IterationHistogram : private boost::noncopyable {
+    std::vector<vw::uint64> m_counts;
+    mutable vw::Mutex m_mutex;
+
+  public:
+    // Adds counts, where counts[k] is the number of pixels that took
+    // k steps.
+    void add( std::vector<vw::uint64> const& counts );
+    std::vector<vw::uint64> counts() const;
+  };
+
+  // One line per step count, with its share of the pixels.
+  std::ostream& operator<<( std::ostream& os, IterationHistogram const& histogram );
+
+  // Refined disparity of one tile. left is the tile plus half the
+  // kernel on every side. right is a window of the right image whose
+  // first pixel is right_offset from the first pixel of the tile.
+  // Windows that warp past its edges see its edge pixels repeated.
+  // Pixels invalid in disparity stay invalid, as do pixels whose
+  // normal equations are singular and, unless settings.max_move is 0,
+  // pixels that move further than it from their integer disparity. If
+  // iterations is given, the pixels refined are counted into it by the
+  // number of steps they took, growing it as needed.
+  vw::ImageView<vw::PixelMask<vw::Vector2f> >
+  affine_subpixel_block( vw::ImageView<float> const& left,
+                         vw::ImageView<float> const& right,
+                         vw::Vector2i const& right_offset,
+                         vw::ImageView<vw::PixelMask<vw::Vector2f> > const& disparity,
+                         AffineSubpixelSettings const& settings,
+                         std::vector<vw::uint64>* iterations = 0 );
+
+  // Affine refinement of an integer disparity map as a lazy view. The
+  // images are expected to be filtered already, normally by the LOG
+  // filter. With a histogram, every tile rendered adds its step counts
+  // to it.
+  class AffineSubpixelView : public vw::ImageViewBase<AffineSubpixelView> {
+    vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > m_disparity;
+    vw::ImageViewRef<vw::PixelGray<float> > m_left, m_right;
+    AffineSubpixelSettings m_settings;
+    boost::shared_ptr<IterationHistogram> m_histogram;
+
+  public:
+    typedef vw::PixelMask<vw::Vector2f> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<AffineSubpixelView> pixel_accessor;
+
+    AffineSubpixelView( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity,
+                        vw::ImageViewRef<vw::PixelGray<float> > const& left,
+                        vw::ImageViewRef<vw::PixelGray<float> > const& right,
+                        AffineSubpixelSettings const& settings = AffineSubpixelSettings(),
+                        boost::shared_ptr<IterationHistogram> const& histogram =
+                        boost::shared_ptr<IterationHistogram>() ) :
+      m_disparity( disparity ), m_left( left ), m_right( right ), m_settings( settings ),
+      m_histogram( histogram ) {}
+
+    AffineSubpixelSettings const& settings() const { return m_settings; }
+
+    inline vw::int32 cols() const { return m_disparity.cols(); }
+    inline vw::int32 rows() const { return m_disparity.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+    inline result_type operator()( vw::int32 /*i*/, vw::int32 /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw( vw::NoImplErr() << "AffineSubpixelView::operator() is not implemented." );
+      return result_type(); // never reached
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( vw::BBox2i const& bbox ) const;
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize( bbox ), dest, bbox );
+    }
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_AFFINESUBPIXEL_H__
@@ -0,0 +1,70 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file Census.cc
+///
+
+#include <asp/Core/Census.h>
+
+#include <vw/Core/Exception.h>
+
+using namespace vw;
+
+ImageView<asp::CensusSignature>
+asp::census_transform( ImageView<PixelGray<float> > const& image ) {
+  const int32 h = census_half_window;
+  VW_ASSERT( image.cols() > 2 * h && image.rows() > 2 * h,
+             ArgumentErr() << "census_transform: image is smaller than the window." );
+
+  ImageView<CensusSignature> result( image.cols() - 2 * h, image.rows() - 2 * h );
+  for ( int32 j = 0; j < result.rows(); j++ ) {
+    for ( int32 i = 0; i < result.cols(); i++ ) {
+      const float center = image(i + h, j + h).v();
+      CensusSignature signature = 0;
+      for ( int32 v = -h; v <= h; v++ )
+        for ( int32 u = -h; u <= h; u++ )
+          if ( u || v )
+            signature = ( signature << 1 ) | ( image(i + h + u, j + h + v).v() < center );
+      result(i,j) = signature;
+    }
+  }
+  return result;
+}
+
+namespace {
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define ASP_HAVE_POPCNT_DISPATCH 1
+  // Compiled for the popcnt instruction whatever the build targets,
+  // and called only when the processor has it.
+  __attribute__(( target( "popcnt" ) ))
+  void hamming_distance_popcnt( asp::CensusSignature const* a, asp::CensusSignature const* b,
+                                uint8* distance, size_t count ) {
+    for ( size_t i = 0; i < count; i++ )
+      distance[i] = uint8( __builtin_popcountll( a[i] ^ b[i] ) );
+  }
+
+  bool cpu_has_popcnt() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "popcnt" );
+  }
+#endif
+
+}
+
+void asp::hamming_distance( CensusSignature const* a, CensusSignature const* b,
+                            uint8* distance, size_t count ) {
+#ifdef ASP_HAVE_POPCNT_DISPATCH
+  static const bool has_popcnt = cpu_has_popcnt();
+  if ( has_popcnt ) {
+    hamming_distance_popcnt( a, b, distance, count );
+    return;
+  }
+#endif
+  for ( size_t i = 0; i < count; i++ )
+    distance[i] = popcount( a[i] ^ b[i] );
+}
@@ -0,0 +1,53 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file Census.h
+///
+/// Census transform. Each pixel is described by which of its neighbors
+/// are darker than it, packed as bits into one 64 bit word, and two
+/// pixels are compared by the number of bits their signatures differ
+/// in. Only the order of intensities matters, so the cost is unaffected
+/// by gain and bias differences between the images and needs no
+/// preprocessing filter to remove them.
+
+#ifndef __ASP_CORE_CENSUS_H__
+#define __ASP_CORE_CENSUS_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelTypes.h>
+
+namespace asp {
+
+  typedef vw::uint64 CensusSignature;
+
+  // The census window is 7x7: the 48 neighbors of the center pixel.
+  const vw::int32 census_half_window = 3;
+
+  // Bit count in portable code. GCC's __builtin_popcountll is a call
+  // into libgcc unless the whole build targets the popcnt instruction,
+  // so the row loops below pick the instruction at run time instead.
+  inline vw::uint8 popcount( CensusSignature x ) {
+    x = x - ( ( x >> 1 ) & 0x5555555555555555ULL );
+    x = ( x & 0x3333333333333333ULL ) + ( ( x >> 2 ) & 0x3333333333333333ULL );
+    x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f0f0f0f0fULL;
+    return vw::uint8( ( x * 0x0101010101010101ULL ) >> 56 );
+  }
+
+  // Signatures of the pixels whose whole window lies in the image, so
+  // the result is census_half_window smaller on every side.
+  vw::ImageView<CensusSignature>
+  census_transform( vw::ImageView<vw::PixelGray<float> > const& image );
+
+  // Hamming distances between a[i] and b[i]. On x86 processors with
+  // the popcnt instruction it counts one word per instruction, and
+  // falls back to popcount() elsewhere.
+  void hamming_distance( CensusSignature const* a, CensusSignature const* b,
+                         vw::uint8* distance, size_t count );
+
+} // end namespace asp
+
+#endif//__ASP_CORE_CENSUS_H__
@@ -23,6 +23,8 @@ asp::BaseOptions::BaseOptions() {
   raster_tile_size =
     Vector2i(vw_settings().default_tile_size(),
              vw_settings().default_tile_size());
+  num_threads = 0;
+  memory_limit_mb = 0;
 }
 
 asp::BaseOptionsDescription::BaseOptionsDescription( asp::BaseOptions& opt ) {
@@ -30,6 +32,8 @@ asp::BaseOptionsDescription::BaseOptionsDescription( asp::BaseOptions& opt ) {
   (*this).add_options()
     ("threads", po::value(&opt.num_threads)->default_value(0),
      "Select the number of processors (threads) to use.")
+    ("memory-limit", po::value(&opt.memory_limit_mb)->default_value(0),
+     "Memory in MiB that tiles may use. Tile size and thread count are picked to fit. 0 uses half the physical memory.")
     ("no-bigtiff", "Tell GDAL to not create bigtiffs.")
     ("version,v", "Display the version of software.")
     ("help,h", "Display this help message");
@@ -26,6 +26,7 @@ namespace asp {
     vw::DiskImageResourceGDAL::Options gdal_options;
     vw::Vector2i raster_tile_size;
     vw::uint32 num_threads;
+    vw::uint32 memory_limit_mb;   // 0 picks a share of physical memory
 
     BaseOptions();
   };
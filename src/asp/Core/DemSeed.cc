@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file DemSeed.cc
+///
+
+#include <asp/Core/DemSeed.h>
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Image/Manipulation.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+asp::DisparitySeedBuilder::DisparitySeedBuilder( Vector2i const& size, float scale ) :
+  m_sum( size.x(), size.y() ), m_scale( scale ) {
+  fill( m_sum, Vector3f() );
+}
+
+void asp::DisparitySeedBuilder::add( Vector2 const& left_pixel, Vector2 const& right_pixel ) {
+  int32 i = int32( floor( left_pixel.x() * m_scale ) ),
+    j = int32( floor( left_pixel.y() * m_scale ) );
+  if ( i < 0 || j < 0 || i >= m_sum.cols() || j >= m_sum.rows() )
+    return;
+  Vector2 disparity = ( right_pixel - left_pixel ) * m_scale;
+  m_sum(i,j) += Vector3f( disparity.x(), disparity.y(), 1 );
+}
+
+ImageView<PixelMask<Vector2f> > asp::DisparitySeedBuilder::seed() const {
+  ImageView<PixelMask<Vector2f> > result( m_sum.cols(), m_sum.rows() );
+  for ( int32 j = 0; j < m_sum.rows(); j++ )
+    for ( int32 i = 0; i < m_sum.cols(); i++ ) {
+      Vector3f const& sum = m_sum(i,j);
+      if ( sum[2] > 0 )
+        result(i,j) = PixelMask<Vector2f>( Vector2f( sum[0] / sum[2], sum[1] / sum[2] ) );
+      else
+        result(i,j) = PixelMask<Vector2f>();
+    }
+  return result;
+}
+
+ImageView<PixelMask<Vector2f> >
+asp::dem_disparity_seed( ImageViewRef<PixelMask<float> > const& dem,
+                         cartography::GeoReference const& georef,
+                         camera::CameraModel const& left_camera,
+                         camera::CameraModel const& right_camera,
+                         Matrix3x3 const& right_alignment,
+                         Vector2i const& size, float scale ) {
+  DisparitySeedBuilder builder( size, scale );
+
+  // Far more posts than seed pixels only costs projections.
+  double ratio = ( double( dem.cols() ) * dem.rows() ) /
+    ( 4.0 * std::max( size.x(), 1 ) * std::max( size.y(), 1 ) );
+  int32 step = std::max( int32( floor( sqrt( ratio ) ) ), 1 );
+  ImageView<PixelMask<float> > posts = subsample( dem, step );
+
+  for ( int32 j = 0; j < posts.rows(); j++ ) {
+    for ( int32 i = 0; i < posts.cols(); i++ ) {
+      if ( !is_valid( posts(i,j) ) )
+        continue;
+      Vector2 lonlat = georef.pixel_to_lonlat( Vector2( i * step, j * step ) );
+      Vector3 xyz = georef.datum().geodetic_to_cartesian( Vector3( lonlat.x(), lonlat.y(),
+                                                                   posts(i,j).child() ) );
+      Vector2 left_pixel, right_pixel;
+      try {
+        left_pixel = left_camera.point_to_pixel( xyz );
+        right_pixel = right_camera.point_to_pixel( xyz );
+      } catch ( camera::PointToPixelErr const& e ) {
+        continue;
+      }
+      Vector3 aligned = right_alignment * Vector3( right_pixel.x(), right_pixel.y(), 1 );
+      if ( aligned.z() == 0 )
+        continue;
+      builder.add( left_pixel, Vector2( aligned.x(), aligned.y() ) / aligned.z() );
+    }
+  }
+  return builder.seed();
+}
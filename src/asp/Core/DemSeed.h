@@ -0,0 +1,66 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file DemSeed.h
+///
+/// Search range seeds from a prior DEM. On repeat coverage the terrain
+/// is already known, so instead of correlating the subsampled images
+/// the DEM is projected into both cameras and the disparity each post
+/// predicts is written into a seed image like the one SEED_MODE 1
+/// correlates. The per tile search ranges then follow the terrain from
+/// the start, and they are the same from one epoch to the next.
+
+#ifndef __ASP_CORE_DEMSEED_H__
+#define __ASP_CORE_DEMSEED_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Matrix.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  // Collects the disparities of points seen in both images into a seed
+  // image. Each seed pixel gets the mean of the disparities of the
+  // points that land in it, and stays invalid when none do.
+  class DisparitySeedBuilder {
+    vw::ImageView<vw::Vector3f> m_sum; // Disparity sum and point count
+    float m_scale;
+
+  public:
+    // size is the size of the seed image, which is scale times the
+    // size of the left image.
+    DisparitySeedBuilder( vw::Vector2i const& size, float scale );
+
+    // A point seen at left_pixel in the left image and at right_pixel
+    // in the right one, both at full resolution.
+    void add( vw::Vector2 const& left_pixel, vw::Vector2 const& right_pixel );
+
+    // Disparities in seed pixels, as SearchRangeSeed expects them.
+    vw::ImageView<vw::PixelMask<vw::Vector2f> > seed() const;
+  };
+
+  // Seed from the posts of a DEM with heights above the datum of its
+  // georeference. Every post is projected into both cameras, and the
+  // right pixel is moved by right_alignment, the homography that maps
+  // the right image to the aligned -R.tif. The DEM is subsampled to
+  // about four posts per seed pixel. Posts either camera can't see are
+  // skipped.
+  vw::ImageView<vw::PixelMask<vw::Vector2f> >
+  dem_disparity_seed( vw::ImageViewRef<vw::PixelMask<float> > const& dem,
+                      vw::cartography::GeoReference const& georef,
+                      vw::camera::CameraModel const& left_camera,
+                      vw::camera::CameraModel const& right_camera,
+                      vw::Matrix3x3 const& right_alignment,
+                      vw::Vector2i const& size, float scale );
+
+} // end namespace asp
+
+#endif//__ASP_CORE_DEMSEED_H__
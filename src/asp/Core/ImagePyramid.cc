@@ -0,0 +1,310 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file ImagePyramid.cc
+///
+
+#include <asp/Core/ImagePyramid.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PerPixelViews.h>
+#include <vw/Math/BBox.h>
+
+#include <gdal.h>
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <sys/stat.h>
+
+using namespace vw;
+
+// The open file, read by one thread at a time.
+struct asp::ImagePyramid::Dataset {
+  std::string filename;
+  GDALDatasetH handle;
+  float scale; // Takes integer channels to [0,1]
+  bool scaled; // Whether the band has a value scaling instead
+  double value_offset, value_scale;
+  Mutex mutex;
+
+  Dataset( std::string const& name ) : filename( name ) {
+    GDALAllRegister();
+    handle = GDALOpen( name.c_str(), GA_ReadOnly );
+    if ( !handle )
+      vw_throw( IOErr() << "Unable to open " << name << "." );
+    GDALRasterBandH first = GDALGetRasterBand( handle, 1 );
+    switch ( GDALGetRasterDataType( first ) ) {
+    case GDT_Byte:   scale = 1.0f / 255;   break;
+    case GDT_UInt16: scale = 1.0f / 65535; break;
+    default:         scale = 1;            break;
+    }
+    int has_offset = 0, has_scale = 0;
+    value_offset = GDALGetRasterOffset( first, &has_offset );
+    value_scale = GDALGetRasterScale( first, &has_scale );
+    scaled = ( has_offset && value_offset != 0 ) || ( has_scale && value_scale != 1 );
+  }
+  ~Dataset() { GDALClose( handle ); }
+
+  GDALRasterBandH band( int32 level ) {
+    GDALRasterBandH band = GDALGetRasterBand( handle, 1 );
+    return level ? GDALGetOverview( band, level - 1 ) : band;
+  }
+
+  // Reads bbox, which must lie within the level.
+  void read( int32 level, BBox2i const& bbox, float* out ) {
+    Mutex::Lock lock( mutex );
+    CPLErr result = GDALRasterIO( band( level ), GF_Read, bbox.min().x(), bbox.min().y(),
+                                  bbox.width(), bbox.height(), out,
+                                  bbox.width(), bbox.height(), GDT_Float32, 0, 0 );
+    if ( result != CE_None )
+      vw_throw( IOErr() << "GDAL failed to read " << bbox << " of level " << level
+                << " of " << filename << ": " << CPLGetLastErrorMsg() );
+    const size_t count = size_t( bbox.width() ) * bbox.height();
+    if ( scaled ) {
+      for ( size_t k = 0; k < count; k++ )
+        if ( out[k] != 0 )
+          out[k] = float( value_offset + value_scale * out[k] );
+    } else if ( scale != 1 ) {
+      for ( size_t k = 0; k < count; k++ )
+        out[k] *= scale;
+    }
+  }
+};
+
+namespace {
+
+  struct ToFixedPoint : ReturnFixedType<PixelGray<uint16> > {
+    double offset, scale;
+    ToFixedPoint( double offset, double scale ) : offset( offset ), scale( scale ) {}
+    PixelGray<uint16> operator()( PixelGray<float> const& value ) const {
+      if ( value.v() == 0 )
+        return PixelGray<uint16>( 0 );
+      double stored = ( value.v() - offset ) / scale + 0.5;
+      return PixelGray<uint16>( uint16( std::min( std::max( stored, 1.0 ), 65535.0 ) ) );
+    }
+  };
+
+  // Applies a value scaling to stored values that were read already
+  // divided by max_stored, as DiskImageView reads integer channels.
+  struct FromFixedPoint : ReturnFixedType<PixelGray<float> > {
+    double offset, scale, max_stored;
+    FromFixedPoint( double offset, double scale, double max_stored ) :
+      offset( offset ), scale( scale ), max_stored( max_stored ) {}
+    PixelGray<float> operator()( PixelGray<float> const& value ) const {
+      if ( value.v() == 0 )
+        return PixelGray<float>( 0 );
+      double stored = floor( value.v() * max_stored + 0.5 );
+      return PixelGray<float>( float( offset + scale * stored ) );
+    }
+  };
+
+  // What a shared pyramid is remembered by.
+  struct PyramidKey {
+    std::string filename;
+    uint64 size, mtime_sec, mtime_nsec;
+    bool operator==( PyramidKey const& other ) const {
+      return filename == other.filename && size == other.size &&
+        mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+    }
+  };
+
+  PyramidKey pyramid_key( std::string const& filename ) {
+    struct stat info;
+    if ( stat( filename.c_str(), &info ) != 0 )
+      vw_throw( IOErr() << "Unable to open " << filename << "." );
+    PyramidKey key;
+    key.filename = filename;
+    key.size = info.st_size;
+#ifdef __APPLE__
+    key.mtime_sec = info.st_mtimespec.tv_sec;
+    key.mtime_nsec = info.st_mtimespec.tv_nsec;
+#else
+    key.mtime_sec = info.st_mtim.tv_sec;
+    key.mtime_nsec = info.st_mtim.tv_nsec;
+#endif
+    return key;
+  }
+
+  // One overview as a lazy view.
+  class OverviewView : public ImageViewBase<OverviewView> {
+    boost::shared_ptr<asp::ImagePyramid::Dataset> m_dataset;
+    int32 m_level;
+    Vector2i m_size;
+
+  public:
+    typedef PixelGray<float> pixel_type;
+    typedef pixel_type result_type;
+    typedef ProceduralPixelAccessor<OverviewView> pixel_accessor;
+
+    OverviewView( boost::shared_ptr<asp::ImagePyramid::Dataset> const& dataset,
+                  int32 level, Vector2i const& size ) :
+      m_dataset( dataset ), m_level( level ), m_size( size ) {}
+
+    inline int32 cols() const { return m_size.x(); }
+    inline int32 rows() const { return m_size.y(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+    inline result_type operator()( int32 i, int32 j, int32 /*p*/ = 0 ) const {
+      return prerasterize( BBox2i( i, j, 1, 1 ) )(i,j);
+    }
+
+    // Pixels outside the level are zero.
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      ImageView<pixel_type> tile( bbox.width(), bbox.height() );
+      BBox2i inside = bbox;
+      inside.crop( BBox2i( 0, 0, m_size.x(), m_size.y() ) );
+      if ( !inside.empty() ) {
+        ImageView<pixel_type> part( inside.width(), inside.height() );
+        m_dataset->read( m_level, inside, reinterpret_cast<float*>( &part(0,0) ) );
+        crop( tile, inside - bbox.min() ) = part;
+      }
+      return prerasterize_type( tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize( bbox ), dest, bbox );
+    }
+  };
+}
+
+int32 asp::pyramid_levels( Vector2i const& size, int32 min_side ) {
+  int32 levels = 0;
+  while ( ( std::max( size.x(), size.y() ) >> levels ) > min_side )
+    levels++;
+  return levels;
+}
+
+void asp::build_overviews( std::string const& filename, int32 num_overviews ) {
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen( filename.c_str(), GA_Update );
+  if ( !dataset )
+    vw_throw( IOErr() << "Unable to open " << filename << " for update." );
+  std::vector<int> factors;
+  for ( int32 k = 1; k <= num_overviews; k++ )
+    factors.push_back( 1 << k );
+  CPLErr result = GDALBuildOverviews( dataset, "AVERAGE", int( factors.size() ),
+                                      factors.empty() ? NULL : &factors[0],
+                                      0, NULL, NULL, NULL );
+  GDALClose( dataset );
+  if ( result != CE_None )
+    vw_throw( IOErr() << "GDAL failed to build overviews of " << filename << ": "
+              << CPLGetLastErrorMsg() );
+}
+
+ImageViewRef<PixelGray<uint16> >
+asp::to_fixed_point( ImageViewRef<PixelGray<float> > const& image, double offset, double scale ) {
+  return per_pixel_filter( image, ToFixedPoint( offset, scale ) );
+}
+
+void asp::write_value_scaling( std::string const& filename, double offset, double scale ) {
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen( filename.c_str(), GA_Update );
+  if ( !dataset )
+    vw_throw( IOErr() << "Unable to open " << filename << " for update." );
+  GDALRasterBandH band = GDALGetRasterBand( dataset, 1 );
+  bool ok = GDALSetRasterOffset( band, offset ) == CE_None &&
+    GDALSetRasterScale( band, scale ) == CE_None;
+  GDALClose( dataset );
+  if ( !ok )
+    vw_throw( IOErr() << "GDAL failed to record the value scaling of " << filename << ": "
+              << CPLGetLastErrorMsg() );
+}
+
+ImageViewRef<PixelGray<float> > asp::read_float_image( std::string const& filename ) {
+  double offset, scale, max_stored;
+  {
+    ImagePyramid::Dataset dataset( filename );
+    if ( !dataset.scaled )
+      return DiskImageView<PixelGray<float> >( filename );
+    offset = dataset.value_offset;
+    scale = dataset.value_scale;
+    max_stored = floor( 1.0 / dataset.scale + 0.5 );
+  }
+  return per_pixel_filter( DiskImageView<PixelGray<float> >( filename ),
+                           FromFixedPoint( offset, scale, max_stored ) );
+}
+
+int32 asp::overview_count( std::string const& filename ) {
+  ImagePyramid::Dataset dataset( filename );
+  return GDALGetOverviewCount( dataset.band( 0 ) );
+}
+
+asp::ImagePyramid::ImagePyramid( std::string const& filename, size_t cache_bytes ) :
+  m_dataset( new Dataset( filename ) ), m_cache_bytes( cache_bytes ),
+  m_cached( new std::vector<ImageView<PixelGray<float> > >() ), m_mutex( new Mutex() ) {
+  GDALRasterBandH band = m_dataset->band( 0 );
+  int32 count = GDALGetOverviewCount( band );
+  for ( int32 level = 0; level <= count; level++ ) {
+    GDALRasterBandH level_band = m_dataset->band( level );
+    m_sizes.push_back( Vector2i( GDALGetRasterBandXSize( level_band ),
+                                 GDALGetRasterBandYSize( level_band ) ) );
+  }
+  m_cached->resize( m_sizes.size() );
+}
+
+Vector2i const& asp::ImagePyramid::size( int32 level ) const {
+  VW_ASSERT( level >= 0 && level < levels(),
+             ArgumentErr() << "ImagePyramid: " << m_dataset->filename
+             << " has no level " << level << "." );
+  return m_sizes[level];
+}
+
+int32 asp::ImagePyramid::level_for_scale( double scale ) const {
+  int32 level = 0;
+  while ( level + 1 < levels() &&
+          m_sizes[level + 1].x() >= scale * m_sizes[0].x() &&
+          m_sizes[level + 1].y() >= scale * m_sizes[0].y() )
+    level++;
+  return level;
+}
+
+ImageViewRef<PixelGray<float> > asp::ImagePyramid::level( int32 level ) const {
+  Vector2i const& level_size = size( level );
+  if ( level == 0 )
+    return read_float_image( m_dataset->filename );
+  OverviewView view( m_dataset, level, level_size );
+  if ( double( level_size.x() ) * level_size.y() * sizeof(PixelGray<float>) > m_cache_bytes )
+    return view;
+
+  Mutex::Lock lock( *m_mutex );
+  ImageView<PixelGray<float> >& cached = ( *m_cached )[level];
+  if ( cached.cols() == 0 )
+    cached = view;
+  return cached;
+}
+
+asp::ImagePyramid asp::shared_pyramid( std::string const& filename, size_t capacity ) {
+  // Most recently used first.
+  typedef std::list<std::pair<PyramidKey, ImagePyramid> > Entries;
+  static Mutex mutex;
+  static Entries entries;
+
+  PyramidKey key = pyramid_key( filename );
+  Mutex::Lock lock( mutex );
+  for ( Entries::iterator it = entries.begin(); it != entries.end(); ++it )
+    if ( it->first == key ) {
+      entries.splice( entries.begin(), entries, it );
+      return entries.front().second;
+    }
+
+  // Older versions of the file are no use to anyone.
+  for ( Entries::iterator it = entries.begin(); it != entries.end(); )
+    if ( it->first.filename == filename )
+      it = entries.erase( it );
+    else
+      ++it;
+  entries.push_front( std::make_pair( key, ImagePyramid( filename ) ) );
+  while ( entries.size() > std::max( capacity, size_t( 1 ) ) )
+    entries.pop_back();
+  return entries.front().second;
+}
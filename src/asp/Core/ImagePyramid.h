@@ -0,0 +1,100 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file ImagePyramid.h
+///
+/// Reduced resolution levels of the stage inputs, stored as internal
+/// overviews of the GeoTIFF itself. Preprocessing builds them once with
+/// GDAL, and any stage that wants a smaller copy of -L.tif or -R.tif
+/// reads the level it needs instead of resampling the full image
+/// again. Levels small enough are kept in memory after the first read.
+
+#ifndef __ASP_CORE_IMAGEPYRAMID_H__
+#define __ASP_CORE_IMAGEPYRAMID_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  // Number of overviews, each half the size of the one before, until
+  // the longer side is no more than min_side pixels.
+  vw::int32 pyramid_levels( vw::Vector2i const& size, vw::int32 min_side = 256 );
+
+  // Replaces the overviews of filename with num_overviews averaged
+  // ones, reduced by 2, 4, 8 and so on. GeoTIFFs keep them inside the
+  // file.
+  void build_overviews( std::string const& filename, vw::int32 num_overviews );
+
+  // Number of overviews filename has.
+  vw::int32 overview_count( std::string const& filename );
+
+  // Integer images can stand for other values through the GDAL offset
+  // and scale of their band: value = offset + scale * stored. Stored 0
+  // is 0 whatever the scaling, so that the zero pixels the stages mask
+  // as nodata stay zero and no other pixel becomes one.
+  //
+  // image in 16 bit fixed point with the given scaling. Values below
+  // stored 1 or above 65535 saturate.
+  vw::ImageViewRef<vw::PixelGray<vw::uint16> >
+  to_fixed_point( vw::ImageViewRef<vw::PixelGray<float> > const& image,
+                  double offset, double scale );
+
+  // Record the scaling of a fixed point image written by the above.
+  void write_value_scaling( std::string const& filename, double offset, double scale );
+
+  // filename as floats, through its scaling if it has one and otherwise
+  // rescaled from integer channels the way DiskImageView does.
+  vw::ImageViewRef<vw::PixelGray<float> > read_float_image( std::string const& filename );
+
+  // Access to an image and its overviews by level, with level 0 the
+  // image itself. Pixels are read as floats like read_float_image
+  // does. Copies share the file and the levels kept in memory.
+  class ImagePyramid {
+  public:
+    struct Dataset;
+
+  private:
+    boost::shared_ptr<Dataset> m_dataset;
+    std::vector<vw::Vector2i> m_sizes;
+    size_t m_cache_bytes;
+    boost::shared_ptr<std::vector<vw::ImageView<vw::PixelGray<float> > > > m_cached;
+    boost::shared_ptr<vw::Mutex> m_mutex;
+
+  public:
+    // Levels of up to cache_bytes are kept in memory once read.
+    ImagePyramid( std::string const& filename, size_t cache_bytes = 64 * 1024 * 1024 );
+
+    vw::int32 levels() const { return vw::int32( m_sizes.size() ); }
+    vw::Vector2i const& size( vw::int32 level ) const;
+
+    // The smallest level that is still at least scale times the size
+    // of the image, for scale at most 1.
+    vw::int32 level_for_scale( double scale ) const;
+
+    vw::ImageViewRef<vw::PixelGray<float> > level( vw::int32 level ) const;
+  };
+
+  // The pyramid of filename, shared with every other caller in the
+  // process that asked for the same file. Up to capacity pyramids are
+  // kept, dropping the least recently used, each with its open file and
+  // the levels it holds in memory. They are keyed on the path, size and
+  // modification time of the file, so a file that is rewritten or gets
+  // new overviews is opened again.
+  ImagePyramid shared_pyramid( std::string const& filename, size_t capacity = 8 );
+
+} // end namespace asp
+
+#endif//__ASP_CORE_IMAGEPYRAMID_H__
@@ -0,0 +1,421 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file InterestPoints.cc
+///
+
+#include <asp/Core/InterestPoints.h>
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/InterestPoint.h>
+
+#include <boost/foreach.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+using namespace vw;
+
+namespace {
+
+  // Collects the output of the tasks and the first error any of them
+  // hit, since exceptions can't leave a worker thread.
+  struct TaskResults {
+    Mutex mutex;
+    std::string error;
+
+    void fail( std::string const& what ) {
+      Mutex::Lock lock( mutex );
+      if ( error.empty() )
+        error = what.empty() ? "unknown error" : what;
+    }
+    void check() const {
+      if ( !error.empty() )
+        vw_throw( LogicErr() << "Interest point processing failed: " << error );
+    }
+  };
+
+  class DetectTileTask : public Task {
+    asp::IpImage m_image;
+    BBox2i m_core, m_read;
+    float m_threshold;
+    ip::InterestPointList& m_points;
+    TaskResults& m_results;
+
+  public:
+    DetectTileTask( asp::IpImage const& image, BBox2i const& core, BBox2i const& read,
+                    float threshold, ip::InterestPointList& points, TaskResults& results ) :
+      m_image( image ), m_core( core ), m_read( read ), m_threshold( threshold ),
+      m_points( points ), m_results( results ) {}
+
+    void operator()() {
+      try {
+        ip::OBALoGInterestOperator interest_operator( m_threshold );
+        ip::IntegralInterestPointDetector<ip::OBALoGInterestOperator> detector( interest_operator, 0 );
+        asp::IpImage tile = crop( m_image, m_read );
+        ip::InterestPointList found = ip::detect_interest_points( tile, detector );
+
+        ip::InterestPointList kept;
+        BOOST_FOREACH( ip::InterestPoint ip, found ) {
+          ip.x  += m_read.min().x();
+          ip.y  += m_read.min().y();
+          ip.ix += m_read.min().x();
+          ip.iy += m_read.min().y();
+          if ( m_core.contains( Vector2i( ip.ix, ip.iy ) ) )
+            kept.push_back( ip );
+        }
+
+        Mutex::Lock lock( m_results.mutex );
+        m_points.splice( m_points.end(), kept );
+      } catch ( std::exception const& e ) {
+        m_results.fail( e.what() );
+      }
+    }
+  };
+
+  class DescribeTask : public Task {
+    asp::IpImage m_image;
+    ip::InterestPointList& m_points;
+    TaskResults& m_results;
+
+  public:
+    DescribeTask( asp::IpImage const& image, ip::InterestPointList& points,
+                  TaskResults& results ) :
+      m_image( image ), m_points( points ), m_results( results ) {}
+
+    void operator()() {
+      try {
+        ip::SGradDescriptorGenerator descriptor;
+        descriptor( m_image, m_points );
+      } catch ( std::exception const& e ) {
+        m_results.fail( e.what() );
+      }
+    }
+  };
+
+  // The scale space vw::ip::IntegralInterestPointDetector builds for
+  // the OBALoG operator: OBALOG_SCALES scales with sigma starting at
+  // OBALOG_FIRST_SIGMA and growing by sqrt(2) from one to the next. The
+  // octagonal filter standing in for the Laplacian of Gaussian reaches
+  // OBALOG_SUPPORT sigmas from its center.
+  const int32 OBALOG_SCALES = 8;
+  const double OBALOG_FIRST_SIGMA = 1.6;
+  const double OBALOG_SUPPORT = 3.0;
+
+  uint32 thread_count( uint32 num_threads ) {
+    return num_threads ? num_threads : vw_settings().default_num_threads();
+  }
+
+  // KD-tree over a set of descriptors, searched best bin first: the
+  // branches passed over on the way down are queued by how close the
+  // splitting plane is to the query, and are visited nearest first
+  // until the two best neighbors can't improve or the budget of
+  // descriptor comparisons runs out.
+  class DescriptorTree {
+    struct Node {
+      int32 dim;          // Splitting dimension, -1 for a leaf
+      float split;
+      int32 child[2];     // Below and at or above the split
+      size_t begin, end;  // Range of m_index held by a leaf
+    };
+
+    size_t m_dims;
+    std::vector<float> m_data;
+    std::vector<size_t> m_index;
+    std::vector<Node> m_nodes;
+
+    static const size_t leaf_size = 8;
+
+    float const* descriptor( size_t i ) const { return &m_data[i * m_dims]; }
+
+    struct ByDim {
+      DescriptorTree const& tree; size_t dim;
+      ByDim( DescriptorTree const& tree, size_t dim ) : tree( tree ), dim( dim ) {}
+      bool operator()( size_t a, size_t b ) const {
+        return tree.descriptor( a )[dim] < tree.descriptor( b )[dim];
+      }
+    };
+
+    int32 build( size_t begin, size_t end ) {
+      int32 id = m_nodes.size();
+      m_nodes.push_back( Node() );
+      Node node;
+      node.dim = -1; node.split = 0;
+      node.child[0] = node.child[1] = -1;
+      node.begin = begin; node.end = end;
+
+      if ( end - begin > leaf_size ) {
+        // Split at the median of the dimension with the largest spread.
+        float best_spread = 0;
+        for ( size_t d = 0; d < m_dims; d++ ) {
+          double sum = 0, sum2 = 0;
+          for ( size_t i = begin; i < end; i++ ) {
+            float v = descriptor( m_index[i] )[d];
+            sum += v; sum2 += v * v;
+          }
+          double n = end - begin;
+          float spread = sum2 / n - ( sum / n ) * ( sum / n );
+          if ( spread > best_spread ) {
+            best_spread = spread;
+            node.dim = d;
+          }
+        }
+        if ( node.dim >= 0 ) {
+          size_t mid = begin + ( end - begin ) / 2;
+          std::nth_element( m_index.begin() + begin, m_index.begin() + mid,
+                            m_index.begin() + end, ByDim( *this, node.dim ) );
+          node.split = descriptor( m_index[mid] )[node.dim];
+          // Everything equal to the split goes right, so the left part
+          // ends at the first of them.
+          size_t left_end = std::partition( m_index.begin() + begin, m_index.begin() + end,
+                                            SplitBelow( *this, node.dim, node.split ) )
+            - m_index.begin();
+          if ( left_end == begin || left_end == end ) {
+            node.dim = -1;
+          } else {
+            node.child[0] = build( begin, left_end );
+            node.child[1] = build( left_end, end );
+          }
+        }
+      }
+      m_nodes[id] = node;
+      return id;
+    }
+
+    struct SplitBelow {
+      DescriptorTree const& tree; size_t dim; float split;
+      SplitBelow( DescriptorTree const& tree, size_t dim, float split ) :
+        tree( tree ), dim( dim ), split( split ) {}
+      bool operator()( size_t a ) const { return tree.descriptor( a )[dim] < split; }
+    };
+
+  public:
+    DescriptorTree( std::vector<ip::InterestPoint> const& points ) :
+      m_dims( points.empty() ? 0 : points.front().descriptor.size() ) {
+      m_data.reserve( points.size() * m_dims );
+      for ( size_t i = 0; i < points.size(); i++ ) {
+        VW_ASSERT( points[i].descriptor.size() == m_dims,
+                   ArgumentErr() << "match_interest_points: descriptors differ in size." );
+        m_data.insert( m_data.end(), points[i].descriptor.begin(), points[i].descriptor.end() );
+        m_index.push_back( i );
+      }
+      if ( !points.empty() )
+        build( 0, points.size() );
+    }
+
+    size_t dims() const { return m_dims; }
+
+    // The two nearest neighbors of query and their squared distances.
+    void nearest_two( float const* query, size_t max_checks,
+                      size_t best[2], float dist[2] ) const {
+      best[0] = best[1] = 0;
+      dist[0] = dist[1] = std::numeric_limits<float>::max();
+      if ( m_nodes.empty() )
+        return;
+
+      typedef std::pair<float,int32> Branch;
+      std::priority_queue<Branch, std::vector<Branch>, std::greater<Branch> > branches;
+      branches.push( Branch( 0, 0 ) );
+      size_t checks = 0;
+      while ( !branches.empty() ) {
+        Branch branch = branches.top();
+        branches.pop();
+        if ( branch.first >= dist[1] )
+          break;
+        if ( max_checks && checks >= max_checks )
+          break;
+
+        // Walk down to a leaf, queueing the far side of every split.
+        int32 id = branch.second;
+        while ( m_nodes[id].dim >= 0 ) {
+          Node const& node = m_nodes[id];
+          float diff = query[node.dim] - node.split;
+          int32 near = diff < 0 ? 0 : 1;
+          branches.push( Branch( diff * diff, node.child[1 - near] ) );
+          id = node.child[near];
+        }
+
+        Node const& leaf = m_nodes[id];
+        for ( size_t i = leaf.begin; i < leaf.end; i++ ) {
+          float const* d = descriptor( m_index[i] );
+          float sum = 0;
+          for ( size_t k = 0; k < m_dims && sum < dist[1]; k++ )
+            sum += ( query[k] - d[k] ) * ( query[k] - d[k] );
+          checks++;
+          if ( sum < dist[0] ) {
+            dist[1] = dist[0]; best[1] = best[0];
+            dist[0] = sum;     best[0] = m_index[i];
+          } else if ( sum < dist[1] ) {
+            dist[1] = sum;     best[1] = m_index[i];
+          }
+        }
+      }
+    }
+  };
+
+  class MatchTask : public Task {
+    DescriptorTree const& m_tree;
+    std::vector<ip::InterestPoint> const& m_queries;
+    size_t m_begin, m_end, m_max_checks;
+    double m_ratio;
+    std::vector<int64>& m_matches;
+    TaskResults& m_results;
+    ProgressCallback const& m_progress;
+    size_t& m_done;
+
+  public:
+    MatchTask( DescriptorTree const& tree, std::vector<ip::InterestPoint> const& queries,
+               size_t begin, size_t end, size_t max_checks, double ratio,
+               std::vector<int64>& matches, TaskResults& results,
+               ProgressCallback const& progress, size_t& done ) :
+      m_tree( tree ), m_queries( queries ), m_begin( begin ), m_end( end ),
+      m_max_checks( max_checks ), m_ratio( ratio ), m_matches( matches ),
+      m_results( results ), m_progress( progress ), m_done( done ) {}
+
+    void operator()() {
+      try {
+        std::vector<float> query( m_tree.dims() );
+        for ( size_t i = m_begin; i < m_end; i++ ) {
+          VW_ASSERT( m_queries[i].descriptor.size() == m_tree.dims(),
+                     ArgumentErr() << "match_interest_points: descriptors differ in size." );
+          std::copy( m_queries[i].descriptor.begin(), m_queries[i].descriptor.end(), query.begin() );
+          size_t best[2];
+          float dist[2];
+          m_tree.nearest_two( &query[0], m_max_checks, best, dist );
+          if ( dist[1] < std::numeric_limits<float>::max() && dist[0] < m_ratio * dist[1] )
+            m_matches[i] = best[0];
+        }
+        Mutex::Lock lock( m_results.mutex );
+        m_done += m_end - m_begin;
+        m_progress.report_fractional_progress( m_done, m_queries.size() );
+      } catch ( std::exception const& e ) {
+        m_results.fail( e.what() );
+      }
+    }
+  };
+}
+
+int32 asp::interest_point_margin() {
+  double coarsest_sigma = OBALOG_FIRST_SIGMA * pow( 2.0, 0.5 * ( OBALOG_SCALES - 1 ) );
+  return int32( ceil( OBALOG_SUPPORT * coarsest_sigma ) ) + 1;
+}
+
+std::vector<ip::InterestPointList>
+asp::detect_interest_points_tiled( std::vector<IpImage> const& images, float threshold,
+                                   int32 tile_size, int32 margin, uint32 num_threads ) {
+  std::vector<ip::InterestPointList> points( images.size() );
+  TaskResults results;
+  {
+    FifoWorkQueue queue( thread_count( num_threads ) );
+    for ( size_t i = 0; i < images.size(); i++ ) {
+      BBox2i bounds = bounding_box( images[i] );
+      BOOST_FOREACH( BBox2i const& core, image_blocks( images[i], tile_size, tile_size ) ) {
+        BBox2i read = core;
+        read.expand( margin );
+        read.crop( bounds );
+        queue.add_task( boost::shared_ptr<Task>( new DetectTileTask( images[i], core, read,
+                                                                     threshold, points[i],
+                                                                     results ) ) );
+      }
+    }
+    queue.join_all();
+  }
+  results.check();
+  return points;
+}
+
+size_t asp::count_interest_points( ip::InterestPointList const& points, float threshold ) {
+  size_t count = 0;
+  BOOST_FOREACH( ip::InterestPoint const& ip, points )
+    if ( fabs( ip.interest ) > threshold )
+      count++;
+  return count;
+}
+
+void asp::threshold_interest_points( ip::InterestPointList& points, float threshold ) {
+  for ( ip::InterestPointList::iterator it = points.begin(); it != points.end(); ) {
+    if ( fabs( it->interest ) > threshold )
+      ++it;
+    else
+      it = points.erase( it );
+  }
+}
+
+void asp::describe_interest_points( std::vector<IpImage> const& images,
+                                    std::vector<ip::InterestPointList>& points,
+                                    uint32 num_threads ) {
+  VW_ASSERT( images.size() == points.size(),
+             ArgumentErr() << "describe_interest_points: one point list per image is required." );
+
+  // Split every list into chunks of about equal size, describe them
+  // all on the pool, and put the lists back together in order.
+  const size_t chunk_size = 256;
+  std::vector<std::vector<ip::InterestPointList> > chunks( images.size() );
+  for ( size_t i = 0; i < images.size(); i++ ) {
+    while ( !points[i].empty() ) {
+      chunks[i].push_back( ip::InterestPointList() );
+      ip::InterestPointList::iterator end = points[i].begin();
+      for ( size_t n = 0; n < chunk_size && end != points[i].end(); n++ )
+        ++end;
+      chunks[i].back().splice( chunks[i].back().end(), points[i], points[i].begin(), end );
+    }
+  }
+
+  TaskResults results;
+  {
+    FifoWorkQueue queue( thread_count( num_threads ) );
+    for ( size_t i = 0; i < images.size(); i++ )
+      BOOST_FOREACH( ip::InterestPointList& chunk, chunks[i] )
+        queue.add_task( boost::shared_ptr<Task>( new DescribeTask( images[i], chunk, results ) ) );
+    queue.join_all();
+  }
+
+  for ( size_t i = 0; i < images.size(); i++ )
+    BOOST_FOREACH( ip::InterestPointList& chunk, chunks[i] )
+      points[i].splice( points[i].end(), chunk );
+  results.check();
+}
+
+void asp::match_interest_points( std::vector<ip::InterestPoint> const& ip1,
+                                 std::vector<ip::InterestPoint> const& ip2,
+                                 std::vector<ip::InterestPoint>& matched_ip1,
+                                 std::vector<ip::InterestPoint>& matched_ip2,
+                                 double ratio, size_t max_checks, uint32 num_threads,
+                                 ProgressCallback const& progress ) {
+  matched_ip1.clear();
+  matched_ip2.clear();
+  DescriptorTree tree( ip2 );
+
+  std::vector<int64> matches( ip1.size(), -1 );
+  TaskResults results;
+  size_t done = 0;
+  progress.report_progress( 0 );
+  {
+    const size_t chunk_size = 256;
+    FifoWorkQueue queue( thread_count( num_threads ) );
+    for ( size_t begin = 0; begin < ip1.size(); begin += chunk_size )
+      queue.add_task( boost::shared_ptr<Task>
+                      ( new MatchTask( tree, ip1, begin, std::min( begin + chunk_size, ip1.size() ),
+                                       max_checks, ratio, matches, results, progress, done ) ) );
+    queue.join_all();
+  }
+  results.check();
+  progress.report_finished();
+
+  for ( size_t i = 0; i < ip1.size(); i++ ) {
+    if ( matches[i] < 0 )
+      continue;
+    matched_ip1.push_back( ip1[i] );
+    matched_ip2.push_back( ip2[matches[i]] );
+  }
+}
@@ -0,0 +1,83 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file InterestPoints.h
+///
+/// Threaded interest point detection and description. Images are cut
+/// into overlapping tiles and every tile of every image is handed to
+/// one pool of threads, so a pair of images is processed concurrently
+/// instead of one image after the other on a single thread.
+///
+/// Matching goes through a KD-tree over the descriptors of the second
+/// image rather than comparing every pair, which is what lets the point
+/// caps be raised into the tens of thousands.
+
+#ifndef __ASP_CORE_INTERESTPOINTS_H__
+#define __ASP_CORE_INTERESTPOINTS_H__
+
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/InterestPoint/InterestData.h>
+
+#include <vector>
+
+namespace asp {
+
+  typedef vw::ImageView<vw::PixelGray<float> > IpImage;
+
+  // How far outside a tile the OBALoG detector looks to decide on a
+  // point inside it: the radius of its filter at the coarsest scale
+  // plus the neighbor a scale space extremum is compared against.
+  vw::int32 interest_point_margin();
+
+  // OBALoG interest points of each image with |interest| above
+  // threshold. Tiles are tile_size square plus a margin on every side
+  // so that points near their edges are found as in the whole image;
+  // each point is kept only by the tile whose center part holds it.
+  std::vector<vw::ip::InterestPointList>
+  detect_interest_points_tiled( std::vector<IpImage> const& images, float threshold,
+                                vw::int32 tile_size = 512,
+                                vw::int32 margin = interest_point_margin(),
+                                vw::uint32 num_threads = 0 );
+
+  // Number of points with |interest| above threshold.
+  size_t count_interest_points( vw::ip::InterestPointList const& points, float threshold );
+
+  // Drop the points with |interest| at or below threshold.
+  void threshold_interest_points( vw::ip::InterestPointList& points, float threshold );
+
+  // Fill in SGrad descriptors for the points of each image, in chunks
+  // spread over the threads.
+  void describe_interest_points( std::vector<IpImage> const& images,
+                                 std::vector<vw::ip::InterestPointList>& points,
+                                 vw::uint32 num_threads = 0 );
+
+  // Default number of descriptors match_interest_points compares per
+  // point. Enough for nearly all the exact matches of SGrad descriptors
+  // while keeping 10000 x 10000 points to a few seconds.
+  const size_t default_match_checks = 512;
+
+  // Match each point of ip1 to its nearest neighbor in ip2 by L2
+  // descriptor distance. A match is kept when the squared distance to
+  // the nearest neighbor is below ratio times the squared distance to
+  // the second nearest, the same test as vw::ip::InterestPointMatcher,
+  // so the thresholds used with it carry over. At most max_checks
+  // descriptors are compared per point, trading exactness for speed;
+  // 0 searches exhaustively and gives the brute force result.
+  void match_interest_points( std::vector<vw::ip::InterestPoint> const& ip1,
+                              std::vector<vw::ip::InterestPoint> const& ip2,
+                              std::vector<vw::ip::InterestPoint>& matched_ip1,
+                              std::vector<vw::ip::InterestPoint>& matched_ip2,
+                              double ratio, size_t max_checks = default_match_checks,
+                              vw::uint32 num_threads = 0,
+                              vw::ProgressCallback const& progress =
+                              vw::ProgressCallback::dummy_instance() );
+
+} // end namespace asp
+
+#endif//__ASP_CORE_INTERESTPOINTS_H__
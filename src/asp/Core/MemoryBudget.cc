@@ -0,0 +1,87 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file MemoryBudget.cc
+///
+
+#include <asp/Core/MemoryBudget.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+
+#include <algorithm>
+#include <unistd.h>
+
+using namespace vw;
+
+namespace {
+  const double MIB = 1024.0 * 1024.0;
+}
+
+double asp::TileCost::bytes( int32 tile_size ) const {
+  double side = tile_size + 2.0 * halo;
+  return bytes_per_pixel * side * side + fixed_bytes;
+}
+
+asp::TileCost& asp::TileCost::operator+=( TileCost const& other ) {
+  bytes_per_pixel += other.bytes_per_pixel;
+  halo = std::max( halo, other.halo );
+  fixed_bytes += other.fixed_bytes;
+  return *this;
+}
+
+double asp::memory_budget( BaseOptions const& opt ) {
+  if ( opt.memory_limit_mb )
+    return opt.memory_limit_mb * MIB;
+  double physical = double( sysconf( _SC_PHYS_PAGES ) ) * double( sysconf( _SC_PAGESIZE ) );
+  if ( physical <= 0 )
+    return 2048 * MIB;
+  return physical / 2;
+}
+
+uint32 asp::max_threads( BaseOptions const& opt ) {
+  return opt.num_threads ? opt.num_threads : vw_settings().default_num_threads();
+}
+
+asp::TilePlan asp::plan_tiles( TileCost const& cost, double budget, uint32 max_threads,
+                               int32 max_tile, int32 min_tile ) {
+  TilePlan best;
+  best.tile_size = min_tile;
+  best.num_threads = 1;
+  best.bytes_per_thread = cost.bytes( min_tile );
+  double best_throughput = -1;
+
+  for ( int32 tile = min_tile; tile <= max_tile; tile *= 2 ) {
+    double bytes = cost.bytes( tile );
+    uint32 threads = std::min( max_threads, uint32( budget / bytes ) );
+    if ( threads < 1 )
+      break;
+    double useful = double( tile ) * tile / ( ( tile + 2.0 * cost.halo ) * ( tile + 2.0 * cost.halo ) );
+    double throughput = threads * useful;
+    if ( throughput >= best_throughput ) {
+      best_throughput = throughput;
+      best.tile_size = tile;
+      best.num_threads = threads;
+      best.bytes_per_thread = bytes;
+    }
+  }
+
+  if ( best_throughput < 0 )
+    vw_out(WarningMessage) << "Memory limit of " << budget / MIB << " MiB is too small: one "
+                           << min_tile << " px tile needs " << best.bytes_per_thread / MIB
+                           << " MiB.\n";
+  return best;
+}
+
+asp::TilePlan asp::plan_stage_tiles( std::string const& stage, TileCost const& cost,
+                                     BaseOptions const& opt, int32 max_tile ) {
+  double budget = memory_budget( opt );
+  TilePlan plan = plan_tiles( cost, budget, max_threads( opt ), max_tile );
+  vw_out() << "\t--> " << stage << ": " << plan.tile_size << " px tiles on "
+           << plan.num_threads << " threads, ~" << int( plan.bytes_per_thread / MIB )
+           << " MiB each of a " << int( budget / MIB ) << " MiB budget.\n";
+  return plan;
+}
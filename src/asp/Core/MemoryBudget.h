@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file MemoryBudget.h
+///
+/// Picks the tile size and thread count of a stage from a memory
+/// budget. Each stage describes what one tile costs with a TileCost: the
+/// bytes its view tree keeps alive per pixel while a tile is rendered,
+/// and how far outside the tile it reads. plan_tiles then searches the
+/// power of two tile sizes and thread counts for the combination that
+/// fits the budget and wastes the least work on halos.
+
+#ifndef __ASP_CORE_MEMORYBUDGET_H__
+#define __ASP_CORE_MEMORYBUDGET_H__
+
+#include <asp/Core/Common.h>
+
+#include <string>
+
+namespace asp {
+
+  struct TileCost {
+    double bytes_per_pixel;   // Buffers alive per pixel of the tile plus its halo
+    vw::int32 halo;           // Pixels read beyond each side of the tile
+    double fixed_bytes;       // Per thread memory that doesn't grow with the tile
+
+    TileCost( double bytes_per_pixel = 0, vw::int32 halo = 0, double fixed_bytes = 0 ) :
+      bytes_per_pixel( bytes_per_pixel ), halo( halo ), fixed_bytes( fixed_bytes ) {}
+
+    // Memory needed by one thread rendering a tile_size square tile.
+    double bytes( vw::int32 tile_size ) const;
+
+    // Cost of rendering through both view trees at once. The larger
+    // halo is charged to both, which overestimates a little.
+    TileCost& operator+=( TileCost const& other );
+  };
+
+  struct TilePlan {
+    vw::int32 tile_size;
+    vw::uint32 num_threads;
+    double bytes_per_thread;
+  };
+
+  // Bytes the tiles of a stage may use: --memory-limit, or half the
+  // physical memory when that isn't set.
+  double memory_budget( BaseOptions const& opt );
+
+  // Threads to plan for: --threads, or the Vision Workbench default.
+  vw::uint32 max_threads( BaseOptions const& opt );
+
+  // Search tile sizes from min_tile to max_tile and 1 to max_threads
+  // threads for the most useful pixels per round (threads times the
+  // fraction of each tile that isn't halo) within budget. Ties go to
+  // the larger tile. If nothing fits, one thread on min_tile tiles is
+  // returned with a warning.
+  TilePlan plan_tiles( TileCost const& cost, double budget, vw::uint32 max_threads,
+                       vw::int32 max_tile, vw::int32 min_tile = 64 );
+
+  // plan_tiles with opt's budget and threads. The choice is logged
+  // under the stage name. The caller writes with the options of
+  // stage_options and passes num_threads on to the block writer.
+  TilePlan plan_stage_tiles( std::string const& stage, TileCost const& cost,
+                             BaseOptions const& opt, vw::int32 max_tile );
+
+  // A copy of opt with the tile size of plan, for the writers of one
+  // stage. opt itself is left alone, so the plan of one stage doesn't
+  // carry over into the next.
+  template <class OptionsT>
+  OptionsT stage_options( OptionsT const& opt, TilePlan const& plan ) {
+    OptionsT stage_opt( opt );
+    stage_opt.raster_tile_size = vw::Vector2i( plan.tile_size, plan.tile_size );
+    return stage_opt;
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_MEMORYBUDGET_H__
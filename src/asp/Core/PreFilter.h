@@ -0,0 +1,42 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file PreFilter.h
+///
+/// The filters of PREPROCESSING_FILTER_MODE as lazy views over a whole
+/// image. They are the filters the vw::stereo preprocessing filter
+/// functors apply to each tile, so an image filtered once here can be
+/// correlated with the null filter instead, as long as the correlator
+/// filters at full resolution only.
+
+#ifndef __ASP_CORE_PREFILTER_H__
+#define __ASP_CORE_PREFILTER_H__
+
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelTypes.h>
+
+namespace asp {
+
+  // Filter mode 3 is SLOG, 2 LOG, 1 a Gaussian blur and anything else
+  // none. width is the standard deviation of the blur.
+  inline vw::ImageViewRef<vw::PixelGray<float> >
+  preprocessing_filter( vw::ImageViewRef<vw::PixelGray<float> > const& image,
+                        int mode, float width ) {
+    switch ( mode ) {
+    case 3:  return vw::threshold( vw::laplacian_filter( vw::gaussian_filter( image, width ) ),
+                                   0.0f, 0.0f, 1.0f );
+    case 2:  return vw::laplacian_filter( vw::gaussian_filter( image, width ) );
+    case 1:  return vw::gaussian_filter( image, width );
+    default: return image;
+    }
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_PREFILTER_H__
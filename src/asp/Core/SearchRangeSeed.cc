@@ -0,0 +1,67 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file SearchRangeSeed.cc
+///
+
+#include <asp/Core/SearchRangeSeed.h>
+
+#include <algorithm>
+
+using namespace vw;
+
+BBox2i asp::SearchRangeSeed::search_range( BBox2i const& tile ) const {
+  // Seed pixels under the tile, and one more all around so the seed's
+  // blocky sampling can't miss terrain at the tile's edge.
+  BBox2i area( Vector2i( int32( floor( tile.min().x() * m_scale ) ) - 1,
+                         int32( floor( tile.min().y() * m_scale ) ) - 1 ),
+               Vector2i( int32( ceil( tile.max().x() * m_scale ) ) + 1,
+                         int32( ceil( tile.max().y() * m_scale ) ) + 1 ) );
+  area.crop( BBox2i( 0, 0, m_seed.cols(), m_seed.rows() ) );
+
+  Vector2f low, high;
+  bool found = false;
+  for ( int32 j = area.min().y(); j < area.max().y(); j++ ) {
+    for ( int32 i = area.min().x(); i < area.max().x(); i++ ) {
+      PixelMask<Vector2f> const& d = m_seed(i,j);
+      if ( !is_valid( d ) )
+        continue;
+      if ( !found ) {
+        low = high = d.child();
+        found = true;
+      } else {
+        for ( size_t k = 0; k < 2; k++ ) {
+          low[k]  = std::min( low[k],  d.child()[k] );
+          high[k] = std::max( high[k], d.child()[k] );
+        }
+      }
+    }
+  }
+  if ( !found )
+    return m_limit;
+
+  BBox2i range( Vector2i( int32( floor( low.x() / m_scale ) ) - m_margin,
+                          int32( floor( low.y() / m_scale ) ) - m_margin ),
+                Vector2i( int32( ceil( high.x() / m_scale ) ) + m_margin,
+                          int32( ceil( high.y() / m_scale ) ) + m_margin ) );
+  // Mismatches in the seed must not make a tile search further than
+  // the whole image would have.
+  range.crop( m_limit );
+  if ( range.min().x() > range.max().x() || range.min().y() > range.max().y() )
+    return m_limit;
+  return range;
+}
+
+double asp::SearchRangeSeed::coverage() const {
+  size_t valid = 0;
+  for ( int32 j = 0; j < m_seed.rows(); j++ )
+    for ( int32 i = 0; i < m_seed.cols(); i++ )
+      if ( is_valid( m_seed(i,j) ) )
+        valid++;
+  return m_seed.cols() * m_seed.rows() ?
+    double( valid ) / ( double( m_seed.cols() ) * m_seed.rows() ) : 0;
+}
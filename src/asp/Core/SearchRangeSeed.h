@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file SearchRangeSeed.h
+///
+/// Per tile correlation search ranges. A single search range has to
+/// cover the steepest terrain in the image, so on high relief scenes
+/// most tiles search a far larger window than they need. Instead a
+/// coarse disparity map correlated on the subsampled images seeds the
+/// search: each tile only searches the disparities the seed found
+/// under it, plus a margin for what the seed can't resolve.
+
+#ifndef __ASP_CORE_SEARCHRANGESEED_H__
+#define __ASP_CORE_SEARCHRANGESEED_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cmath>
+
+namespace asp {
+
+  class SearchRangeSeed {
+    vw::ImageView<vw::PixelMask<vw::Vector2f> > m_seed;
+    float m_scale;
+    vw::BBox2i m_limit;
+    vw::int32 m_margin;
+
+  public:
+    // seed is the disparity of the subsampled images, which are scale
+    // times the size of the full images. limit is the search range of
+    // the whole image: seeded ranges are cropped to it, and tiles with
+    // no valid seed pixels search all of it. margin is added on every
+    // side, in full resolution pixels, on top of the two seed pixels it
+    // takes to cover the seed's own error.
+    template <class SeedT>
+    SearchRangeSeed( vw::ImageViewBase<SeedT> const& seed, float scale,
+                     vw::BBox2i const& limit, vw::int32 margin ) :
+      m_seed( seed.impl() ), m_scale( scale ), m_limit( limit ),
+      m_margin( margin + vw::int32( ceil( 2 / scale ) ) ) {}
+
+    // Search range for a tile of the full resolution left image.
+    vw::BBox2i search_range( vw::BBox2i const& tile ) const;
+
+    // Fraction of the valid seed pixels, for reporting.
+    double coverage() const;
+  };
+
+  // Wraps a correlator so that every tile is correlated with the search
+  // range the seed gives for it. CorrViewT is a configured
+  // vw::stereo::CorrelatorView; a copy of it is made for each tile.
+  // offset is where the correlator's origin lies in the full left
+  // image, when only a window of it is correlated.
+  template <class CorrViewT>
+  class SeededCorrelatorView : public vw::ImageViewBase<SeededCorrelatorView<CorrViewT> > {
+    CorrViewT m_correlator;
+    boost::shared_ptr<SearchRangeSeed> m_seed;
+    vw::Vector2i m_offset;
+
+  public:
+    typedef typename CorrViewT::pixel_type pixel_type;
+    typedef typename CorrViewT::result_type result_type;
+    typedef vw::ProceduralPixelAccessor<SeededCorrelatorView> pixel_accessor;
+
+    SeededCorrelatorView( CorrViewT const& correlator,
+                          boost::shared_ptr<SearchRangeSeed> seed,
+                          vw::Vector2i const& offset = vw::Vector2i() ) :
+      m_correlator( correlator ), m_seed( seed ), m_offset( offset ) {}
+
+    inline vw::int32 cols() const { return m_correlator.cols(); }
+    inline vw::int32 rows() const { return m_correlator.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+    inline result_type operator()( vw::int32 /*i*/, vw::int32 /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw( vw::NoImplErr() << "SeededCorrelatorView::operator() is not implemented." );
+      return result_type(); // never reached
+    }
+
+    typedef typename CorrViewT::prerasterize_type prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      CorrViewT correlator( m_correlator );
+      correlator.set_search_range( m_seed->search_range( bbox + m_offset ) );
+      return correlator.prerasterize( bbox );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize( bbox ), dest, bbox );
+    }
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_SEARCHRANGESEED_H__
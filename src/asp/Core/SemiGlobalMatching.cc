@@ -0,0 +1,580 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file SemiGlobalMatching.cc
+///
+
+#include <asp/Core/SemiGlobalMatching.h>
+#include <asp/Core/Census.h>
+
+#include <vw/Image/EdgeExtension.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  typedef uint8  Cost;  // Matching cost of one pixel and disparity
+  typedef uint16 Path;  // Cost aggregated along a path
+
+  const Cost max_cost = 255;
+
+  // The cost of a window whose mean absolute difference equals the
+  // standard deviation of the left block.
+  const float sigma_cost = 64;
+
+  // The cost of a window whose census signatures differ by one bit on
+  // average. The 48 bits of the window cap costs at 192.
+  const float census_cost = 4;
+
+  // The cost of a window with no correlation. Anticorrelated windows
+  // cost up to twice that.
+  const float ncc_cost = 64;
+
+  // Sums of every kx x ky window of a rows x cols image, which is kx - 1
+  // and ky - 1 smaller. The column sums are carried down a row at a
+  // time and the row sums along it, so each window costs a few adds
+  // whatever its size, and the column loop runs over contiguous memory
+  // for the compiler to vectorize.
+  void box_sum( float const* in, int32 cols, int32 rows, int32 kx, int32 ky,
+                std::vector<float>& column_sum, float* out ) {
+    const int32 out_cols = cols - kx + 1, out_rows = rows - ky + 1;
+    column_sum.assign( cols, 0 );
+    float* c = &column_sum[0];
+    for ( int32 v = 0; v < ky; v++ )
+      for ( int32 i = 0; i < cols; i++ )
+        c[i] += in[ size_t( v ) * cols + i ];
+    for ( int32 j = 0; j < out_rows; j++ ) {
+      if ( j > 0 ) {
+        float const* add = in + size_t( j + ky - 1 ) * cols;
+        float const* sub = in + size_t( j - 1 ) * cols;
+        for ( int32 i = 0; i < cols; i++ )
+          c[i] += add[i] - sub[i];
+      }
+      float* o = out + size_t( j ) * out_cols;
+      float s = 0;
+      for ( int32 u = 0; u < kx; u++ )
+        s += c[u];
+      o[0] = s;
+      for ( int32 i = 1; i < out_cols; i++ ) {
+        s += c[i + kx - 1] - c[i - 1];
+        o[i] = s;
+      }
+    }
+  }
+
+  // Sum and variance (times the window area) of every window of an
+  // image, for normalized cross correlation.
+  struct WindowStats {
+    int32 cols;
+    std::vector<float> sum, variance;
+
+    void compute( ImageView<PixelGray<float> > const& image, int32 kx, int32 ky ) {
+      cols = image.cols() - kx + 1;
+      size_t count = size_t( cols ) * ( image.rows() - ky + 1 );
+      std::vector<float> values( size_t( image.cols() ) * image.rows() ), squares( values.size() ),
+        column_sum;
+      for ( int32 j = 0; j < image.rows(); j++ )
+        for ( int32 i = 0; i < image.cols(); i++ ) {
+          float v = image(i,j).v();
+          values[ size_t( j ) * image.cols() + i ] = v;
+          squares[ size_t( j ) * image.cols() + i ] = v * v;
+        }
+      sum.resize( count );
+      variance.resize( count );
+      box_sum( &values[0], image.cols(), image.rows(), kx, ky, column_sum, &sum[0] );
+      box_sum( &squares[0], image.cols(), image.rows(), kx, ky, column_sum, &variance[0] );
+      const float area = float( kx * ky );
+      for ( size_t k = 0; k < count; k++ )
+        variance[k] = std::max( variance[k] - sum[k] * sum[k] / area, 0.0f );
+    }
+  };
+
+  // Right to left matches from the costs of the left to right ones.
+  // Every cost of a left pixel and disparity is also offered to the
+  // right pixel they match, and each right pixel keeps its cheapest.
+  struct RightMatches {
+    int32 left_cols, left_rows, nx, ny, cols;
+    std::vector<float> cost;
+    std::vector<int32> label;
+
+    RightMatches( int32 left_cols, int32 left_rows, int32 nx, int32 ny, bool enabled ) :
+      left_cols( left_cols ), left_rows( left_rows ), nx( nx ), ny( ny ),
+      cols( left_cols + nx - 1 ),
+      cost( enabled ? size_t( cols ) * ( left_rows + ny - 1 ) : 0,
+            std::numeric_limits<float>::max() ),
+      label( cost.size(), -1 ) {}
+
+    bool enabled() const { return !cost.empty(); }
+
+    void offer( int32 i, int32 j, int32 dx, int32 dy, float c ) {
+      size_t r = size_t( j + dy ) * cols + i + dx;
+      if ( c < cost[r] ) {
+        cost[r] = c;
+        label[r] = dy * nx + dx;
+      }
+    }
+
+    // Whether the right pixel that left pixel (i,j) matches at (dx,dy)
+    // agrees within threshold. Right pixels with candidates outside
+    // the block get the benefit of the doubt.
+    bool consistent( int32 i, int32 j, int32 dx, int32 dy, float threshold ) const {
+      int32 ri = i + dx, rj = j + dy;
+      if ( ri < nx - 1 || ri >= left_cols || rj < ny - 1 || rj >= left_rows )
+        return true;
+      int32 best = label[ size_t( rj ) * cols + ri ];
+      if ( best < 0 )
+        return true;
+      return fabs( float( best % nx - dx ) ) <= threshold &&
+        fabs( float( best / nx - dy ) ) <= threshold;
+    }
+  };
+
+  // One step along a path:
+  //
+  //   L(p,d) = C(p,d) + min( L(q,d), L(q,d') + P1, min L(q) + P2 ) - min L(q)
+  //
+  // where q is the previous pixel on the path and d' the disparities
+  // next to d. The loops run over contiguous disparities with no
+  // branches inside, so the compiler turns them into vector code.
+  // prev is null where the path enters the block. Returns min L(p).
+  Path path_step( Cost const* cost, Path const* prev, Path prev_min, Path* out,
+                  int32 nx, int32 ny, Path p1, Path p2 ) {
+    const int32 n = nx * ny;
+    if ( !prev ) {
+      for ( int32 d = 0; d < n; d++ )
+        out[d] = cost[d];
+    } else {
+      const Path jump = prev_min + p2;
+      for ( int32 d = 0; d < n; d++ )
+        out[d] = std::min( prev[d], jump );
+      for ( int32 dy = 0; dy < ny; dy++ ) {
+        Path const* row = prev + dy * nx;
+        Path* o = out + dy * nx;
+        for ( int32 dx = 1; dx < nx; dx++ )
+          o[dx] = std::min( o[dx], Path( row[dx - 1] + p1 ) );
+        for ( int32 dx = 0; dx < nx - 1; dx++ )
+          o[dx] = std::min( o[dx], Path( row[dx + 1] + p1 ) );
+      }
+      for ( int32 d = nx; d < n; d++ )
+        out[d] = std::min( out[d], Path( prev[d - nx] + p1 ) );
+      for ( int32 d = 0; d < n - nx; d++ )
+        out[d] = std::min( out[d], Path( prev[d + nx] + p1 ) );
+      for ( int32 d = 0; d < n; d++ )
+        out[d] = Path( cost[d] + out[d] - prev_min );
+    }
+    Path result = std::numeric_limits<Path>::max();
+    for ( int32 d = 0; d < n; d++ )
+      result = std::min( result, out[d] );
+    return result;
+  }
+
+  // Sweeps the block once in scan order (or in reverse) and adds the
+  // aggregated cost of every path that arrives from pixels the sweep
+  // has already visited. rows_buffer holds the last and the current
+  // row of every path.
+  void aggregate( std::vector<Cost> const& cost, std::vector<Path>& sum,
+                  int32 cols, int32 rows, int32 nx, int32 ny,
+                  std::vector<Vector2i> const& directions, bool reverse,
+                  Path p1, Path p2, std::vector<Path>& rows_buffer,
+                  std::vector<Path>& min_buffer ) {
+    const size_t n = nx * ny;
+    const size_t k_count = directions.size();
+    const size_t row_size = size_t( cols ) * n;
+    rows_buffer.resize( 2 * k_count * row_size );
+    min_buffer.resize( 2 * k_count * cols );
+    Path* last = &rows_buffer[0];
+    Path* current = last + k_count * row_size;
+    Path* last_min = &min_buffer[0];
+    Path* current_min = last_min + k_count * cols;
+
+    for ( int32 jj = 0; jj < rows; jj++ ) {
+      int32 j = reverse ? rows - 1 - jj : jj;
+      for ( int32 ii = 0; ii < cols; ii++ ) {
+        int32 i = reverse ? cols - 1 - ii : ii;
+        Cost const* c = &cost[ ( size_t( j ) * cols + i ) * n ];
+        Path* s = &sum[ ( size_t( j ) * cols + i ) * n ];
+        for ( size_t k = 0; k < k_count; k++ ) {
+          int32 pi = i - directions[k].x(), pj = j - directions[k].y();
+          Path const* prev = 0;
+          Path prev_min = 0;
+          if ( pi >= 0 && pi < cols && pj >= 0 && pj < rows ) {
+            bool same_row = pj == j;
+            prev = ( same_row ? current : last ) + k * row_size + pi * n;
+            prev_min = ( same_row ? current_min : last_min )[ k * cols + pi ];
+          }
+          Path* out = current + k * row_size + i * n;
+          current_min[ k * cols + i ] = path_step( c, prev, prev_min, out, nx, ny, p1, p2 );
+          for ( size_t d = 0; d < n; d++ )
+            s[d] += out[d];
+        }
+      }
+      std::swap( last, current );
+      std::swap( last_min, current_min );
+    }
+  }
+}
+
+Vector2i asp::sgm_border( SgmSettings const& settings ) {
+  int32 census = settings.cost == CENSUS_COST ? census_half_window : 0;
+  return Vector2i( settings.kernel.x() / 2 + census, settings.kernel.y() / 2 + census );
+}
+
+size_t asp::sgm_volume_bytes( Vector2i const& block_size, BBox2i const& search_range ) {
+  return size_t( block_size.x() ) * block_size.y() *
+    ( search_range.width() + 1 ) * ( search_range.height() + 1 ) *
+    ( sizeof(Cost) + sizeof(Path) );
+}
+
+float asp::sgm_contrast( ImageViewRef<PixelGray<float> > const& image,
+                        ImageViewRef<uint8> const& mask, int32 max_rows ) {
+  const int32 count_rows = std::min( image.rows(), std::max( max_rows, 1 ) );
+  double sum = 0, sum2 = 0, count = 0;
+  for ( int32 k = 0; k < count_rows; k++ ) {
+    const int32 j = int32( ( k + 0.5 ) * image.rows() / count_rows );
+    BBox2i row( 0, j, image.cols(), 1 );
+    ImageView<PixelGray<float> > values = crop( image, row );
+    ImageView<uint8> valid = crop( mask, row );
+    for ( int32 i = 0; i < image.cols(); i++ )
+      if ( valid(i,0) ) {
+        double v = values(i,0).v();
+        sum += v; sum2 += v * v; count++;
+      }
+  }
+  if ( !count )
+    return 0;
+  return float( sqrt( std::max( sum2 / count - ( sum / count ) * ( sum / count ), 0.0 ) ) );
+}
+
+size_t asp::sgm_block_bytes( Vector2i const& block_size, BBox2i const& search_range,
+                            SgmSettings const& settings ) {
+  const size_t nx = search_range.width() + 1, ny = search_range.height() + 1;
+  size_t bytes = 0;
+  if ( settings.num_paths ) {
+    // aggregate() keeps two rows for each of half the paths.
+    const size_t paths = settings.num_paths / 2;
+    bytes += sgm_volume_bytes( block_size, search_range ) +
+      2 * paths * block_size.x() * ( nx * ny + 1 ) * sizeof(Path);
+  }
+  if ( settings.lr_threshold >= 0 )
+    bytes += ( block_size.x() + nx - 1 ) * ( block_size.y() + ny - 1 ) *
+      ( sizeof(float) + sizeof(int32) );
+  return bytes;
+}
+
+ImageView<PixelMask<Vector2f> >
+asp::sgm_block( ImageView<PixelGray<float> > const& left,
+                ImageView<PixelGray<float> > const& right,
+                ImageView<uint8> const& left_mask,
+                ImageView<uint8> const& right_mask,
+                BBox2i const& search_range, SgmSettings const& settings ) {
+  SgmBuffers buffers;
+  return sgm_block( left, right, left_mask, right_mask, search_range, settings, buffers );
+}
+
+ImageView<PixelMask<Vector2f> >
+asp::sgm_block( ImageView<PixelGray<float> > const& left,
+                ImageView<PixelGray<float> > const& right,
+                ImageView<uint8> const& left_mask,
+                ImageView<uint8> const& right_mask,
+                BBox2i const& search_range, SgmSettings const& settings,
+                SgmBuffers& buffers ) {
+  const int32 hx = settings.kernel.x() / 2, hy = settings.kernel.y() / 2;
+  const int32 kx = 2 * hx + 1, ky = 2 * hy + 1;
+  const Vector2i border = sgm_border( settings );
+  const int32 cols = left.cols() - 2 * border.x(), rows = left.rows() - 2 * border.y();
+  const int32 nx = search_range.width() + 1, ny = search_range.height() + 1;
+  const size_t n = nx * ny;
+  VW_ASSERT( cols > 0 && rows > 0 && nx > 0 && ny > 0,
+             ArgumentErr() << "sgm_block: empty block or search range." );
+  VW_ASSERT( right.cols() == left.cols() + nx - 1 && right.rows() == left.rows() + ny - 1 &&
+             left_mask.cols() == cols && left_mask.rows() == rows &&
+             right_mask.cols() == cols + nx - 1 && right_mask.rows() == rows + ny - 1,
+             ArgumentErr() << "sgm_block: image sizes don't match the search range." );
+  VW_ASSERT( settings.num_paths == 0 || settings.num_paths == 4 || settings.num_paths == 8,
+             ArgumentErr() << "sgm_block: paths must be 0, 4 or 8." );
+
+  // Differences are summed over the block plus half the kernel. With
+  // census costs that is what is left after the census window.
+  const int32 window_cols = cols + 2 * hx, window_rows = rows + 2 * hy;
+  const float area = float( kx * ky );
+  ImageView<CensusSignature> left_census, right_census;
+  WindowStats left_stats, right_stats;
+  float to_cost = 0;
+  if ( settings.cost == CENSUS_COST ) {
+    left_census = census_transform( left );
+    right_census = census_transform( right );
+    to_cost = census_cost / area;
+  } else if ( settings.cost == NCC_COST ) {
+    left_stats.compute( left, kx, ky );
+    right_stats.compute( right, kx, ky );
+  } else {
+    // Costs are measured against the contrast of the left image, so the
+    // penalties mean the same whichever preprocessing filter was used.
+    // Blocks on their own measure their own.
+    double sigma = settings.contrast;
+    if ( sigma <= 0 ) {
+      double sum = 0, sum2 = 0, count = 0;
+      for ( int32 j = 0; j < rows; j++ )
+        for ( int32 i = 0; i < cols; i++ )
+          if ( left_mask(i,j) ) {
+            float v = left(i + hx, j + hy).v();
+            sum += v; sum2 += v * v; count++;
+          }
+      sigma = count ? sqrt( std::max( sum2 / count - ( sum / count ) * ( sum / count ), 0.0 ) ) : 0;
+    }
+    to_cost = sigma_cost / ( std::max( sigma, 1e-6 ) * area );
+  }
+
+  // Without paths only the best window cost of each pixel is kept, so
+  // there is no cost volume at all.
+  // The cost volume and the other large buffers come from the caller,
+  // which can hand the same ones to every block. Every cost is written
+  // below, so the volume needs no clearing.
+  const bool winner_take_all = settings.num_paths == 0;
+  std::vector<Cost>& cost = buffers.cost;
+  cost.resize( winner_take_all ? 0 : size_t( cols ) * rows * n );
+  std::vector<float>& best_cost = buffers.best_cost;
+  best_cost.assign( winner_take_all ? size_t( cols ) * rows : 0,
+                    std::numeric_limits<float>::max() );
+  std::vector<int32>& best_label = buffers.best_label;
+  best_label.assign( best_cost.size(), -1 );
+  RightMatches right_matches( cols, rows, nx, ny, settings.lr_threshold >= 0 );
+
+  // For every disparity: per pixel differences (or products, for NCC),
+  // their window sums, and from those the cost of each pixel.
+  std::vector<float>& diff = buffers.diff;
+  std::vector<float>& window = buffers.window;
+  diff.resize( size_t( window_cols ) * window_rows );
+  window.resize( size_t( cols ) * rows );
+  std::vector<float> value( cols ), column_sum;
+  std::vector<uint8> distance( window_cols );
+  for ( int32 dy = 0; dy < ny; dy++ ) {
+    for ( int32 dx = 0; dx < nx; dx++ ) {
+      const size_t d = dy * nx + dx;
+      for ( int32 j = 0; j < window_rows; j++ ) {
+        float* row = &diff[ size_t( j ) * window_cols ];
+        if ( settings.cost == CENSUS_COST ) {
+          hamming_distance( &left_census(0,j), &right_census(dx,j + dy), &distance[0], window_cols );
+          for ( int32 i = 0; i < window_cols; i++ )
+            row[i] = distance[i];
+        } else {
+          PixelGray<float> const* l = &left(0,j);
+          PixelGray<float> const* r = &right(dx,j + dy);
+          if ( settings.cost == NCC_COST )
+            for ( int32 i = 0; i < window_cols; i++ )
+              row[i] = l[i].v() * r[i].v();
+          else
+            for ( int32 i = 0; i < window_cols; i++ )
+              row[i] = fabs( l[i].v() - r[i].v() );
+        }
+      }
+      box_sum( &diff[0], window_cols, window_rows, kx, ky, column_sum, &window[0] );
+
+      for ( int32 j = 0; j < rows; j++ ) {
+        float const* s = &window[ size_t( j ) * cols ];
+        if ( settings.cost == NCC_COST ) {
+          // 1 - NCC, from the cross term and the window statistics.
+          float const* lsum = &left_stats.sum[ size_t( j ) * left_stats.cols ];
+          float const* lvar = &left_stats.variance[ size_t( j ) * left_stats.cols ];
+          float const* rsum = &right_stats.sum[ size_t( j + dy ) * right_stats.cols + dx ];
+          float const* rvar = &right_stats.variance[ size_t( j + dy ) * right_stats.cols + dx ];
+          for ( int32 i = 0; i < cols; i++ ) {
+            float covariance = s[i] - lsum[i] * rsum[i] / area;
+            float norm = lvar[i] * rvar[i];
+            value[i] = ncc_cost * ( 1 - ( norm > 0 ? covariance / sqrt( norm ) : 0 ) );
+          }
+        } else {
+          for ( int32 i = 0; i < cols; i++ )
+            value[i] = s[i] * to_cost;
+        }
+
+        for ( int32 i = 0; i < cols; i++ ) {
+          if ( winner_take_all ) {
+            size_t p = size_t( j ) * cols + i;
+            if ( !left_mask(i,j) || !right_mask(i + dx, j + dy) )
+              continue;
+            if ( value[i] < best_cost[p] ) {
+              best_cost[p] = value[i];
+              best_label[p] = d;
+            }
+            if ( right_matches.enabled() )
+              right_matches.offer( i, j, dx, dy, value[i] );
+            continue;
+          }
+          Cost& c = cost[ ( size_t( j ) * cols + i ) * n + d ];
+          if ( !left_mask(i,j) )
+            c = 0;
+          else if ( !right_mask(i + dx, j + dy) )
+            c = max_cost;
+          else
+            c = Cost( std::min( value[i] + 0.5f, float( max_cost ) ) );
+        }
+      }
+    }
+  }
+
+  ImageView<PixelMask<Vector2f> > result( cols, rows );
+  if ( winner_take_all ) {
+    for ( int32 j = 0; j < rows; j++ ) {
+      for ( int32 i = 0; i < cols; i++ ) {
+        int32 best = best_label[ size_t( j ) * cols + i ];
+        int32 dx = std::max( best, 0 ) % nx, dy = std::max( best, 0 ) / nx;
+        result(i,j) = PixelMask<Vector2f>( Vector2f( search_range.min().x() + dx,
+                                                     search_range.min().y() + dy ) );
+        if ( best < 0 ||
+             ( right_matches.enabled() &&
+               !right_matches.consistent( i, j, dx, dy, settings.lr_threshold ) ) )
+          invalidate( result(i,j) );
+      }
+    }
+    return result;
+  }
+
+  // Eight paths keep their sum under 2^16 as long as P2 does under 2^12.
+  const Path p2 = Path( std::min( std::max( settings.penalty2, 0 ), 4096 ) );
+  const Path p1 = Path( std::min( std::max( settings.penalty1, 0 ), int32( p2 ) ) );
+  std::vector<Vector2i> forward;
+  forward.push_back( Vector2i( 1, 0 ) );
+  forward.push_back( Vector2i( 0, 1 ) );
+  if ( settings.num_paths == 8 ) {
+    forward.push_back( Vector2i( 1, 1 ) );
+    forward.push_back( Vector2i( -1, 1 ) );
+  }
+  std::vector<Vector2i> backward;
+  for ( size_t k = 0; k < forward.size(); k++ )
+    backward.push_back( -forward[k] );
+
+  std::vector<Path>& total = buffers.total;
+  total.assign( cost.size(), 0 );
+  aggregate( cost, total, cols, rows, nx, ny, forward, false, p1, p2,
+             buffers.path_rows, buffers.path_mins );
+  aggregate( cost, total, cols, rows, nx, ny, backward, true, p1, p2,
+             buffers.path_rows, buffers.path_mins );
+
+  if ( right_matches.enabled() )
+    for ( int32 j = 0; j < rows; j++ )
+      for ( int32 i = 0; i < cols; i++ ) {
+        if ( !left_mask(i,j) )
+          continue;
+        Path const* s = &total[ ( size_t( j ) * cols + i ) * n ];
+        for ( int32 dy = 0; dy < ny; dy++ )
+          for ( int32 dx = 0; dx < nx; dx++ )
+            if ( right_mask(i + dx, j + dy) )
+              right_matches.offer( i, j, dx, dy, s[ dy * nx + dx ] );
+      }
+
+  for ( int32 j = 0; j < rows; j++ ) {
+    for ( int32 i = 0; i < cols; i++ ) {
+      Path const* s = &total[ ( size_t( j ) * cols + i ) * n ];
+      size_t best = std::min_element( s, s + n ) - s;
+      int32 dx = best % nx, dy = best / nx;
+      result(i,j) = PixelMask<Vector2f>( Vector2f( search_range.min().x() + dx,
+                                                   search_range.min().y() + dy ) );
+      if ( !left_mask(i,j) || !right_mask(i + dx, j + dy) ||
+           ( right_matches.enabled() &&
+             !right_matches.consistent( i, j, dx, dy, settings.lr_threshold ) ) )
+        invalidate( result(i,j) );
+    }
+  }
+  return result;
+}
+
+asp::SemiGlobalMatchingView::prerasterize_type
+asp::SemiGlobalMatchingView::prerasterize( BBox2i const& bbox ) const {
+  ImageView<pixel_type> result( bbox.width(), bbox.height() );
+  const BBox2i bounds = bounding_box( m_left );
+  const Vector2i half = sgm_border( m_settings );
+  const int32 overlap = m_settings.num_paths ? m_settings.overlap : 0;
+
+  // The left-right check needs every candidate of the right pixels the
+  // block's own pixels match, which lie up to the search range away.
+  Vector2i margin( overlap, overlap );
+  if ( m_settings.lr_threshold >= 0 )
+    margin = Vector2i( std::max( overlap, m_search_range.width() ),
+                       std::max( overlap, m_search_range.height() ) );
+
+  // Strips of whole tile rows, as many as fit the cap with the margin
+  // and the scratch buffers included, so that only their top and
+  // bottom carry overlap. Tiles
+  // too wide for strips of a useful height are cut in the largest
+  // squares that fit instead, and very wide search ranges still get
+  // blocks of a useful size, over the cap if need be. Without paths
+  // there is no volume, and no reason to split the tile.
+  Vector2i block_size( bbox.width(), bbox.height() );
+  if ( m_settings.num_paths ) {
+    // sgm_block_bytes grows linearly with the rows of a strip.
+    const double cap = double( m_settings.max_volume_bytes );
+    const int32 strip_cols = bbox.width() + 2 * margin.x();
+    const double fixed = double( sgm_block_bytes( Vector2i( strip_cols, 0 ), m_search_range,
+                                                  m_settings ) );
+    const double per_row = sgm_block_bytes( Vector2i( strip_cols, 1 ), m_search_range,
+                                            m_settings ) - fixed;
+    int32 strip_rows = cap > fixed ? int32( ( cap - fixed ) / per_row ) - 2 * margin.y() : 0;
+    if ( strip_rows >= std::max( 2 * margin.y(), 16 ) ) {
+      block_size.y() = strip_rows;
+    } else {
+      // The largest square whose block with its margin fits.
+      const int32 grow = 2 * std::max( margin.x(), margin.y() );
+      int32 low = 16, high = std::max( int32( sqrt( cap / ( sizeof(Cost) + sizeof(Path) ) ) ), 16 );
+      while ( low < high ) {
+        int32 side = ( low + high + 1 ) / 2;
+        if ( sgm_block_bytes( Vector2i( side + grow, side + grow ), m_search_range,
+                              m_settings ) <= m_settings.max_volume_bytes )
+          low = side;
+        else
+          high = side - 1;
+      }
+      block_size = Vector2i( low, low );
+    }
+  }
+
+  SgmBuffers buffers;
+  for ( int32 y = bbox.min().y(); y < bbox.max().y(); y += block_size.y() ) {
+    for ( int32 x = bbox.min().x(); x < bbox.max().x(); x += block_size.x() ) {
+      BBox2i core( x, y, block_size.x(), block_size.y() );
+      core.crop( bbox );
+      BBox2i block( core.min() - margin, core.max() + margin );
+      block.crop( bounds );
+      BBox2i right_block( block.min() + m_search_range.min(),
+                          block.max() + m_search_range.max() );
+
+      ImageView<PixelGray<float> >
+        left = crop( edge_extend( m_left, ZeroEdgeExtension() ),
+                     BBox2i( block.min() - half, block.max() + half ) ),
+        right = crop( edge_extend( m_right, ZeroEdgeExtension() ),
+                      BBox2i( right_block.min() - half, right_block.max() + half ) );
+      ImageView<uint8>
+        left_mask = crop( edge_extend( m_left_mask, ZeroEdgeExtension() ), block ),
+        right_mask = crop( edge_extend( m_right_mask, ZeroEdgeExtension() ), right_block );
+
+      ImageView<pixel_type> disparity =
+        sgm_block( left, right, left_mask, right_mask, m_search_range, m_settings, buffers );
+      crop( result, core - bbox.min() ) = crop( disparity, core - block.min() );
+    }
+  }
+  return prerasterize_type( result, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+}
+
+std::ostream& asp::operator<<( std::ostream& os, SemiGlobalMatchingView const& view ) {
+  SgmSettings const& settings = view.settings();
+  os << "------------------------- SemiGlobalMatchingView ----------------------\n";
+  os << "\tsearch range: " << view.search_range() << "\n";
+  os << "\tkernel size : " << settings.kernel << "\n";
+  const char* costs[] = { "absolute difference", "census", "normalized cross correlation" };
+  os << "\tcost        : " << costs[ settings.cost ] << "\n";
+  os << "\tpenalties   : " << settings.penalty1 << " " << settings.penalty2 << "\n";
+  os << "\tpaths       : " << settings.num_paths << "\n";
+  if ( settings.lr_threshold >= 0 )
+    os << "\tleft-right  : " << settings.lr_threshold << "\n";
+  os << "---------------------------------------------------------------\n";
+  return os;
+}
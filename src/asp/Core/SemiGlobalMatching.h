@@ -0,0 +1,178 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file SemiGlobalMatching.h
+///
+/// Semi-global matching. A small window matching cost is computed for
+/// every disparity in the search range and then smoothed along eight
+/// (or four) straight paths through the tile, penalizing disparity
+/// changes between neighbors. This recovers the completeness the large
+/// kernels of the window correlators buy, without their cost or their
+/// blurring of edges.
+///
+/// Tiles are grown by an overlap so that paths have context to start
+/// from, and are cut into strips of whole rows whose cost volume and
+/// path buffers fit a memory cap. The strips of a tile share one set of
+/// buffers, so a wide search range means more strips rather than
+/// smaller tiles.
+///
+/// Costs are absolute differences, census Hamming distances or one
+/// minus the normalized cross correlation, all summed over the kernel
+/// with running sums so that their price doesn't depend on its size.
+/// With no paths the best window cost wins at each pixel, which is
+/// plain block matching and needs no cost volume.
+///
+/// The left-right check reuses the costs the left image was matched
+/// with: each right pixel takes the disparity of its cheapest match
+/// among them, and left pixels whose match disagrees are dropped. That
+/// is the quality of a second, right to left, correlation for the
+/// price of one more pass over the costs.
+
+#ifndef __ASP_CORE_SEMIGLOBALMATCHING_H__
+#define __ASP_CORE_SEMIGLOBALMATCHING_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <vector>
+
+namespace asp {
+
+  enum MatchingCost { ABS_DIFF_COST, CENSUS_COST, NCC_COST };
+
+  struct SgmSettings {
+    vw::Vector2i kernel;       // Matching window, odd sizes
+    vw::int32 penalty1;        // Disparity changes of one pixel
+    vw::int32 penalty2;        // Larger disparity changes
+    vw::int32 num_paths;       // 4 or 8, or 0 for block matching
+    MatchingCost cost;
+    vw::int32 overlap;         // Context added around each block
+    size_t max_volume_bytes;   // Cap on one block's sgm_block_bytes
+    float lr_threshold;        // Left-right disagreement allowed, negative to skip the check
+    float contrast;            // Deviation absolute differences are measured against,
+                               // 0 to use that of each block
+
+    SgmSettings() : kernel( 5, 5 ), penalty1( 8 ), penalty2( 32 ), num_paths( 8 ),
+                    cost( ABS_DIFF_COST ), overlap( 32 ), max_volume_bytes( 256 * 1024 * 1024 ),
+                    lr_threshold( -1 ), contrast( 0 ) {}
+  };
+
+  // Standard deviation of the pixels of image where mask is set, from
+  // up to max_rows rows spread evenly over it.
+  float sgm_contrast( vw::ImageViewRef<vw::PixelGray<float> > const& image,
+                      vw::ImageViewRef<vw::uint8> const& mask, vw::int32 max_rows = 64 );
+
+  // Bytes of cost volume for a block of the given size: one byte of
+  // matching cost and two of aggregated cost per pixel and disparity.
+  size_t sgm_volume_bytes( vw::Vector2i const& block_size, vw::BBox2i const& search_range );
+
+  // Bytes sgm_block needs for a block of the given size that grow with
+  // the search range: the cost volume, the last and current row of
+  // every path and, with the left-right check, the best match of every
+  // right pixel.
+  size_t sgm_block_bytes( vw::Vector2i const& block_size, vw::BBox2i const& search_range,
+                          SgmSettings const& settings );
+
+  // Pixels needed around a block: half the kernel, plus half the
+  // census window for census costs.
+  vw::Vector2i sgm_border( SgmSettings const& settings );
+
+  // Scratch memory of sgm_block, the cost volume foremost. Handing the
+  // same buffers to consecutive blocks keeps their allocations instead
+  // of returning them to the heap after each block.
+  struct SgmBuffers {
+    std::vector<vw::uint8> cost;
+    std::vector<vw::uint16> total, path_rows, path_mins;
+    std::vector<float> diff, window, best_cost;
+    std::vector<vw::int32> best_label;
+  };
+
+  // Disparity of one block. The search range is inclusive of its max.
+  // left is the block plus sgm_border on every side. right starts
+  // at the first of those pixels moved by search_range.min() and is
+  // search_range.size() larger. left_mask covers the block and
+  // right_mask right without its border. Masked left pixels
+  // come out invalid, as do matches to masked right pixels and, with
+  // the left-right check, matches whose right pixel prefers a left
+  // pixel more than lr_threshold away. Right pixels near the edge of
+  // the block, which see only some of their candidates, aren't checked.
+  vw::ImageView<vw::PixelMask<vw::Vector2f> >
+  sgm_block( vw::ImageView<vw::PixelGray<float> > const& left,
+             vw::ImageView<vw::PixelGray<float> > const& right,
+             vw::ImageView<vw::uint8> const& left_mask,
+             vw::ImageView<vw::uint8> const& right_mask,
+             vw::BBox2i const& search_range, SgmSettings const& settings );
+  vw::ImageView<vw::PixelMask<vw::Vector2f> >
+  sgm_block( vw::ImageView<vw::PixelGray<float> > const& left,
+             vw::ImageView<vw::PixelGray<float> > const& right,
+             vw::ImageView<vw::uint8> const& left_mask,
+             vw::ImageView<vw::uint8> const& right_mask,
+             vw::BBox2i const& search_range, SgmSettings const& settings,
+             SgmBuffers& buffers );
+
+  // Semi-global matching of a whole image pair as a lazy view, with the
+  // interface of vw::stereo::CorrelatorView that the stereo tools use.
+  class SemiGlobalMatchingView : public vw::ImageViewBase<SemiGlobalMatchingView> {
+    vw::ImageViewRef<vw::PixelGray<float> > m_left, m_right;
+    vw::ImageViewRef<vw::uint8> m_left_mask, m_right_mask;
+    vw::BBox2i m_search_range;
+    SgmSettings m_settings;
+
+  public:
+    typedef vw::PixelMask<vw::Vector2f> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<SemiGlobalMatchingView> pixel_accessor;
+
+    SemiGlobalMatchingView( vw::ImageViewRef<vw::PixelGray<float> > const& left,
+                            vw::ImageViewRef<vw::PixelGray<float> > const& right,
+                            vw::ImageViewRef<vw::uint8> const& left_mask,
+                            vw::ImageViewRef<vw::uint8> const& right_mask,
+                            vw::BBox2i const& search_range,
+                            SgmSettings const& settings = SgmSettings() ) :
+      m_left( left ), m_right( right ), m_left_mask( left_mask ), m_right_mask( right_mask ),
+      m_search_range( search_range ), m_settings( settings ) {
+      // Absolute differences are measured against the contrast of the
+      // whole left image, so that every block weighs its costs against
+      // the penalties the same way.
+      if ( m_settings.cost == ABS_DIFF_COST && m_settings.contrast <= 0 )
+        m_settings.contrast = sgm_contrast( m_left, m_left_mask );
+    }
+
+    void set_search_range( vw::BBox2i const& range ) { m_search_range = range; }
+    vw::BBox2i const& search_range() const { return m_search_range; }
+    SgmSettings const& settings() const { return m_settings; }
+
+    inline vw::int32 cols() const { return m_left.cols(); }
+    inline vw::int32 rows() const { return m_left.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+    inline result_type operator()( vw::int32 /*i*/, vw::int32 /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw( vw::NoImplErr() << "SemiGlobalMatchingView::operator() is not implemented." );
+      return result_type(); // never reached
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( vw::BBox2i const& bbox ) const;
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize( bbox ), dest, bbox );
+    }
+  };
+
+  std::ostream& operator<<( std::ostream& os, SemiGlobalMatchingView const& view );
+
+} // end namespace asp
+
+#endif//__ASP_CORE_SEMIGLOBALMATCHING_H__
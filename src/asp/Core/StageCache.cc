@@ -0,0 +1,331 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file StageCache.cc
+///
+
+#include <asp/Core/StageCache.h>
+#include <asp/Core/TileCheckpoint.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+
+#include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <cstdio>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace vw;
+namespace fs = boost::filesystem;
+
+namespace {
+  // FNV-1a
+  const uint64 HASH_OFFSET = 14695981039346656037ULL;
+  const uint64 HASH_PRIME  = 1099511628211ULL;
+
+  // File contents are read in blocks of this size and hashed a 64 bit
+  // word at a time in independent lanes, which keeps up with the disk.
+  const size_t FILE_BLOCK_SIZE = 1 << 20;
+  const int FILE_HASH_LANES = 4;
+
+  // What the content hash of a file is remembered by.
+  struct FileStamp {
+    uint64 size, inode, device, mtime_sec, mtime_nsec;
+    bool operator==( FileStamp const& other ) const {
+      return size == other.size && inode == other.inode && device == other.device &&
+        mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+    }
+  };
+
+  FileStamp file_stamp( std::string const& filename ) {
+    struct stat info;
+    if ( stat( filename.c_str(), &info ) != 0 )
+      vw_throw( IOErr() << "StageKey: unable to read " << filename );
+    FileStamp stamp;
+    stamp.size = info.st_size;
+    stamp.inode = info.st_ino;
+    stamp.device = info.st_dev;
+#ifdef __APPLE__
+    stamp.mtime_sec = info.st_mtimespec.tv_sec;
+    stamp.mtime_nsec = info.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime_sec = info.st_mtim.tv_sec;
+    stamp.mtime_nsec = info.st_mtim.tv_nsec;
+#endif
+    return stamp;
+  }
+
+  uint64 content_hash( std::string const& filename ) {
+    std::ifstream input( filename.c_str(), std::ios::binary );
+    if ( !input )
+      vw_throw( IOErr() << "StageKey: unable to read " << filename );
+    uint64 lanes[FILE_HASH_LANES];
+    for ( int k = 0; k < FILE_HASH_LANES; k++ )
+      lanes[k] = HASH_OFFSET + k;
+    std::vector<char> buffer( FILE_BLOCK_SIZE );
+    uint64 total = 0;
+    while ( input ) {
+      input.read( &buffer[0], buffer.size() );
+      size_t count = input.gcount();
+      // Zero pad the last block to whole groups of words.
+      size_t group = FILE_HASH_LANES * sizeof(uint64);
+      size_t padded = ( count + group - 1 ) / group * group;
+      std::fill( buffer.begin() + count, buffer.begin() + padded, 0 );
+      for ( size_t i = 0; i < padded; i += group )
+        for ( int k = 0; k < FILE_HASH_LANES; k++ ) {
+          uint64 word;
+          memcpy( &word, &buffer[i + k * sizeof(uint64)], sizeof(word) );
+          lanes[k] = ( lanes[k] ^ word ) * HASH_PRIME;
+        }
+      total += count;
+    }
+    uint64 hash = HASH_OFFSET ^ total;
+    for ( int k = 0; k < FILE_HASH_LANES; k++ )
+      hash = ( hash ^ lanes[k] ) * HASH_PRIME;
+    return hash;
+  }
+
+  // A content hash, the stamp the file had and when the hash was
+  // taken, in microseconds.
+  struct KnownHash {
+    FileStamp stamp;
+    uint64 hash, taken_usec;
+  };
+
+  uint64 now_usec() {
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    return uint64( now.tv_sec ) * 1000000 + now.tv_usec;
+  }
+
+  // Whether a write could have come after the hash was taken without
+  // changing the modification time. Filesystems that keep whole
+  // seconds only show a later write once the second is over; the
+  // others round to a clock tick of a few milliseconds.
+  bool trusted( KnownHash const& known ) {
+    uint64 mtime_usec = known.stamp.mtime_sec * 1000000 + known.stamp.mtime_nsec / 1000;
+    uint64 margin = known.stamp.mtime_nsec ? 20000 : 1000000;
+    return known.taken_usec >= mtime_usec + margin;
+  }
+
+  // Hashes are kept in memory and in a file beside the hashed file,
+  // so that each version of a file is read once by all the stages and
+  // workers that key on it.
+  const char CONTENT_MAGIC[] = "ASP_CONTENT1";
+  Mutex g_file_hash_mutex;
+  std::map<std::string, KnownHash> g_file_hashes;
+
+  bool read_content_sidecar( std::string const& filename, KnownHash& known ) {
+    std::ifstream input( asp::StageKey::content_filename( filename ).c_str() );
+    std::string magic;
+    input >> magic >> known.stamp.size >> known.stamp.inode >> known.stamp.device
+          >> known.stamp.mtime_sec >> known.stamp.mtime_nsec >> known.taken_usec
+          >> std::hex >> known.hash;
+    return input && magic == CONTENT_MAGIC;
+  }
+
+  // Written under a private name and renamed into place, since workers
+  // may record the same file at once. A directory we can't write to
+  // only means the file is hashed again next time.
+  void write_content_sidecar( std::string const& filename, KnownHash const& known ) {
+    std::string sidecar = asp::StageKey::content_filename( filename );
+    std::ostringstream temp;
+    temp << sidecar << ".tmp" << getpid();
+    {
+      std::ofstream out( temp.str().c_str() );
+      out << CONTENT_MAGIC << " " << known.stamp.size << " " << known.stamp.inode << " "
+          << known.stamp.device << " " << known.stamp.mtime_sec << " " << known.stamp.mtime_nsec
+          << " " << known.taken_usec << " " << std::hex << known.hash << "\n";
+      if ( !out ) {
+        out.close();
+        unlink( temp.str().c_str() );
+        return;
+      }
+    }
+    if ( rename( temp.str().c_str(), sidecar.c_str() ) != 0 )
+      unlink( temp.str().c_str() );
+  }
+}
+
+// StageKey
+//----------------------------------------------------------
+
+asp::StageKey::StageKey( std::string const& stage ) :
+  m_stage( stage ), m_hash( HASH_OFFSET ) {
+  mix( stage );
+}
+
+void asp::StageKey::mix( void const* data, size_t size ) {
+  unsigned char const* bytes = static_cast<unsigned char const*>( data );
+  for ( size_t i = 0; i < size; i++ ) {
+    m_hash ^= bytes[i];
+    m_hash *= HASH_PRIME;
+  }
+}
+
+std::string asp::StageKey::content_filename( std::string const& filename ) {
+  return filename + ".content";
+}
+
+asp::StageKey& asp::StageKey::file( std::string const& filename ) {
+  FileStamp stamp = file_stamp( filename );
+  KnownHash known;
+  bool found = false;
+  {
+    Mutex::Lock lock( g_file_hash_mutex );
+    std::map<std::string, KnownHash>::const_iterator it = g_file_hashes.find( filename );
+    if ( it != g_file_hashes.end() && it->second.stamp == stamp && trusted( it->second ) ) {
+      known = it->second;
+      found = true;
+    }
+  }
+  if ( !found && read_content_sidecar( filename, known ) &&
+       known.stamp == stamp && trusted( known ) ) {
+    found = true;
+    Mutex::Lock lock( g_file_hash_mutex );
+    g_file_hashes[filename] = known;
+  }
+  if ( !found ) {
+    known.taken_usec = now_usec();
+    known.hash = content_hash( filename );
+    known.stamp = file_stamp( filename );
+    // A file that changed while it was read gets hashed again next time.
+    if ( known.stamp == stamp ) {
+      {
+        Mutex::Lock lock( g_file_hash_mutex );
+        g_file_hashes[filename] = known;
+      }
+      if ( trusted( known ) )
+        write_content_sidecar( filename, known );
+    }
+  }
+  mix( &stamp.size, sizeof(stamp.size) );
+  mix( &known.hash, sizeof(known.hash) );
+  return *this;
+}
+
+std::string asp::StageKey::str() const {
+  std::ostringstream ostr;
+  ostr << m_stage << " " << std::hex << std::setw(16) << std::setfill('0') << m_hash;
+  return ostr.str();
+}
+
+// StageCache
+//----------------------------------------------------------
+
+asp::StageCache::StageCache( StageKey const& key, std::string const& shared_dir ) :
+  m_key( key ), m_shared_dir( shared_dir ) {}
+
+asp::StageCache& asp::StageCache::output( std::string const& filename ) {
+  m_outputs.push_back( filename );
+  return *this;
+}
+
+std::string asp::StageCache::sidecar_filename( std::string const& output ) {
+  return output + ".hash";
+}
+
+std::string asp::StageCache::shared_entry() const {
+  std::string key = m_key.str();
+  std::replace( key.begin(), key.end(), ' ', '-' );
+  return ( fs::path( m_shared_dir ) / key ).string();
+}
+
+// Entries are named by position, not by the output name, so they can
+// be found from any output prefix.
+std::string asp::StageCache::shared_filename( size_t index ) const {
+  std::ostringstream ostr;
+  ostr << index << fs::extension( m_outputs[index] );
+  return ( fs::path( shared_entry() ) / ostr.str() ).string();
+}
+
+bool asp::StageCache::recorded( std::string const& output ) const {
+  std::ifstream input( sidecar_filename( output ).c_str() );
+  std::string line;
+  return std::getline( input, line ) && line == m_key.str();
+}
+
+void asp::StageCache::record( std::string const& output ) const {
+  std::ofstream out( sidecar_filename( output ).c_str() );
+  out << m_key.str() << "\n";
+  if ( !out )
+    vw_throw( IOErr() << "Unable to write " << sidecar_filename( output ) );
+}
+
+bool asp::StageCache::lookup() {
+  bool valid = true;
+  for ( size_t i = 0; i < m_outputs.size(); i++ ) {
+    if ( !fs::exists( m_outputs[i] ) || !recorded( m_outputs[i] ) ) {
+      valid = false;
+      break;
+    }
+  }
+  if ( valid )
+    return true;
+
+  // Remove anything another key produced.
+  for ( size_t i = 0; i < m_outputs.size(); i++ ) {
+    std::string sidecar = sidecar_filename( m_outputs[i] );
+    if ( fs::exists( sidecar ) ) {
+      vw_out(DebugMessage,"asp") << "\t    * Removing stale " << m_outputs[i] << "\n";
+      fs::remove( m_outputs[i] );
+      fs::remove( sidecar );
+      fs::remove( StageKey::content_filename( m_outputs[i] ) );
+      fs::remove( TileManifest::manifest_filename( m_outputs[i] ) );
+    }
+  }
+
+  if ( m_shared_dir.empty() || !fs::exists( shared_entry() ) )
+    return false;
+  for ( size_t i = 0; i < m_outputs.size(); i++ )
+    if ( !fs::exists( shared_filename( i ) ) )
+      return false;
+
+  vw_out() << "\t--> Copying " << m_key.stage() << " outputs from "
+           << shared_entry() << "\n";
+  for ( size_t i = 0; i < m_outputs.size(); i++ ) {
+    fs::remove( m_outputs[i] );
+    fs::remove( TileManifest::manifest_filename( m_outputs[i] ) );
+    fs::copy_file( shared_filename( i ), m_outputs[i] );
+    record( m_outputs[i] );
+  }
+  return true;
+}
+
+void asp::StageCache::store() const {
+  for ( size_t i = 0; i < m_outputs.size(); i++ )
+    record( m_outputs[i] );
+
+  if ( m_shared_dir.empty() || fs::exists( shared_entry() ) )
+    return;
+
+  // Fill a private directory and rename it into place, so readers
+  // never see a half copied entry.
+  std::ostringstream temp;
+  temp << shared_entry() << ".tmp" << getpid();
+  try {
+    fs::create_directories( temp.str() );
+    for ( size_t i = 0; i < m_outputs.size(); i++ ) {
+      std::ostringstream name;
+      name << i << fs::extension( m_outputs[i] );
+      fs::copy_file( m_outputs[i], fs::path( temp.str() ) / name.str() );
+    }
+    fs::rename( temp.str(), shared_entry() );
+  } catch ( fs::filesystem_error const& e ) {
+    // Another process may have published the same entry first.
+    vw_out(DebugMessage,"asp") << "Not publishing to stage cache: " << e.what() << "\n";
+    fs::remove_all( temp.str() );
+  }
+}
@@ -0,0 +1,103 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file StageCache.h
+///
+/// Decides whether a stage's outputs can be reused. A StageKey hashes
+/// everything the outputs depend on: the identity of the input files
+/// and the settings the stage reads. After the outputs are written the
+/// key is recorded next to each of them (<output>.hash), and later runs
+/// only skip the work if the recorded key matches the current one.
+///
+/// Optionally the outputs are also published to a shared directory
+/// under their key, so a run with a different output prefix but the
+/// same inputs and settings can copy them instead of recomputing.
+
+#ifndef __ASP_CORE_STAGECACHE_H__
+#define __ASP_CORE_STAGECACHE_H__
+
+#include <vw/Core/FundamentalTypes.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class StageKey {
+    std::string m_stage;
+    vw::uint64 m_hash;
+
+    void mix( void const* data, size_t size );
+    void mix( std::string const& text ) { mix( text.data(), text.size() ); }
+
+  public:
+    // The stage name keeps keys of different stages apart. Bump a
+    // version suffix in it when the stage's algorithm changes.
+    explicit StageKey( std::string const& stage );
+
+    // Identity of a file: its size and a hash of all of its content,
+    // so it follows the file through renames and copies but not through
+    // any change. The content hash is remembered, by the process and
+    // in content_filename beside the file for later processes, for as
+    // long as the file keeps its size, modification time and inode.
+    StageKey& file( std::string const& filename );
+
+    // Where the content hash of filename is remembered (<file>.content).
+    static std::string content_filename( std::string const& filename );
+
+    // A named setting that affects the output.
+    template <class T>
+    StageKey& value( std::string const& name, T const& v ) {
+      std::ostringstream ostr;
+      ostr.precision(17);
+      ostr << name << "=" << v << ";";
+      mix( ostr.str() );
+      return *this;
+    }
+
+    std::string const& stage() const { return m_stage; }
+
+    // The key as it is written to disk.
+    std::string str() const;
+  };
+
+  class StageCache {
+    StageKey m_key;
+    std::string m_shared_dir;
+    std::vector<std::string> m_outputs;
+
+    std::string shared_entry() const;
+    std::string shared_filename( size_t index ) const;
+    bool recorded( std::string const& output ) const;
+    void record( std::string const& output ) const;
+
+  public:
+    // shared_dir may be empty to only reuse outputs in place.
+    StageCache( StageKey const& key, std::string const& shared_dir = "" );
+
+    StageCache& output( std::string const& filename );
+
+    StageKey const& key() const { return m_key; }
+
+    static std::string sidecar_filename( std::string const& output );
+
+    // True if every output is present and was made with this key,
+    // either in place or after copying it from the shared directory.
+    // Outputs left by a run with a different key are deleted, along
+    // with any tile manifest, so a partial write is never resumed on
+    // top of them.
+    bool lookup();
+
+    // Record the key for every output and publish them to the shared
+    // directory. Call once all outputs are completely written.
+    void store() const;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_STAGECACHE_H__
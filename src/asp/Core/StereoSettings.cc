@@ -74,10 +74,10 @@ inline void getword(std::istream& s, std::string& str) {
 //--------------------------------------------------
 StereoSettings::StereoSettings() {
 
-#define ASSOC_INT(X,Y,V,D)             m_desc.add_options()(X, po::value<int>(&(this->Y))->default_value(V), D)
-#define ASSOC_FLOAT(X,Y,V,D)           m_desc.add_options()(X, po::value<float>(&(this->Y))->default_value(V), D)
-#define ASSOC_DOUBLE(X,Y,V,D)          m_desc.add_options()(X, po::value<double>(&(this->Y))->default_value(V), D)
-#define ASSOC_STRING(X,Y,V,D)          m_desc.add_options()(X, po::value<std::string>(&(this->Y))->default_value(V), D)
+#define ASSOC_INT(X,Y,V,D)             m_desc.add_options()(X, po::value<int>(&(this->Y))->default_value(V), D); add_value(X, 'i', &(this->Y))
+#define ASSOC_FLOAT(X,Y,V,D)           m_desc.add_options()(X, po::value<float>(&(this->Y))->default_value(V), D); add_value(X, 'f', &(this->Y))
+#define ASSOC_DOUBLE(X,Y,V,D)          m_desc.add_options()(X, po::value<double>(&(this->Y))->default_value(V), D); add_value(X, 'd', &(this->Y))
+#define ASSOC_STRING(X,Y,V,D)          m_desc.add_options()(X, po::value<std::string>(&(this->Y))->default_value(V), D); add_value(X, 's', &(this->Y))
 
   // ---------------------
   // Preprocessing options
@@ -91,6 +91,9 @@ StereoSettings::StereoSettings() {
   // Image normalization
   ASSOC_INT("FORCE_USE_ENTIRE_RANGE", force_max_min, 0, "Use images entire values, otherwise compress image range to -+2.5 sigmas around mean.");
   ASSOC_INT("DO_INDIVIDUAL_NORMALIZATION", individually_normalize, 0, "Normalize each image individually before processsing.");
+  ASSOC_INT("PREPROCESS_UINT16", preprocess_uint16, 0, "Store the normalized images as 16 bit fixed point instead of floats.");
+  ASSOC_INT("PREPROCESS_PYRAMID", preprocess_pyramid, 0, "Add reduced resolution overviews to the normalized images for the stages that read them smaller.");
+  ASSOC_INT("PREFILTER_CACHE", prefilter_cache, 0, "Write the images through the preprocessing filter once in stereo_pprc and read them in correlation and refinement.");
 
   // -------------------
   // Correlation Options
@@ -101,7 +104,7 @@ StereoSettings::StereoSettings() {
   ASSOC_FLOAT("SLOG_KERNEL_WIDTH", slogW, 1.5, "SIGMA for the gaussian blure in LOG and SLOG");
 
   // Integer correlator
-  ASSOC_INT("COST_MODE", cost_mode, 2, "0 - absolute different, 1 - squared difference, 2 - normalized cross correlation");
+  ASSOC_INT("COST_MODE", cost_mode, 2, "0 - absolute different, 1 - squared difference, 2 - normalized cross correlation, 3 - semi-global matching, 4 - census, 5 - semi-global matching of census costs, 6 - normalized cross correlation from running sums");
   ASSOC_FLOAT("XCORR_THRESHOLD", xcorr_threshold, 2.0, "");
   ASSOC_FLOAT("CORRSCORE_REJECTION_THRESHOLD", corrscore_rejection_threshold, 1.1, "");
   ASSOC_INT("COST_BLUR", cost_blur, 0, "Reduces the number of missing pixels by blurring the fitness landscape computed by the cost function.");
@@ -112,17 +115,28 @@ StereoSettings::StereoSettings() {
   ASSOC_INT("H_CORR_MIN", h_corr_min, 0, "correlation window size min x");
   ASSOC_INT("V_CORR_MAX", v_corr_max, 0, "correlation window size max y");
   ASSOC_INT("V_CORR_MIN", v_corr_min, 0, "correlation window size min y");
+  ASSOC_INT("SEED_MODE", seed_mode, 0, "0 - one search range for the whole image, 1 - per tile search ranges from a correlation of the subsampled images, 2 - per tile search ranges from the DEM in SEED_DEM");
+  ASSOC_INT("SEED_MARGIN", seed_margin, 8, "pixels added around each seeded search range");
+  ASSOC_STRING("SEED_DEM", seed_dem, "", "prior DEM of the scene for SEED_MODE 2, with heights above its datum");
+  ASSOC_INT("SGM_PENALTY1", sgm_penalty1, 8, "semi-global matching penalty for disparity changes of one pixel");
+  ASSOC_INT("SGM_PENALTY2", sgm_penalty2, 32, "semi-global matching penalty for larger disparity changes");
+  ASSOC_INT("SGM_PATHS", sgm_paths, 8, "number of semi-global matching paths, 4 or 8");
+  ASSOC_INT("SGM_MEMORY_CAP_MB", sgm_memory_cap_mb, 256, "megabytes of semi-global matching cost volume and path buffers per thread");
 
   ASSOC_INT("SUBPIXEL_MODE", subpixel_mode, 2, "0 - no subpixel, 1 - parabola, 2 - bayes EM");
   ASSOC_INT("SUBPIXEL_H_KERNEL", subpixel_h_kern, 35, "subpixel kernel width");
   ASSOC_INT("SUBPIXEL_V_KERNEL", subpixel_v_kern, 35, "subpixel kernel height");
   ASSOC_INT("DO_H_SUBPIXEL", do_h_subpixel, 1, "Do vertical subpixel interpolation.");
   ASSOC_INT("DO_V_SUBPIXEL", do_v_subpixel, 1, "Do horizontal subpixel interpolation.");
+  ASSOC_FLOAT("SUBPIXEL_AFFINE_TOLERANCE", subpixel_affine_tolerance, 0.01, "subpixel mode 2 stops a pixel when no window corner moves further [pixels], 0 runs every iteration");
+  ASSOC_FLOAT("SUBPIXEL_AFFINE_MAX_MOVE", subpixel_affine_max_move, 2, "subpixel mode 2 invalidates pixels that move further from their integer disparity [pixels], 0 keeps them");
+  ASSOC_INT("SUBPIXEL_ITER_HISTOGRAM", subpixel_iter_histogram, 0, "log how many pixels took each number of subpixel mode 2 iterations");
 
   // EMSubpixelCorrelator options
   ASSOC_INT("SUBPIXEL_EM_ITER", subpixel_em_iter, 15, "Maximum number of EM iterations for EMSubpixelCorrelator");
-  ASSOC_INT("SUBPIXEL_AFFINE_ITER", subpixel_affine_iter, 5, "Maximum number of affine optimization iterations for EMSubpixelCorrelator");
+  ASSOC_INT("SUBPIXEL_AFFINE_ITER", subpixel_affine_iter, 5, "Maximum number of affine optimization iterations for subpixel mode 2 and EMSubpixelCorrelator");
   ASSOC_INT("SUBPIXEL_PYRAMID_LEVELS", subpixel_pyramid_levels, 3, "Number of pyramid levels for EMSubpixelCorrelator");
+  ASSOC_INT("SUBPIXEL_UNCERTAINTY", subpixel_uncertainty, 0, "Also write the EMSubpixelCorrelator uncertainty images -U.tif and -US.tif");
 
   // Filtering Options
   ASSOC_INT("RM_H_HALF_KERN", rm_h_half_kern, 5, "low conf pixel removal kernel half size");
@@ -143,6 +157,7 @@ StereoSettings::StereoSettings() {
 
   // System Settings
   ASSOC_STRING("CACHE_DIR", cache_dir, "/tmp", "Change if can't write large files to /tmp (i.e. Super Computer)");
+  ASSOC_STRING("STAGE_CACHE_DIR", stage_cache_dir, "", "Share preprocessing outputs between runs through this directory. Empty to disable.");
 
 #undef ASSOC_INT
 #undef ASSOC_FLOAT
@@ -192,6 +207,33 @@ void StereoSettings::read(std::string const& filename) {
   fp.close();
 }
 
+void StereoSettings::add_value(std::string const& name, char type, void const* address) {
+  Value value;
+  value.name = name;
+  value.type = type;
+  value.address = address;
+  m_values.push_back(value);
+}
+
+void StereoSettings::write_values(std::ostream& os, bool search_range) const {
+  std::streamsize precision = os.precision(17);
+  for (size_t i = 0; i < m_values.size(); i++) {
+    Value const& value = m_values[i];
+    if (!search_range && (value.address == &h_corr_min || value.address == &h_corr_max ||
+                          value.address == &v_corr_min || value.address == &v_corr_max))
+      continue;
+    os << value.name << " ";
+    switch (value.type) {
+    case 'i': os << *static_cast<int const*>(value.address); break;
+    case 'f': os << *static_cast<float const*>(value.address); break;
+    case 'd': os << *static_cast<double const*>(value.address); break;
+    default:  os << *static_cast<std::string const*>(value.address); break;
+    }
+    os << "\n";
+  }
+  os.precision(precision);
+}
+
 void StereoSettings::copy_settings(std::string const& filename, std::string const& destination) {
   std::ifstream in(filename.c_str());
   std::ofstream out(destination.c_str());
@@ -11,16 +11,34 @@
 #include <boost/version.hpp>
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <string>
+#include <vector>
 namespace po = boost::program_options;
 
 class StereoSettings {
   po::options_description m_desc;
   po::variables_map m_vm;
 
+  // Where each setting lives, for write_values.
+  struct Value {
+    std::string name;
+    char type;            // 'i', 'f', 'd' or 's'
+    void const* address;
+  };
+  std::vector<Value> m_values;
+  void add_value(std::string const& name, char type, void const* address);
+
 public:
   StereoSettings();
   void read(std::string const& filename);
   void copy_settings(std::string const& filename, std::string const& destination);
+
+  // Write the current value of every setting, one "NAME value" per
+  // line, including any changed since the file was read. Without
+  // search_range, the H_CORR_* and V_CORR_* settings are left out, for
+  // keys that hold the search range actually used instead: it is
+  // detected when they are all 0 and handed to workers through them.
+  void write_values(std::ostream& os, bool search_range = true) const;
   bool is_search_defined() {
     return h_corr_min != 0 || h_corr_max != 0 ||
            v_corr_min != 0 || v_corr_max != 0;
@@ -42,6 +60,9 @@ public:
                                      individually with their
                                      own hi's and low */
   int force_max_min;          // Use entire dynamic range of image..
+  int preprocess_uint16;      // Write -L.tif and -R.tif as uint16
+  int preprocess_pyramid;     // Add overviews to -L.tif and -R.tif
+  int prefilter_cache;        // Write -lFiltered.tif and -rFiltered.tif
   int pre_filter_mode;        /* 0 = None
                                  1 = Gaussian Blur
                                  2 = Log Filter
@@ -57,8 +78,20 @@ public:
   int h_corr_min;          /* correlation window min x */
   int v_corr_max;          /* correlation window max y */
   int v_corr_min;          /* correlation window min y */
+  int seed_mode;           /* 0 = one search range for the image
+                              1 = per tile ranges from a low-res seed
+                              2 = per tile ranges from a prior DEM */
+  int seed_margin;         /* pixels added around each seeded range */
+  std::string seed_dem;    /* DEM projected for SEED_MODE 2 */
+  int sgm_penalty1;        /* SGM penalty for one pixel disparity steps */
+  int sgm_penalty2;        /* SGM penalty for larger steps */
+  int sgm_paths;           /* SGM paths, 4 or 8 */
+  int sgm_memory_cap_mb;   /* SGM cost volume per thread, in MB */
   int do_h_subpixel;       /* Both of these must on    */
   int do_v_subpixel;
+  float subpixel_affine_tolerance; /* mode 2 convergence, pixels */
+  float subpixel_affine_max_move;  /* mode 2 invalidation, pixels */
+  int subpixel_iter_histogram;     /* log mode 2 iteration counts */
   int subpixel_mode;       /* 0 = parabola fitting
                               1 = affine, robust weighting
                               2 = affine, bayes weighting
@@ -72,6 +105,7 @@ public:
   int subpixel_affine_iter;
   int subpixel_em_iter;
   int subpixel_pyramid_levels;
+  int subpixel_uncertainty;    /* write -U.tif and -US.tif in EM mode */
 
   // Filtering Options
   int rm_h_half_kern;      /* low confidence pixel removal kernel size */
@@ -95,6 +129,8 @@ public:
 
   // System Settings
   std::string cache_dir;   /* DiskCacheViews will use this directory */
+  std::string stage_cache_dir; /* Stage outputs shared between output
+                                  prefixes, keyed by their inputs */
 };
 
 /// Return the singleton instance of the stereo setting structure.
@@ -0,0 +1,188 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file TileCheckpoint.cc
+///
+
+#include <asp/Core/TileCheckpoint.h>
+#include <vw/Core/Exception.h>
+
+#include <gdal.h>
+#include <cstdio>
+
+using namespace vw;
+
+namespace {
+  // The first line of a manifest identifies the image it belongs to.
+  const char* MANIFEST_MAGIC = "ASP_TILES2";
+
+  GDALDataType gdal_data_type( ChannelTypeEnum type ) {
+    switch ( type ) {
+    case VW_CHANNEL_UINT8:   return GDT_Byte;
+    case VW_CHANNEL_INT16:   return GDT_Int16;
+    case VW_CHANNEL_UINT16:  return GDT_UInt16;
+    case VW_CHANNEL_INT32:   return GDT_Int32;
+    case VW_CHANNEL_UINT32:  return GDT_UInt32;
+    case VW_CHANNEL_FLOAT32: return GDT_Float32;
+    case VW_CHANNEL_FLOAT64: return GDT_Float64;
+    default:
+      vw_throw( NoImplErr() << "Unsupported channel type for tile checkpointing." );
+    }
+    return GDT_Unknown; // never reached
+  }
+
+  boost::shared_ptr<FifoWorkQueue> g_shared_tile_queue;
+  Mutex g_shared_tile_queue_mutex;
+}
+
+void asp::set_shared_tile_queue( boost::shared_ptr<FifoWorkQueue> const& queue ) {
+  Mutex::Lock lock( g_shared_tile_queue_mutex );
+  g_shared_tile_queue = queue;
+}
+
+boost::shared_ptr<FifoWorkQueue> asp::shared_tile_queue() {
+  Mutex::Lock lock( g_shared_tile_queue_mutex );
+  return g_shared_tile_queue;
+}
+
+bool asp::TileJob::owns( BBox2i const& tile, Vector2i const& tile_size,
+                         int32 image_cols ) const {
+  return tile_index( tile, tile_size, image_cols ) % num_workers == worker_index;
+}
+
+// TileManifest
+//----------------------------------------------------------
+
+std::string asp::TileManifest::manifest_filename( std::string const& image_filename ) {
+  return image_filename + ".tiles";
+}
+
+asp::TileManifest::TileManifest( std::string const& image_filename,
+                                 Vector2i const& image_size,
+                                 Vector2i const& tile_size,
+                                 TileJob const& job ) :
+  m_filename( manifest_filename( image_filename ) ),
+  m_image_size( image_size ), m_tile_size( tile_size ), m_job( job ),
+  m_resuming( false ) {
+
+  std::ifstream input( m_filename.c_str() );
+  if ( !input )
+    return;
+
+  // The header is the image and tile size, the worker split and, on a
+  // line of its own, the job key.
+  std::string magic, rest, key;
+  Vector2i stored_image, stored_tile;
+  uint32 worker_index = 0, num_workers = 0;
+  input >> magic >> stored_image[0] >> stored_image[1]
+        >> stored_tile[0] >> stored_tile[1] >> worker_index >> num_workers;
+  std::getline( input, rest );
+  std::getline( input, key );
+  if ( !input || magic != MANIFEST_MAGIC ||
+       stored_image != m_image_size || stored_tile != m_tile_size ) {
+    vw_out(WarningMessage) << "Ignoring tile manifest " << m_filename
+                           << " written for a different image.\n";
+    return;
+  }
+  if ( worker_index != m_job.worker_index || num_workers != m_job.num_workers ||
+       key != m_job.key ) {
+    vw_out(WarningMessage) << "Ignoring tile manifest " << m_filename
+                           << " written for different inputs, settings or workers.\n";
+    return;
+  }
+
+  // A partially written last line is simply dropped.
+  int32 x, y;
+  while ( input >> x >> y )
+    m_done.insert( std::make_pair( x, y ) );
+  m_resuming = true;
+}
+
+bool asp::TileManifest::is_done( BBox2i const& tile ) const {
+  Mutex::Lock lock( m_mutex );
+  return m_done.count( std::make_pair( tile.min()[0], tile.min()[1] ) );
+}
+
+size_t asp::TileManifest::num_done() const {
+  Mutex::Lock lock( m_mutex );
+  return m_done.size();
+}
+
+size_t asp::TileManifest::num_done( std::vector<BBox2i> const& tiles ) const {
+  size_t count = 0;
+  for ( size_t i = 0; i < tiles.size(); i++ )
+    count += is_done( tiles[i] );
+  return count;
+}
+
+void asp::TileManifest::reset() {
+  Mutex::Lock lock( m_mutex );
+  m_done.clear();
+  m_resuming = false;
+  if ( m_stream.is_open() )
+    m_stream.close();
+  m_stream.open( m_filename.c_str(), std::ios::out | std::ios::trunc );
+  if ( !m_stream )
+    vw_throw( IOErr() << "Unable to create tile manifest " << m_filename );
+  m_stream << MANIFEST_MAGIC << " " << m_image_size[0] << " " << m_image_size[1]
+           << " " << m_tile_size[0] << " " << m_tile_size[1]
+           << " " << m_job.worker_index << " " << m_job.num_workers << "\n"
+           << m_job.key << "\n" << std::flush;
+}
+
+void asp::TileManifest::mark_done( BBox2i const& tile ) {
+  Mutex::Lock lock( m_mutex );
+  if ( !m_stream.is_open() ) {
+    m_stream.open( m_filename.c_str(), std::ios::out | std::ios::app );
+    if ( !m_stream )
+      vw_throw( IOErr() << "Unable to append to tile manifest " << m_filename );
+  }
+  m_done.insert( std::make_pair( tile.min()[0], tile.min()[1] ) );
+  m_stream << tile.min()[0] << " " << tile.min()[1] << "\n" << std::flush;
+}
+
+void asp::TileManifest::remove() {
+  Mutex::Lock lock( m_mutex );
+  if ( m_stream.is_open() )
+    m_stream.close();
+  std::remove( m_filename.c_str() );
+}
+
+// GdalTileUpdater
+//----------------------------------------------------------
+
+asp::GdalTileUpdater::GdalTileUpdater( std::string const& filename ) {
+  GDALAllRegister();
+  m_dataset = GDALOpen( filename.c_str(), GA_Update );
+  if ( !m_dataset )
+    vw_throw( IOErr() << "Unable to open " << filename << " for update." );
+  m_bands = GDALGetRasterCount( (GDALDatasetH)m_dataset );
+}
+
+asp::GdalTileUpdater::~GdalTileUpdater() {
+  GDALClose( (GDALDatasetH)m_dataset );
+}
+
+void asp::GdalTileUpdater::write( void const* data, ChannelTypeEnum channel_type,
+                                  int num_channels, BBox2i const& bbox ) {
+  int channel_bytes = channel_size( channel_type );
+  Mutex::Lock lock( m_mutex );
+  CPLErr result =
+    GDALDatasetRasterIO( (GDALDatasetH)m_dataset, GF_Write,
+                         bbox.min()[0], bbox.min()[1],
+                         bbox.width(), bbox.height(),
+                         const_cast<void*>(data),
+                         bbox.width(), bbox.height(),
+                         gdal_data_type( channel_type ), num_channels, NULL,
+                         num_channels*channel_bytes,
+                         num_channels*channel_bytes*bbox.width(),
+                         channel_bytes );
+  if ( result != CE_None )
+    vw_throw( IOErr() << "GDAL failed to write tile " << bbox << ": "
+              << CPLGetLastErrorMsg() );
+  GDALFlushCache( (GDALDatasetH)m_dataset );
+}
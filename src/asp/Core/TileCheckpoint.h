@@ -0,0 +1,512 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file TileCheckpoint.h
+///
+/// Block writing that can be resumed after the process dies. Every
+/// tile that reaches the disk is recorded in a manifest next to the
+/// output image (<filename>.tiles). When the writer is called again
+/// with a manifest present, the existing image is opened for update
+/// and only the missing tiles are rendered. The manifest is deleted
+/// once the image is complete.
+///
+/// Several files can also be written from one image, rendering each
+/// tile once and handing it to every file, for views whose output is
+/// split over files (like the disparity and uncertainty of EM subpixel
+/// refinement).
+
+#ifndef __ASP_CORE_TILECHECKPOINT_H__
+#define __ASP_CORE_TILECHECKPOINT_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PerPixelViews.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Math/BBox.h>
+
+#include <asp/Core/Common.h>
+#include <asp/Core/TraceLog.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <fstream>
+#include <set>
+#include <vector>
+
+namespace asp {
+
+  // Which tiles of an image a writer renders, and from what. Tiles
+  // whose tile_index is worker_index modulo num_workers belong to the
+  // writer. The key names the inputs and settings the tiles are
+  // computed from, normally a StageKey string.
+  struct TileJob {
+    vw::uint32 worker_index, num_workers;
+    std::string key;
+
+    explicit TileJob( std::string const& key = "", vw::uint32 worker_index = 0,
+                      vw::uint32 num_workers = 1 ) :
+      worker_index( worker_index ), num_workers( num_workers ), key( key ) {}
+
+    bool owns( vw::BBox2i const& tile, vw::Vector2i const& tile_size,
+               vw::int32 image_cols ) const;
+  };
+
+  // List of finished tiles for one output image. Tiles are identified
+  // by their upper left corner.
+  class TileManifest : private boost::noncopyable {
+    std::string m_filename;
+    vw::Vector2i m_image_size, m_tile_size;
+    TileJob m_job;
+    std::set<std::pair<vw::int32,vw::int32> > m_done;
+    std::ofstream m_stream;
+    bool m_resuming;
+    mutable vw::Mutex m_mutex;
+
+  public:
+    // Loads the manifest for image_filename if there is one and it was
+    // written for the same image, tile size and job. Otherwise starts
+    // empty.
+    TileManifest( std::string const& image_filename,
+                  vw::Vector2i const& image_size,
+                  vw::Vector2i const& tile_size,
+                  TileJob const& job = TileJob() );
+
+    static std::string manifest_filename( std::string const& image_filename );
+
+    // True if a matching manifest was found on disk.
+    bool resuming() const { return m_resuming; }
+
+    bool is_done( vw::BBox2i const& tile ) const;
+    size_t num_done() const;
+    // How many of tiles are done.
+    size_t num_done( std::vector<vw::BBox2i> const& tiles ) const;
+
+    // Forget everything and start a new manifest on disk.
+    void reset();
+
+    // Record a tile as written. The manifest is flushed before
+    // returning, so the caller must have flushed the tile first.
+    void mark_done( vw::BBox2i const& tile );
+
+    // Delete the manifest file. Call once the image is complete.
+    void remove();
+  };
+
+  // Writes tiles straight into an existing GDAL image, bypassing the
+  // Vision Workbench resource which only opens files read only.
+  class GdalTileUpdater : private boost::noncopyable {
+    void* m_dataset;
+    int m_bands;
+    vw::Mutex m_mutex;
+
+  public:
+    GdalTileUpdater( std::string const& filename );
+    ~GdalTileUpdater();
+
+    int bands() const { return m_bands; }
+
+    // Write interleaved pixel data covering bbox and flush it to disk.
+    void write( void const* data, vw::ChannelTypeEnum channel_type,
+                int num_channels, vw::BBox2i const& bbox );
+  };
+
+  // Row major index of a tile. Tiles are split among processes by
+  // this index, so it must not depend on the order tiles are visited.
+  inline size_t tile_index( vw::BBox2i const& tile, vw::Vector2i const& tile_size,
+                            vw::int32 image_cols ) {
+    size_t tiles_per_row = ( image_cols + tile_size[0] - 1 ) / tile_size[0];
+    return size_t( tile.min()[1] / tile_size[1] ) * tiles_per_row +
+      size_t( tile.min()[0] / tile_size[0] );
+  }
+
+  namespace detail {
+
+    // Render one tile and write it. queued is when the tile was
+    // scheduled, or 0 if unknown.
+    template <class ImageT>
+    void write_tile( ImageT const& image, vw::BBox2i const& bbox,
+                     GdalTileUpdater& updater, std::string const& filename,
+                     vw::uint64 queued = 0 ) {
+      typedef typename ImageT::pixel_type pixel_type;
+      typedef typename vw::PixelChannelType<pixel_type>::type channel_type;
+      vw::ImageView<pixel_type> tile;
+      {
+        TraceScope trace( "compute", "tile" );
+        trace.args()( "file", filename )( "bbox", bbox );
+        if ( queued && trace_log().enabled() )
+          trace.args()( "queue_wait_us", double( TraceLog::now() - queued ) );
+        tile = vw::crop( image, bbox );
+      }
+      {
+        TraceScope trace( "write", "io" );
+        trace.args()( "file", filename )( "bbox", bbox )
+          ( "bytes", double( bbox.width() ) * bbox.height() * sizeof(pixel_type) );
+        updater.write( &tile(0,0), vw::ChannelTypeID<channel_type>::value,
+                       vw::PixelNumChannels<pixel_type>::value, bbox );
+      }
+    }
+
+    // Progress is shared by all tile tasks. It also tells the writer
+    // when they are all done, since tasks on the shared queue can't be
+    // joined individually.
+    class CheckpointProgress : private boost::noncopyable {
+      vw::ProgressCallback const& m_callback;
+      size_t m_total, m_done;
+      std::string m_error;
+      vw::Mutex m_mutex;
+      vw::Condition m_finished;
+    public:
+      CheckpointProgress( vw::ProgressCallback const& callback,
+                          size_t total, size_t done ) :
+        m_callback(callback), m_total(total), m_done(done) {
+        m_callback.report_fractional_progress( m_done, m_total );
+      }
+
+      // Count a tile as finished. A non-empty error marks it failed.
+      void tick( std::string const& error = "" ) {
+        vw::Mutex::Lock lock(m_mutex);
+        m_done++;
+        if ( !error.empty() && m_error.empty() )
+          m_error = error;
+        m_callback.report_fractional_progress( m_done, m_total );
+        if ( m_done >= m_total )
+          m_finished.notify_all();
+      }
+
+      // Block until every tile is finished. Returns the first error.
+      std::string wait() {
+        vw::Mutex::Lock lock(m_mutex);
+        while ( m_done < m_total )
+          m_finished.wait( lock );
+        return m_error;
+      }
+    };
+
+    template <class ImageT>
+    class CheckpointTileTask : public vw::Task, private boost::noncopyable {
+      ImageT m_image;
+      vw::BBox2i m_bbox;
+      GdalTileUpdater& m_updater;
+      TileManifest& m_manifest;
+      CheckpointProgress& m_progress;
+      std::string m_filename;
+      vw::uint64 m_queued;
+    public:
+      CheckpointTileTask( ImageT const& image, vw::BBox2i const& bbox,
+                          GdalTileUpdater& updater, TileManifest& manifest,
+                          CheckpointProgress& progress,
+                          std::string const& filename ) :
+        m_image(image), m_bbox(bbox), m_updater(updater),
+        m_manifest(manifest), m_progress(progress), m_filename(filename),
+        m_queued( trace_log().enabled() ? TraceLog::now() : 0 ) {}
+
+      void operator()() {
+        std::string error;
+        try {
+          write_tile( m_image, m_bbox, m_updater, m_filename, m_queued );
+          m_manifest.mark_done( m_bbox );
+        } catch ( std::exception const& e ) {
+          error = e.what();
+        }
+        trace_log().sample_process();
+        // The writer may return as soon as the last tile ticks, so
+        // nothing here can be touched afterwards.
+        m_progress.tick( error );
+      }
+    };
+  }
+
+  // Drivers that write several images at once (stereo_batch) install
+  // one queue here so all of their tiles share a single set of
+  // threads. While it is set, checkpoint_block_write_gdal_image adds
+  // its tiles to this queue and ignores its num_threads argument.
+  void set_shared_tile_queue( boost::shared_ptr<vw::FifoWorkQueue> const& queue );
+  boost::shared_ptr<vw::FifoWorkQueue> shared_tile_queue();
+
+  // Drop in replacement for block_write_gdal_image that can pick up
+  // where an interrupted run stopped. The unit of work is one
+  // opt.raster_tile_size tile.
+  //
+  // Only the tiles the job owns are rendered; the rest of the image is
+  // left blank for other processes to fill in. A manifest left by a
+  // different job is ignored and the image started over.
+  template <class ImageT>
+  void checkpoint_block_write_gdal_image( const std::string &filename,
+                                          vw::ImageViewBase<ImageT> const& image,
+                                          BaseOptions const& opt,
+                                          vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance(),
+                                          vw::uint32 num_threads = 0,
+                                          TileJob const& job = TileJob() ) {
+    ImageT const& view = image.impl();
+    vw::Vector2i image_size( view.cols(), view.rows() );
+    TileManifest manifest( filename, image_size, opt.raster_tile_size, job );
+
+    std::vector<vw::BBox2i> tiles;
+    BOOST_FOREACH( vw::BBox2i const& tile,
+                   vw::image_blocks( view, opt.raster_tile_size[0],
+                                     opt.raster_tile_size[1] ) ) {
+      if ( job.owns( tile, opt.raster_tile_size, view.cols() ) )
+        tiles.push_back( tile );
+    }
+
+    if ( manifest.resuming() && boost::filesystem::exists( filename ) ) {
+      vw::vw_out() << "\t--> Resuming " << filename << ": "
+                   << manifest.num_done( tiles ) << " tiles already written.\n";
+    } else {
+      // Create the image with all of its tiles blank. Closing the
+      // resource finalizes the header so it can be reopened.
+      boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, opt ) );
+      rsrc.reset();
+      manifest.reset();
+    }
+
+    GdalTileUpdater updater( filename );
+    if ( updater.bands() != vw::PixelNumChannels<typename ImageT::pixel_type>::value )
+      vw::vw_throw( vw::IOErr() << "Can't resume " << filename
+                    << ": channel count doesn't match. Delete it and "
+                    << TileManifest::manifest_filename( filename ) << " to start over." );
+
+    // Only this job's tiles count towards the total, or the writer
+    // could return while some of them are still queued.
+    detail::CheckpointProgress progress( progress_callback, tiles.size(),
+                                         manifest.num_done( tiles ) );
+
+    boost::shared_ptr<vw::FifoWorkQueue> queue = shared_tile_queue();
+    if ( !queue )
+      queue.reset( new vw::FifoWorkQueue( num_threads ? num_threads :
+                                          vw::vw_settings().default_num_threads() ) );
+    BOOST_FOREACH( vw::BBox2i const& tile, tiles ) {
+      if ( manifest.is_done( tile ) )
+        continue;
+      boost::shared_ptr<vw::Task>
+        task( new detail::CheckpointTileTask<ImageT>( view, tile, updater,
+                                                      manifest, progress,
+                                                      filename ) );
+      queue->add_task( task );
+    }
+    std::string error = progress.wait();
+    if ( !error.empty() )
+      vw::vw_throw( vw::IOErr() << "Failed to write " << filename << ": " << error );
+    progress_callback.report_finished();
+
+    manifest.remove();
+  }
+
+  // One of the files checkpoint_block_write_gdal_images writes from the
+  // tiles of an image with pixels of SrcPixelT.
+  template <class SrcPixelT>
+  class TileSink : private boost::noncopyable {
+  public:
+    virtual ~TileSink() {}
+    virtual std::string const& filename() const = 0;
+    // Create the file, blank, for an image of the given size.
+    virtual void create( vw::Vector2i const& size, BaseOptions const& opt ) = 0;
+    // Open the file for writing tiles, and return its channel count.
+    virtual int open() = 0;
+    virtual void write( vw::ImageView<SrcPixelT> const& tile, vw::BBox2i const& bbox ) = 0;
+  };
+
+  // A sink that writes the tiles through a per pixel functor, the same
+  // one per_pixel_filter would apply to the whole image.
+  template <class SrcPixelT, class FuncT>
+  class FilteredTileSink : public TileSink<SrcPixelT> {
+    typedef typename vw::PerPixelView<vw::ImageView<SrcPixelT>, FuncT>::pixel_type pixel_type;
+    typedef typename vw::PixelChannelType<pixel_type>::type channel_type;
+    std::string m_filename;
+    FuncT m_func;
+    boost::scoped_ptr<GdalTileUpdater> m_updater;
+
+  public:
+    FilteredTileSink( std::string const& filename, FuncT const& func = FuncT() ) :
+      m_filename( filename ), m_func( func ) {}
+
+    std::string const& filename() const { return m_filename; }
+
+    void create( vw::Vector2i const& size, BaseOptions const& opt ) {
+      vw::ImageFormat format;
+      format.cols = size[0];
+      format.rows = size[1];
+      format.planes = 1;
+      format.pixel_format = vw::PixelFormatID<pixel_type>::value;
+      format.channel_type = vw::ChannelTypeID<channel_type>::value;
+      // Closing the resource right away leaves a blank image to update.
+      boost::scoped_ptr<vw::DiskImageResourceGDAL>
+        rsrc( new vw::DiskImageResourceGDAL( m_filename, format, opt.raster_tile_size,
+                                             opt.gdal_options ) );
+    }
+
+    int open() {
+      m_updater.reset( new GdalTileUpdater( m_filename ) );
+      if ( m_updater->bands() != vw::PixelNumChannels<pixel_type>::value )
+        vw::vw_throw( vw::IOErr() << "Can't resume " << m_filename
+                      << ": channel count doesn't match." );
+      return m_updater->bands();
+    }
+
+    void write( vw::ImageView<SrcPixelT> const& tile, vw::BBox2i const& bbox ) {
+      vw::ImageView<pixel_type> result = vw::per_pixel_filter( tile, m_func );
+      TraceScope trace( "write", "io" );
+      trace.args()( "file", m_filename )( "bbox", bbox )
+        ( "bytes", double( bbox.width() ) * bbox.height() * sizeof(pixel_type) );
+      m_updater->write( &result(0,0), vw::ChannelTypeID<channel_type>::value,
+                        vw::PixelNumChannels<pixel_type>::value, bbox );
+    }
+  };
+
+  namespace detail {
+
+    template <class ImageT>
+    class MultiSinkTileTask : public vw::Task, private boost::noncopyable {
+      typedef typename ImageT::pixel_type pixel_type;
+      typedef std::vector<boost::shared_ptr<TileSink<pixel_type> > > sink_list;
+      ImageT m_image;
+      vw::BBox2i m_bbox;
+      sink_list const& m_sinks;
+      TileManifest& m_manifest;
+      CheckpointProgress& m_progress;
+    public:
+      MultiSinkTileTask( ImageT const& image, vw::BBox2i const& bbox,
+                         sink_list const& sinks, TileManifest& manifest,
+                         CheckpointProgress& progress ) :
+        m_image(image), m_bbox(bbox), m_sinks(sinks), m_manifest(manifest),
+        m_progress(progress) {}
+
+      void operator()() {
+        std::string error;
+        try {
+          vw::ImageView<pixel_type> tile;
+          {
+            TraceScope trace( "compute", "tile" );
+            trace.args()( "file", m_sinks.front()->filename() )( "bbox", m_bbox );
+            tile = vw::crop( m_image, m_bbox );
+          }
+          for ( size_t i = 0; i < m_sinks.size(); i++ )
+            m_sinks[i]->write( tile, m_bbox );
+          m_manifest.mark_done( m_bbox );
+        } catch ( std::exception const& e ) {
+          error = e.what();
+        }
+        trace_log().sample_process();
+        m_progress.tick( error );
+      }
+    };
+  }
+
+  // checkpoint_block_write_gdal_image for several files written from
+  // the same image. Each tile is rendered once and passed to every
+  // sink, so an expensive view isn't computed once per file, nor
+  // written to an intermediate file to be split afterwards. The
+  // manifest belongs to the first sink's file and a tile is only
+  // recorded once all of the files have it.
+  template <class ImageT>
+  void checkpoint_block_write_gdal_images( vw::ImageViewBase<ImageT> const& image,
+                                           std::vector<boost::shared_ptr<TileSink<typename ImageT::pixel_type> > > const& sinks,
+                                           BaseOptions const& opt,
+                                           vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance(),
+                                           vw::uint32 num_threads = 0,
+                                           TileJob const& job = TileJob() ) {
+    VW_ASSERT( !sinks.empty(),
+               vw::ArgumentErr() << "checkpoint_block_write_gdal_images: no files to write." );
+    ImageT const& view = image.impl();
+    vw::Vector2i image_size( view.cols(), view.rows() );
+    TileManifest manifest( sinks.front()->filename(), image_size, opt.raster_tile_size, job );
+
+    std::vector<vw::BBox2i> tiles;
+    BOOST_FOREACH( vw::BBox2i const& tile,
+                   vw::image_blocks( view, opt.raster_tile_size[0],
+                                     opt.raster_tile_size[1] ) ) {
+      if ( job.owns( tile, opt.raster_tile_size, view.cols() ) )
+        tiles.push_back( tile );
+    }
+
+    bool resume = manifest.resuming();
+    for ( size_t i = 0; i < sinks.size(); i++ )
+      resume = resume && boost::filesystem::exists( sinks[i]->filename() );
+    if ( resume ) {
+      vw::vw_out() << "\t--> Resuming " << sinks.front()->filename() << ": "
+                   << manifest.num_done( tiles ) << " tiles already written.\n";
+    } else {
+      for ( size_t i = 0; i < sinks.size(); i++ )
+        sinks[i]->create( image_size, opt );
+      manifest.reset();
+    }
+    for ( size_t i = 0; i < sinks.size(); i++ )
+      sinks[i]->open();
+
+    detail::CheckpointProgress progress( progress_callback, tiles.size(),
+                                         manifest.num_done( tiles ) );
+
+    boost::shared_ptr<vw::FifoWorkQueue> queue = shared_tile_queue();
+    if ( !queue )
+      queue.reset( new vw::FifoWorkQueue( num_threads ? num_threads :
+                                          vw::vw_settings().default_num_threads() ) );
+    BOOST_FOREACH( vw::BBox2i const& tile, tiles ) {
+      if ( manifest.is_done( tile ) )
+        continue;
+      boost::shared_ptr<vw::Task>
+        task( new detail::MultiSinkTileTask<ImageT>( view, tile, sinks, manifest, progress ) );
+      queue->add_task( task );
+    }
+    std::string error = progress.wait();
+    if ( !error.empty() )
+      vw::vw_throw( vw::IOErr() << "Failed to write " << sinks.front()->filename()
+                    << ": " << error );
+    progress_callback.report_finished();
+
+    manifest.remove();
+  }
+
+  // Writes tiles of an image into a new file in whatever order the
+  // caller produces them, for schedulers that decide when each tile is
+  // ready (see TileDag.h). Copies share the open file, so a writer can
+  // be passed around as a callback. If serial is set, tiles are also
+  // rendered one at a time, for views that aren't thread safe.
+  //
+  // There is no manifest: a file written this way can't be resumed.
+  template <class ImageT>
+  class TileFileWriter {
+    struct Shared {
+      GdalTileUpdater updater;
+      vw::Mutex mutex;
+      Shared( std::string const& filename ) : updater( filename ) {}
+    };
+    ImageT m_image;
+    std::string m_filename;
+    bool m_serial;
+    boost::shared_ptr<Shared> m_shared;
+
+  public:
+    TileFileWriter( std::string const& filename,
+                    vw::ImageViewBase<ImageT> const& image,
+                    BaseOptions const& opt, bool serial = false ) :
+      m_image( image.impl() ), m_filename( filename ), m_serial( serial ) {
+      boost::filesystem::remove( TileManifest::manifest_filename( filename ) );
+      boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, opt ) );
+      rsrc.reset();
+      m_shared.reset( new Shared( filename ) );
+    }
+
+    void operator()( vw::BBox2i const& bbox ) const {
+      if ( m_serial ) {
+        vw::Mutex::Lock lock( m_shared->mutex );
+        detail::write_tile( m_image, bbox, m_shared->updater, m_filename );
+      } else {
+        detail::write_tile( m_image, bbox, m_shared->updater, m_filename );
+      }
+    }
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_TILECHECKPOINT_H__
@@ -0,0 +1,330 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file TileDag.h
+///
+/// Runs a chain of image stages tile by tile, starting each tile of a
+/// stage as soon as the tiles of the previous stage that it reads are
+/// finished. A tile of stage s depends on every tile of stage s-1 that
+/// intersects its own bounding box grown by the stage's halo. Finished
+/// tiles are kept in memory until all of their dependents are done.
+///
+/// The work is spread over the Vision Workbench thread pool. Ready
+/// tiles of later stages are always picked before earlier ones, so
+/// tiles flow through to the end of the chain instead of each stage
+/// draining completely before the next one starts.
+
+#ifndef __ASP_CORE_TILEDAG_H__
+#define __ASP_CORE_TILEDAG_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+
+#include <asp/Core/TraceLog.h>
+
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace asp {
+
+  namespace detail {
+
+    // The finished tiles of one stage, shared between threads.
+    template <class PixelT>
+    class TileStore : private boost::noncopyable {
+      typedef std::map<std::pair<vw::int32,vw::int32>,
+                       boost::shared_ptr<vw::ImageView<PixelT> > > map_type;
+      map_type m_tiles;
+      mutable vw::Mutex m_mutex;
+    public:
+      void insert( vw::BBox2i const& tile, boost::shared_ptr<vw::ImageView<PixelT> > data ) {
+        vw::Mutex::Lock lock( m_mutex );
+        m_tiles[ std::make_pair( tile.min().x(), tile.min().y() ) ] = data;
+      }
+      void erase( vw::BBox2i const& tile ) {
+        vw::Mutex::Lock lock( m_mutex );
+        m_tiles.erase( std::make_pair( tile.min().x(), tile.min().y() ) );
+      }
+      boost::shared_ptr<vw::ImageView<PixelT> > get( vw::int32 x, vw::int32 y ) const {
+        vw::Mutex::Lock lock( m_mutex );
+        typename map_type::const_iterator it = m_tiles.find( std::make_pair( x, y ) );
+        if ( it == m_tiles.end() )
+          vw::vw_throw( vw::LogicErr() << "TileDag: tile (" << x << "," << y
+                        << ") was read before it was computed or after it was released. "
+                        << "The stage halo is too small." );
+        return it->second;
+      }
+    };
+  }
+
+  // The finished tiles of a stage seen as one image.
+  template <class PixelT>
+  class TileStoreView : public vw::ImageViewBase<TileStoreView<PixelT> > {
+    boost::shared_ptr<detail::TileStore<PixelT> > m_store;
+    vw::Vector2i m_tile_size;
+    vw::int32 m_cols, m_rows;
+
+    vw::int32 tile_x( vw::int32 i ) const { return ( i / m_tile_size[0] ) * m_tile_size[0]; }
+    vw::int32 tile_y( vw::int32 j ) const { return ( j / m_tile_size[1] ) * m_tile_size[1]; }
+
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef vw::ProceduralPixelAccessor<TileStoreView> pixel_accessor;
+
+    TileStoreView( boost::shared_ptr<detail::TileStore<PixelT> > store,
+                   vw::Vector2i const& tile_size, vw::int32 cols, vw::int32 rows ) :
+      m_store(store), m_tile_size(tile_size), m_cols(cols), m_rows(rows) {}
+
+    inline vw::int32 cols() const { return m_cols; }
+    inline vw::int32 rows() const { return m_rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this,0,0); }
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 /*p*/=0 ) const {
+      vw::int32 x = tile_x(i), y = tile_y(j);
+      return (*m_store->get( x, y ))( i - x, j - y );
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      vw::ImageView<pixel_type> buffer( bbox.width(), bbox.height() );
+      vw::BBox2i inside = bbox;
+      inside.crop( vw::BBox2i( 0, 0, m_cols, m_rows ) );
+      for ( vw::int32 y = tile_y( inside.min().y() ); y < inside.max().y(); y += m_tile_size[1] ) {
+        for ( vw::int32 x = tile_x( inside.min().x() ); x < inside.max().x(); x += m_tile_size[0] ) {
+          boost::shared_ptr<vw::ImageView<pixel_type> > tile = m_store->get( x, y );
+          vw::BBox2i section( x, y, tile->cols(), tile->rows() );
+          section.crop( inside );
+          vw::crop( buffer, vw::BBox2i( section.min() - bbox.min(),
+                                        section.max() - bbox.min() ) ) =
+            vw::crop( *tile, vw::BBox2i( section.min() - vw::Vector2i(x,y),
+                                         section.max() - vw::Vector2i(x,y) ) );
+        }
+      }
+      return prerasterize_type( buffer, -bbox.min().x(), -bbox.min().y(), m_cols, m_rows );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  template <class PixelT>
+  class TileDag : private boost::noncopyable {
+  public:
+    typedef vw::ImageViewRef<PixelT> view_type;
+    // Builds a stage's view from the view of the previous stage's output.
+    typedef boost::function<view_type (view_type const&)> stage_func;
+    // Called on a worker thread once a tile of a stage is finished.
+    // The tile can be read through output(stage) until it returns.
+    typedef boost::function<void (vw::BBox2i const&)> tap_func;
+
+  private:
+    struct Stage {
+      view_type view;
+      vw::Vector2i halo;
+      boost::shared_ptr<detail::TileStore<PixelT> > store;
+      std::vector<tap_func> taps;
+    };
+    // Priority of a ready tile: later stages first, then row major.
+    typedef std::pair<vw::int32,size_t> node_key;
+
+    std::vector<Stage> m_stages;
+    std::vector<vw::BBox2i> m_tiles;
+    vw::Vector2i m_tile_size;
+    vw::int32 m_cols, m_rows;
+
+    // Scheduler state, guarded by m_mutex.
+    vw::Mutex m_mutex;
+    vw::Condition m_condition;
+    std::set<node_key> m_ready;
+    std::vector<std::vector<size_t> > m_waiting;    // [stage][tile] unfinished inputs
+    std::vector<std::vector<size_t> > m_consumers;  // [stage][tile] unfinished readers
+    std::vector<std::vector<std::vector<size_t> > > m_inputs, m_readers;
+    size_t m_remaining, m_sink_done;
+    std::string m_error;
+
+    // Tiles of the previous stage that a tile of stage s reads. The
+    // tiles form a regular grid in row major order.
+    std::vector<size_t> inputs( size_t stage, size_t tile ) const {
+      vw::BBox2i needed = m_tiles[tile];
+      needed.min() -= m_stages[stage].halo;
+      needed.max() += m_stages[stage].halo;
+      needed.crop( vw::BBox2i( 0, 0, m_cols, m_rows ) );
+      size_t tiles_per_row = ( m_cols + m_tile_size[0] - 1 ) / m_tile_size[0];
+      std::vector<size_t> result;
+      for ( vw::int32 ty = needed.min().y() / m_tile_size[1];
+            ty <= ( needed.max().y() - 1 ) / m_tile_size[1]; ty++ )
+        for ( vw::int32 tx = needed.min().x() / m_tile_size[0];
+              tx <= ( needed.max().x() - 1 ) / m_tile_size[0]; tx++ )
+          result.push_back( ty * tiles_per_row + tx );
+      return result;
+    }
+
+    void compute( size_t stage, size_t tile ) {
+      std::ostringstream name;
+      name << "stage " << stage;
+      {
+        TraceScope trace( name.str(), "tile" );
+        trace.args()( "bbox", m_tiles[tile] );
+        boost::shared_ptr<vw::ImageView<PixelT> > data
+          ( new vw::ImageView<PixelT>( vw::crop( m_stages[stage].view, m_tiles[tile] ) ) );
+        m_stages[stage].store->insert( m_tiles[tile], data );
+      }
+      BOOST_FOREACH( tap_func const& tap, m_stages[stage].taps )
+        tap( m_tiles[tile] );
+    }
+
+    // Bookkeeping after a tile finished. Called with m_mutex held.
+    void finished( size_t stage, size_t tile ) {
+      m_remaining--;
+      if ( stage > 0 ) {
+        BOOST_FOREACH( size_t input, m_inputs[stage][tile] )
+          if ( --m_consumers[stage-1][input] == 0 )
+            m_stages[stage-1].store->erase( m_tiles[input] );
+      }
+      if ( stage + 1 < m_stages.size() ) {
+        BOOST_FOREACH( size_t reader, m_readers[stage][tile] )
+          if ( --m_waiting[stage+1][reader] == 0 )
+            m_ready.insert( node_key( -vw::int32(stage+1), reader ) );
+      } else {
+        m_sink_done++;
+        m_stages[stage].store->erase( m_tiles[tile] );
+      }
+    }
+
+    class Worker : public vw::Task {
+      TileDag& m_dag;
+      vw::ProgressCallback const& m_progress;
+    public:
+      Worker( TileDag& dag, vw::ProgressCallback const& progress ) :
+        m_dag(dag), m_progress(progress) {}
+      void operator()() { m_dag.work( m_progress ); }
+    };
+
+    void work( vw::ProgressCallback const& progress ) {
+      vw::Mutex::Lock lock( m_mutex );
+      while ( true ) {
+        while ( m_ready.empty() && m_remaining > 0 && m_error.empty() )
+          m_condition.wait( lock );
+        if ( m_remaining == 0 || !m_error.empty() )
+          break;
+        node_key node = *m_ready.begin();
+        m_ready.erase( m_ready.begin() );
+        lock.unlock();
+
+        size_t stage = -node.first, tile = node.second;
+        try {
+          compute( stage, tile );
+        } catch ( std::exception const& e ) {
+          lock.lock();
+          if ( m_error.empty() )
+            m_error = e.what();
+          m_condition.notify_all();
+          break;
+        }
+
+        lock.lock();
+        finished( stage, tile );
+        progress.report_fractional_progress( m_sink_done, m_tiles.size() );
+        m_condition.notify_all();
+      }
+    }
+
+  public:
+    // The first stage reads from disk, so it has no input and no halo.
+    TileDag( view_type const& source, vw::Vector2i const& tile_size ) :
+      m_tile_size( tile_size ), m_cols( source.cols() ), m_rows( source.rows() ) {
+      m_tiles = vw::image_blocks( source, tile_size[0], tile_size[1] );
+      Stage first;
+      first.view = source;
+      first.store.reset( new detail::TileStore<PixelT>() );
+      m_stages.push_back( first );
+    }
+
+    // Append a stage. halo is how far beyond a tile's own bounding box
+    // the stage reads from the previous stage's output. Returns the
+    // index of the new stage.
+    size_t add_stage( stage_func const& func, vw::Vector2i const& halo ) {
+      Stage stage;
+      stage.halo = halo;
+      stage.store.reset( new detail::TileStore<PixelT>() );
+      stage.view = func( output( m_stages.size() - 1 ) );
+      if ( stage.view.cols() != m_cols || stage.view.rows() != m_rows )
+        vw::vw_throw( vw::ArgumentErr() << "TileDag: stages must keep the image size." );
+      m_stages.push_back( stage );
+      return m_stages.size() - 1;
+    }
+
+    size_t num_stages() const { return m_stages.size(); }
+
+    // The finished tiles of a stage. Only the tiles handed to a tap, and
+    // the inputs of tiles being computed, are guaranteed to be present.
+    view_type output( size_t stage ) const {
+      return TileStoreView<PixelT>( m_stages[stage].store, m_tile_size, m_cols, m_rows );
+    }
+
+    // Taps run in the order they were added, on the thread that
+    // finished the tile.
+    void add_tap( size_t stage, tap_func const& tap ) {
+      m_stages[stage].taps.push_back( tap );
+    }
+
+    void run( vw::ProgressCallback const& progress = vw::ProgressCallback::dummy_instance(),
+              vw::uint32 num_threads = 0 ) {
+      size_t num_tiles = m_tiles.size();
+      m_waiting.assign( m_stages.size(), std::vector<size_t>( num_tiles, 0 ) );
+      m_consumers.assign( m_stages.size(), std::vector<size_t>( num_tiles, 0 ) );
+      m_inputs.assign( m_stages.size(), std::vector<std::vector<size_t> >( num_tiles ) );
+      m_readers.assign( m_stages.size(), std::vector<std::vector<size_t> >( num_tiles ) );
+      for ( size_t stage = 1; stage < m_stages.size(); stage++ ) {
+        for ( size_t tile = 0; tile < num_tiles; tile++ ) {
+          m_inputs[stage][tile] = inputs( stage, tile );
+          m_waiting[stage][tile] = m_inputs[stage][tile].size();
+          BOOST_FOREACH( size_t input, m_inputs[stage][tile] ) {
+            m_consumers[stage-1][input]++;
+            m_readers[stage-1][input].push_back( tile );
+          }
+        }
+      }
+      m_ready.clear();
+      for ( size_t tile = 0; tile < num_tiles; tile++ )
+        m_ready.insert( node_key( 0, tile ) );
+      m_remaining = num_tiles * m_stages.size();
+      m_sink_done = 0;
+      m_error.clear();
+
+      progress.report_progress(0);
+      if ( num_threads == 0 )
+        num_threads = vw::vw_settings().default_num_threads();
+      vw::FifoWorkQueue queue( num_threads );
+      for ( vw::uint32 i = 0; i < num_threads; i++ )
+        queue.add_task( boost::shared_ptr<vw::Task>( new Worker( *this, progress ) ) );
+      queue.join_all();
+
+      if ( !m_error.empty() )
+        vw::vw_throw( vw::LogicErr() << "Tile pipeline failed: " << m_error );
+      progress.report_finished();
+    }
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_TILEDAG_H__
@@ -0,0 +1,161 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file TraceLog.cc
+///
+
+#include <asp/Core/TraceLog.h>
+#include <vw/Core/Exception.h>
+
+#include <cstdio>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace vw;
+
+std::string asp::json_escape( std::string const& input ) {
+  std::string output;
+  for ( size_t i = 0; i < input.size(); i++ ) {
+    unsigned char c = input[i];
+    if ( c == '"' || c == '\\' ) {
+      output += '\\';
+      output += c;
+    } else if ( c < 0x20 ) {
+      char code[8];
+      snprintf( code, sizeof(code), "\\u%04x", c );
+      output += code;
+    } else {
+      output += c;
+    }
+  }
+  return output;
+}
+
+// TraceArgs
+//----------------------------------------------------------
+
+asp::TraceArgs& asp::TraceArgs::operator()( std::string const& key, double value ) {
+  std::ostringstream ostr;
+  ostr.precision(15);
+  ostr << ( m_json.empty() ? "" : "," ) << "\"" << json_escape(key) << "\":" << value;
+  m_json += ostr.str();
+  return *this;
+}
+
+asp::TraceArgs& asp::TraceArgs::operator()( std::string const& key, std::string const& value ) {
+  m_json += ( m_json.empty() ? "" : "," ) + std::string("\"") + json_escape(key) +
+    "\":\"" + json_escape(value) + "\"";
+  return *this;
+}
+
+asp::TraceArgs& asp::TraceArgs::operator()( std::string const& key, BBox2i const& bbox ) {
+  std::ostringstream ostr;
+  ostr << ( m_json.empty() ? "" : "," ) << "\"" << json_escape(key) << "\":["
+       << bbox.min().x() << "," << bbox.min().y() << ","
+       << bbox.width() << "," << bbox.height() << "]";
+  m_json += ostr.str();
+  return *this;
+}
+
+// TraceLog
+//----------------------------------------------------------
+
+void asp::TraceLog::open( std::string const& filename ) {
+  Mutex::Lock lock( m_mutex );
+  m_stream.open( filename.c_str() );
+  if ( !m_stream )
+    vw_throw( IOErr() << "Unable to open trace file " << filename );
+  m_stream << "[\n";
+  m_first = true;
+  m_enabled = true;
+}
+
+void asp::TraceLog::close() {
+  if ( !enabled() )
+    return;
+  sample_process();
+  Mutex::Lock lock( m_mutex );
+  if ( !m_enabled )
+    return; // Closed by another thread meanwhile
+  m_stream << "\n]\n";
+  m_stream.close();
+  m_enabled = false;
+}
+
+uint64 asp::TraceLog::now() {
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  return uint64(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+void asp::TraceLog::append( std::string const& event ) {
+  Mutex::Lock lock( m_mutex );
+  if ( !m_enabled )
+    return;
+  m_stream << ( m_first ? "" : ",\n" ) << event;
+  m_first = false;
+  // Flushed every event so a trace of a crashed run is still usable.
+  m_stream.flush();
+}
+
+void asp::TraceLog::complete( std::string const& name, std::string const& category,
+                              uint64 start, uint64 duration, TraceArgs const& args ) {
+  if ( !enabled() )
+    return;
+  std::ostringstream ostr;
+  ostr << "{\"name\":\"" << json_escape(name) << "\",\"cat\":\"" << json_escape(category)
+       << "\",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << duration
+       << ",\"pid\":" << getpid() << ",\"tid\":" << Thread::id()
+       << ",\"args\":" << args.str() << "}";
+  append( ostr.str() );
+}
+
+void asp::TraceLog::sample_process() {
+  if ( !enabled() )
+    return;
+  uint64 timestamp = now();
+
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+  double peak_rss_mb = usage.ru_maxrss / ( 1024.0 * 1024.0 ); // bytes
+#else
+  double peak_rss_mb = usage.ru_maxrss / 1024.0;             // kilobytes
+#endif
+
+  std::ostringstream memory;
+  memory << "{\"name\":\"memory\",\"ph\":\"C\",\"ts\":" << timestamp
+         << ",\"pid\":" << getpid() << ",\"args\":"
+         << TraceArgs()( "peak_rss_mb", peak_rss_mb ).str() << "}";
+  append( memory.str() );
+
+  // Bytes that actually reached the storage layer. Only Linux reports
+  // these.
+  std::ifstream io( "/proc/self/io" );
+  if ( !io )
+    return;
+  TraceArgs io_args;
+  std::string key;
+  uint64 value;
+  while ( io >> key >> value ) {
+    if ( key == "read_bytes:" )
+      io_args( "read_bytes", double(value) );
+    else if ( key == "write_bytes:" )
+      io_args( "write_bytes", double(value) );
+  }
+  std::ostringstream disk;
+  disk << "{\"name\":\"disk\",\"ph\":\"C\",\"ts\":" << timestamp
+       << ",\"pid\":" << getpid() << ",\"args\":" << io_args.str() << "}";
+  append( disk.str() );
+}
+
+asp::TraceLog& asp::trace_log() {
+  static TraceLog log;
+  return log;
+}
@@ -0,0 +1,154 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file TraceLog.h
+///
+/// Optional performance trace for the stereo tools. When enabled,
+/// events are appended to a file in the Chrome trace event format
+/// (load it in chrome://tracing). Every event records the thread that
+/// produced it, so tiles that dominate the runtime and threads that
+/// sit idle are easy to spot.
+///
+/// Tracing is off unless TraceLog::open is called. The cost of a
+/// disabled trace is an uncontended lock and a branch.
+
+#ifndef __ASP_CORE_TRACELOG_H__
+#define __ASP_CORE_TRACELOG_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/noncopyable.hpp>
+#include <fstream>
+#include <string>
+
+namespace asp {
+
+  // input as the contents of a JSON string, without the quotes.
+  std::string json_escape( std::string const& input );
+
+  // Key / value pairs attached to an event. Built by chaining:
+  //   TraceArgs()("file", name)("bytes", size)
+  class TraceArgs {
+    std::string m_json;
+  public:
+    TraceArgs& operator()( std::string const& key, double value );
+    TraceArgs& operator()( std::string const& key, std::string const& value );
+    TraceArgs& operator()( std::string const& key, vw::BBox2i const& bbox );
+
+    // JSON object holding the arguments.
+    std::string str() const { return "{" + m_json + "}"; }
+  };
+
+  class TraceLog : private boost::noncopyable {
+    std::ofstream m_stream;
+    bool m_enabled, m_first;
+    mutable vw::Mutex m_mutex; // Guards all of the above
+
+    void append( std::string const& event );
+
+  public:
+    TraceLog() : m_enabled(false), m_first(true) {}
+    ~TraceLog() { close(); }
+
+    // Start writing events to filename, replacing what was there.
+    void open( std::string const& filename );
+
+    // Record final process statistics and terminate the JSON array.
+    void close();
+
+    bool enabled() const {
+      vw::Mutex::Lock lock( m_mutex );
+      return m_enabled;
+    }
+
+    // Wall clock time in microseconds.
+    static vw::uint64 now();
+
+    // An event that ran from start for duration microseconds on the
+    // calling thread.
+    void complete( std::string const& name, std::string const& category,
+                   vw::uint64 start, vw::uint64 duration,
+                   TraceArgs const& args = TraceArgs() );
+
+    // Counter events for the peak resident set size and the bytes the
+    // process has read and written so far.
+    void sample_process();
+  };
+
+  // The trace shared by the whole process.
+  TraceLog& trace_log();
+
+  // Records an event covering the lifetime of the object.
+  class TraceScope : private boost::noncopyable {
+    std::string m_name, m_category;
+    vw::uint64 m_start;
+    TraceArgs m_args;
+  public:
+    TraceScope( std::string const& name, std::string const& category ) :
+      m_name(name), m_category(category), m_start(0) {
+      if ( trace_log().enabled() )
+        m_start = TraceLog::now();
+    }
+    ~TraceScope() {
+      if ( trace_log().enabled() )
+        trace_log().complete( m_name, m_category, m_start,
+                              TraceLog::now() - m_start, m_args );
+    }
+    TraceArgs& args() { return m_args; }
+  };
+
+  // Pass-through view that records a "read" event with the pixel bytes
+  // requested from a file each time a region is rasterized.
+  template <class ViewT>
+  class TracedReadView : public vw::ImageViewBase<TracedReadView<ViewT> > {
+    ViewT m_view;
+    std::string m_filename;
+  public:
+    typedef typename ViewT::pixel_type pixel_type;
+    typedef typename ViewT::result_type result_type;
+    typedef typename ViewT::pixel_accessor pixel_accessor;
+
+    TracedReadView( ViewT const& view, std::string const& filename ) :
+      m_view(view), m_filename(filename) {}
+
+    inline vw::int32 cols() const { return m_view.cols(); }
+    inline vw::int32 rows() const { return m_view.rows(); }
+    inline vw::int32 planes() const { return m_view.planes(); }
+
+    inline pixel_accessor origin() const { return m_view.origin(); }
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
+      return m_view(i,j,p);
+    }
+
+    typedef typename ViewT::prerasterize_type prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      if ( !trace_log().enabled() )
+        return m_view.prerasterize( bbox );
+      TraceScope scope( "read", "io" );
+      scope.args()( "file", m_filename )( "bbox", bbox )
+        ( "bytes", double(bbox.width()) * bbox.height() * planes() *
+          sizeof(pixel_type) );
+      return m_view.prerasterize( bbox );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  template <class ViewT>
+  TracedReadView<ViewT> trace_read( vw::ImageViewBase<ViewT> const& view,
+                                    std::string const& filename ) {
+    return TracedReadView<ViewT>( view.impl(), filename );
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_TRACELOG_H__
@@ -0,0 +1,157 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/AffineSubpixel.h>
+#include <vw/Stereo.h>
+
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+  // Smooth texture, and the same texture moved by (3.3,-0.8).
+  float texture( double x, double y ) {
+    return float( sin( 0.31 * x + 0.17 * y ) + 0.7 * cos( 0.23 * x - 0.41 * y ) +
+                  0.5 * sin( 0.1 * x + 0.53 * y + 1 ) + 0.3 * cos( 0.35 * x + 0.05 * y ) );
+  }
+
+  struct Pair {
+    ImageView<PixelGray<float> > left, right;
+    ImageView<PixelMask<Vector2f> > disparity;
+
+    Pair( int32 cols, int32 rows ) :
+      left( cols, rows ), right( cols, rows ), disparity( cols, rows ) {
+      for ( int32 j = 0; j < rows; j++ )
+        for ( int32 i = 0; i < cols; i++ ) {
+          left(i,j) = texture( i, j );
+          right(i,j) = texture( i - 3.3, j + 0.8 );
+          disparity(i,j) = PixelMask<Vector2f>( Vector2f( 3, -1 ) );
+        }
+    }
+  };
+}
+
+TEST(AffineSubpixel, recovers_subpixel_disparity) {
+  Pair pair( 80, 60 );
+  asp::AffineSubpixelSettings settings;
+  settings.kernel = Vector2i( 15, 15 );
+  ImageView<PixelMask<Vector2f> > refined =
+    asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  // Away from the edges, where windows run off the images.
+  double error = 0;
+  for ( int32 j = 10; j < 50; j++ )
+    for ( int32 i = 10; i < 70; i++ ) {
+      ASSERT_TRUE( is_valid( refined(i,j) ) );
+      EXPECT_NEAR( 3.3, refined(i,j).child().x(), 0.1 );
+      EXPECT_NEAR( -0.8, refined(i,j).child().y(), 0.1 );
+      error += fabs( refined(i,j).child().x() - 3.3 ) + fabs( refined(i,j).child().y() + 0.8 );
+    }
+  EXPECT_LT( error / ( 40 * 60 ), 0.03 );
+}
+
+TEST(AffineSubpixel, one_direction) {
+  Pair pair( 80, 60 );
+  asp::AffineSubpixelSettings settings;
+  settings.kernel = Vector2i( 15, 15 );
+  settings.do_v = false;
+  ImageView<PixelMask<Vector2f> > refined =
+    asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  ASSERT_TRUE( is_valid( refined(40,30) ) );
+  EXPECT_EQ( -1, refined(40,30).child().y() );
+  EXPECT_NEAR( 3.3, refined(40,30).child().x(), 0.1 );
+}
+
+TEST(AffineSubpixel, invalid_pixels) {
+  Pair pair( 80, 60 );
+  invalidate( pair.disparity(40,30) );
+  // Nothing to match with in a flat image.
+  ImageView<PixelGray<float> > flat( 80, 60 );
+  fill( flat, PixelGray<float>( 1 ) );
+  asp::AffineSubpixelSettings settings;
+  settings.kernel = Vector2i( 15, 15 );
+  ImageView<PixelMask<Vector2f> > refined =
+    asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  EXPECT_FALSE( is_valid( refined(40,30) ) );
+  EXPECT_TRUE( is_valid( refined(41,30) ) );
+  refined = asp::AffineSubpixelView( pair.disparity, flat, flat, settings );
+  EXPECT_FALSE( is_valid( refined(20,30) ) );
+}
+
+TEST(AffineSubpixel, early_exit) {
+  Pair pair( 80, 60 );
+  asp::AffineSubpixelSettings settings;
+  settings.kernel = Vector2i( 15, 15 );
+  settings.max_iterations = 10;
+  uint64 pixels[2] = { 0, 0 }, steps[2] = { 0, 0 };
+  ImageView<PixelMask<Vector2f> > refined[2];
+  for ( int32 k = 0; k < 2; k++ ) {
+    settings.tolerance = k ? 0.01f : 0.0f;
+    boost::shared_ptr<asp::IterationHistogram> histogram( new asp::IterationHistogram() );
+    refined[k] = asp::AffineSubpixelView( pair.disparity, pair.left, pair.right,
+                                          settings, histogram );
+    std::vector<uint64> counts = histogram->counts();
+    ASSERT_GE( 11u, counts.size() );
+    for ( size_t n = 0; n < counts.size(); n++ ) {
+      pixels[k] += counts[n];
+      steps[k] += n * counts[n];
+    }
+  }
+  EXPECT_EQ( 80u * 60u, pixels[0] );
+  EXPECT_EQ( 80u * 60u, pixels[1] );
+
+  // Most pixels converge long before the budget runs out, to the same
+  // disparity.
+  EXPECT_LT( steps[1], steps[0] * 7 / 10 );
+  ASSERT_TRUE( is_valid( refined[1](40,30) ) );
+  EXPECT_NEAR( refined[0](40,30).child().x(), refined[1](40,30).child().x(), 0.02 );
+  EXPECT_NEAR( refined[0](40,30).child().y(), refined[1](40,30).child().y(), 0.02 );
+}
+
+TEST(AffineSubpixel, max_move) {
+  Pair pair( 80, 60 );
+  asp::AffineSubpixelSettings settings;
+  settings.kernel = Vector2i( 15, 15 );
+  // Starting from (6,-1), the match at (3.3,-0.8) is 2.7 pixels away.
+  fill( pair.disparity, PixelMask<Vector2f>( Vector2f( 6, -1 ) ) );
+  ImageView<PixelMask<Vector2f> > refined =
+    asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  EXPECT_FALSE( is_valid( refined(40,30) ) );
+  settings.max_move = 0;
+  settings.max_iterations = 20;
+  refined = asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  ASSERT_TRUE( is_valid( refined(40,30) ) );
+  EXPECT_NEAR( 3.3, refined(40,30).child().x(), 0.1 );
+
+  // A limit under the move from the integer disparity.
+  fill( pair.disparity, PixelMask<Vector2f>( Vector2f( 3, -1 ) ) );
+  settings.max_move = 0.25f;
+  refined = asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  EXPECT_FALSE( is_valid( refined(40,30) ) );
+}
+
+TEST(AffineSubpixel, matches_vw_affine_mode) {
+  Pair pair( 80, 60 );
+  asp::AffineSubpixelSettings settings;
+  settings.kernel = Vector2i( 15, 15 );
+  settings.max_iterations = 10;
+  settings.tolerance = 0;
+  ImageView<PixelMask<Vector2f> > refined =
+    asp::AffineSubpixelView( pair.disparity, pair.left, pair.right, settings );
+  ImageView<PixelMask<Vector2f> > reference =
+    stereo::subpixel_refine( pair.disparity, pair.left, pair.right, 15, 15, true, true, 2,
+                             stereo::NullStereoPreprocessingFilter() );
+  for ( int32 j = 10; j < 50; j++ )
+    for ( int32 i = 10; i < 70; i++ ) {
+      ASSERT_TRUE( is_valid( reference(i,j) ) );
+      ASSERT_TRUE( is_valid( refined(i,j) ) );
+      EXPECT_NEAR( reference(i,j).child().x(), refined(i,j).child().x(), 0.05 );
+      EXPECT_NEAR( reference(i,j).child().y(), refined(i,j).child().y(), 0.05 );
+    }
+}
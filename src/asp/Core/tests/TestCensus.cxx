@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/Census.h>
+
+#include <vector>
+
+using namespace vw;
+
+TEST(Census, transform) {
+  // Brighter to the right: the neighbors in the three columns left of
+  // the center are darker, and so are the three to its left in the
+  // center row.
+  ImageView<PixelGray<float> > image( 9, 8 );
+  for ( int32 j = 0; j < image.rows(); j++ )
+    for ( int32 i = 0; i < image.cols(); i++ )
+      image(i,j) = float( i );
+  ImageView<asp::CensusSignature> census = asp::census_transform( image );
+  ASSERT_EQ( 3, census.cols() );
+  ASSERT_EQ( 2, census.rows() );
+  EXPECT_EQ( 21, asp::popcount( census(0,0) ) );
+  EXPECT_EQ( census(0,0), census(2,1) );
+
+  // Only the order of intensities counts.
+  ImageView<PixelGray<float> > brighter( 9, 8 );
+  for ( int32 j = 0; j < image.rows(); j++ )
+    for ( int32 i = 0; i < image.cols(); i++ )
+      brighter(i,j) = 0.5f * image(i,j).v() + 3;
+  EXPECT_EQ( census(1,1), asp::census_transform( brighter )(1,1) );
+}
+
+TEST(Census, hamming_distance) {
+  asp::CensusSignature a[] = { 0, 0xffULL, 0xffffffffffffffffULL, 0x8000000000000001ULL };
+  asp::CensusSignature b[] = { 0, 0x0fULL, 0, 0x1ULL };
+  uint8 distance[4];
+  asp::hamming_distance( a, b, distance, 4 );
+  EXPECT_EQ( 0, distance[0] );
+  EXPECT_EQ( 4, distance[1] );
+  EXPECT_EQ( 64, distance[2] );
+  EXPECT_EQ( 1, distance[3] );
+}
+
+TEST(Census, hamming_distance_matches_popcount) {
+  std::vector<asp::CensusSignature> a( 1000 ), b( 1000 );
+  asp::CensusSignature x = 0x9e3779b97f4a7c15ULL;
+  for ( size_t i = 0; i < a.size(); i++ ) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    a[i] = x;
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    b[i] = x >> ( i % 64 );
+  }
+  std::vector<uint8> distance( a.size() );
+  asp::hamming_distance( &a[0], &b[0], &distance[0], a.size() );
+  for ( size_t i = 0; i < a.size(); i++ ) {
+    int bits = 0;
+    for ( int k = 0; k < 64; k++ )
+      bits += ( ( a[i] ^ b[i] ) >> k ) & 1;
+    ASSERT_EQ( bits, distance[i] );
+    ASSERT_EQ( bits, asp::popcount( a[i] ^ b[i] ) );
+  }
+}
@@ -0,0 +1,43 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/DemSeed.h>
+
+using namespace vw;
+
+TEST(DemSeed, builder) {
+  // A 10x8 seed for an 80x64 image.
+  asp::DisparitySeedBuilder builder( Vector2i( 10, 8 ), 0.125 );
+  builder.add( Vector2( 4, 4 ), Vector2( 12, 5 ) );
+  builder.add( Vector2( 6, 2 ), Vector2( 30, 3 ) );
+  builder.add( Vector2( 20, 60 ), Vector2( 12, 60 ) );
+  // Off the left image, so nowhere in the seed.
+  builder.add( Vector2( -1, 4 ), Vector2( 12, 5 ) );
+  builder.add( Vector2( 4, 64 ), Vector2( 12, 5 ) );
+
+  ImageView<PixelMask<Vector2f> > seed = builder.seed();
+  ASSERT_EQ( 10, seed.cols() );
+  ASSERT_EQ( 8, seed.rows() );
+
+  // Mean of the two points in the first seed pixel, in seed pixels.
+  ASSERT_TRUE( is_valid( seed(0,0) ) );
+  EXPECT_NEAR( 2, seed(0,0).child().x(), 1e-6 );
+  EXPECT_NEAR( 0.125, seed(0,0).child().y(), 1e-6 );
+  ASSERT_TRUE( is_valid( seed(2,7) ) );
+  EXPECT_NEAR( -1, seed(2,7).child().x(), 1e-6 );
+  EXPECT_NEAR( 0, seed(2,7).child().y(), 1e-6 );
+
+  size_t valid = 0;
+  for ( int32 j = 0; j < seed.rows(); j++ )
+    for ( int32 i = 0; i < seed.cols(); i++ )
+      if ( is_valid( seed(i,j) ) )
+        valid++;
+  EXPECT_EQ( 2u, valid );
+}
@@ -0,0 +1,122 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/ImagePyramid.h>
+#include <asp/Core/Common.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+
+using namespace vw;
+
+namespace {
+  // Pixel value i + 100 j, so that averaging 2x2 blocks gives the value
+  // at the middle of the block.
+  void write_ramp( std::string const& filename, int32 cols, int32 rows ) {
+    ImageView<PixelGray<float> > image( cols, rows );
+    for ( int32 j = 0; j < rows; j++ )
+      for ( int32 i = 0; i < cols; i++ )
+        image(i,j) = i + 100.0f * j;
+    asp::BaseOptions opt;
+    opt.raster_tile_size = Vector2i( 32, 32 );
+    asp::block_write_gdal_image( filename, image, opt );
+  }
+}
+
+TEST(ImagePyramid, levels) {
+  EXPECT_EQ( 0, asp::pyramid_levels( Vector2i( 200, 100 ) ) );
+  EXPECT_EQ( 1, asp::pyramid_levels( Vector2i( 300, 100 ) ) );
+  EXPECT_EQ( 3, asp::pyramid_levels( Vector2i( 100, 2048 ) ) );
+  EXPECT_EQ( 2, asp::pyramid_levels( Vector2i( 64, 16 ), 16 ) );
+}
+
+TEST(ImagePyramid, overviews) {
+  test::UnlinkName file( "pyramid.tif" );
+  write_ramp( file, 64, 48 );
+  EXPECT_EQ( 0, asp::overview_count( file ) );
+  asp::build_overviews( file, 2 );
+  EXPECT_EQ( 2, asp::overview_count( file ) );
+
+  asp::ImagePyramid pyramid( file );
+  ASSERT_EQ( 3, pyramid.levels() );
+  EXPECT_EQ( Vector2i( 32, 24 ), pyramid.size( 1 ) );
+  EXPECT_EQ( Vector2i( 16, 12 ), pyramid.size( 2 ) );
+  EXPECT_EQ( 0, pyramid.level_for_scale( 0.6 ) );
+  EXPECT_EQ( 1, pyramid.level_for_scale( 0.5 ) );
+  EXPECT_EQ( 2, pyramid.level_for_scale( 0.1 ) );
+
+  ImageView<PixelGray<float> > full = pyramid.level( 0 ), half = pyramid.level( 1 );
+  EXPECT_EQ( 64, full.cols() );
+  EXPECT_NEAR( 5 + 100 * 3, full(5,3).v(), 1e-3 );
+  ASSERT_EQ( 32, half.cols() );
+  ASSERT_EQ( 24, half.rows() );
+  EXPECT_NEAR( 2 * 5 + 0.5 + 100 * ( 2 * 3 + 0.5 ), half(5,3).v(), 1e-3 );
+
+  // Lazy levels read the same pixels, and nothing outside the image.
+  asp::ImagePyramid uncached( file, 0 );
+  ImageView<PixelGray<float> > lazy = crop( edge_extend( uncached.level( 1 ), ZeroEdgeExtension() ),
+                                            BBox2i( 28, 20, 8, 8 ) );
+  EXPECT_NEAR( half(30,22).v(), lazy(2,2).v(), 1e-3 );
+  EXPECT_EQ( 0, lazy(6,6).v() );
+
+  EXPECT_THROW( pyramid.level( 3 ), ArgumentErr );
+}
+
+TEST(ImagePyramid, fixed_point) {
+  // Values from -0.9 to 1.9, as normalizing to a few standard
+  // deviations gives, and a zero pixel for nodata.
+  ImageView<PixelGray<float> > image( 64, 8 );
+  for ( int32 j = 0; j < image.rows(); j++ )
+    for ( int32 i = 0; i < image.cols(); i++ )
+      image(i,j) = -0.9f + 2.8f * ( i + 64 * j ) / ( 64 * 8 - 1 );
+  image(10,3) = 0;
+
+  asp::BaseOptions opt;
+  opt.raster_tile_size = Vector2i( 32, 32 );
+  test::UnlinkName float_file( "float.tif" ), fixed_file( "fixed.tif" );
+  asp::block_write_gdal_image( float_file, image, opt );
+  const double scale = 3.0 / 65534, offset = -1 - scale;
+  asp::block_write_gdal_image( fixed_file, asp::to_fixed_point( image, offset, scale ), opt );
+  asp::write_value_scaling( fixed_file, offset, scale );
+
+  ImageView<PixelGray<float> > from_float = asp::read_float_image( float_file ),
+    from_fixed = asp::read_float_image( fixed_file ),
+    level = asp::ImagePyramid( fixed_file ).level( 0 );
+  for ( int32 j = 0; j < image.rows(); j++ )
+    for ( int32 i = 0; i < image.cols(); i++ ) {
+      ASSERT_NEAR( from_float(i,j).v(), from_fixed(i,j).v(), scale );
+      EXPECT_EQ( from_fixed(i,j).v(), level(i,j).v() );
+      // Only the nodata pixel reads back as zero.
+      EXPECT_EQ( i == 10 && j == 3, from_fixed(i,j).v() == 0 );
+    }
+  EXPECT_NEAR( -0.9, from_fixed(0,0).v(), scale );
+  EXPECT_NEAR( 1.9, from_fixed(63,7).v(), scale );
+}
+
+TEST(ImagePyramid, shared) {
+  test::UnlinkName file( "shared.tif" ), other( "other.tif" );
+  write_ramp( file, 64, 48 );
+  write_ramp( other, 32, 32 );
+  EXPECT_EQ( 1, asp::shared_pyramid( file ).levels() );
+
+  // New overviews change the file, so it is opened again.
+  asp::build_overviews( file, 2 );
+  asp::ImagePyramid pyramid = asp::shared_pyramid( file );
+  ASSERT_EQ( 3, pyramid.levels() );
+
+  // With room for one pyramid, another file pushes it out, and it is
+  // read again from the file next time.
+  EXPECT_EQ( 1, asp::shared_pyramid( other, 1 ).levels() );
+  pyramid = asp::shared_pyramid( file, 1 );
+  ASSERT_EQ( 3, pyramid.levels() );
+  ImageView<PixelGray<float> > half = pyramid.level( 1 );
+  EXPECT_NEAR( 2 * 5 + 0.5 + 100 * ( 2 * 3 + 0.5 ), half(5,3).v(), 1e-3 );
+
+  EXPECT_THROW( asp::shared_pyramid( "missing.tif" ), IOErr );
+}
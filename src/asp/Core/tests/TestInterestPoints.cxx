@@ -0,0 +1,161 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/InterestPoints.h>
+#include <vw/InterestPoint.h>
+#include <boost/foreach.hpp>
+
+#include <cstdlib>
+#include <map>
+#include <set>
+
+using namespace vw;
+
+namespace {
+  // Gaussian blobs of a few sizes on a regular grid.
+  asp::IpImage blob_image() {
+    asp::IpImage image( 256, 256 );
+    for ( int32 j = 0; j < image.rows(); j++ )
+      for ( int32 i = 0; i < image.cols(); i++ ) {
+        float value = 0;
+        for ( int32 by = 24; by < 256; by += 48 )
+          for ( int32 bx = 24; bx < 256; bx += 48 ) {
+            float sigma = 3 + ( bx + by ) % 5;
+            float d2 = float( ( i - bx ) * ( i - bx ) + ( j - by ) * ( j - by ) );
+            value += exp( -d2 / ( 2 * sigma * sigma ) );
+          }
+        image(i,j) = value;
+      }
+    return image;
+  }
+
+  std::set<std::pair<int32,int32> > locations( ip::InterestPointList const& points ) {
+    std::set<std::pair<int32,int32> > result;
+    BOOST_FOREACH( ip::InterestPoint const& ip, points )
+      result.insert( std::make_pair( ip.ix, ip.iy ) );
+    return result;
+  }
+}
+
+TEST(InterestPoints, tiles_match_whole_image) {
+  std::vector<asp::IpImage> images( 1, blob_image() );
+  std::vector<ip::InterestPointList> whole =
+    asp::detect_interest_points_tiled( images, 0.01, 256, 0, 1 );
+  // Every tile reads the whole image, so the tiles only decide which
+  // of them reports a point.
+  std::vector<ip::InterestPointList> tiled =
+    asp::detect_interest_points_tiled( images, 0.01, 64, 256, 4 );
+  ASSERT_EQ( 1u, tiled.size() );
+  EXPECT_LT( 0u, whole[0].size() );
+  EXPECT_EQ( whole[0].size(), tiled[0].size() );
+  EXPECT_TRUE( locations( whole[0] ) == locations( tiled[0] ) );
+}
+
+TEST(InterestPoints, default_margin_matches_whole_image) {
+  std::vector<asp::IpImage> images( 1, blob_image() );
+  std::vector<ip::InterestPointList> whole =
+    asp::detect_interest_points_tiled( images, 0.01, 256, 0, 1 );
+  // Small tiles, so most blobs are within the margin of a tile edge.
+  std::vector<ip::InterestPointList> tiled =
+    asp::detect_interest_points_tiled( images, 0.01, 32, asp::interest_point_margin(), 4 );
+  ASSERT_EQ( 1u, tiled.size() );
+  EXPECT_LT( 0u, whole[0].size() );
+  EXPECT_EQ( whole[0].size(), tiled[0].size() );
+  EXPECT_TRUE( locations( whole[0] ) == locations( tiled[0] ) );
+
+  std::map<std::pair<int32,int32>,float> interest;
+  BOOST_FOREACH( ip::InterestPoint const& ip, whole[0] )
+    interest[std::make_pair( ip.ix, ip.iy )] = ip.interest;
+  BOOST_FOREACH( ip::InterestPoint const& ip, tiled[0] )
+    EXPECT_NEAR( interest[std::make_pair( ip.ix, ip.iy )], ip.interest, 1e-5 );
+}
+
+TEST(InterestPoints, threshold) {
+  ip::InterestPointList points;
+  float interest[] = { 0.5, -0.2, 0.05, -0.01 };
+  for ( size_t i = 0; i < 4; i++ ) {
+    points.push_back( ip::InterestPoint( i, i ) );
+    points.back().interest = interest[i];
+  }
+  EXPECT_EQ( 3u, asp::count_interest_points( points, 0.02 ) );
+  asp::threshold_interest_points( points, 0.1 );
+  ASSERT_EQ( 2u, points.size() );
+  EXPECT_EQ( 0.5, points.front().interest );
+  EXPECT_EQ( -0.2f, points.back().interest );
+}
+
+namespace {
+  // Points whose descriptors are those of base plus a little noise.
+  std::vector<ip::InterestPoint> random_points( size_t count, size_t dims, float noise,
+                                                std::vector<ip::InterestPoint> const& base =
+                                                std::vector<ip::InterestPoint>() ) {
+    std::vector<ip::InterestPoint> points( count );
+    for ( size_t i = 0; i < count; i++ ) {
+      points[i] = ip::InterestPoint( i, i );
+      points[i].descriptor.set_size( dims );
+      for ( size_t k = 0; k < dims; k++ ) {
+        float r = float( rand() ) / RAND_MAX;
+        points[i].descriptor[k] = base.empty() ? r : base[i].descriptor[k] + noise * ( r - 0.5 );
+      }
+    }
+    return points;
+  }
+
+  size_t brute_force_match( ip::InterestPoint const& query,
+                            std::vector<ip::InterestPoint> const& points, double ratio ) {
+    float dist[2] = { 1e30f, 1e30f };
+    size_t best = 0;
+    for ( size_t j = 0; j < points.size(); j++ ) {
+      float d = norm_2_sqr( query.descriptor - points[j].descriptor );
+      if ( d < dist[0] ) {
+        dist[1] = dist[0]; dist[0] = d; best = j;
+      } else if ( d < dist[1] ) {
+        dist[1] = d;
+      }
+    }
+    return dist[0] < ratio * dist[1] ? best : points.size();
+  }
+}
+
+TEST(InterestPoints, exhaustive_match_is_brute_force) {
+  srand( 7 );
+  std::vector<ip::InterestPoint> ip2 = random_points( 500, 16, 0 );
+  std::vector<ip::InterestPoint> ip1 = random_points( 200, 16, 0 );
+  std::vector<ip::InterestPoint> matched1, matched2;
+  asp::match_interest_points( ip1, ip2, matched1, matched2, 0.8, 0, 4 );
+  ASSERT_EQ( matched1.size(), matched2.size() );
+
+  size_t expected = 0, m = 0;
+  for ( size_t i = 0; i < ip1.size(); i++ ) {
+    size_t j = brute_force_match( ip1[i], ip2, 0.8 );
+    if ( j == ip2.size() )
+      continue;
+    expected++;
+    ASSERT_LT( m, matched1.size() );
+    EXPECT_EQ( ip1[i].x, matched1[m].x );
+    EXPECT_EQ( ip2[j].x, matched2[m].x );
+    m++;
+  }
+  EXPECT_LT( 0u, expected );
+  EXPECT_EQ( expected, matched1.size() );
+}
+
+TEST(InterestPoints, bounded_match) {
+  srand( 11 );
+  std::vector<ip::InterestPoint> ip2 = random_points( 5000, 42, 0 );
+  std::vector<ip::InterestPoint> ip1 = random_points( 5000, 42, 0.05, ip2 );
+  std::vector<ip::InterestPoint> matched1, matched2;
+  asp::match_interest_points( ip1, ip2, matched1, matched2, 0.6 );
+  size_t correct = 0;
+  for ( size_t i = 0; i < matched1.size(); i++ )
+    if ( matched1[i].x == matched2[i].x )
+      correct++;
+  EXPECT_LT( 4900u, correct );
+}
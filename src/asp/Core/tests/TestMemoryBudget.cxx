@@ -0,0 +1,63 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/MemoryBudget.h>
+
+using namespace vw;
+
+TEST(MemoryBudget, tile_cost) {
+  asp::TileCost cost( 4, 8, 100 );
+  EXPECT_DOUBLE_EQ( 4.0 * 32 * 32 + 100, cost.bytes( 16 ) );
+
+  cost += asp::TileCost( 2, 3, 10 );
+  EXPECT_DOUBLE_EQ( 6, cost.bytes_per_pixel );
+  EXPECT_EQ( 8, cost.halo );
+  EXPECT_DOUBLE_EQ( 110, cost.fixed_bytes );
+}
+
+TEST(MemoryBudget, plan_tiles) {
+  // Without a halo every tile size is equally efficient, so all the
+  // threads are used with the largest tile that fits.
+  asp::TilePlan plan = asp::plan_tiles( asp::TileCost( 4 ), 8 * 4.0 * 256 * 256, 8, 1024 );
+  EXPECT_EQ( 256, plan.tile_size );
+  EXPECT_EQ( 8u, plan.num_threads );
+  EXPECT_LE( plan.num_threads * plan.bytes_per_thread, 8 * 4.0 * 256 * 256 );
+
+  // Plenty of memory: the tile is capped and threads are capped.
+  plan = asp::plan_tiles( asp::TileCost( 4 ), 1e12, 4, 512 );
+  EXPECT_EQ( 512, plan.tile_size );
+  EXPECT_EQ( 4u, plan.num_threads );
+
+  // A large halo makes small tiles wasteful, so fewer threads on
+  // bigger tiles win.
+  asp::TileCost halo_cost( 1, 256 );
+  double budget = 4 * halo_cost.bytes( 64 );
+  plan = asp::plan_tiles( halo_cost, budget, 4, 1024 );
+  EXPECT_GT( plan.tile_size, 64 );
+  EXPECT_LT( plan.num_threads, 4u );
+  EXPECT_LE( plan.num_threads * plan.bytes_per_thread, budget );
+
+  // Nothing fits: fall back to one thread on the smallest tile.
+  plan = asp::plan_tiles( asp::TileCost( 4 ), 10, 8, 1024 );
+  EXPECT_EQ( 64, plan.tile_size );
+  EXPECT_EQ( 1u, plan.num_threads );
+}
+
+TEST(MemoryBudget, stage_options) {
+  asp::BaseOptions opt;
+  opt.raster_tile_size = Vector2i( 256, 256 );
+  opt.num_threads = 2;
+  opt.memory_limit_mb = 64;
+  asp::TilePlan plan = asp::plan_stage_tiles( "Test", asp::TileCost( 16 ), opt, 4096 );
+  asp::BaseOptions stage_opt = asp::stage_options( opt, plan );
+  EXPECT_EQ( Vector2i( plan.tile_size, plan.tile_size ), stage_opt.raster_tile_size );
+  // The plan stays with the stage.
+  EXPECT_EQ( Vector2i( 256, 256 ), opt.raster_tile_size );
+}
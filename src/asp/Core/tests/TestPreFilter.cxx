@@ -0,0 +1,109 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/PreFilter.h>
+#include <asp/Core/SemiGlobalMatching.h>
+#include <vw/Stereo.h>
+
+#include <cstdlib>
+
+using namespace vw;
+
+namespace {
+  // Random texture, and the same texture moved by (4,1).
+  struct Pair {
+    ImageView<PixelGray<float> > left, right;
+    ImageView<uint8> left_mask, right_mask;
+
+    Pair( int32 cols, int32 rows ) :
+      left( cols, rows ), right( cols, rows ), left_mask( cols, rows ), right_mask( cols, rows ) {
+      srand( 7 );
+      ImageView<float> texture( cols + 20, rows + 20 );
+      for ( int32 j = 0; j < texture.rows(); j++ )
+        for ( int32 i = 0; i < texture.cols(); i++ )
+          texture(i,j) = float( rand() ) / RAND_MAX;
+      for ( int32 j = 0; j < rows; j++ )
+        for ( int32 i = 0; i < cols; i++ ) {
+          left(i,j) = texture(i + 10, j + 10);
+          right(i,j) = texture(i + 10 - 4, j + 10 - 1);
+          left_mask(i,j) = right_mask(i,j) = 255;
+        }
+    }
+  };
+
+  // The full resolution correlator, as --optimized-correlator runs it.
+  template <class FilterT>
+  ImageView<PixelMask<Vector2f> >
+  correlate( ImageViewRef<PixelGray<float> > const& left,
+             ImageViewRef<PixelGray<float> > const& right,
+             Pair const& pair, FilterT const& filter ) {
+    stereo::CorrelatorView<PixelGray<float>, uint8, FilterT>
+      corr_view( left, right, pair.left_mask, pair.right_mask, filter, false );
+    corr_view.set_search_range( BBox2i( 0, -2, 8, 4 ) );
+    corr_view.set_kernel_size( Vector2i( 9, 9 ) );
+    return corr_view;
+  }
+
+  // Disparities away from the edges, where the filters see different
+  // edge extensions.
+  void expect_same( ImageView<PixelMask<Vector2f> > const& a,
+                    ImageView<PixelMask<Vector2f> > const& b ) {
+    ASSERT_EQ( a.cols(), b.cols() );
+    ASSERT_EQ( a.rows(), b.rows() );
+    int32 valid = 0;
+    for ( int32 j = 12; j < a.rows() - 12; j++ )
+      for ( int32 i = 12; i < a.cols() - 12; i++ ) {
+        ASSERT_EQ( is_valid( a(i,j) ), is_valid( b(i,j) ) ) << i << " " << j;
+        if ( !is_valid( a(i,j) ) )
+          continue;
+        valid++;
+        EXPECT_EQ( a(i,j).child(), b(i,j).child() ) << i << " " << j;
+      }
+    EXPECT_GT( valid, 0 );
+  }
+}
+
+TEST(PreFilter, cached_images_match_correlator_filters) {
+  Pair pair( 80, 60 );
+  const float width = 1.5;
+  // Filtering the whole image first, as PREFILTER_CACHE does, gives
+  // the disparities of filtering each tile in the correlator.
+  for ( int mode = 1; mode <= 3; mode++ ) {
+    ImageView<PixelGray<float> > left = asp::preprocessing_filter( pair.left, mode, width ),
+      right = asp::preprocessing_filter( pair.right, mode, width );
+    ImageView<PixelMask<Vector2f> > cached =
+      correlate( left, right, pair, stereo::NullStereoPreprocessingFilter() );
+    ImageView<PixelMask<Vector2f> > direct;
+    if ( mode == 3 )
+      direct = correlate( pair.left, pair.right, pair, stereo::SlogStereoPreprocessingFilter( width ) );
+    else if ( mode == 2 )
+      direct = correlate( pair.left, pair.right, pair, stereo::LogStereoPreprocessingFilter( width ) );
+    else
+      direct = correlate( pair.left, pair.right, pair, stereo::BlurStereoPreprocessingFilter( width ) );
+    SCOPED_TRACE( mode );
+    expect_same( direct, cached );
+  }
+}
+
+TEST(PreFilter, cached_images_match_sgm) {
+  Pair pair( 80, 60 );
+  asp::SgmSettings settings;
+  settings.kernel = Vector2i( 5, 5 );
+  BBox2i range( 0, -2, 8, 4 );
+  ImageView<PixelMask<Vector2f> > direct =
+    asp::SemiGlobalMatchingView( asp::preprocessing_filter( pair.left, 2, 1.5 ),
+                                 asp::preprocessing_filter( pair.right, 2, 1.5 ),
+                                 pair.left_mask, pair.right_mask, range, settings );
+  ImageView<PixelGray<float> > left = asp::preprocessing_filter( pair.left, 2, 1.5 ),
+    right = asp::preprocessing_filter( pair.right, 2, 1.5 );
+  ImageView<PixelMask<Vector2f> > cached =
+    asp::SemiGlobalMatchingView( left, right, pair.left_mask, pair.right_mask, range, settings );
+  expect_same( direct, cached );
+}
@@ -0,0 +1,53 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/SearchRangeSeed.h>
+
+using namespace vw;
+
+namespace {
+  // A 10x10 seed for an 80x80 image. The left half moved by one seed
+  // pixel, the right half by five, and the bottom three rows have no
+  // matches.
+  ImageView<PixelMask<Vector2f> > seed_image() {
+    ImageView<PixelMask<Vector2f> > seed( 10, 10 );
+    for ( int32 j = 0; j < seed.rows(); j++ )
+      for ( int32 i = 0; i < seed.cols(); i++ ) {
+        seed(i,j) = PixelMask<Vector2f>( Vector2f( i < 5 ? 1 : 5, 0 ) );
+        if ( j >= 7 )
+          invalidate( seed(i,j) );
+      }
+    return seed;
+  }
+}
+
+TEST(SearchRangeSeed, per_tile_range) {
+  BBox2i limit( -100, -10, 200, 20 );
+  asp::SearchRangeSeed seed( seed_image(), 0.125, limit, 0 );
+  EXPECT_NEAR( 0.7, seed.coverage(), 1e-6 );
+
+  // Two seed pixels of margin are 16 full resolution pixels. The
+  // vertical range is cropped to the limit.
+  EXPECT_EQ( BBox2i( Vector2i(-8,-10), Vector2i(24,10) ),
+             seed.search_range( BBox2i(0,0,16,16) ) );
+
+  // Next to the step the tile sees both sides.
+  EXPECT_EQ( BBox2i( Vector2i(-8,-10), Vector2i(56,10) ),
+             seed.search_range( BBox2i(32,0,16,16) ) );
+
+  // Only unmatched rows lie under this tile.
+  EXPECT_EQ( limit, seed.search_range( BBox2i(0,76,16,4) ) );
+}
+
+TEST(SearchRangeSeed, margin) {
+  asp::SearchRangeSeed seed( seed_image(), 0.125, BBox2i(-1000,-1000,2000,2000), 5 );
+  EXPECT_EQ( BBox2i( Vector2i(19,-21), Vector2i(61,21) ),
+             seed.search_range( BBox2i(64,0,16,16) ) );
+}
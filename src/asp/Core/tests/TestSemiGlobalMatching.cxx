@@ -0,0 +1,223 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/SemiGlobalMatching.h>
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+
+namespace {
+  // Random texture, and the same texture seen with the left part of
+  // the image moved by (3,1) and the right part by (7,1).
+  struct Pair {
+    ImageView<PixelGray<float> > left, right;
+    ImageView<uint8> left_mask, right_mask;
+
+    Pair( int32 cols, int32 rows, float gain = 1, float bias = 0 ) :
+      left( cols, rows ), right( cols, rows ), left_mask( cols, rows ), right_mask( cols, rows ) {
+      srand( 5 );
+      ImageView<float> texture( cols + 20, rows + 20 );
+      for ( int32 j = 0; j < texture.rows(); j++ )
+        for ( int32 i = 0; i < texture.cols(); i++ )
+          texture(i,j) = float( rand() ) / RAND_MAX;
+      for ( int32 j = 0; j < rows; j++ )
+        for ( int32 i = 0; i < cols; i++ ) {
+          left(i,j) = texture(i + 10, j + 10);
+          right(i,j) = gain * texture(i + 10 - disparity(i), j + 10 - 1) + bias;
+          left_mask(i,j) = right_mask(i,j) = 255;
+        }
+    }
+
+    static int32 disparity( int32 i ) { return i < 100 ? 3 : 7; }
+  };
+
+  double fraction_correct( ImageView<PixelMask<Vector2f> > const& disparity ) {
+    double correct = 0, count = 0;
+    // Leave out the step between the two parts and the right edge,
+    // where the right image has no match.
+    for ( int32 j = 2; j < disparity.rows() - 2; j++ )
+      for ( int32 i = 2; i < disparity.cols() - 10; i++ ) {
+        if ( i > 92 && i < 108 )
+          continue;
+        count++;
+        if ( is_valid( disparity(i,j) ) &&
+             disparity(i,j).child() == Vector2f( Pair::disparity(i), 1 ) )
+          correct++;
+      }
+    return correct / count;
+  }
+}
+
+TEST(SemiGlobalMatching, recovers_disparity) {
+  Pair pair( 200, 120 );
+  asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                   BBox2i( Vector2i( -2, -2 ), Vector2i( 10, 3 ) ) );
+  ImageView<PixelMask<Vector2f> > disparity = sgm;
+  EXPECT_LT( 0.98, fraction_correct( disparity ) );
+}
+
+TEST(SemiGlobalMatching, contrast) {
+  // Uniform noise has a deviation of 1 / sqrt(12).
+  Pair pair( 200, 120 );
+  EXPECT_NEAR( 1 / sqrt( 12.0 ), asp::sgm_contrast( pair.left, pair.left_mask ), 0.01 );
+  EXPECT_NEAR( 1 / sqrt( 12.0 ), asp::sgm_contrast( pair.left, pair.left_mask, 4 ), 0.02 );
+
+  // The view measures the whole image once for all of its blocks.
+  asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                   BBox2i( Vector2i( -2, -2 ), Vector2i( 10, 3 ) ) );
+  EXPECT_EQ( asp::sgm_contrast( pair.left, pair.left_mask ), sgm.settings().contrast );
+
+  // Masked pixels don't count.
+  for ( int32 j = 0; j < 120; j++ )
+    for ( int32 i = 0; i < 100; i++ ) {
+      pair.left(i,j) = 10;
+      pair.left_mask(i,j) = 0;
+    }
+  EXPECT_NEAR( 1 / sqrt( 12.0 ), asp::sgm_contrast( pair.left, pair.left_mask ), 0.015 );
+}
+
+TEST(SemiGlobalMatching, memory_cap) {
+  Pair pair( 200, 120 );
+  asp::SgmSettings settings;
+  settings.num_paths = 4;
+  settings.overlap = 16;
+  // Room for a 64 pixel square block, so each tile is cut in several.
+  settings.max_volume_bytes = 64 * 64 * 13 * 6 * 3;
+  BBox2i range( Vector2i( -2, -2 ), Vector2i( 10, 3 ) );
+  EXPECT_EQ( settings.max_volume_bytes, asp::sgm_volume_bytes( Vector2i( 64, 64 ), range ) );
+
+  asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                   range, settings );
+  ImageView<PixelMask<Vector2f> > disparity = sgm;
+  EXPECT_LT( 0.98, fraction_correct( disparity ) );
+}
+
+TEST(SemiGlobalMatching, block_bytes) {
+  BBox2i range( Vector2i( -2, -2 ), Vector2i( 10, 3 ) );
+  asp::SgmSettings settings;
+  settings.num_paths = 4;
+  // Two rows of two paths, 78 disparities and a minimum per pixel.
+  size_t path_rows = 2 * 2 * 64 * 79 * 2;
+  EXPECT_EQ( asp::sgm_volume_bytes( Vector2i( 64, 32 ), range ) + path_rows,
+             asp::sgm_block_bytes( Vector2i( 64, 32 ), range, settings ) );
+
+  // The left-right check keeps a cost and a label per right pixel.
+  settings.lr_threshold = 1;
+  EXPECT_EQ( asp::sgm_volume_bytes( Vector2i( 64, 32 ), range ) + path_rows + 76 * 37 * 8,
+             asp::sgm_block_bytes( Vector2i( 64, 32 ), range, settings ) );
+
+  // Block matching has no volume and no paths.
+  settings.num_paths = 0;
+  EXPECT_EQ( 76u * 37 * 8, asp::sgm_block_bytes( Vector2i( 64, 32 ), range, settings ) );
+}
+
+TEST(SemiGlobalMatching, strips) {
+  Pair pair( 200, 120 );
+  asp::SgmSettings settings;
+  settings.num_paths = 4;
+  settings.overlap = 16;
+  // Room for strips of 32 rows across the whole image, which all go
+  // through the same buffers.
+  BBox2i range( Vector2i( -2, -2 ), Vector2i( 10, 3 ) );
+  settings.max_volume_bytes = asp::sgm_block_bytes( Vector2i( 232, 64 ), range, settings );
+
+  asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                   range, settings );
+  ImageView<PixelMask<Vector2f> > disparity = sgm;
+  EXPECT_LT( 0.98, fraction_correct( disparity ) );
+}
+
+TEST(SemiGlobalMatching, masked_pixels) {
+  Pair pair( 200, 120 );
+  for ( int32 j = 40; j < 60; j++ )
+    for ( int32 i = 40; i < 60; i++ )
+      pair.left_mask(i,j) = 0;
+  asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                   BBox2i( Vector2i( -2, -2 ), Vector2i( 10, 3 ) ) );
+  ImageView<PixelMask<Vector2f> > disparity = sgm;
+  EXPECT_FALSE( is_valid( disparity(50,50) ) );
+  EXPECT_TRUE( is_valid( disparity(20,50) ) );
+}
+
+TEST(SemiGlobalMatching, census) {
+  // Census costs don't see a change of gain and bias.
+  Pair pair( 200, 120, 0.5, 0.3 );
+  BBox2i range( Vector2i( -2, -2 ), Vector2i( 10, 3 ) );
+  asp::SgmSettings settings;
+  settings.cost = asp::CENSUS_COST;
+  asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                   range, settings );
+  ImageView<PixelMask<Vector2f> > disparity = sgm;
+  EXPECT_LT( 0.98, fraction_correct( disparity ) );
+
+  // Nor does block matching with them.
+  settings.num_paths = 0;
+  settings.kernel = Vector2i( 9, 9 );
+  asp::SemiGlobalMatchingView block( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                     range, settings );
+  disparity = block;
+  EXPECT_LT( 0.98, fraction_correct( disparity ) );
+}
+
+TEST(SemiGlobalMatching, normalized_cross_correlation) {
+  // NCC doesn't see gain and bias either, and any kernel size costs the
+  // same.
+  Pair pair( 200, 120, 0.5, 0.3 );
+  asp::SgmSettings settings;
+  settings.cost = asp::NCC_COST;
+  settings.num_paths = 0;
+  settings.kernel = Vector2i( 25, 25 );
+  asp::SemiGlobalMatchingView block( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                     BBox2i( Vector2i( -2, -2 ), Vector2i( 10, 3 ) ), settings );
+  ImageView<PixelMask<Vector2f> > disparity = block;
+  // The large kernel straddles the step for longer.
+  double correct = 0, count = 0;
+  for ( int32 j = 14; j < disparity.rows() - 14; j++ )
+    for ( int32 i = 14; i < disparity.cols() - 20; i++ ) {
+      if ( i > 84 && i < 116 )
+        continue;
+      count++;
+      if ( is_valid( disparity(i,j) ) &&
+           disparity(i,j).child() == Vector2f( Pair::disparity(i), 1 ) )
+        correct++;
+    }
+  EXPECT_LT( 0.98, correct / count );
+}
+
+TEST(SemiGlobalMatching, left_right_check) {
+  Pair pair( 200, 120 );
+  BBox2i range( Vector2i( -2, -2 ), Vector2i( 10, 3 ) );
+  asp::SgmSettings settings;
+  settings.lr_threshold = 1;
+  asp::SemiGlobalMatchingView checked( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                       range, settings );
+  ImageView<PixelMask<Vector2f> > disparity = checked;
+  EXPECT_LT( 0.98, fraction_correct( disparity ) );
+
+  // Left pixels with nothing to match in the right image. Most of the
+  // disparities found for them don't survive the check.
+  for ( int32 j = 40; j < 70; j++ )
+    for ( int32 i = 30; i < 60; i++ )
+      pair.left(i,j) = float( rand() ) / RAND_MAX;
+  size_t unchecked_valid = 0, checked_valid = 0;
+  for ( int32 k = 0; k < 2; k++ ) {
+    settings.lr_threshold = k ? 1 : -1;
+    asp::SemiGlobalMatchingView sgm( pair.left, pair.right, pair.left_mask, pair.right_mask,
+                                     range, settings );
+    disparity = sgm;
+    for ( int32 j = 45; j < 65; j++ )
+      for ( int32 i = 35; i < 55; i++ )
+        if ( is_valid( disparity(i,j) ) )
+          ( k ? checked_valid : unchecked_valid )++;
+  }
+  EXPECT_LT( checked_valid, unchecked_valid * 3 / 4 );
+}
@@ -0,0 +1,130 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/StageCache.h>
+#include <boost/filesystem/operations.hpp>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+  void write_text( std::string const& filename, std::string const& text ) {
+    std::ofstream out( filename.c_str() );
+    out << text;
+  }
+}
+
+TEST(StageCache, key) {
+  test::UnlinkName input("stagekey.txt");
+  write_text( input, "abc" );
+  std::string a = asp::StageKey("s").file( input ).value( "k", 1 ).str();
+  EXPECT_EQ( a, asp::StageKey("s").file( input ).value( "k", 1 ).str() );
+  EXPECT_NE( a, asp::StageKey("s").file( input ).value( "k", 2 ).str() );
+  EXPECT_NE( a, asp::StageKey("t").file( input ).value( "k", 1 ).str() );
+  write_text( input, "abd" );
+  EXPECT_NE( a, asp::StageKey("s").file( input ).value( "k", 1 ).str() );
+}
+
+TEST(StageCache, key_covers_whole_file) {
+  test::UnlinkName input("stagekey.bin");
+  std::string content( 1 << 20, 'x' );
+  write_text( input, content );
+  std::string a = asp::StageKey("s").file( input ).str();
+  // Same size, one byte changed far from the start, middle and end.
+  content[100000] = 'y';
+  write_text( input, content );
+  EXPECT_NE( a, asp::StageKey("s").file( input ).str() );
+  content[100000] = 'x';
+  write_text( input, content );
+  EXPECT_EQ( a, asp::StageKey("s").file( input ).str() );
+}
+
+TEST(StageCache, lookup_and_invalidate) {
+  test::UnlinkName output("stagecache-out.txt");
+  test::UnlinkName sidecar( asp::StageCache::sidecar_filename( output ) );
+
+  asp::StageCache first( asp::StageKey("s").value( "k", 1 ) );
+  first.output( output );
+  EXPECT_FALSE( first.lookup() );
+  write_text( output, "result" );
+  first.store();
+  EXPECT_TRUE( first.lookup() );
+
+  // A different setting invalidates and removes the old output.
+  asp::StageCache second( asp::StageKey("s").value( "k", 2 ) );
+  second.output( output );
+  EXPECT_FALSE( second.lookup() );
+  EXPECT_FALSE( fs::exists( output ) );
+  EXPECT_FALSE( fs::exists( sidecar ) );
+}
+
+TEST(StageCache, shared_directory) {
+  test::UnlinkName shared("stagecache-shared");
+  test::UnlinkName first_out("stagecache-a.txt"), second_out("stagecache-b.txt");
+  test::UnlinkName first_side( asp::StageCache::sidecar_filename( first_out ) );
+  test::UnlinkName second_side( asp::StageCache::sidecar_filename( second_out ) );
+  fs::create_directory( shared );
+
+  asp::StageCache first( asp::StageKey("s"), shared );
+  first.output( first_out );
+  write_text( first_out, "shared result" );
+  first.store();
+
+  // Same key under another name is restored from the shared copy.
+  asp::StageCache second( asp::StageKey("s"), shared );
+  second.output( second_out );
+  ASSERT_TRUE( second.lookup() );
+  std::ifstream input( second_out.c_str() );
+  std::string line;
+  std::getline( input, line );
+  EXPECT_EQ( "shared result", line );
+}
+
+TEST(StageCache, content_hash_sidecar) {
+  test::UnlinkName input("stagekey-content.txt"), same("stagekey-same.txt");
+  test::UnlinkName sidecar( asp::StageKey::content_filename( input ) ),
+    same_sidecar( asp::StageKey::content_filename( same ) );
+  write_text( input, "abc" );
+  write_text( same, "abc" );
+  // Long enough after the write for the hash to be recorded.
+  usleep( 50000 );
+  std::string key = asp::StageKey("s").file( same ).str();
+  EXPECT_TRUE( fs::exists( same_sidecar ) );
+
+  // A recorded hash for the current version of a file is used instead
+  // of reading it. This one is wrong on purpose.
+  struct stat info;
+  ASSERT_EQ( 0, stat( input.c_str(), &info ) );
+  {
+    std::ofstream out( sidecar.c_str() );
+    out << "ASP_CONTENT1 " << info.st_size << " " << info.st_ino << " " << info.st_dev << " "
+#ifdef __APPLE__
+        << info.st_mtimespec.tv_sec << " " << info.st_mtimespec.tv_nsec
+#else
+        << info.st_mtim.tv_sec << " " << info.st_mtim.tv_nsec
+#endif
+        << " 99999999999999999 1234\n";
+  }
+  EXPECT_NE( key, asp::StageKey("s").file( input ).str() );
+
+  // Once the file changes the record no longer applies, and it is
+  // replaced by the real hash.
+  write_text( input, "abcd" );
+  write_text( same, "abcd" );
+  usleep( 50000 );
+  EXPECT_EQ( asp::StageKey("s").file( same ).str(), asp::StageKey("s").file( input ).str() );
+  std::ifstream recorded( sidecar.c_str() );
+  std::string magic, size;
+  recorded >> magic >> size;
+  EXPECT_EQ( "ASP_CONTENT1", magic );
+  EXPECT_EQ( "4", size );
+}
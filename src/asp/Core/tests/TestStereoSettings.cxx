@@ -0,0 +1,59 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/StageCache.h>
+#include <vw/Math/BBox.h>
+
+#include <fstream>
+#include <sstream>
+
+using namespace vw;
+
+namespace {
+  // The settings part of a resume key, as stereo.h builds it, with the
+  // search range the stage uses.
+  std::string job_key( StereoSettings const& settings, BBox2i const& search_range ) {
+    std::ostringstream values;
+    settings.write_values( values, false );
+    return asp::StageKey( "corr" ).value( "settings", values.str() )
+      .value( "search_range", search_range ).str();
+  }
+}
+
+TEST(StereoSettings, job_key_with_detected_range) {
+  test::UnlinkName file( "stereo.default.test" );
+  {
+    std::ofstream out( file.c_str() );
+    out << "H_KERNEL 25\nV_KERNEL 25\n";
+  }
+
+  // The coordinator detects the range with H_CORR_* and V_CORR_* all
+  // 0, and passes it to its workers, which set them from it.
+  StereoSettings coordinator;
+  coordinator.read( file );
+  EXPECT_FALSE( coordinator.is_search_defined() );
+  StereoSettings worker;
+  worker.read( file );
+  worker.h_corr_min = -40; worker.v_corr_min = -3;
+  worker.h_corr_max = 25;  worker.v_corr_max = 4;
+  BBox2i detected( Vector2i( -40, -3 ), Vector2i( 25, 4 ) );
+  EXPECT_EQ( job_key( coordinator, detected ), job_key( worker, detected ) );
+  EXPECT_NE( job_key( coordinator, detected ),
+             job_key( worker, BBox2i( Vector2i( -40, -3 ), Vector2i( 26, 4 ) ) ) );
+
+  // Any other setting still changes the key, and the full dump still
+  // has the range settings.
+  worker.h_kern = 21;
+  EXPECT_NE( job_key( coordinator, detected ), job_key( worker, detected ) );
+  std::ostringstream all;
+  worker.write_values( all );
+  EXPECT_NE( std::string::npos, all.str().find( "H_CORR_MIN -40\n" ) );
+}
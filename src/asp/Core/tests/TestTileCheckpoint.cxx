@@ -0,0 +1,212 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/TileCheckpoint.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <boost/filesystem/operations.hpp>
+
+using namespace vw;
+
+namespace {
+  template <int N>
+  struct ChannelFunctor : ReturnFixedType<float> {
+    float operator()( Vector2f const& v ) const { return v[N]; }
+  };
+
+  // Reads source, but fails on the tiles that start in columns
+  // [fail_begin, fail_end), like a run killed before it got to them.
+  class FailingView : public ImageViewBase<FailingView> {
+    ImageView<float> m_source;
+    int32 m_fail_begin, m_fail_end;
+  public:
+    typedef float pixel_type;
+    typedef float result_type;
+    typedef ImageView<float>::pixel_accessor pixel_accessor;
+
+    FailingView( ImageView<float> const& source, int32 fail_begin, int32 fail_end ) :
+      m_source( source ), m_fail_begin( fail_begin ), m_fail_end( fail_end ) {}
+
+    inline int32 cols() const { return m_source.cols(); }
+    inline int32 rows() const { return m_source.rows(); }
+    inline int32 planes() const { return 1; }
+    inline pixel_accessor origin() const { return m_source.origin(); }
+    inline result_type operator()( int32 i, int32 j, int32 /*p*/ = 0 ) const { return m_source(i,j); }
+
+    typedef ImageView<float> prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      if ( bbox.min().x() >= m_fail_begin && bbox.min().x() < m_fail_end )
+        vw_throw( IOErr() << "Killed at " << bbox );
+      return m_source;
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize( bbox ), dest, bbox );
+    }
+  };
+
+  ImageView<float> ramp( int32 cols, int32 rows ) {
+    ImageView<float> source( cols, rows );
+    for ( int32 j = 0; j < source.rows(); j++ )
+      for ( int32 i = 0; i < source.cols(); i++ )
+        source(i,j) = i + 1000 * j;
+    return source;
+  }
+}
+
+TEST(TileCheckpoint, manifest_resume) {
+  test::UnlinkName image("manifest.tif");
+  test::UnlinkName manifest_name( asp::TileManifest::manifest_filename( image ) );
+
+  {
+    asp::TileManifest manifest( image, Vector2i(300,200), Vector2i(128,128) );
+    EXPECT_FALSE( manifest.resuming() );
+    manifest.reset();
+    manifest.mark_done( BBox2i(0,0,128,128) );
+    manifest.mark_done( BBox2i(256,128,44,72) );
+  }
+
+  asp::TileManifest manifest( image, Vector2i(300,200), Vector2i(128,128) );
+  EXPECT_TRUE( manifest.resuming() );
+  EXPECT_EQ( 2u, manifest.num_done() );
+  EXPECT_TRUE( manifest.is_done( BBox2i(0,0,128,128) ) );
+  EXPECT_TRUE( manifest.is_done( BBox2i(256,128,44,72) ) );
+  EXPECT_FALSE( manifest.is_done( BBox2i(128,0,128,128) ) );
+
+  manifest.remove();
+  EXPECT_FALSE( boost::filesystem::exists( manifest_name ) );
+}
+
+TEST(TileCheckpoint, manifest_mismatch) {
+  test::UnlinkName image("mismatch.tif");
+  test::UnlinkName manifest_name( asp::TileManifest::manifest_filename( image ) );
+
+  {
+    asp::TileManifest manifest( image, Vector2i(300,200), Vector2i(128,128) );
+    manifest.reset();
+    manifest.mark_done( BBox2i(0,0,128,128) );
+  }
+
+  // A different tile size means the old manifest can't be trusted.
+  asp::TileManifest manifest( image, Vector2i(300,200), Vector2i(256,256) );
+  EXPECT_FALSE( manifest.resuming() );
+  EXPECT_EQ( 0u, manifest.num_done() );
+}
+
+TEST(TileCheckpoint, manifest_job) {
+  test::UnlinkName image("job.tif");
+  test::UnlinkName manifest_name( asp::TileManifest::manifest_filename( image ) );
+
+  {
+    asp::TileManifest manifest( image, Vector2i(300,200), Vector2i(128,128),
+                                asp::TileJob( "corr 0123", 0, 2 ) );
+    manifest.reset();
+    manifest.mark_done( BBox2i(0,0,128,128) );
+    manifest.mark_done( BBox2i(128,0,128,128) );
+  }
+
+  {
+    asp::TileManifest manifest( image, Vector2i(300,200), Vector2i(128,128),
+                                asp::TileJob( "corr 0123", 0, 2 ) );
+    EXPECT_TRUE( manifest.resuming() );
+    // Only the tiles of this worker count.
+    std::vector<BBox2i> tiles;
+    tiles.push_back( BBox2i(0,0,128,128) );
+    tiles.push_back( BBox2i(256,0,44,128) );
+    EXPECT_EQ( 2u, manifest.num_done() );
+    EXPECT_EQ( 1u, manifest.num_done( tiles ) );
+  }
+
+  // Other inputs, or another split of the tiles, start over.
+  EXPECT_FALSE( asp::TileManifest( image, Vector2i(300,200), Vector2i(128,128),
+                                   asp::TileJob( "corr 4567", 0, 2 ) ).resuming() );
+  EXPECT_FALSE( asp::TileManifest( image, Vector2i(300,200), Vector2i(128,128),
+                                   asp::TileJob( "corr 0123", 0, 3 ) ).resuming() );
+  EXPECT_FALSE( asp::TileManifest( image, Vector2i(300,200), Vector2i(128,128),
+                                   asp::TileJob( "corr 0123", 1, 2 ) ).resuming() );
+}
+
+TEST(TileCheckpoint, resume_image) {
+  test::UnlinkName image("resume.tif"), whole("whole.tif");
+  test::UnlinkName manifest_name( asp::TileManifest::manifest_filename( image ) );
+  ImageView<float> source = ramp( 100, 70 );
+  asp::BaseOptions opt;
+  opt.raster_tile_size = Vector2i(32,32);
+
+  // The first run dies after the two left columns of tiles.
+  EXPECT_THROW( asp::checkpoint_block_write_gdal_image( image, FailingView( source, 64, 100 ),
+                                                        opt, ProgressCallback::dummy_instance(), 2 ),
+                IOErr );
+  ASSERT_TRUE( boost::filesystem::exists( manifest_name ) );
+  {
+    asp::TileManifest manifest( image, Vector2i(100,70), opt.raster_tile_size );
+    EXPECT_TRUE( manifest.resuming() );
+    EXPECT_EQ( 6u, manifest.num_done() );
+  }
+
+  // The second one must not render those again.
+  asp::checkpoint_block_write_gdal_image( image, FailingView( source, 0, 64 ),
+                                          opt, ProgressCallback::dummy_instance(), 2 );
+  EXPECT_FALSE( boost::filesystem::exists( manifest_name ) );
+  asp::checkpoint_block_write_gdal_image( whole, source, opt );
+
+  DiskImageView<float> resumed( image ), expected( whole );
+  ASSERT_EQ( expected.cols(), resumed.cols() );
+  ASSERT_EQ( expected.rows(), resumed.rows() );
+  for ( int32 j = 0; j < expected.rows(); j++ )
+    for ( int32 i = 0; i < expected.cols(); i++ )
+      EXPECT_EQ( expected(i,j), resumed(i,j) );
+}
+
+TEST(TileCheckpoint, shared_queue) {
+  test::UnlinkName image("shared.tif");
+  ImageView<float> source = ramp( 100, 70 );
+
+  asp::BaseOptions opt;
+  opt.raster_tile_size = Vector2i(32,32);
+  asp::set_shared_tile_queue( boost::shared_ptr<FifoWorkQueue>( new FifoWorkQueue(2) ) );
+  asp::checkpoint_block_write_gdal_image( image, source, opt );
+  asp::set_shared_tile_queue( boost::shared_ptr<FifoWorkQueue>() );
+
+  // The writer waits for its own tiles without joining the queue.
+  EXPECT_FALSE( boost::filesystem::exists( asp::TileManifest::manifest_filename( image ) ) );
+  DiskImageView<float> result( image );
+  ASSERT_EQ( source.cols(), result.cols() );
+  ASSERT_EQ( source.rows(), result.rows() );
+  for ( int32 j = 0; j < source.rows(); j++ )
+    for ( int32 i = 0; i < source.cols(); i++ )
+      EXPECT_EQ( source(i,j), result(i,j) );
+}
+
+TEST(TileCheckpoint, multiple_sinks) {
+  test::UnlinkName first("first.tif"), second("second.tif");
+  ImageView<Vector2f> source( 100, 70 );
+  for ( int32 j = 0; j < source.rows(); j++ )
+    for ( int32 i = 0; i < source.cols(); i++ )
+      source(i,j) = Vector2f( i, 1000 * j );
+
+  asp::BaseOptions opt;
+  opt.raster_tile_size = Vector2i(32,32);
+  std::vector<boost::shared_ptr<asp::TileSink<Vector2f> > > sinks;
+  sinks.push_back( boost::shared_ptr<asp::TileSink<Vector2f> >
+                   ( new asp::FilteredTileSink<Vector2f, ChannelFunctor<0> >( first ) ) );
+  sinks.push_back( boost::shared_ptr<asp::TileSink<Vector2f> >
+                   ( new asp::FilteredTileSink<Vector2f, ChannelFunctor<1> >( second ) ) );
+  asp::checkpoint_block_write_gdal_images( source, sinks, opt, ProgressCallback::dummy_instance(), 2 );
+
+  EXPECT_FALSE( boost::filesystem::exists( asp::TileManifest::manifest_filename( first ) ) );
+  DiskImageView<float> x( first ), y( second );
+  ASSERT_EQ( source.cols(), y.cols() );
+  ASSERT_EQ( source.rows(), y.rows() );
+  for ( int32 j = 0; j < source.rows(); j++ )
+    for ( int32 i = 0; i < source.cols(); i++ ) {
+      EXPECT_EQ( source(i,j)[0], x(i,j) );
+      EXPECT_EQ( source(i,j)[1], y(i,j) );
+    }
+}
@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/TileDag.h>
+#include <vw/Image/EdgeExtension.h>
+
+using namespace vw;
+
+namespace {
+
+  // Moves the image right by two pixels, so every tile reads two
+  // columns of the tile to its left.
+  ImageViewRef<float> shift_right( ImageViewRef<float> const& input ) {
+    return crop( edge_extend( input, ConstantEdgeExtension() ),
+                 BBox2i( -2, 0, input.cols(), input.rows() ) );
+  }
+
+  struct CopyTile {
+    ImageViewRef<float> view;
+    ImageView<float>* result;
+    void operator()( BBox2i const& bbox ) const {
+      crop( *result, bbox ) = crop( view, bbox );
+    }
+  };
+
+  ImageView<float> source_image() {
+    ImageView<float> image( 64, 48 );
+    for ( int32 j = 0; j < image.rows(); j++ )
+      for ( int32 i = 0; i < image.cols(); i++ )
+        image(i,j) = i + 100 * j;
+    return image;
+  }
+}
+
+TEST(TileDag, chained_stages) {
+  ImageView<float> source = source_image();
+  asp::TileDag<float> dag( source, Vector2i(16,16) );
+  size_t first = dag.add_stage( &shift_right, Vector2i(2,0) );
+  size_t last  = dag.add_stage( &shift_right, Vector2i(2,0) );
+  EXPECT_EQ( 3u, dag.num_stages() );
+
+  ImageView<float> middle( source.cols(), source.rows() ),
+    result( source.cols(), source.rows() );
+  CopyTile middle_tap = { dag.output(first), &middle };
+  CopyTile last_tap   = { dag.output(last), &result };
+  dag.add_tap( first, middle_tap );
+  dag.add_tap( last, last_tap );
+  dag.run( ProgressCallback::dummy_instance(), 4 );
+
+  for ( int32 j = 0; j < source.rows(); j++ ) {
+    for ( int32 i = 0; i < source.cols(); i++ ) {
+      EXPECT_EQ( source( std::max(i-2,0), j ), middle(i,j) );
+      EXPECT_EQ( source( std::max(i-4,0), j ), result(i,j) );
+    }
+  }
+}
+
+TEST(TileDag, missing_halo) {
+  ImageView<float> source = source_image();
+  asp::TileDag<float> dag( source, Vector2i(16,16) );
+  dag.add_stage( &shift_right, Vector2i(0,0) );
+  // With one thread each tile's input is released as soon as the tile
+  // itself is done, so the next tile can't see it.
+  EXPECT_THROW( dag.run( ProgressCallback::dummy_instance(), 1 ), LogicErr );
+}
@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+#include <gtest/gtest.h>
+#include <test/Helpers.h>
+
+#include <asp/Core/TraceLog.h>
+#include <vw/Image/ImageView.h>
+#include <fstream>
+#include <iterator>
+
+using namespace vw;
+
+TEST(TraceLog, chrome_format) {
+  test::UnlinkName trace_file("trace.json");
+
+  asp::TraceLog log;
+  EXPECT_FALSE( log.enabled() );
+  log.complete( "ignored", "tile", 0, 1 );
+
+  log.open( trace_file );
+  EXPECT_TRUE( log.enabled() );
+  log.complete( "compute", "tile", 10, 5,
+                asp::TraceArgs()( "file", "a\"b.tif" )( "bytes", 64 ) );
+  log.close();
+  EXPECT_FALSE( log.enabled() );
+
+  std::ifstream input( trace_file.c_str() );
+  std::string json( (std::istreambuf_iterator<char>(input)),
+                    std::istreambuf_iterator<char>() );
+  EXPECT_EQ( 0u, json.find("[\n") );
+  EXPECT_EQ( std::string::npos, json.find("ignored") );
+  EXPECT_NE( std::string::npos, json.find("\"name\":\"compute\"") );
+  EXPECT_NE( std::string::npos, json.find("\"ph\":\"X\",\"ts\":10,\"dur\":5") );
+  EXPECT_NE( std::string::npos, json.find("\"file\":\"a\\\"b.tif\",\"bytes\":64") );
+  EXPECT_NE( std::string::npos, json.find("\"name\":\"memory\"") );
+  EXPECT_EQ( json.size() - 3, json.rfind("\n]\n") );
+}
+
+TEST(TraceLog, json_escape) {
+  EXPECT_EQ( "v1.0-3-gabc", asp::json_escape( "v1.0-3-gabc" ) );
+  EXPECT_EQ( "a\\\"b\\\\c", asp::json_escape( "a\"b\\c" ) );
+  EXPECT_EQ( "x\\u000ay", asp::json_escape( "x\ny" ) );
+}
+
+TEST(TraceLog, traced_view_passthrough) {
+  ImageView<float> image(4,3);
+  for ( int32 j = 0; j < image.rows(); j++ )
+    for ( int32 i = 0; i < image.cols(); i++ )
+      image(i,j) = i + 10*j;
+
+  ImageView<float> copy = asp::trace_read( image, "memory" );
+  ASSERT_EQ( 4, copy.cols() );
+  ASSERT_EQ( 3, copy.rows() );
+  EXPECT_EQ( 21, copy(1,2) );
+}
@@ -21,6 +21,7 @@
 #include <asp/Sessions/ISIS/StereoSessionIsis.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/StageCache.h>
 #include <asp/IsisIO/IsisAdjustCameraModel.h>
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 #include <asp/Sessions/ISIS/PhotometricOutlier.h>
@@ -119,8 +120,8 @@ void write_preprocessed_isis_image( BaseOptions const& opt,
 
   // Write the results to disk.
   vw_out() << "\t--> Writing normalized images.\n";
-  block_write_gdal_image( out_file, applied_image, opt,
-                          TerminalProgressCallback("asp", "\t  "+tag+":  ") );
+  asp::write_preprocessed_image( opt, out_file, applied_image,
+                                 TerminalProgressCallback("asp", "\t  "+tag+":  ") );
 }
 
 void
@@ -131,20 +132,17 @@ asp::StereoSessionIsis::pre_preprocessing_hook(std::string const& input_file1,
   output_file1 = m_out_prefix + "-L.tif";
   output_file2 = m_out_prefix + "-R.tif";
 
-  if ( fs::exists(output_file1) && fs::exists(output_file2) ) {
-    try {
-      vw_log().console_log().rule_set().add_rule(-1,"fileio");
-      DiskImageView<PixelGray<float32> > out1(output_file1);
-      DiskImageView<PixelGray<float32> > out2(output_file2);
-      vw_out(InfoMessage) << "\t--> Using cached normalized input images.\n";
-      vw_settings().reload_config();
-      return;
-    } catch (vw::ArgumentErr const& e) {
-      // This throws on a corrupted file.
-      vw_settings().reload_config();
-    } catch (vw::IOErr const& e) {
-      vw_settings().reload_config();
-    }
+  asp::StageCache cache( asp::StageKey( "isis-pprc-v1" )
+                         .file( input_file1 ).file( input_file2 )
+                         .value( "keypoint_alignment", stereo_settings().keypoint_alignment )
+                         .value( "keypoint_align_subsampling", stereo_settings().keypoint_align_subsampling )
+                         .value( "individually_normalize", stereo_settings().individually_normalize )
+                         .value( "preprocess_uint16", stereo_settings().preprocess_uint16 ),
+                         stereo_settings().stage_cache_dir );
+  cache.output( output_file1 ).output( output_file2 ).output( m_out_prefix + "-align.exr" );
+  if ( cache.lookup() ) {
+    vw_out(InfoMessage) << "\t--> Using cached normalized input images.\n";
+    return;
   }
 
   float left_lo, left_hi, right_lo, right_hi;
@@ -197,6 +195,7 @@ asp::StereoSessionIsis::pre_preprocessing_hook(std::string const& input_file1,
                                    right_lo, right_hi, right_lo, right_hi,
                                    align_matrix, left_size );
   }
+  cache.store();
 }
 
 inline std::string write_shadow_mask( BaseOptions const& opt,
@@ -306,6 +305,16 @@ asp::StereoSessionIsis::pre_pointcloud_hook(std::string const& input_file,
                           TerminalProgressCallback("asp", "\t    Processing:") );
 }
 
+bool
+asp::StereoSessionIsis::has_pointcloud_view_hook() {
+  return !stereo_settings().mask_flatfield;
+}
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::StereoSessionIsis::pre_pointcloud_view_hook( ImageViewRef<PixelMask<Vector2f> > const& disparity ) {
+  return reverse_alignment_view( disparity );
+}
+
 boost::shared_ptr<vw::camera::CameraModel>
 asp::StereoSessionIsis::camera_model(std::string const& image_file,
                                      std::string const& camera_file) {
@@ -135,6 +135,10 @@ namespace asp {
     camera_model(std::string const& image_file,
                  std::string const& camera_file = "");
 
+    // Cameras come from each cube's own SPICE data, so sessions on the
+    // same cubes can reuse them.
+    virtual bool shared_camera_models() const { return true; }
+
     // Stage 1: Preprocessing
     //
     // Pre file is a pair of images.            ( ImageView<PixelT> )
@@ -156,6 +160,12 @@ namespace asp {
     virtual void pre_pointcloud_hook(std::string const& input_file,
                                      std::string & output_file);
 
+    // Dust masking for Apollo Metric needs the disparity on disk.
+    virtual bool has_pointcloud_view_hook();
+
+    virtual vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+    pre_pointcloud_view_hook( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity );
+
     static StereoSession* construct() { return new StereoSessionIsis; }
   };
 
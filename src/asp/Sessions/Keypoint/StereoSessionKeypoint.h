@@ -35,6 +35,11 @@ namespace asp {
     // Pre file is a disparity map.  ( ImageView<PixelDisparity<float> > )
     virtual void pre_pointcloud_hook(std::string const& input_file, std::string & output_file);
 
+    virtual vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+    pre_pointcloud_view_hook( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity ) {
+      return reverse_alignment_view( disparity );
+    }
+
   protected:
 
     // To speed up things one can optionally sub-sample the images
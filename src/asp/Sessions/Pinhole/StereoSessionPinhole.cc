@@ -234,10 +234,11 @@ void asp::StereoSessionPinhole::pre_preprocessing_hook(std::string const& input_
   output_file1 = m_out_prefix + "-L.tif";
   output_file2 = m_out_prefix + "-R.tif";
   vw_out() << "\t--> Writing pre-aligned images.\n";
-  block_write_gdal_image( output_file1, Limg, m_options,
-                          TerminalProgressCallback("asp","\t  L:  ") );
-  block_write_gdal_image( output_file2, crop(edge_extend(Rimg,ConstantEdgeExtension()),bounding_box(Limg)), m_options,
-                          TerminalProgressCallback("asp","\t  R:  ") );
+  asp::write_preprocessed_image( m_options, output_file1, Limg,
+                                 TerminalProgressCallback("asp","\t  L:  ") );
+  asp::write_preprocessed_image( m_options, output_file2,
+                                 crop(edge_extend(Rimg,ConstantEdgeExtension()),bounding_box(Limg)),
+                                 TerminalProgressCallback("asp","\t  R:  ") );
 }
 
 // Reverse any pre-alignment that might have been done to the disparity map
@@ -274,3 +275,10 @@ void asp::StereoSessionPinhole::pre_pointcloud_hook(std::string const& input_fil
     output_file = input_file;
   }
 }
+
+vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+asp::StereoSessionPinhole::pre_pointcloud_view_hook( ImageViewRef<PixelMask<Vector2f> > const& disparity ) {
+  if ( stereo_settings().keypoint_alignment )
+    return reverse_alignment_view( disparity );
+  return disparity;
+}
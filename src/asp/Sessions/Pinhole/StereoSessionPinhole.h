@@ -63,6 +63,9 @@ namespace asp {
     virtual void pre_pointcloud_hook(std::string const& input_file,
                                      std::string & output_file);
 
+    virtual vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+    pre_pointcloud_view_hook( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity );
+
     static StereoSession* construct() { return new StereoSessionPinhole; }
   };
 
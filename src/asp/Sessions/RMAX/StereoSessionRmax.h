@@ -23,6 +23,8 @@ namespace asp {
     camera_model(std::string const& image_file,
                  std::string const& camera_file = "");
 
+    virtual bool shared_camera_models() const { return true; }
+
     static StereoSession* construct() { return new StereoSessionRmax; }
   };
 } // end namespace asp
@@ -10,16 +10,36 @@
 
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/Pinhole/StereoSessionPinhole.h>
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/ImagePyramid.h>
 
 #include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/MatrixIO.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/Transform.h>
+#include <vw/Stereo/DisparityMap.h>
+
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
 
 #include <map>
+#include <typeinfo>
 
 // This creates an anonymous namespace where the lookup table for
 // stereo sessions lives.
 namespace {
   typedef std::map<std::string,asp::StereoSession::construct_func> ConstructMapType;
   ConstructMapType *stereo_session_construct_map = 0;
+
+  // Camera models shared between sessions, keyed by session type,
+  // image file and camera file.
+  typedef boost::tuple<std::string,std::string,std::string> CameraKey;
+  typedef std::map<CameraKey,boost::shared_ptr<vw::camera::CameraModel> > CameraMapType;
+  CameraMapType camera_cache;
+  vw::Mutex camera_cache_mutex;
 }
 
 void asp::StereoSession::register_session_type( std::string const& id,
@@ -49,3 +69,78 @@ asp::StereoSession* asp::StereoSession::create( std::string const& session_type
             << session_type );
   return 0; // never reached
 }
+
+vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+asp::StereoSession::reverse_alignment_view( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity ) {
+  using namespace vw;
+
+  Matrix<double> align_matrix;
+  try {
+    read_matrix(align_matrix, m_out_prefix + "-align.exr");
+    vw_out(DebugMessage) << "Alignment Matrix: " << align_matrix << "\n";
+  } catch ( vw::IOErr const& e ) {
+    vw_throw( IOErr() << "Could not read in alignment matrix: "
+              << m_out_prefix << "-align.exr" );
+  }
+
+  DiskImageView<PixelGray<float> > right_disk_image( m_right_image_file );
+  return stereo::disparity_range_mask( stereo::transform_disparities( disparity,
+                                         HomographyTransform(align_matrix)),
+                                       Vector2f(0,0),
+                                       Vector2f( right_disk_image.cols(),
+                                                 right_disk_image.rows()) );
+}
+
+vw::Matrix3x3 asp::StereoSession::right_alignment_matrix() {
+  using namespace vw;
+
+  std::string align_file = m_out_prefix + "-align.exr";
+  if ( !boost::filesystem::exists( align_file ) )
+    return Matrix3x3( math::identity_matrix<3>() );
+  Matrix<double> align_matrix;
+  try {
+    read_matrix(align_matrix, align_file);
+  } catch ( vw::IOErr const& e ) {
+    vw_throw( IOErr() << "Could not read in alignment matrix: " << align_file );
+  }
+  return Matrix3x3( align_matrix );
+}
+
+void asp::write_preprocessed_image( BaseOptions const& opt, std::string const& filename,
+                                    vw::ImageViewRef<vw::PixelGray<float> > const& image,
+                                    vw::ProgressCallback const& progress ) {
+  using namespace vw;
+  if ( stereo_settings().preprocess_uint16 ) {
+    // Stored 1 to 65535 cover [-1,2]. The pinhole session puts four
+    // standard deviations in [0,1], so this keeps twelve.
+    const double low = -1, high = 2, scale = ( high - low ) / 65534, offset = low - scale;
+    block_write_gdal_image( filename, to_fixed_point( image, offset, scale ), opt, progress );
+    write_value_scaling( filename, offset, scale );
+  } else {
+    block_write_gdal_image( filename, image, opt, progress );
+  }
+}
+
+void asp::StereoSession::camera_models( boost::shared_ptr<vw::camera::CameraModel> &cam1,
+                                        boost::shared_ptr<vw::camera::CameraModel> &cam2 ) {
+  if ( !shared_camera_models() ) {
+    cam1 = camera_model(m_left_image_file, m_left_camera_file);
+    cam2 = camera_model(m_right_image_file, m_right_camera_file);
+    return;
+  }
+
+  // Loading happens under the lock as well. The sessions that share
+  // cameras (ISIS) can't load two at once anyway.
+  vw::Mutex::Lock lock( camera_cache_mutex );
+  std::string type = typeid(*this).name();
+  boost::shared_ptr<vw::camera::CameraModel>& left =
+    camera_cache[ CameraKey( type, m_left_image_file, m_left_camera_file ) ];
+  if ( !left )
+    left = camera_model(m_left_image_file, m_left_camera_file);
+  boost::shared_ptr<vw::camera::CameraModel>& right =
+    camera_cache[ CameraKey( type, m_right_image_file, m_right_camera_file ) ];
+  if ( !right )
+    right = camera_model(m_right_image_file, m_right_camera_file);
+  cam1 = left;
+  cam2 = right;
+}
@@ -12,6 +12,9 @@
 #define __STEREO_SESSION_H__
 
 #include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypes.h>
 #include <vw/Camera/CameraModel.h>
 
 #include <vw/Math/Functors.h>
@@ -23,6 +26,7 @@
 #include <boost/filesystem/operations.hpp>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/InterestPoints.h>
 
 namespace asp {
 
@@ -133,12 +137,9 @@ namespace asp {
         }
 
         vw_out() << "\t--> Matching interest points\n";
-        ip::InterestPointMatcher<ip::L2NormMetric,ip::NullConstraint> matcher(0.5);
-
-        matcher(ip1_copy, ip2_copy,
-                matched_ip1, matched_ip2,
-                false,
-                TerminalProgressCallback( "asp", "\t    Matching: "));
+        asp::match_interest_points( ip1_copy, ip2_copy, matched_ip1, matched_ip2, 0.5,
+                                    asp::default_match_checks, 0,
+                                    TerminalProgressCallback( "asp", "\t    Matching: ") );
 
       } // End matching
 
@@ -185,6 +186,11 @@ namespace asp {
       return T;
     }
 
+    // Undo the homography written to -align.exr during preprocessing
+    // and mask disparities that land outside of the right image.
+    vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+    reverse_alignment_view( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity );
+
   public:
     void initialize (BaseOptions const& options,
                      std::string const& left_image_file,
@@ -215,11 +221,20 @@ namespace asp {
     typedef StereoSession* (*construct_func)();
     static void register_session_type( std::string const& id, construct_func func);
 
+    // Camera models for the pair. When the session's cameras can be
+    // shared, each one is loaded once per process and reused by every
+    // session that asks for the same files.
     virtual void camera_models(boost::shared_ptr<vw::camera::CameraModel> &cam1,
-                               boost::shared_ptr<vw::camera::CameraModel> &cam2) {
-      cam1 = camera_model(m_left_image_file, m_left_camera_file);
-      cam2 = camera_model(m_right_image_file, m_right_camera_file);
-    }
+                               boost::shared_ptr<vw::camera::CameraModel> &cam2);
+
+    // Homography from the right image to the aligned -R.tif written by
+    // preprocessing, or identity when the right image wasn't aligned.
+    vw::Matrix3x3 right_alignment_matrix();
+
+    // True if a camera model only depends on its own image and camera
+    // files. Sessions whose cameras are built from both images of the
+    // pair, like epipolar pinhole, must not share them.
+    virtual bool shared_camera_models() const { return false; }
 
     virtual boost::shared_ptr<vw::camera::CameraModel>
     camera_model(std::string const& image_file,
@@ -283,6 +298,18 @@ namespace asp {
       output_file = input_file;
     }
 
+    // Same as pre_pointcloud_hook, but for the fused pipeline where
+    // the disparity map only exists as a view. Sessions that can't
+    // express their hook lazily should return false from
+    // has_pointcloud_view_hook so the caller writes -F.tif and falls
+    // back to the file based hook.
+    virtual bool has_pointcloud_view_hook() { return true; }
+
+    virtual vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+    pre_pointcloud_view_hook( vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity ) {
+      return disparity;
+    }
+
     virtual void post_pointcloud_hook(std::string const& input_file,
                                       std::string & output_file) {
       output_file = input_file;
@@ -303,6 +330,16 @@ namespace asp {
 
   };
 
+  // Write a normalized -L.tif or -R.tif, as floats or, with
+  // PREPROCESS_UINT16, as 16 bit fixed point over [-1,2] with its
+  // scaling recorded in the file. Stages read them with
+  // asp::read_float_image, so nothing downstream needs to know which
+  // was written. Zero pixels, which the masks take for nodata, stay
+  // zero and no other pixel becomes zero.
+  void write_preprocessed_image( BaseOptions const& opt, std::string const& filename,
+                                 vw::ImageViewRef<vw::PixelGray<float> > const& image,
+                                 vw::ProgressCallback const& progress );
+
 } // end namespace asp
 
 #endif // __STEREO_SESSION_H__
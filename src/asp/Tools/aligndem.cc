@@ -13,6 +13,7 @@
 #include <vw/Mosaic/ImageComposite.h>
 #include <asp/ControlNetTK/Equalization.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/InterestPoints.h>
 #include <asp/Core/Macros.h>
 #include <limits>
 
@@ -117,10 +118,9 @@ void match_orthoimages( string const& left_image_name,
     ip2_copy = read_binary_ip_file(right_ip_file);
 
     vw_out() << "\t    * Matching interest points\n";
-    ip::DefaultMatcher matcher(0.6);
-
-    matcher(ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-            false, TerminalProgressCallback( "asp", "\t    Matching: "));
+    asp::match_interest_points( ip1_copy, ip2_copy, matched_ip1, matched_ip2, 0.6,
+                                asp::default_match_checks, 0,
+                                TerminalProgressCallback( "asp", "\t    Matching: ") );
     ip::remove_duplicates(matched_ip1, matched_ip2);
     vw_out(InfoMessage) << "\t    " << matched_ip1.size() << " putative matches.\n";
     asp::cnettk::equalization( matched_ip1, matched_ip2, max_points );
@@ -39,6 +39,7 @@ using namespace vw::stereo;
 
 #include <asp/Core/StereoSettings.h>
 #include <asp/Sessions.h>
+#include <asp/Tools/results.h>
 
 // Support for ISIS image files
 #if defined(ASP_HAVE_PKG_ISIS) && ASP_HAVE_PKG_ISIS == 1
@@ -58,6 +59,13 @@ using namespace vw::stereo;
 
 using namespace std;
 
+// Pixels that stereo_fltr marked good in the GoodPixelMap.
+struct GoodPixelFunc : public ReturnFixedType<bool> {
+  bool operator()( PixelRGB<uint8> const& pixel ) const {
+    return pixel.r() == 200;
+  }
+};
+
 //***********************************************************************
 // MAIN
 //***********************************************************************
@@ -88,49 +96,17 @@ int main(int argc, char* argv[]) {
   DiskImageView<PixelGray<float> > pred_disp_map_v (pred_disp_map_v_filename);
   DiskImageView<PixelRGB<uint8> >  good_pixels_map (good_pixels_map_filename);
 
-  //compute the average coverage measure
-  int img_size = true_disp_map_h.rows() * true_disp_map_h.cols();
-  int num_good_pixels = 0;
-  int i, j;
-
-  for (i = 0; i < good_pixels_map.rows(); i++){
-    for (j = 0; j < good_pixels_map.cols(); j++){
-
-      if (good_pixels_map(i,j).r()==200){
-          num_good_pixels++;
-      }
-    }
-  }
-
-  float avg_cover = num_good_pixels/(float) img_size;
-  printf("Average Coverage = %f\n", avg_cover);
-
-  //compute the average error measure
-  float avg_error_h = 0;
-
-  for (i = 0; i < pred_disp_map_h.rows(); i++){
-    for (j = 0; j < pred_disp_map_h.cols(); j++){
-      float tmp = pred_disp_map_h(i,j).v()-true_disp_map_h(i,j).v();
-       avg_error_h = avg_error_h + tmp*tmp;
-    }
-  }
-
-  avg_error_h = avg_error_h/num_good_pixels;
-  printf("avg_error_h = %f\n", avg_error_h);
-
-  float avg_error_v = 0;
-
-  for (i = 0; i < pred_disp_map_h.rows(); i++){
-    for (j = 0; j < pred_disp_map_h.cols(); j++){
-      float tmp = pred_disp_map_v(i,j).v()-true_disp_map_v(i,j).v();
-       avg_error_v = avg_error_v + tmp*tmp;
-    }
-  }
-
-  avg_error_v = avg_error_v/num_good_pixels;
-  printf("avg_error_v = %f\n", avg_error_v);
-  float avg_error = 0.5*(avg_error_v + avg_error_h);
-  printf("avg_error = %f\n", avg_error);
+  DisparityAccuracy accuracy =
+    disparity_accuracy( select_channel(true_disp_map_h,0),
+                        select_channel(true_disp_map_v,0),
+                        select_channel(pred_disp_map_h,0),
+                        select_channel(pred_disp_map_v,0),
+                        per_pixel_filter(good_pixels_map, GoodPixelFunc()) );
+
+  printf("Average Coverage = %f\n", accuracy.coverage);
+  printf("avg_error_h = %f\n", accuracy.error_h);
+  printf("avg_error_v = %f\n", accuracy.error_v);
+  printf("avg_error = %f\n", accuracy.error);
 
   return(EXIT_SUCCESS);
 }
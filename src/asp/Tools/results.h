@@ -0,0 +1,74 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file results.h
+///
+/// Disparity accuracy measures shared by results and stereo_bench.
+
+#ifndef __ASP_RESULTS_H__
+#define __ASP_RESULTS_H__
+
+#include <vw/Image.h>
+
+#include <boost/foreach.hpp>
+
+namespace vw {
+
+  struct DisparityAccuracy {
+    double coverage; // Fraction of the image marked good
+    double error_h;  // Mean squared horizontal error over good pixels
+    double error_v;  // Mean squared vertical error over good pixels
+    double error;    // Average of the two
+  };
+
+  // Compare a predicted disparity against ground truth, one channel at
+  // a time. The good view decides which pixels are counted; its pixels
+  // must convert to bool. The images are walked one block at a time so
+  // this works on images that do not fit in memory.
+  template <class TrueHT, class TrueVT, class PredHT, class PredVT, class GoodT>
+  DisparityAccuracy
+  disparity_accuracy( ImageViewBase<TrueHT> const& true_h,
+                      ImageViewBase<TrueVT> const& true_v,
+                      ImageViewBase<PredHT> const& pred_h,
+                      ImageViewBase<PredVT> const& pred_v,
+                      ImageViewBase<GoodT>  const& good ) {
+    if ( true_h.impl().cols() != pred_h.impl().cols() ||
+         true_h.impl().rows() != pred_h.impl().rows() )
+      vw_throw( ArgumentErr() << "disparity_accuracy: image sizes differ." );
+
+    double sum_h = 0, sum_v = 0;
+    size_t num_good = 0;
+    BOOST_FOREACH( BBox2i const& block,
+                   image_blocks( true_h.impl(), 1024, 1024 ) ) {
+      ImageView<typename TrueHT::pixel_type> th = crop( true_h.impl(), block );
+      ImageView<typename TrueVT::pixel_type> tv = crop( true_v.impl(), block );
+      ImageView<typename PredHT::pixel_type> ph = crop( pred_h.impl(), block );
+      ImageView<typename PredVT::pixel_type> pv = crop( pred_v.impl(), block );
+      ImageView<typename GoodT::pixel_type>  gd = crop( good.impl(),   block );
+      for ( int32 j = 0; j < block.height(); j++ ) {
+        for ( int32 i = 0; i < block.width(); i++ ) {
+          if ( !gd(i,j) )
+            continue;
+          double dh = ph(i,j) - th(i,j), dv = pv(i,j) - tv(i,j);
+          sum_h += dh*dh;
+          sum_v += dv*dv;
+          num_good++;
+        }
+      }
+    }
+
+    DisparityAccuracy result;
+    result.coverage = double(num_good) / ( double(true_h.impl().cols()) * true_h.impl().rows() );
+    result.error_h = num_good ? sum_h / num_good : 0;
+    result.error_v = num_good ? sum_v / num_good : 0;
+    result.error = 0.5 * ( result.error_h + result.error_v );
+    return result;
+  }
+
+} // end namespace vw
+
+#endif//__ASP_RESULTS_H__
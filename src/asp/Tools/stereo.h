@@ -23,6 +23,12 @@
 #include <asp/Core/MedianFilter.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/TileCheckpoint.h>
+#include <asp/Core/MemoryBudget.h>
+#include <asp/Core/TraceLog.h>
+#include <asp/Core/StageCache.h>
+#include <asp/Core/ImagePyramid.h>
+#include <asp/Core/PreFilter.h>
 #include <asp/Sessions.h>
 
 namespace po = boost::program_options;
@@ -62,10 +68,15 @@ struct Options : asp::BaseOptions {
   std::string stereo_session_string, stereo_default_filename;
   boost::shared_ptr<asp::StereoSession> session;   // Used to extract cameras
   vw::BBox2i search_range;                         // Correlation search window
-  bool optimized_correlator, draft_mode;
+  bool optimized_correlator, draft_mode, trace;
+  vw::uint32 corr_processes;                       // Local stereo_corr workers to launch
+  vw::uint32 worker_index, num_workers;            // This process' share of the tiles
+  std::string corr_search_range;                   // "minx,miny,maxx,maxy" override
+  vw::BBox2i left_image_crop_win;                  // Part of the left image to process
 
   // Output
   std::string out_prefix, corr_debug_prefix;
+  std::string fused_outputs;                       // Products kept by stereo_fused
 };
 
 // Allows FileIO to correctly read/write these pixel types
@@ -93,52 +104,161 @@ namespace vw {
   }
 #endif
 
-  // Parse input command line arguments
-  void handle_arguments( int argc, char *argv[], Options& opt ) {
-    po::options_description general_options("");
-    general_options.add_options()
-      ("session-type,t", po::value(&opt.stereo_session_string), "Select the stereo session type to use for processing. [options: pinhole isis]")
-      ("stereo-file,s", po::value(&opt.stereo_default_filename)->default_value("./stereo.default"), "Explicitly specify the stereo.default file to use. [default: ./stereo.default]")
-      ("draft-mode", po::value(&opt.corr_debug_prefix),"Cause the pyramid correlator to save out debug imagery named with this prefix.")
-      ("optimized-correlator", po::bool_switch(&opt.optimized_correlator)->default_value(false),
-       "Use the optimized correlator instead of the pyramid correlator.");
-    general_options.add( asp::BaseOptionsDescription(opt) );
+  // The part of the left image that is processed: the crop window
+  // clipped to the image, or the whole image if there is none.
+  inline BBox2i left_crop_window( Options const& opt, Vector2i const& left_size ) {
+    BBox2i image( 0, 0, left_size[0], left_size[1] );
+    if ( opt.left_image_crop_win.empty() )
+      return image;
+    BBox2i window = opt.left_image_crop_win;
+    window.crop( image );
+    if ( window.empty() )
+      vw_throw( ArgumentErr() << "Crop window " << opt.left_image_crop_win
+                << " is outside of the left image " << image << ".\n" );
+    return window;
+  }
 
-    po::options_description positional("");
-    positional.add_options()
-      ("left-input-image", po::value(&opt.in_file1), "Left Input Image")
-      ("right-input-image", po::value(&opt.in_file2), "Right Input Image")
-      ("left-camera-model", po::value(&opt.cam_file1), "Left Camera Model File")
-      ("right-camera-model", po::value(&opt.cam_file2), "Right Camera Model File")
-      ("output-prefix", po::value(&opt.out_prefix), "Prefix for output filenames")
-      ("extra_argument1", po::value(&opt.extra_arg1), "Extra Argument 1")
-      ("extra_argument2", po::value(&opt.extra_arg2), "Extra Argument 2")
-      ("extra_argument3", po::value(&opt.extra_arg3), "Extra Argument 3")
-      ("extra_argument4", po::value(&opt.extra_arg4), "Extra Argument 4");
+  // With a crop window, every stage after preprocessing works in the
+  // window's frame: pixel (0,0) is window.min() of the left image. The
+  // right image is shifted by the same amount, so disparities keep
+  // their meaning and are directly comparable with uncropped runs.
+  template <class ViewT>
+  CropView<ViewT>
+  left_window_view( ImageViewBase<ViewT> const& left, BBox2i const& window ) {
+    return crop( left.impl(), window );
+  }
 
-    po::positional_options_description positional_desc;
-    positional_desc.add("left-input-image", 1);
-    positional_desc.add("right-input-image", 1);
-    positional_desc.add("left-camera-model", 1);
-    positional_desc.add("right-camera-model", 1);
-    positional_desc.add("output-prefix", 1);
-    positional_desc.add("extra_argument1", 1);
-    positional_desc.add("extra_argument2", 1);
-    positional_desc.add("extra_argument3", 1);
-    positional_desc.add("extra_argument4", 1);
+  template <class ViewT>
+  CropView<EdgeExtensionView<ViewT,ZeroEdgeExtension> >
+  right_window_view( ImageViewBase<ViewT> const& right, BBox2i const& window ) {
+    return crop( edge_extend( right.impl(), ZeroEdgeExtension() ),
+                 BBox2i( window.min().x(), window.min().y(),
+                         right.impl().cols(), right.impl().rows() ) );
+  }
 
-    std::string usage("[options] <Left_input_image> <Right_input_image> [Left_camera_file] [Right_camera_file] <output_file_prefix>\n  Extensions are automaticaly added to the output files.\n  Camera model arguments may be optional for some stereo session types (e.g. isis).\n  Stereo parameters should be set in the stereo.default file.");
-    po::variables_map vm =
-      asp::check_command_line( argc, argv, opt, general_options,
-                               positional, positional_desc, usage );
+  // Replace full size left and right views (images or masks) with
+  // their views in the crop window's frame. Does nothing without a
+  // crop window.
+  template <class PixelT>
+  void apply_crop_window( Options const& opt, ImageViewRef<PixelT>& left,
+                          ImageViewRef<PixelT>& right ) {
+    if ( opt.left_image_crop_win.empty() )
+      return;
+    BBox2i window = left_crop_window( opt, Vector2i( left.cols(), left.rows() ) );
+    ImageViewRef<PixelT> left_full = left, right_full = right;
+    left  = left_window_view( left_full, window );
+    right = right_window_view( right_full, window );
+  }
 
-    opt.draft_mode = vm.count("draft-mode");
+  // Put an image in the window's frame back into the frame of the
+  // whole left image, for code that depends on the pixel location
+  // such as the camera models. Pixels outside the window are zero.
+  template <class ViewT>
+  CropView<EdgeExtensionView<ViewT,ZeroEdgeExtension> >
+  uncrop_window_view( ImageViewBase<ViewT> const& image, BBox2i const& window,
+                      Vector2i const& left_size ) {
+    return crop( edge_extend( image.impl(), ZeroEdgeExtension() ),
+                 BBox2i( -window.min().x(), -window.min().y(),
+                         left_size[0], left_size[1] ) );
+  }
 
-    if (!vm.count("left-input-image") || !vm.count("right-input-image") ||
-        !vm.count("left-camera-model") )
-      vw_throw( ArgumentErr() << "Missing all of the correct input files.\n\n"
-                << usage << general_options );
+  // ISIS cube I/O and camera models aren't thread safe. Code that can
+  // run beside other pairs in stereo_batch holds this while it uses
+  // them.
+  inline Mutex& isis_mutex() {
+    static Mutex mutex;
+    return mutex;
+  }
 
+  // Start of the key a stage's resumable outputs are written under: the
+  // options that shape them and every stereo setting. The caller adds
+  // the files they are computed from. A partial output left by a run
+  // with a different key is started over instead of resumed. The
+  // search range is keyed as opt.search_range, the one in use, and not
+  // as the H_CORR_* and V_CORR_* settings it may be detected from, so
+  // that a coordinator that detected it and the workers it was passed
+  // to agree on the key.
+  inline asp::StageKey resume_key( Options const& opt, std::string const& stage ) {
+    std::ostringstream settings;
+    stereo_settings().write_values( settings, false );
+    asp::StageKey key( stage );
+    key.value( "settings", settings.str() )
+      .value( "session", opt.stereo_session_string )
+      .value( "cameras", opt.cam_file1 + " " + opt.cam_file2 )
+      .value( "search_range", opt.search_range )
+      .value( "crop", opt.left_image_crop_win )
+      .value( "optimized", opt.optimized_correlator )
+      .value( "draft", opt.draft_mode );
+    return key;
+  }
+
+  // The levels of a stage input such as -L.tif or -R.tif, for any stage
+  // that wants it smaller. They are the overviews preprocessing adds
+  // with PREPROCESS_PYRAMID; without them only level 0, the image
+  // itself, is there. Stages in one process share the pyramid and the
+  // coarse levels it keeps in memory, through asp::shared_pyramid.
+  inline asp::ImagePyramid input_pyramid( std::string const& filename ) {
+    return asp::shared_pyramid( filename );
+  }
+
+  // Add overviews down to about 256 pixels to filename, unless it has
+  // them already.
+  inline void add_pyramid( std::string const& filename ) {
+    DiskImageView<PixelGray<float> > image( filename );
+    int32 levels = asp::pyramid_levels( Vector2i( image.cols(), image.rows() ) );
+    if ( asp::overview_count( filename ) != levels ) {
+      vw_out() << "\t--> Adding " << levels << " overviews to " << filename << ".\n";
+      asp::build_overviews( filename, levels );
+    }
+  }
+
+  // The filter of PREPROCESSING_FILTER_MODE as a lazy view, for the
+  // correlators that don't filter their input themselves and for the
+  // filtered images written by stereo_pprc.
+  inline ImageViewRef<PixelGray<float> >
+  preprocessing_filter( ImageViewRef<PixelGray<float> > const& image ) {
+    return asp::preprocessing_filter( image, stereo_settings().pre_filter_mode,
+                                      stereo_settings().slogW );
+  }
+
+  // -lFiltered.tif and -rFiltered.tif, the whole of -L.tif and -R.tif
+  // through preprocessing_filter. They are keyed to the images, the
+  // filter and SLOG_KERNEL_WIDTH.
+  inline asp::StageCache filtered_image_cache( Options const& opt ) {
+    asp::StageCache cache( asp::StageKey( "prefilter-v1" )
+                           .file( opt.out_prefix + "-L.tif" ).file( opt.out_prefix + "-R.tif" )
+                           .value( "filter", stereo_settings().pre_filter_mode )
+                           .value( "width", stereo_settings().slogW ),
+                           stereo_settings().stage_cache_dir );
+    cache.output( opt.out_prefix + "-lFiltered.tif" ).output( opt.out_prefix + "-rFiltered.tif" );
+    return cache;
+  }
+
+  // With PREFILTER_CACHE and a filter, replace left and right with the
+  // filtered images stereo_pprc wrote, in the crop window's frame.
+  // Returns false, leaving them alone, if there are none for the
+  // current images and settings; the stages then filter each tile
+  // themselves.
+  inline bool open_filtered_images( Options const& opt, ImageViewRef<PixelGray<float> >& left,
+                                    ImageViewRef<PixelGray<float> >& right ) {
+    if ( !stereo_settings().prefilter_cache || !stereo_settings().pre_filter_mode )
+      return false;
+    if ( !filtered_image_cache( opt ).lookup() ) {
+      vw_out(WarningMessage) << "No filtered images for the current settings, "
+                             << "filtering each tile instead. Rerun stereo_pprc to make them.\n";
+      return false;
+    }
+    vw_out() << "\t--> Reading the filtered images written in preprocessing.\n";
+    left = DiskImageView<PixelGray<float> >( opt.out_prefix + "-lFiltered.tif" );
+    right = DiskImageView<PixelGray<float> >( opt.out_prefix + "-rFiltered.tif" );
+    apply_crop_window( opt, left, right );
+    return true;
+  }
+
+  // Guess the session type when it wasn't given, check that the pair
+  // has everything that session needs, create the output directory and
+  // start the session. Shared by the stage tools and stereo_batch.
+  void stereo_pair_setup( Options& opt ) {
     // If the user hasn't specified a stereo session type, we take a
     // guess here based on the file suffixes.
     if (opt.stereo_session_string.empty()) {
@@ -188,10 +308,11 @@ namespace vw {
                             opt.cam_file1, opt.cam_file2,
                             opt.out_prefix, opt.extra_arg1, opt.extra_arg2,
                             opt.extra_arg3, opt.extra_arg4);
+  }
 
-    // Finally read in the stereo settings
-    stereo_settings().read(opt.stereo_default_filename);
-
+  // Take the search range from the stereo.default settings and copy
+  // them next to the results.
+  void stereo_settings_apply( Options& opt ) {
     // Set search range from stereo.default file
     opt.search_range = BBox2i(Vector2i(stereo_settings().h_corr_min,
                                        stereo_settings().v_corr_min),
@@ -206,6 +327,119 @@ namespace vw {
                                     opt.out_prefix + "-stereo.default");
   }
 
+  // Parse input command line arguments
+  void handle_arguments( int argc, char *argv[], Options& opt ) {
+    std::string crop_win;
+    po::options_description general_options("");
+    general_options.add_options()
+      ("session-type,t", po::value(&opt.stereo_session_string), "Select the stereo session type to use for processing. [options: pinhole isis]")
+      ("stereo-file,s", po::value(&opt.stereo_default_filename)->default_value("./stereo.default"), "Explicitly specify the stereo.default file to use. [default: ./stereo.default]")
+      ("draft-mode", po::value(&opt.corr_debug_prefix),"Cause the pyramid correlator to save out debug imagery named with this prefix.")
+      ("optimized-correlator", po::bool_switch(&opt.optimized_correlator)->default_value(false),
+       "Use the optimized correlator instead of the pyramid correlator.")
+      ("fused-outputs", po::value(&opt.fused_outputs)->default_value("PC"),
+       "Comma separated list of products for stereo_fused to write. [options: D RD F GoodPixelMap PC]")
+      ("corr-processes", po::value(&opt.corr_processes)->default_value(1),
+       "Split correlation across this many stereo_corr processes and merge their output.")
+      ("worker-index", po::value(&opt.worker_index)->default_value(0),
+       "Index of this correlation worker. Used with --num-workers.")
+      ("num-workers", po::value(&opt.num_workers)->default_value(1),
+       "Total number of correlation workers. A worker only correlates every num-workers'th tile.")
+      ("trace", po::bool_switch(&opt.trace)->default_value(false),
+       "Write per tile timing, I/O and memory use to <output-prefix>-<program>-trace.json in Chrome trace format.")
+      ("corr-search-range", po::value(&opt.corr_search_range),
+       "Override the correlation search range with \"minx,miny,maxx,maxy\".")
+      ("left-image-crop-win", po::value(&crop_win),
+       "Only process this region of the left image, given as \"xoff,yoff,width,height\".");
+    general_options.add( asp::BaseOptionsDescription(opt) );
+
+    po::options_description positional("");
+    positional.add_options()
+      ("left-input-image", po::value(&opt.in_file1), "Left Input Image")
+      ("right-input-image", po::value(&opt.in_file2), "Right Input Image")
+      ("left-camera-model", po::value(&opt.cam_file1), "Left Camera Model File")
+      ("right-camera-model", po::value(&opt.cam_file2), "Right Camera Model File")
+      ("output-prefix", po::value(&opt.out_prefix), "Prefix for output filenames")
+      ("extra_argument1", po::value(&opt.extra_arg1), "Extra Argument 1")
+      ("extra_argument2", po::value(&opt.extra_arg2), "Extra Argument 2")
+      ("extra_argument3", po::value(&opt.extra_arg3), "Extra Argument 3")
+      ("extra_argument4", po::value(&opt.extra_arg4), "Extra Argument 4");
+
+    po::positional_options_description positional_desc;
+    positional_desc.add("left-input-image", 1);
+    positional_desc.add("right-input-image", 1);
+    positional_desc.add("left-camera-model", 1);
+    positional_desc.add("right-camera-model", 1);
+    positional_desc.add("output-prefix", 1);
+    positional_desc.add("extra_argument1", 1);
+    positional_desc.add("extra_argument2", 1);
+    positional_desc.add("extra_argument3", 1);
+    positional_desc.add("extra_argument4", 1);
+
+    std::string usage("[options] <Left_input_image> <Right_input_image> [Left_camera_file] [Right_camera_file] <output_file_prefix>\n  Extensions are automaticaly added to the output files.\n  Camera model arguments may be optional for some stereo session types (e.g. isis).\n  Stereo parameters should be set in the stereo.default file.");
+    po::variables_map vm =
+      asp::check_command_line( argc, argv, opt, general_options,
+                               positional, positional_desc, usage );
+
+    opt.draft_mode = vm.count("draft-mode");
+
+    if (!vm.count("left-input-image") || !vm.count("right-input-image") ||
+        !vm.count("left-camera-model") )
+      vw_throw( ArgumentErr() << "Missing all of the correct input files.\n\n"
+                << usage << general_options );
+
+    stereo_pair_setup( opt );
+
+    if ( opt.trace ) {
+      std::ostringstream trace_file;
+      trace_file << opt.out_prefix << "-" << fs::path( argv[0] ).filename();
+      if ( opt.num_workers > 1 )
+        trace_file << "-worker" << opt.worker_index;
+      trace_file << "-trace.json";
+      asp::trace_log().open( trace_file.str() );
+    }
+
+    // Finally read in the stereo settings
+    stereo_settings().read(opt.stereo_default_filename);
+
+    if ( opt.num_workers < 1 || opt.worker_index >= opt.num_workers )
+      vw_throw( ArgumentErr() << "Worker index " << opt.worker_index
+                << " is out of range for " << opt.num_workers << " workers.\n" );
+
+    // A search range given on the command line replaces the one in
+    // stereo.default. Correlation workers receive it this way so that
+    // the interest point search only happens once.
+    if ( !opt.corr_search_range.empty() ) {
+      std::vector<std::string> values;
+      boost::split( values, opt.corr_search_range, boost::is_any_of(", "),
+                    boost::token_compress_on );
+      if ( values.size() != 4 )
+        vw_throw( ArgumentErr() << "Search range must be given as "
+                  << "\"minx,miny,maxx,maxy\".\n" );
+      stereo_settings().h_corr_min = atoi( values[0].c_str() );
+      stereo_settings().v_corr_min = atoi( values[1].c_str() );
+      stereo_settings().h_corr_max = atoi( values[2].c_str() );
+      stereo_settings().v_corr_max = atoi( values[3].c_str() );
+    }
+
+    if ( !crop_win.empty() ) {
+      std::vector<std::string> values;
+      boost::split( values, crop_win, boost::is_any_of(", "),
+                    boost::token_compress_on );
+      if ( values.size() != 4 )
+        vw_throw( ArgumentErr() << "Crop window must be given as "
+                  << "\"xoff,yoff,width,height\".\n" );
+      opt.left_image_crop_win = BBox2i( atoi( values[0].c_str() ), atoi( values[1].c_str() ),
+                                        atoi( values[2].c_str() ), atoi( values[3].c_str() ) );
+      if ( opt.left_image_crop_win.empty() )
+        vw_throw( ArgumentErr() << "Crop window " << crop_win << " is empty.\n" );
+      if ( stereo_settings().mask_flatfield )
+        vw_throw( ArgumentErr() << "MASK_FLATFIELD can't be used with a crop window.\n" );
+    }
+
+    stereo_settings_apply( opt );
+  }
+
   // Register Session types
   void stereo_register_sessions() {
 
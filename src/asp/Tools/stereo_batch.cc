@@ -0,0 +1,240 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file stereo_batch.cc
+///
+/// Runs the stereo stages on a list of pairs in one process. The
+/// stereo.default file is read once, camera models that only depend on
+/// their own cube are loaded once and shared by every pair that uses
+/// them, and the tiles of all pairs are rendered by one pool of
+/// threads. Several pairs are in flight at a time, so the pool stays
+/// busy while a large pair is working through its last tiles.
+
+#include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_preprocessing.h>
+#include <asp/Tools/stereo_correlation.h>
+#include <asp/Tools/stereo_refinement.h>
+#include <asp/Tools/stereo_filtering.h>
+#include <asp/Tools/stereo_triangulation.h>
+
+#include <fstream>
+
+using namespace vw;
+
+namespace vw {
+  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+struct BatchOptions : asp::BaseOptions {
+  std::string pair_list, stereo_session_string, stereo_default_filename;
+  uint32 concurrent_pairs;
+};
+
+// Read the pair list. Each line is
+//   left_image right_image [left_camera right_camera] output_prefix
+// Blank lines and lines starting with # are skipped.
+std::vector<Options> read_pair_list( BatchOptions const& batch ) {
+  std::ifstream input( batch.pair_list.c_str() );
+  if ( !input )
+    vw_throw( IOErr() << "Unable to open " << batch.pair_list );
+
+  std::vector<Options> pairs;
+  std::string line;
+  for ( int line_number = 1; std::getline( input, line ); line_number++ ) {
+    boost::trim( line );
+    if ( line.empty() || line[0] == '#' )
+      continue;
+    std::vector<std::string> fields;
+    boost::split( fields, line, boost::is_any_of(" \t"), boost::token_compress_on );
+    if ( fields.size() != 3 && fields.size() != 5 )
+      vw_throw( ArgumentErr() << batch.pair_list << ":" << line_number
+                << ": expected \"left right [left_camera right_camera] output_prefix\".\n" );
+
+    Options opt;
+    static_cast<asp::BaseOptions&>(opt) = batch;
+    opt.stereo_session_string = batch.stereo_session_string;
+    opt.stereo_default_filename = batch.stereo_default_filename;
+    opt.optimized_correlator = opt.draft_mode = opt.trace = false;
+    opt.corr_processes = 1;
+    opt.worker_index = 0;
+    opt.num_workers = 1;
+    opt.fused_outputs = "PC";
+    opt.in_file1 = fields[0];
+    opt.in_file2 = fields[1];
+    if ( fields.size() == 5 ) {
+      opt.cam_file1 = fields[2];
+      opt.cam_file2 = fields[3];
+    }
+    opt.out_prefix = fields.back();
+    pairs.push_back( opt );
+  }
+  return pairs;
+}
+
+// Hands pairs out to the pair threads and records how each one went.
+class BatchRunner : private boost::noncopyable {
+  std::vector<Options>& m_pairs;
+  std::vector<std::string> m_errors;
+  size_t m_next;
+  Mutex m_mutex;
+
+  typedef void (*StageFunc)( Options& );
+
+  // The stages that use ISIS throughout run for one ISIS pair at a
+  // time. Correlation only uses it for a DEM seed, and takes
+  // isis_mutex() itself just for that.
+  void run_stage( Options& opt, StageFunc stage, bool uses_isis ) {
+    if ( uses_isis && opt.stereo_session_string == "isis" ) {
+      Mutex::Lock lock( isis_mutex() );
+      stage( opt );
+    } else {
+      stage( opt );
+    }
+  }
+
+  static void check_cameras( Options& opt ) {
+    try {
+      boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
+      opt.session->camera_models(camera_model1,camera_model2);
+      if ( norm_2(camera_model1->camera_center(Vector2()) -
+                  camera_model2->camera_center(Vector2())) < 1e-3 )
+        vw_out(WarningMessage,"console")
+          << opt.out_prefix << ": your cameras appear to be in the same location!\n";
+    } catch ( camera::PixelToRayErr const& e ) {
+    } catch ( camera::PointToPixelErr const& e ) {
+      // Silent. Top Left pixel might not be valid on a map
+      // projected image.
+    }
+  }
+
+  void run_pair( Options& opt ) {
+    vw_out() << "\n[ " << current_posix_time_string() << " ] : Starting "
+             << opt.in_file1 << " " << opt.in_file2 << " -> " << opt.out_prefix << "\n";
+    stereo_pair_setup( opt );
+    stereo_settings_apply( opt );
+
+    run_stage( opt, &check_cameras, true );
+    run_stage( opt, &stereo_preprocessing, true );
+    run_stage( opt, &stereo_correlation, false );
+    run_stage( opt, &stereo_refinement, false );
+    run_stage( opt, &stereo_filtering, false );
+    run_stage( opt, &stereo_triangulation, true );
+
+    vw_out() << "\n[ " << current_posix_time_string() << " ] : Finished "
+             << opt.out_prefix << "\n";
+  }
+
+public:
+  BatchRunner( std::vector<Options>& pairs ) :
+    m_pairs( pairs ), m_errors( pairs.size() ), m_next( 0 ) {}
+
+  // Body of each pair thread: keep taking the next pair until none
+  // are left. A failed pair is reported and doesn't stop the others.
+  void operator()() {
+    while ( true ) {
+      size_t index;
+      {
+        Mutex::Lock lock( m_mutex );
+        if ( m_next >= m_pairs.size() )
+          return;
+        index = m_next++;
+      }
+      try {
+        run_pair( m_pairs[index] );
+      } catch ( std::exception const& e ) {
+        vw_out(ErrorMessage) << m_pairs[index].out_prefix << " failed: " << e.what() << "\n";
+        Mutex::Lock lock( m_mutex );
+        m_errors[index] = e.what();
+        if ( m_errors[index].empty() )
+          m_errors[index] = "unknown error";
+      }
+    }
+  }
+
+  std::vector<std::string> const& errors() const { return m_errors; }
+};
+
+int main( int argc, char* argv[] ) {
+
+  stereo_register_sessions();
+  BatchOptions opt;
+  try {
+    po::options_description general_options("");
+    general_options.add_options()
+      ("session-type,t", po::value(&opt.stereo_session_string),
+       "Select the stereo session type to use for processing. [options: pinhole isis]")
+      ("stereo-file,s", po::value(&opt.stereo_default_filename)->default_value("./stereo.default"),
+       "Explicitly specify the stereo.default file to use. [default: ./stereo.default]")
+      ("concurrent-pairs", po::value(&opt.concurrent_pairs)->default_value(2),
+       "Number of pairs to process at the same time. Each gets an equal share of --threads and --memory-limit.");
+    general_options.add( asp::BaseOptionsDescription(opt) );
+
+    po::options_description positional("");
+    positional.add_options()
+      ("pair-list", po::value(&opt.pair_list), "Pair list");
+    po::positional_options_description positional_desc;
+    positional_desc.add("pair-list", 1);
+
+    std::string usage("[options] <pair_list>\n  Each line of the pair list is \"left_image right_image [left_camera right_camera] output_prefix\".\n  Stereo parameters should be set in the stereo.default file.");
+    po::variables_map vm =
+      asp::check_command_line( argc, argv, opt, general_options,
+                               positional, positional_desc, usage );
+    if ( !vm.count("pair-list") )
+      vw_throw( ArgumentErr() << "Missing the pair list.\n\n" << usage << general_options );
+
+    std::vector<Options> pairs = read_pair_list( opt );
+    if ( pairs.empty() )
+      vw_throw( ArgumentErr() << "No pairs in " << opt.pair_list << ".\n" );
+    stereo_settings().read( opt.stereo_default_filename );
+
+    // Every pair plans its tiles for its share of the threads and the
+    // memory. A tile then never needs more than budget / threads, so
+    // the shared pool stays within the budget whichever pairs its
+    // threads are working on.
+    uint32 num_threads = asp::max_threads( opt );
+    uint32 concurrent = std::max( uint32(1), std::min( opt.concurrent_pairs, uint32(pairs.size()) ) );
+    uint32 pair_threads = std::max( uint32(1), num_threads / concurrent );
+    uint32 pair_memory = std::max( uint32(1), uint32( asp::memory_budget( opt ) / concurrent / ( 1024.0 * 1024.0 ) ) );
+    BOOST_FOREACH( Options& pair, pairs ) {
+      pair.num_threads = pair_threads;
+      pair.memory_limit_mb = pair_memory;
+    }
+    // Writers that don't go through the shared pool use the Vision
+    // Workbench default, so keep that to the pair's share as well.
+    vw_settings().set_default_num_threads( pair_threads );
+    asp::set_shared_tile_queue( boost::shared_ptr<FifoWorkQueue>( new FifoWorkQueue( num_threads ) ) );
+
+    vw_out() << "\t--> " << pairs.size() << " pairs, " << concurrent << " at a time on "
+             << num_threads << " threads.\n";
+
+    boost::shared_ptr<BatchRunner> runner( new BatchRunner( pairs ) );
+    std::vector<boost::shared_ptr<Thread> > threads;
+    for ( uint32 i = 0; i < concurrent; i++ )
+      threads.push_back( boost::shared_ptr<Thread>( new Thread( runner ) ) );
+    BOOST_FOREACH( boost::shared_ptr<Thread>& thread, threads )
+      thread->join();
+    asp::set_shared_tile_queue( boost::shared_ptr<FifoWorkQueue>() );
+
+    size_t failed = 0;
+    for ( size_t i = 0; i < pairs.size(); i++ ) {
+      if ( runner->errors()[i].empty() )
+        continue;
+      if ( !failed )
+        vw_out() << "\nFailed pairs:\n";
+      vw_out() << "\t" << pairs[i].out_prefix << ": " << runner->errors()[i] << "\n";
+      failed++;
+    }
+
+    vw_out() << "\n[ " << current_posix_time_string() << " ] : BATCH FINISHED, "
+             << pairs.size() - failed << " of " << pairs.size() << " pairs succeeded\n";
+    if ( failed )
+      return 1;
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -0,0 +1,333 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file stereo_bench.cc
+///
+/// Repeatable throughput and accuracy benchmark for the stereo stages.
+/// For each requested size a synthetic pair of pinhole images of a
+/// gently rolling surface is rendered, so the true disparity of every
+/// pixel is known. The stages are run in process, one after another,
+/// and the time each one takes is reported in megapixels per second
+/// along with the error of the filtered disparity. Results are saved
+/// as JSON so runs from different commits can be compared.
+
+#include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_preprocessing.h>
+#include <asp/Tools/stereo_correlation.h>
+#include <asp/Tools/stereo_refinement.h>
+#include <asp/Tools/stereo_filtering.h>
+#include <asp/Tools/stereo_triangulation.h>
+#include <asp/Tools/results.h>
+
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Core/Stopwatch.h>
+
+#include <fstream>
+
+using namespace vw;
+
+namespace vw {
+  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+struct BenchOptions : asp::BaseOptions {
+  std::string sizes, work_dir, output_file, label;
+};
+
+// Synthetic scene
+//----------------------------------------------------------
+
+// Two pinhole cameras side by side looking straight down the z axis
+// at a surface whose depth varies smoothly. The cameras share their
+// orientation, so the pair is already epipolar aligned and the
+// disparity is purely horizontal: -focal * baseline / depth.
+class BenchScene {
+  int32 m_size;
+  double m_focal, m_baseline, m_depth;
+
+  // Band limited value noise. Bilinearly interpolated lattice noise at
+  // a few octaves, deterministic so every run sees the same pair.
+  static float lattice_value( int32 i, int32 j, int32 octave ) {
+    uint32 h = uint32(i) * 374761393u + uint32(j) * 668265263u +
+      uint32(octave) * 2246822519u;
+    h = ( h ^ ( h >> 13 ) ) * 1274126177u;
+    return float( h ^ ( h >> 16 ) ) / 4294967295.0f;
+  }
+  static float lattice( double x, double y, int32 octave ) {
+    double fx = floor(x), fy = floor(y);
+    int32 i = int32(fx), j = int32(fy);
+    float ax = x - fx, ay = y - fy;
+    return ( 1 - ay ) * ( ( 1 - ax ) * lattice_value(i,   j,   octave) +
+                          ax         * lattice_value(i+1, j,   octave) ) +
+      ay *             ( ( 1 - ax ) * lattice_value(i,   j+1, octave) +
+                          ax         * lattice_value(i+1, j+1, octave) );
+  }
+
+public:
+  // Mean disparity of 20 px with about 25% relief.
+  BenchScene( int32 size ) : m_size(size), m_focal(size),
+                             m_baseline(20 * 1000.0 / size), m_depth(1000) {}
+
+  double depth( double x, double y ) const {
+    return m_depth * ( 1 + 0.25 * sin( 2 * M_PI * 3 * x / m_size ) *
+                       sin( 2 * M_PI * 2 * y / m_size ) );
+  }
+
+  double disparity( double x, double y ) const {
+    return -m_focal * m_baseline / depth( x, y );
+  }
+
+  // Surface texture at a left image location.
+  float texture( double x, double y ) const {
+    float sum = 0, amplitude = 1;
+    double scale = 1.0 / 16;
+    for ( int32 octave = 0; octave < 4; octave++ ) {
+      sum += amplitude * lattice( x * scale, y * scale, octave );
+      amplitude *= 0.5;
+      scale *= 2;
+    }
+    return sum / 1.875;
+  }
+
+  // Left image column that lands on column x of the right image. The
+  // disparity changes slowly, so a few fixed point iterations suffice.
+  double left_column( double x, double y ) const {
+    double left = x;
+    for ( int32 iter = 0; iter < 5; iter++ )
+      left = x - disparity( left, y );
+    return left;
+  }
+
+  camera::PinholeModel camera( bool right ) const {
+    return camera::PinholeModel( Vector3( right ? m_baseline : 0, 0, 0 ),
+                                 math::identity_matrix<3>(),
+                                 m_focal, m_focal, m_size / 2.0, m_size / 2.0 );
+  }
+
+  BBox2i search_range() const {
+    double low = -m_focal * m_baseline / ( m_depth * 0.75 );
+    double high = -m_focal * m_baseline / ( m_depth * 1.25 );
+    return BBox2i( Vector2i( int32(floor(low)) - 4, -4 ),
+                   Vector2i( int32(ceil(high)) + 4, 4 ) );
+  }
+};
+
+struct LeftImageFunc {
+  BenchScene const& scene;
+  LeftImageFunc( BenchScene const& s ) : scene(s) {}
+  typedef PixelGray<float> result_type;
+  result_type operator()( int32 i, int32 j, int32 /*p*/ = 0 ) const {
+    return scene.texture( i, j );
+  }
+};
+
+struct RightImageFunc {
+  BenchScene const& scene;
+  RightImageFunc( BenchScene const& s ) : scene(s) {}
+  typedef PixelGray<float> result_type;
+  result_type operator()( int32 i, int32 j, int32 /*p*/ = 0 ) const {
+    return scene.texture( scene.left_column( i, j ), j );
+  }
+};
+
+struct TrueDisparityFunc {
+  BenchScene const& scene;
+  TrueDisparityFunc( BenchScene const& s ) : scene(s) {}
+  typedef float result_type;
+  result_type operator()( int32 i, int32 j, int32 /*p*/ = 0 ) const {
+    return scene.disparity( i, j );
+  }
+};
+
+struct ZeroFunc {
+  typedef float result_type;
+  result_type operator()( int32, int32, int32 = 0 ) const { return 0; }
+};
+
+struct ValidPixelFunc : public ReturnFixedType<bool> {
+  bool operator()( PixelMask<Vector2f> const& pixel ) const {
+    return is_valid( pixel );
+  }
+};
+
+// Benchmark
+//----------------------------------------------------------
+
+struct StageTime {
+  std::string name;
+  double seconds;
+};
+
+void write_stereo_default( std::string const& filename, BBox2i const& search ) {
+  std::ofstream out( filename.c_str() );
+  out << "DO_INTERESTPOINT_ALIGNMENT 0\n"
+      << "DO_EPIPOLAR_ALIGNMENT 0\n"
+      << "FORCE_USE_ENTIRE_RANGE 1\n"
+      << "DO_INDIVIDUAL_NORMALIZATION 0\n"
+      << "PREPROCESSING_FILTER_MODE 2\n"
+      << "SLOG_KERNEL_WIDTH 1.5\n"
+      << "COST_MODE 2\n"
+      << "COST_BLUR 0\n"
+      << "H_KERNEL 25\n"
+      << "V_KERNEL 25\n"
+      << "H_CORR_MIN " << search.min().x() << "\n"
+      << "H_CORR_MAX " << search.max().x() << "\n"
+      << "V_CORR_MIN " << search.min().y() << "\n"
+      << "V_CORR_MAX " << search.max().y() << "\n"
+      << "SUBPIXEL_MODE 1\n"
+      << "SUBPIXEL_H_KERNEL 25\n"
+      << "SUBPIXEL_V_KERNEL 25\n"
+      << "FILL_HOLES 0\n"
+      << "RM_H_HALF_KERN 5\n"
+      << "RM_V_HALF_KERN 5\n"
+      << "RM_MIN_MATCHES 60\n"
+      << "RM_THRESHOLD 3\n"
+      << "RM_CLEANUP_PASSES 1\n"
+      << "NEAR_UNIVERSE_RADIUS 0.0\n"
+      << "FAR_UNIVERSE_RADIUS 0.0\n";
+}
+
+// Run the stages on one synthetic pair and append its record to json.
+void run_size( BenchOptions const& bench, int32 size, std::ostream& json ) {
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : Benchmark "
+           << size << "x" << size << "\n";
+
+  std::ostringstream dir;
+  dir << bench.work_dir << "/" << size;
+  fs::create_directories( dir.str() );
+  std::string prefix = dir.str() + "/bench";
+
+  BenchScene scene( size );
+  std::string left_file = prefix + "-left.tif", right_file = prefix + "-right.tif";
+  std::string left_cam = prefix + "-left.tsai", right_cam = prefix + "-right.tsai";
+  std::string default_file = prefix + ".default";
+  asp::block_write_gdal_image( left_file,
+                               PerPixelIndexView<LeftImageFunc>( LeftImageFunc(scene), size, size ),
+                               bench, TerminalProgressCallback("asp", "\t--> Left :") );
+  asp::block_write_gdal_image( right_file,
+                               PerPixelIndexView<RightImageFunc>( RightImageFunc(scene), size, size ),
+                               bench, TerminalProgressCallback("asp", "\t--> Right:") );
+  scene.camera(false).write( left_cam );
+  scene.camera(true).write( right_cam );
+  write_stereo_default( default_file, scene.search_range() );
+
+  // Set up the stages exactly as the stereo tools would.
+  std::ostringstream threads, memory;
+  threads << bench.num_threads;
+  memory << bench.memory_limit_mb;
+  std::vector<std::string> args;
+  args.push_back( "stereo_bench" );
+  args.push_back( "-t" );            args.push_back( "pinhole" );
+  args.push_back( "--stereo-file" ); args.push_back( default_file );
+  args.push_back( "--threads" );     args.push_back( threads.str() );
+  args.push_back( "--memory-limit" ); args.push_back( memory.str() );
+  args.push_back( left_file );       args.push_back( right_file );
+  args.push_back( left_cam );        args.push_back( right_cam );
+  args.push_back( prefix );
+  std::vector<char*> argv;
+  BOOST_FOREACH( std::string& arg, args )
+    argv.push_back( &arg[0] );
+  Options opt;
+  handle_arguments( argv.size(), &argv[0], opt );
+
+  std::vector<StageTime> times;
+
+#define ASP_BENCH_STAGE( NAME, CALL ) {                               \
+    Stopwatch watch; watch.start(); CALL; watch.stop();               \
+    StageTime t = { NAME, watch.elapsed_seconds() }; times.push_back( t ); }
+
+  ASP_BENCH_STAGE( "preprocessing", stereo_preprocessing( opt ) );
+  ASP_BENCH_STAGE( "correlation", stereo_correlation( opt ) );
+  ASP_BENCH_STAGE( "refinement", stereo_refinement( opt ) );
+  ASP_BENCH_STAGE( "filtering", stereo_filtering( opt ) );
+  ASP_BENCH_STAGE( "triangulation", stereo_triangulation( opt ) );
+
+#undef ASP_BENCH_STAGE
+
+  DiskImageView<PixelMask<Vector2f> > disparity( prefix + "-F.tif" );
+  DisparityAccuracy accuracy =
+    disparity_accuracy( PerPixelIndexView<TrueDisparityFunc>( TrueDisparityFunc(scene), size, size ),
+                        PerPixelIndexView<ZeroFunc>( ZeroFunc(), size, size ),
+                        select_channel( disparity, 0 ),
+                        select_channel( disparity, 1 ),
+                        per_pixel_filter( disparity, ValidPixelFunc() ) );
+
+  double megapixels = double(size) * size / 1e6;
+  json << "    {\n"
+       << "      \"size\": " << size << ",\n"
+       << "      \"megapixels\": " << megapixels << ",\n"
+       << "      \"stages\": {\n";
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    vw_out() << "\t--> " << times[i].name << ": " << times[i].seconds << " s, "
+             << megapixels / times[i].seconds << " MP/s\n";
+    json << "        \"" << times[i].name << "\": { \"seconds\": " << times[i].seconds
+         << ", \"mp_per_s\": " << megapixels / times[i].seconds << " }"
+         << ( i + 1 < times.size() ? ",\n" : "\n" );
+  }
+  vw_out() << "\t--> coverage " << accuracy.coverage << ", mean squared error "
+           << accuracy.error_h << " (h) " << accuracy.error_v << " (v)\n";
+  json << "      },\n"
+       << "      \"accuracy\": { \"coverage\": " << accuracy.coverage
+       << ", \"error_h\": " << accuracy.error_h
+       << ", \"error_v\": " << accuracy.error_v
+       << ", \"error\": " << accuracy.error << " }\n"
+       << "    }";
+}
+
+int main( int argc, char* argv[] ) {
+
+  stereo_register_sessions();
+  BenchOptions opt;
+  try {
+    po::options_description general_options("");
+    general_options.add_options()
+      ("sizes", po::value(&opt.sizes)->default_value("1024,2048,4096,8192,16384"),
+       "Comma separated edge lengths of the synthetic pairs.")
+      ("work-dir", po::value(&opt.work_dir)->default_value("bench"),
+       "Directory for the synthetic images and stage outputs.")
+      ("output,o", po::value(&opt.output_file)->default_value("bench.json"),
+       "File to write the results to.")
+      ("label", po::value(&opt.label),
+       "Free form tag stored with the results, such as a commit id.");
+    general_options.add( asp::BaseOptionsDescription(opt) );
+
+    po::options_description positional("");
+    po::positional_options_description positional_desc;
+    std::string usage("[options]\n  Writes synthetic pairs under --work-dir and their timings to --output.");
+    asp::check_command_line( argc, argv, opt, general_options,
+                             positional, positional_desc, usage );
+
+    std::vector<std::string> size_list;
+    boost::split( size_list, opt.sizes, boost::is_any_of(", "),
+                  boost::token_compress_on );
+
+    std::ofstream json( opt.output_file.c_str() );
+    if ( !json )
+      vw_throw( IOErr() << "Unable to open " << opt.output_file );
+    json << "{\n"
+         << "  \"label\": \"" << asp::json_escape( opt.label ) << "\",\n"
+         << "  \"date\": \"" << current_posix_time_string() << "\",\n"
+         << "  \"threads\": " << vw_settings().default_num_threads() << ",\n"
+         << "  \"runs\": [\n";
+    for ( size_t i = 0; i < size_list.size(); i++ ) {
+      int32 size = atoi( size_list[i].c_str() );
+      if ( size <= 0 )
+        vw_throw( ArgumentErr() << "Invalid size: " << size_list[i] );
+      run_size( opt, size, json );
+      json << ( i + 1 < size_list.size() ? ",\n" : "\n" );
+      json.flush();
+    }
+    json << "  ]\n}\n";
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : BENCHMARK FINISHED -> " << opt.output_file << "\n";
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -12,12 +12,135 @@
 #include <asp/Tools/stereo.h>
 #include <asp/Tools/stereo_correlation.h>
 
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace vw;
 
 namespace vw {
   template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
 }
 
+// Command line for a correlation worker. Everything the user gave is
+// passed along except the options the coordinator decides itself.
+std::vector<std::string> worker_arguments( int argc, char* argv[] ) {
+  const char* owned[] = { "--corr-processes", "--threads", "--memory-limit",
+                          "--worker-index", "--num-workers", "--corr-search-range" };
+  std::vector<std::string> args;
+  for ( int i = 1; i < argc; i++ ) {
+    std::string arg( argv[i] );
+    bool skip = false;
+    for ( size_t j = 0; j < sizeof(owned)/sizeof(owned[0]); j++ ) {
+      if ( arg == owned[j] ) {
+        skip = true;
+        i++; // Also drop the value
+      } else if ( boost::starts_with( arg, std::string(owned[j]) + "=" ) ) {
+        skip = true;
+      }
+    }
+    if ( !skip )
+      args.push_back( arg );
+  }
+  return args;
+}
+
+// Run correlation as opt.corr_processes local stereo_corr processes,
+// each writing its own share of the tiles, then merge their output. The
+// search range and its seed are found once here and handed to every
+// worker.
+void stereo_correlation_coordinator( Options& opt, int argc, char* argv[] ) {
+
+  vw_out() << "\n[ " << current_posix_time_string()
+           << " ] : Stage 1 --> CORRELATION \n";
+  asp::TraceScope trace( "Correlation coordinator", "stage" );
+
+  correlation_search_range( opt );
+  correlation_seed( opt );
+
+  // Every worker gets an equal share of the threads and memory.
+  vw::uint32 num_threads =
+    std::max( asp::max_threads( opt ) / opt.corr_processes, vw::uint32(1) );
+  vw::uint32 memory_limit_mb =
+    std::max( vw::uint32( asp::memory_budget( opt ) / ( 1024 * 1024 ) / opt.corr_processes ),
+              vw::uint32(1) );
+  {
+    Options worker_opt = opt;
+    worker_opt.num_threads = num_threads;
+    worker_opt.memory_limit_mb = memory_limit_mb;
+    asp::plan_stage_tiles( "Correlation worker", correlation_tile_cost( worker_opt ),
+                           worker_opt, MAX_CORRELATION_TILE );
+  }
+
+  std::vector<std::string> common = worker_arguments( argc, argv );
+  std::ostringstream range, threads, memory, workers;
+  range << opt.search_range.min().x() << "," << opt.search_range.min().y() << ","
+        << opt.search_range.max().x() << "," << opt.search_range.max().y();
+  threads << num_threads;
+  memory << memory_limit_mb;
+  workers << opt.corr_processes;
+  common.push_back( "--corr-search-range" ); common.push_back( range.str() );
+  common.push_back( "--threads" );           common.push_back( threads.str() );
+  common.push_back( "--memory-limit" );      common.push_back( memory.str() );
+  common.push_back( "--num-workers" );       common.push_back( workers.str() );
+
+  std::vector<pid_t> pids;
+  for ( vw::uint32 i = 0; i < opt.corr_processes; i++ ) {
+    // A finished output of the same job is reused, for example from
+    // workers that were run by hand on other machines. Anything else
+    // left by an earlier run with another split, search range or
+    // inputs is done again. A partial output of the same job is
+    // resumed by the worker from its tile manifest.
+    std::string worker_file = worker_disparity_filename( opt, i );
+    std::string job = worker_job( opt, i, opt.corr_processes );
+    if ( worker_output_matches( worker_file, job ) ) {
+      vw_out() << "\t--> Using finished worker output " << worker_file << "\n";
+      continue;
+    }
+    if ( fs::exists( worker_job_filename( worker_file ) ) ) {
+      vw_out(WarningMessage) << "Discarding " << worker_file
+                             << ", written for a different correlation job.\n";
+      fs::remove( worker_file );
+      fs::remove( worker_job_filename( worker_file ) );
+    }
+
+    std::ostringstream index;
+    index << i;
+    std::vector<std::string> args( 1, argv[0] );
+    args.insert( args.end(), common.begin(), common.end() );
+    args.push_back( "--worker-index" ); args.push_back( index.str() );
+
+    std::vector<char*> c_args;
+    BOOST_FOREACH( std::string& arg, args )
+      c_args.push_back( &arg[0] );
+    c_args.push_back( NULL );
+
+    pid_t pid = fork();
+    if ( pid < 0 )
+      vw_throw( IOErr() << "Unable to start correlation worker " << i << "." );
+    if ( pid == 0 ) {
+      execvp( c_args[0], &c_args[0] );
+      _exit( 127 );
+    }
+    pids.push_back( pid );
+  }
+
+  bool failed = false;
+  for ( size_t i = 0; i < pids.size(); i++ ) {
+    int status = 0;
+    if ( waitpid( pids[i], &status, 0 ) < 0 ||
+         !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+      vw_out(ErrorMessage) << "Correlation worker process " << pids[i] << " failed.\n";
+      failed = true;
+    }
+  }
+  if ( failed )
+    vw_throw( IOErr() << "Correlation workers failed. Rerun to resume "
+              << "from the tiles they already wrote." );
+
+  stereo_correlation_merge( opt, opt.corr_processes );
+}
+
 int main(int argc, char* argv[]) {
 
   stereo_register_sessions();
@@ -45,13 +168,12 @@ int main(int argc, char* argv[]) {
       // projected image.
     }
 
-    // Integer correlator requires 1024 px tiles
-    //---------------------------------------------------------
-    opt.raster_tile_size = Vector2i(1024,1024);
-
     // Internal Processes
     //---------------------------------------------------------
-    stereo_correlation( opt );
+    if ( opt.corr_processes > 1 && opt.num_workers == 1 )
+      stereo_correlation_coordinator( opt, argc, argv );
+    else
+      stereo_correlation( opt );
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : CORRELATION FINISHED \n";
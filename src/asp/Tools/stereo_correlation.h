@@ -11,6 +11,13 @@
 #define __ASP_STEREO_CORRELATION_H__
 
 #include <asp/Tools/stereo.h>
+#include <asp/Core/StageCache.h>
+#include <asp/Core/SearchRangeSeed.h>
+#include <asp/Core/InterestPoints.h>
+#include <asp/Core/SemiGlobalMatching.h>
+#include <asp/Core/Census.h>
+#include <asp/Core/DemSeed.h>
+#include <vw/Cartography.h>
 #include <vw/InterestPoint.h>
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
@@ -18,11 +25,14 @@
 namespace vw {
 
   // approximate search range
-  //  Find interest points and grow them into a search range
+  //  Find interest points and grow them into a search range. If
+  //  left_window is given (in full resolution pixels), only matches
+  //  inside it are used.
   BBox2i
   approximate_search_range( std::string left_image,
                             std::string right_image,
-                            float scale ) {
+                            float scale,
+                            BBox2i const& left_window = BBox2i() ) {
 
     vw_out() << "\t--> Using interest points to determine search window.\n";
     std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
@@ -37,8 +47,14 @@ namespace vw {
       fs::path( left_image ).replace_extension("").string() + "__" +
       fs::path( right_image ).stem() + ".match";
 
+    // The interest points and matches only depend on the sub images.
+    asp::StageCache ip_cache( asp::StageKey( "search-range-ip-v3" )
+                              .file( left_image ).file( right_image ),
+                              stereo_settings().stage_cache_dir );
+    ip_cache.output( left_ip_file ).output( right_ip_file ).output( match_file );
+
     // Building / Loading Interest point data
-    if ( fs::exists(match_file) ) {
+    if ( ip_cache.lookup() ) {
 
       vw_out() << "\t    * Using cached match file.\n";
       ip::read_binary_match_file(match_file, matched_ip1, matched_ip2);
@@ -47,33 +63,39 @@ namespace vw {
 
       std::vector<ip::InterestPoint> ip1_copy, ip2_copy;
 
-      if ( !fs::exists(left_ip_file) ||
-           !fs::exists(right_ip_file) ) {
+      {
 
         // Worst case, no interest point operations have been performed before
         vw_out() << "\t    * Locating Interest Points\n";
-        DiskImageView<PixelGray<float32> > left_sub_image(left_image);
-        DiskImageView<PixelGray<float32> > right_sub_image(right_image);
-
-        // Interest Point module detector code.
-        float ipgain = 0.07;
-        std::list<ip::InterestPoint> ip1, ip2;
+        std::vector<asp::IpImage> images( 2 );
+        images[0] = DiskImageView<PixelGray<float32> >(left_image);
+        images[1] = DiskImageView<PixelGray<float32> >(right_image);
+
+        // Interest Point module detector code. The threshold starts at
+        // 0.07 and is lowered by a quarter at a time until both images
+        // have 1500 points, but no lower than 0.01. Detection runs once
+        // at the lowest threshold and the rest only picks the cutoff.
+        std::vector<float> ipgains;
+        for ( float ipgain = 0.07; ipgain >= 1e-2; ipgain *= 0.75 )
+          ipgains.push_back( ipgain );
         vw_out() << "\t    * Processing for Interest Points.\n";
-        while ( ip1.size() < 1500 || ip2.size() < 1500 ) {
-          ip1.clear(); ip2.clear();
-
-          ip::OBALoGInterestOperator interest_operator( ipgain );
-          ip::IntegralInterestPointDetector<ip::OBALoGInterestOperator> detector( interest_operator, 0 );
-
-          ip1 = detect_interest_points( left_sub_image, detector );
-          ip2 = detect_interest_points( right_sub_image, detector );
-
-          ipgain *= 0.75;
-          if ( ipgain < 1e-2 ) {
-            vw_out() << "\t    * Unable to find desirable amount of Interest Points.\n";
+        std::vector<ip::InterestPointList> ips =
+          asp::detect_interest_points_tiled( images, ipgains.back() );
+        std::list<ip::InterestPoint>& ip1 = ips[0];
+        std::list<ip::InterestPoint>& ip2 = ips[1];
+
+        float ipgain = ipgains.back();
+        for ( size_t i = 0; i < ipgains.size(); i++ ) {
+          if ( asp::count_interest_points( ip1, ipgains[i] ) >= 1500 &&
+               asp::count_interest_points( ip2, ipgains[i] ) >= 1500 ) {
+            ipgain = ipgains[i];
             break;
           }
+          if ( i + 1 == ipgains.size() )
+            vw_out() << "\t    * Unable to find desirable amount of Interest Points.\n";
         }
+        asp::threshold_interest_points( ip1, ipgain );
+        asp::threshold_interest_points( ip2, ipgain );
 
         if ( ip1.size() < 8 || ip2.size() < 8 )
           vw_throw( InputErr() << "Unable to extract interest points from input images [" << left_image << "," << right_image << "]! Unable to continue." );
@@ -95,9 +117,7 @@ namespace vw {
         BOOST_FOREACH( ip::InterestPoint& ip, ip2 ) ip.orientation = 0;
 
         vw_out() << "\t    * Generating descriptors..." << std::flush;
-        ip::SGradDescriptorGenerator descriptor;
-        descriptor( left_sub_image, ip1 );
-        descriptor( right_sub_image, ip2 );
+        asp::describe_interest_points( images, ips );
         vw_out() << "done.\n";
 
         // Writing out the results
@@ -113,10 +133,9 @@ namespace vw {
       ip2_copy = ip::read_binary_ip_file(right_ip_file);
 
       vw_out() << "\t    * Matching interest points\n";
-      ip::InterestPointMatcher<ip::L2NormMetric,ip::NullConstraint> matcher(0.6);
-
-      matcher(ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-              false, TerminalProgressCallback( "asp", "\t    Matching: "));
+      asp::match_interest_points( ip1_copy, ip2_copy, matched_ip1, matched_ip2, 0.6,
+                                  asp::default_match_checks, 0,
+                                  TerminalProgressCallback( "asp", "\t    Matching: ") );
       vw_out(InfoMessage) << "\t    " << matched_ip1.size() << " putative matches.\n";
 
       vw_out() << "\t    * Rejecting outliers using RANSAC.\n";
@@ -165,6 +184,24 @@ namespace vw {
 
       vw_out() << "\t    * Caching matches: " << match_file << "\n";
       write_binary_match_file( match_file, matched_ip1, matched_ip2);
+      ip_cache.store();
+    }
+
+    if ( !left_window.empty() ) {
+      std::vector<ip::InterestPoint> window_ip1, window_ip2;
+      for ( size_t i = 0; i < matched_ip1.size(); i++ ) {
+        if ( left_window.contains( i_scale*Vector2f( matched_ip1[i].x, matched_ip1[i].y ) ) ) {
+          window_ip1.push_back( matched_ip1[i] );
+          window_ip2.push_back( matched_ip2[i] );
+        }
+      }
+      vw_out() << "\t    * " << window_ip1.size() << " matches inside the crop window.\n";
+      if ( window_ip1.size() >= 8 ) {
+        matched_ip1 = window_ip1;
+        matched_ip2 = window_ip2;
+      } else {
+        vw_out() << "\t    * Too few, using matches from the whole image.\n";
+      }
     }
 
     // Find search window based on interest point matches
@@ -187,10 +224,10 @@ namespace vw {
   // Correlator View
   template <class FilterT>
     inline stereo::CorrelatorView<PixelGray<float>,vw::uint8,FilterT>
-    correlator_helper( DiskImageView<PixelGray<float> > & left_disk_image,
-                       DiskImageView<PixelGray<float> > & right_disk_image,
-                       DiskImageView<vw::uint8> & left_mask,
-                       DiskImageView<vw::uint8> & right_mask,
+    correlator_helper( ImageViewRef<PixelGray<float> > const& left_disk_image,
+                       ImageViewRef<PixelGray<float> > const& right_disk_image,
+                       ImageViewRef<vw::uint8> const& left_mask,
+                       ImageViewRef<vw::uint8> const& right_mask,
                        FilterT const& filter_func, vw::BBox2i & search_range,
                        stereo::CorrelatorType const& cost_mode,
                        bool draft_mode,
@@ -217,97 +254,505 @@ namespace vw {
     return corr_view;
   }
 
-  void stereo_correlation( Options& opt ) {
+  // Settings for COST_MODE 3 (semi-global matching), 4 (census block
+  // matching), 5 (semi-global matching of census costs) and 6
+  // (normalized cross correlation block matching).
+  inline asp::SgmSettings sgm_settings() {
+    int cost_mode = stereo_settings().cost_mode;
+    asp::SgmSettings settings;
+    settings.kernel    = Vector2i( stereo_settings().h_kern, stereo_settings().v_kern );
+    settings.penalty1  = stereo_settings().sgm_penalty1;
+    settings.penalty2  = stereo_settings().sgm_penalty2;
+    settings.num_paths = cost_mode == 4 || cost_mode == 6 ? 0 : stereo_settings().sgm_paths;
+    settings.cost      = cost_mode == 6 ? asp::NCC_COST :
+                         cost_mode >= 4 ? asp::CENSUS_COST : asp::ABS_DIFF_COST;
+    settings.lr_threshold = stereo_settings().xcorr_threshold;
+    settings.max_volume_bytes = size_t( std::max( stereo_settings().sgm_memory_cap_mb, 1 ) ) * 1024 * 1024;
+    return settings;
+  }
 
-    vw_out() << "\n[ " << current_posix_time_string()
-             << " ] : Stage 1 --> CORRELATION \n";
+  // Whether COST_MODE compares census signatures, which need no
+  // preprocessing filter.
+  inline bool census_cost() {
+    return sgm_settings().cost == asp::CENSUS_COST && stereo_settings().cost_mode >= 3;
+  }
+
+  // Whether correlation can read the images prefiltered by stereo_pprc.
+  // The pyramid correlator filters every level after downsampling it,
+  // which a filtered full resolution image can't stand in for, and
+  // census costs take the images unfiltered.
+  inline bool correlation_reads_filtered_images( Options const& opt ) {
+    if ( stereo_settings().cost_mode >= 3 )
+      return !census_cost();
+    return opt.optimized_correlator;
+  }
+
+  // Size of the subsampled images relative to the full ones.
+  inline float preview_scale( Options const& opt ) {
+    DiskImageView<uint8> l_sub(opt.out_prefix+"-L_sub.tif"), r_sub(opt.out_prefix+"-R_sub.tif");
+    DiskImageView<uint8> l_org(opt.out_prefix+"-L.tif"), r_org(opt.out_prefix+"-R.tif");
+    float sub_scale = 0;
+    sub_scale += float(l_sub.cols())/float(l_org.cols());
+    sub_scale += float(r_sub.cols())/float(r_org.cols());
+    sub_scale += float(l_sub.rows())/float(l_org.rows());
+    sub_scale += float(r_sub.rows())/float(r_org.rows());
+    return sub_scale / 4;
+  }
 
-    // Working out search range if need be
+  // Fill in opt.search_range, using interest points on the sub
+  // images unless the user already defined it.
+  void correlation_search_range( Options& opt ) {
     if (stereo_settings().is_search_defined()) {
       vw_out() << "\t--> Using user defined search range: "
                << opt.search_range << "\n";
     } else {
       std::string l_sub_file = opt.out_prefix+"-L_sub.tif";
       std::string r_sub_file = opt.out_prefix+"-R_sub.tif";
-      float sub_scale = 0;
-      {
-        std::string l_org_file = opt.out_prefix+"-L.tif";
-        std::string r_org_file = opt.out_prefix+"-R.tif";
-        DiskImageView<uint8> l_sub(l_sub_file), r_sub(r_sub_file);
-        DiskImageView<uint8> l_org(l_org_file), r_org(r_org_file);
-        sub_scale += float(l_sub.cols())/float(l_org.cols());
-        sub_scale += float(r_sub.cols())/float(r_org.cols());
-        sub_scale += float(l_sub.rows())/float(l_org.rows());
-        sub_scale += float(r_sub.rows())/float(r_org.rows());
-        sub_scale /= 4;
-      }
+      float sub_scale = preview_scale( opt );
 
+      BBox2i left_window;
+      if ( !opt.left_image_crop_win.empty() ) {
+        DiskImageView<uint8> l_org( opt.out_prefix+"-L.tif" );
+        left_window = left_crop_window( opt, Vector2i( l_org.cols(), l_org.rows() ) );
+      }
       opt.search_range =
-        approximate_search_range( l_sub_file, r_sub_file, sub_scale );
+        approximate_search_range( l_sub_file, r_sub_file, sub_scale, left_window );
     }
+  }
 
+  // Wrap a correlator so each tile gets its range from the seed, if
+  // there is one.
+  template <class CorrViewT>
+  ImageViewRef<PixelMask<Vector2f> >
+  seeded_correlator( CorrViewT const& corr_view,
+                     boost::shared_ptr<asp::SearchRangeSeed> const& seed,
+                     Vector2i const& seed_offset ) {
+    if ( seed )
+      return asp::SeededCorrelatorView<CorrViewT>( corr_view, seed, seed_offset );
+    return corr_view;
+  }
 
-    DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
-      Rmask(opt.out_prefix + "-rMask.tif");
-
-    std::string filename_L = opt.out_prefix+"-L.tif",
-      filename_R = opt.out_prefix+"-R.tif";
-
-    /*
-      if (MEDIAN_FILTER==1){
-      filename_L = out_prefix+"-median-L.tif";
-      filename_R = out_prefix+"-median-R.tif";
-      } else { *.
-      filename_L = out_prefix+"-L.tif";
-      filename_R = out_prefix+"-R.tif";
-      }*/
-
-    DiskImageView<PixelGray<float> > left_disk_image(filename_L),
-      right_disk_image(filename_R);
-
-    ImageViewRef<PixelMask<Vector2f> > disparity_map;
+  // Correlate a pair with the preprocessing filter and cost mode chosen
+  // in stereo.default. seed_offset is where the left image starts in
+  // the image the seed was made for. Images that are prefiltered
+  // already, from open_filtered_images, aren't filtered again; only
+  // correlators for which correlation_reads_filtered_images holds can
+  // take them.
+  ImageViewRef<PixelMask<Vector2f> >
+  filtered_correlation( Options const& opt,
+                        ImageViewRef<PixelGray<float> > const& left_image,
+                        ImageViewRef<PixelGray<float> > const& right_image,
+                        ImageViewRef<vw::uint8> const& left_mask,
+                        ImageViewRef<vw::uint8> const& right_mask,
+                        BBox2i search_range, bool draft_mode,
+                        boost::shared_ptr<asp::SearchRangeSeed> const& seed =
+                          boost::shared_ptr<asp::SearchRangeSeed>(),
+                        Vector2i const& seed_offset = Vector2i(),
+                        bool prefiltered = false ) {
+    VW_ASSERT( !prefiltered || correlation_reads_filtered_images( opt ),
+               LogicErr() << "The pyramid correlator can't take prefiltered images." );
+    std::string debug_prefix = opt.corr_debug_prefix;
     stereo::CorrelatorType cost_mode = stereo::ABS_DIFF_CORRELATOR;
     if (stereo_settings().cost_mode == 1)
       cost_mode = stereo::SQR_DIFF_CORRELATOR;
     else if (stereo_settings().cost_mode == 2)
       cost_mode = stereo::NORM_XCORR_CORRELATOR;
 
-    if (stereo_settings().pre_filter_mode == 3) {
+    if (stereo_settings().cost_mode >= 3) {
+      // Census costs only see the order of intensities, which gain and
+      // bias don't change, so the images go in unfiltered.
+      bool census = census_cost();
+      bool filter = !prefiltered && !census;
+      vw_out() << "\t--> Using " << ( sgm_settings().num_paths ? "semi-global" : "block" )
+               << " matching";
+      if ( census )
+        vw_out() << " of census costs without a pre-processing filter.\n";
+      else
+        vw_out() << " after pre-processing filter " << stereo_settings().pre_filter_mode << ".\n";
+      asp::SemiGlobalMatchingView sgm( filter ? preprocessing_filter( left_image ) : left_image,
+                                       filter ? preprocessing_filter( right_image ) : right_image,
+                                       left_mask, right_mask, search_range, sgm_settings() );
+      vw_out() << sgm;
+      vw_out() << "\t--> Building Disparity map." << std::endl;
+      return seeded_correlator( sgm, seed, seed_offset );
+    }
+
+    int filter_mode = prefiltered ? 0 : stereo_settings().pre_filter_mode;
+    if (filter_mode == 3) {
       vw_out() << "\t--> Using SLOG pre-processing filter with "
                << stereo_settings().slogW << " sigma blur.\n";
-      disparity_map =
-        correlator_helper( left_disk_image, right_disk_image, Lmask, Rmask,
+      return seeded_correlator(
+        correlator_helper( left_image, right_image, left_mask, right_mask,
                            stereo::SlogStereoPreprocessingFilter(stereo_settings().slogW),
-                           opt.search_range, cost_mode, opt.draft_mode,
-                           opt.corr_debug_prefix, !opt.optimized_correlator );
-    } else if ( stereo_settings().pre_filter_mode == 2 ) {
+                           search_range, cost_mode, draft_mode,
+                           debug_prefix, !opt.optimized_correlator ),
+        seed, seed_offset );
+    } else if ( filter_mode == 2 ) {
       vw_out() << "\t--> Using LOG pre-processing filter with "
                << stereo_settings().slogW << " sigma blur.\n";
-      disparity_map =
-        correlator_helper( left_disk_image, right_disk_image, Lmask, Rmask,
+      return seeded_correlator(
+        correlator_helper( left_image, right_image, left_mask, right_mask,
                            stereo::LogStereoPreprocessingFilter(stereo_settings().slogW),
-                           opt.search_range, cost_mode, opt.draft_mode,
-                           opt.corr_debug_prefix, !opt.optimized_correlator );
-    } else if ( stereo_settings().pre_filter_mode == 1 ) {
+                           search_range, cost_mode, draft_mode,
+                           debug_prefix, !opt.optimized_correlator ),
+        seed, seed_offset );
+    } else if ( filter_mode == 1 ) {
       vw_out() << "\t--> Using BLUR pre-processing filter with "
                << stereo_settings().slogW << " sigma blur.\n";
-      disparity_map =
-        correlator_helper( left_disk_image, right_disk_image, Lmask, Rmask,
+      return seeded_correlator(
+        correlator_helper( left_image, right_image, left_mask, right_mask,
                            stereo::BlurStereoPreprocessingFilter(stereo_settings().slogW),
-                           opt.search_range, cost_mode, opt.draft_mode,
-                           opt.corr_debug_prefix, !opt.optimized_correlator );
-    } else {
+                           search_range, cost_mode, draft_mode,
+                           debug_prefix, !opt.optimized_correlator ),
+        seed, seed_offset );
+    }
+    if ( prefiltered )
+      vw_out() << "\t--> Using the images prefiltered with filter "
+               << stereo_settings().pre_filter_mode << "." << std::endl;
+    else
       vw_out() << "\t--> Using NO pre-processing filter." << std::endl;
-      disparity_map =
-        correlator_helper( left_disk_image, right_disk_image, Lmask, Rmask,
-                           stereo::NullStereoPreprocessingFilter(),
-                           opt.search_range, cost_mode, opt.draft_mode,
-                           opt.corr_debug_prefix, !opt.optimized_correlator );
+    return seeded_correlator(
+      correlator_helper( left_image, right_image, left_mask, right_mask,
+                         stereo::NullStereoPreprocessingFilter(),
+                         search_range, cost_mode, draft_mode,
+                         debug_prefix, !opt.optimized_correlator ),
+      seed, seed_offset );
+  }
+
+  // Project the SEED_DEM posts into the session's cameras for a seed
+  // the size of the subsampled left image.
+  ImageView<PixelMask<Vector2f> > dem_seed( Options const& opt, float sub_scale ) {
+    std::string const& dem_file = stereo_settings().seed_dem;
+    if ( dem_file.empty() )
+      vw_throw( ArgumentErr() << "SEED_MODE 2 needs a DEM in SEED_DEM.\n" );
+
+    DiskImageResourceGDAL dem_rsrc( dem_file );
+    cartography::GeoReference georef;
+    if ( !cartography::read_georeference( georef, dem_rsrc ) )
+      vw_throw( ArgumentErr() << "SEED_DEM " << dem_file << " has no georeference.\n" );
+    ImageViewRef<PixelMask<float> > dem;
+    if ( dem_rsrc.has_nodata_read() )
+      dem = create_mask( DiskImageView<float>( dem_file ), float( dem_rsrc.nodata_read() ) );
+    else
+      dem = pixel_cast<PixelMask<float> >( DiskImageView<float>( dem_file ) );
+
+    // The seed is rendered here, so the ISIS cameras are done with
+    // before the lock is released.
+    boost::scoped_ptr<Mutex::Lock> isis_lock;
+    if ( opt.stereo_session_string == "isis" )
+      isis_lock.reset( new Mutex::Lock( isis_mutex() ) );
+    boost::shared_ptr<camera::CameraModel> left_camera, right_camera;
+    opt.session->camera_models( left_camera, right_camera );
+    DiskImageView<PixelGray<float> > left_sub( opt.out_prefix+"-L_sub.tif" );
+    return asp::dem_disparity_seed( dem, georef, *left_camera, *right_camera,
+                                    opt.session->right_alignment_matrix(),
+                                    Vector2i( left_sub.cols(), left_sub.rows() ), sub_scale );
+  }
+
+  // With SEED_MODE 1, correlate the subsampled images over the search
+  // range scaled down to their size and save the result as
+  // -D_sub.tif. With SEED_MODE 2 the seed is projected from a prior
+  // DEM instead. It seeds the search range of every full resolution
+  // tile. Correlation workers only read the seed their coordinator
+  // wrote before starting them, so that they don't all write it at
+  // once.
+  boost::shared_ptr<asp::SearchRangeSeed> correlation_seed( Options const& opt ) {
+    boost::shared_ptr<asp::SearchRangeSeed> seed;
+    if ( !stereo_settings().seed_mode )
+      return seed;
+
+    std::string seed_file = opt.out_prefix + "-D_sub.tif";
+    float sub_scale = preview_scale( opt );
+    if ( opt.num_workers > 1 ) {
+      if ( !fs::exists( seed_file ) )
+        vw_throw( IOErr() << "Correlation worker " << opt.worker_index << " needs the seed "
+                  << seed_file << ". Run stereo_corr with --corr-processes to write it, "
+                  << "or copy it from the machine that did." );
+    } else if ( stereo_settings().seed_mode == 2 ) {
+      vw_out() << "\t--> Projecting " << stereo_settings().seed_dem
+               << " to seed the search range.\n";
+      asp::TraceScope trace( "Seed", "stage" );
+      asp::block_write_gdal_image( seed_file, dem_seed( opt, sub_scale ), opt,
+                                   TerminalProgressCallback("asp", "\t--> Seed :") );
+    } else {
+      vw_out() << "\t--> Correlating subsampled images to seed the search range.\n";
+      asp::TraceScope trace( "Seed", "stage" );
+      DiskImageView<PixelGray<float> > left_sub( opt.out_prefix+"-L_sub.tif" ),
+        right_sub( opt.out_prefix+"-R_sub.tif" );
+      BBox2i sub_range( Vector2i( int32( floor( opt.search_range.min().x() * sub_scale ) ) - 1,
+                                  int32( floor( opt.search_range.min().y() * sub_scale ) ) - 1 ),
+                        Vector2i( int32( ceil( opt.search_range.max().x() * sub_scale ) ) + 1,
+                                  int32( ceil( opt.search_range.max().y() * sub_scale ) ) + 1 ) );
+      // The previews have no masks of their own. Mismatches on nodata
+      // only widen the ranges they seed, which are cropped to the full
+      // search range anyway.
+      ImageViewRef<vw::uint8>
+        left_mask = constant_view( vw::uint8(255), left_sub.cols(), left_sub.rows() ),
+        right_mask = constant_view( vw::uint8(255), right_sub.cols(), right_sub.rows() );
+      asp::block_write_gdal_image( seed_file,
+                                   filtered_correlation( opt, left_sub, right_sub,
+                                                         left_mask, right_mask,
+                                                         sub_range, false ),
+                                   opt, TerminalProgressCallback("asp", "\t--> Seed :") );
     }
 
-    asp::block_write_gdal_image( opt.out_prefix + "-D.tif",
-                                 disparity_map, opt,
-                                 TerminalProgressCallback("asp", "\t--> Correlation :") );
+    seed.reset( new asp::SearchRangeSeed( DiskImageView<PixelMask<Vector2f> >( seed_file ),
+                                          sub_scale, opt.search_range,
+                                          stereo_settings().seed_margin ) );
+    vw_out() << "\t--> Seeded search ranges cover " << int( 100 * seed->coverage() )
+             << "% of the image.\n";
+    return seed;
+  }
+
+  // Build the integer disparity map as a lazy view. Nothing is
+  // rasterized here, so the caller decides whether it goes to disk or
+  // straight into the next stage.
+  ImageViewRef<PixelMask<Vector2f> > correlation_view( Options& opt ) {
+
+    correlation_search_range( opt );
+    boost::shared_ptr<asp::SearchRangeSeed> seed = correlation_seed( opt );
+
+    ImageViewRef<vw::uint8> Lmask = DiskImageView<vw::uint8>(opt.out_prefix + "-lMask.tif"),
+      Rmask = DiskImageView<vw::uint8>(opt.out_prefix + "-rMask.tif");
+    apply_crop_window( opt, Lmask, Rmask );
+
+    std::string filename_L = opt.out_prefix+"-L.tif",
+      filename_R = opt.out_prefix+"-R.tif";
+
+    /*
+      if (MEDIAN_FILTER==1){
+      filename_L = out_prefix+"-median-L.tif";
+      filename_R = out_prefix+"-median-R.tif";
+      } else { *.
+      filename_L = out_prefix+"-L.tif";
+      filename_R = out_prefix+"-R.tif";
+      }*/
+
+    ImageViewRef<PixelGray<float> > left_disk_image = asp::read_float_image(filename_L),
+      right_disk_image = asp::read_float_image(filename_R);
+    apply_crop_window( opt, left_disk_image, right_disk_image );
+    bool prefiltered = correlation_reads_filtered_images( opt ) &&
+      open_filtered_images( opt, left_disk_image, right_disk_image );
+
+    Vector2i seed_offset;
+    if ( seed && !opt.left_image_crop_win.empty() ) {
+      DiskImageView<vw::uint8> l_org( filename_L );
+      seed_offset = left_crop_window( opt, Vector2i( l_org.cols(), l_org.rows() ) ).min();
+    }
+
+    return filtered_correlation( opt, left_disk_image, right_disk_image, Lmask, Rmask,
+                                 opt.search_range, opt.draft_mode, seed, seed_offset,
+                                 prefiltered );
+  }
+
+  // Working set of one correlation tile. The correlator keeps the left
+  // tile and the right tile grown by the search range, both masks, the
+  // pyramids of all of them (a third more than the base level) and a
+  // few disparity images while it refines down the pyramid.
+  //
+  // Semi-global matching has no pyramids. Its blocks carry an overlap
+  // and a cost volume of at most a fixed size, whatever the tile. Block
+  // matching only keeps the best cost and disparity of each pixel. The
+  // left-right check keeps the same for the right pixels, and grows
+  // the blocks by the search range.
+  inline asp::TileCost correlation_tile_cost( Options const& opt ) {
+    double image_bytes = ( sizeof(PixelGray<float>) + sizeof(vw::uint8) ) * 4.0 / 3.0;
+    int32 search = std::max( opt.search_range.width(), opt.search_range.height() );
+    int32 kernel = std::max( stereo_settings().h_kern, stereo_settings().v_kern );
+    if ( stereo_settings().cost_mode >= 3 ) {
+      asp::SgmSettings settings = sgm_settings();
+      // Census signatures, or window sums and variances and the
+      // buffers they are computed in.
+      double cost_bytes = settings.cost == asp::CENSUS_COST ? 2 * sizeof(asp::CensusSignature) :
+        settings.cost == asp::NCC_COST ? 8 * sizeof(float) : 0;
+      bool check = settings.lr_threshold >= 0;
+      double check_bytes = check ? sizeof(float) + sizeof(int32) : 0;
+      if ( settings.num_paths == 0 )
+        return asp::TileCost( 2 * ( sizeof(PixelGray<float>) + sizeof(vw::uint8) ) + cost_bytes +
+                              check_bytes + 3 * sizeof(float) + sizeof(PixelMask<Vector2f>),
+                              search / 2 + kernel + ( check ? search : 0 ) );
+      return asp::TileCost( 2 * ( sizeof(PixelGray<float>) + sizeof(vw::uint8) ) + cost_bytes +
+                            check_bytes + 2 * sizeof(PixelMask<Vector2f>),
+                            search / 2 + kernel + std::max( settings.overlap, check ? search : 0 ),
+                            settings.max_volume_bytes );
+    }
+    return asp::TileCost( 2 * image_bytes + 3 * sizeof(PixelMask<Vector2f>),
+                          search / 2 + kernel );
+  }
+
+  // Correlation tiles are at most this large. Bigger tiles don't help
+  // the pyramid correlator and make worker splits coarse.
+  const vw::int32 MAX_CORRELATION_TILE = 1024;
+
+  // Partial disparity written by one correlation worker.
+  inline std::string worker_disparity_filename( Options const& opt,
+                                                vw::uint32 worker_index ) {
+    std::ostringstream ostr;
+    ostr << opt.out_prefix << "-D-worker" << worker_index << ".tif";
+    return ostr.str();
+  }
+
+  // Key of the disparity correlation writes: the images, masks and
+  // seed it is computed from, the search range and the settings.
+  inline asp::StageKey correlation_key( Options const& opt ) {
+    asp::StageKey key = resume_key( opt, "corr-v1" );
+    key.file( opt.out_prefix+"-L.tif" ).file( opt.out_prefix+"-R.tif" )
+      .file( opt.out_prefix+"-lMask.tif" ).file( opt.out_prefix+"-rMask.tif" );
+    if ( stereo_settings().seed_mode )
+      key.file( opt.out_prefix+"-D_sub.tif" );
+    return key;
+  }
+
+  // What one correlation worker was asked to do: its share of the
+  // tiles, the search range and the images it correlated. A worker
+  // records it next to its output (<output>.job) once the output is
+  // complete, and the coordinator only reuses outputs whose job
+  // matches its own.
+  inline std::string worker_job( Options const& opt, vw::uint32 worker_index,
+                                 vw::uint32 num_workers ) {
+    std::ostringstream ostr;
+    ostr << "worker " << worker_index << " of " << num_workers
+         << " range " << opt.search_range << " inputs " << correlation_key( opt ).str();
+    return ostr.str();
+  }
+
+  inline std::string worker_job_filename( std::string const& worker_file ) {
+    return worker_file + ".job";
+  }
+
+  // True if worker_file is a complete output of the given job.
+  inline bool worker_output_matches( std::string const& worker_file, std::string const& job ) {
+    if ( !fs::exists( worker_file ) ||
+         fs::exists( asp::TileManifest::manifest_filename( worker_file ) ) )
+      return false;
+    std::ifstream input( worker_job_filename( worker_file ).c_str() );
+    std::string recorded;
+    return input && std::getline( input, recorded ) && recorded == job;
+  }
+
+  // Presents the partial disparities written by the correlation
+  // workers as one image. Each tile is read from the worker that owns
+  // it, following the same tile_index split the workers used.
+  class WorkerMergeView : public ImageViewBase<WorkerMergeView> {
+    std::vector<DiskImageView<PixelMask<Vector2f> > > m_workers;
+    Vector2i m_tile_size;
+
+    DiskImageView<PixelMask<Vector2f> > const& owner( int32 i, int32 j ) const {
+      BBox2i tile( (i / m_tile_size[0]) * m_tile_size[0],
+                   (j / m_tile_size[1]) * m_tile_size[1], 1, 1 );
+      return m_workers[ asp::tile_index( tile, m_tile_size, cols() ) %
+                        m_workers.size() ];
+    }
+
+  public:
+    typedef PixelMask<Vector2f> pixel_type;
+    typedef pixel_type result_type;
+    typedef ProceduralPixelAccessor<WorkerMergeView> pixel_accessor;
+
+    WorkerMergeView( Options const& opt, vw::uint32 num_workers ) :
+      m_tile_size( opt.raster_tile_size ) {
+      for ( vw::uint32 i = 0; i < num_workers; i++ )
+        m_workers.push_back( DiskImageView<pixel_type>( worker_disparity_filename( opt, i ) ) );
+      for ( size_t i = 1; i < m_workers.size(); i++ )
+        if ( m_workers[i].cols() != m_workers[0].cols() ||
+             m_workers[i].rows() != m_workers[0].rows() )
+          vw_throw( IOErr() << "Correlation worker outputs differ in size." );
+    }
+
+    inline int32 cols() const { return m_workers[0].cols(); }
+    inline int32 rows() const { return m_workers[0].rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this,0,0); }
+    inline result_type operator()( int32 i, int32 j, int32 p=0 ) const {
+      return owner(i,j)(i,j,p);
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      ImageView<pixel_type> buffer( bbox.width(), bbox.height() );
+      for ( int32 y = (bbox.min().y() / m_tile_size[1]) * m_tile_size[1];
+            y < bbox.max().y(); y += m_tile_size[1] ) {
+        for ( int32 x = (bbox.min().x() / m_tile_size[0]) * m_tile_size[0];
+              x < bbox.max().x(); x += m_tile_size[0] ) {
+          BBox2i tile( x, y, m_tile_size[0], m_tile_size[1] );
+          tile.crop( bbox );
+          crop( buffer, BBox2i( tile.min() - bbox.min(), tile.max() - bbox.min() ) ) =
+            crop( owner(x,y), tile );
+        }
+      }
+      return prerasterize_type( buffer, -bbox.min().x(), -bbox.min().y(),
+                                cols(), rows() );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  void stereo_correlation( Options& opt ) {
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stage 1 --> CORRELATION \n";
+    asp::TraceScope trace( "Correlation", "stage" );
+
+    ImageViewRef<PixelMask<Vector2f> > disparity_map = correlation_view( opt );
+    asp::TilePlan plan = asp::plan_stage_tiles( "Correlation", correlation_tile_cost( opt ),
+                                                opt, MAX_CORRELATION_TILE );
+    Options stage_opt = asp::stage_options( opt, plan );
+
+    if ( opt.num_workers > 1 ) {
+      vw_out() << "\t--> Correlation worker " << opt.worker_index << " of "
+               << opt.num_workers << "\n";
+      asp::checkpoint_block_write_gdal_image( worker_disparity_filename( opt, opt.worker_index ),
+                                              disparity_map, stage_opt,
+                                              TerminalProgressCallback("asp", "\t--> Correlation :"),
+                                              plan.num_threads,
+                                              asp::TileJob( correlation_key( opt ).str(),
+                                                            opt.worker_index, opt.num_workers ) );
+      std::string worker_file = worker_disparity_filename( opt, opt.worker_index );
+      std::ofstream job( worker_job_filename( worker_file ).c_str() );
+      job << worker_job( opt, opt.worker_index, opt.num_workers ) << "\n";
+      if ( !job.flush() )
+        vw_throw( IOErr() << "Unable to write " << worker_job_filename( worker_file ) );
+      return;
+    }
+
+    asp::checkpoint_block_write_gdal_image( opt.out_prefix + "-D.tif",
+                                            disparity_map, stage_opt,
+                                            TerminalProgressCallback("asp", "\t--> Correlation :"),
+                                            plan.num_threads, asp::TileJob( correlation_key( opt ).str() ) );
+  }
+
+  // Combine the outputs of num_workers correlation workers into -D.tif
+  // and remove them.
+  void stereo_correlation_merge( Options const& opt, vw::uint32 num_workers ) {
+    vw_out() << "\t--> Merging " << num_workers << " correlation workers.\n";
+
+    // Workers plan their tile size from their own memory limit, so the
+    // split is recovered from the block size of their output.
+    Options merge_opt = opt;
+    for ( vw::uint32 i = 0; i < num_workers; i++ ) {
+      boost::scoped_ptr<DiskImageResource>
+        rsrc( DiskImageResource::open( worker_disparity_filename( opt, i ) ) );
+      if ( i == 0 )
+        merge_opt.raster_tile_size = rsrc->block_read_size();
+      else if ( rsrc->block_read_size() != merge_opt.raster_tile_size )
+        vw_throw( IOErr() << "Correlation workers used different tile sizes. "
+                  << "Give them the same --memory-limit and --threads." );
+    }
+
+    asp::StageKey merge_key = resume_key( opt, "corr-merge-v1" );
+    for ( vw::uint32 i = 0; i < num_workers; i++ )
+      merge_key.file( worker_disparity_filename( opt, i ) );
+    asp::checkpoint_block_write_gdal_image( opt.out_prefix + "-D.tif",
+                                            WorkerMergeView( merge_opt, num_workers ), merge_opt,
+                                            TerminalProgressCallback("asp", "\t--> Merging :"),
+                                            0, asp::TileJob( merge_key.str() ) );
+    for ( vw::uint32 i = 0; i < num_workers; i++ ) {
+      fs::remove( worker_disparity_filename( opt, i ) );
+      fs::remove( worker_job_filename( worker_disparity_filename( opt, i ) ) );
+    }
   }
 
 } //end namespace vw
@@ -55,12 +55,170 @@ namespace vw {
     }
   };
 
+  // How far outside a tile filtering_view reads its input. Each
+  // clean up pass looks one outlier kernel further out.
+  inline Vector2i filtering_halo() {
+    int passes = std::min( stereo_settings().rm_cleanup_passes, 5 );
+    return Vector2i( passes * stereo_settings().rm_h_half_kern + 1,
+                     passes * stereo_settings().rm_v_half_kern + 1 );
+  }
+
+  // Working set of one filtering tile: a disparity buffer for every
+  // clean up pass and both masks.
+  inline asp::TileCost filtering_tile_cost() {
+    Vector2i halo = filtering_halo();
+    int passes = std::min( stereo_settings().rm_cleanup_passes, 5 );
+    return asp::TileCost( ( passes + 1 ) * sizeof(PixelMask<Vector2f>) + 2 * sizeof(vw::uint8),
+                          std::max( halo[0], halo[1] ) );
+  }
+
+  // Outlier removal and edge masking of a raw disparity map. All of
+  // this works tile by tile, so the result is returned as a lazy view.
+  ImageViewRef<PixelMask<Vector2f> >
+  filtering_view( Options const& opt,
+                  ImageViewRef<PixelMask<Vector2f> > const& disparity_input ) {
+
+    // Applying additional clipping from the edge. We make new
+    // mask files to avoid a weird and tricky segfault due to
+    // ownership issues.
+    DiskImageView<vw::uint8> left_mask( opt.out_prefix+"-lMask.tif" );
+    DiskImageView<vw::uint8> right_mask( opt.out_prefix+"-rMask.tif" );
+    int mask_buffer = std::max( stereo_settings().subpixel_h_kern,
+                                stereo_settings().subpixel_v_kern );
+
+    // This is light weight .. don't worry about caching. All cost
+    // is on construction of the edge_mask.
+    ImageViewRef<vw::uint8> Rmaskmore =
+      apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024));
+    ImageViewRef<vw::uint8> Lmaskmore;
+    if ( opt.left_image_crop_win.empty() ) {
+      Lmaskmore = apply_mask(asp::threaded_edge_mask(left_mask,0,mask_buffer,1024));
+    } else {
+      // Only the window and the buffer around it are searched for
+      // edges. The left mask is invalid beyond that anyway.
+      BBox2i window = left_crop_window( opt, Vector2i( left_mask.cols(), left_mask.rows() ) );
+      BBox2i expanded = window;
+      expanded.expand( mask_buffer );
+      expanded.crop( BBox2i( 0, 0, left_mask.cols(), left_mask.rows() ) );
+      Lmaskmore =
+        crop(apply_mask(asp::threaded_edge_mask(crop(left_mask,expanded),0,mask_buffer,1024)),
+             window - expanded.min());
+      Rmaskmore = right_window_view( ImageViewRef<vw::uint8>( Rmaskmore ), window );
+    }
+
+    vw_out() << "\t--> Cleaning up disparity map prior to filtering processes (" << stereo_settings().rm_cleanup_passes << " pass).\n";
+    ImageViewRef<PixelMask<Vector2f> > disparity_map;
+    typedef ImageViewRef<PixelMask<Vector2f> > input_type;
+    if ( stereo_settings().rm_cleanup_passes == 1 )
+      disparity_map =
+        stereo::disparity_mask(MultipleDisparityCleanUp<input_type,1>()(
+              disparity_input,stereo_settings().rm_h_half_kern,
+              stereo_settings().rm_v_half_kern,
+              stereo_settings().rm_threshold,
+              stereo_settings().rm_min_matches/100.0),
+                               Lmaskmore, Rmaskmore);
+    else if ( stereo_settings().rm_cleanup_passes == 2 )
+      disparity_map =
+        stereo::disparity_mask(MultipleDisparityCleanUp<input_type,2>()(
+              disparity_input,stereo_settings().rm_h_half_kern,
+              stereo_settings().rm_v_half_kern,
+              stereo_settings().rm_threshold,
+              stereo_settings().rm_min_matches/100.0),
+                               Lmaskmore, Rmaskmore);
+    else if ( stereo_settings().rm_cleanup_passes == 3 )
+      disparity_map =
+        stereo::disparity_mask(MultipleDisparityCleanUp<input_type,3>()(
+              disparity_input,stereo_settings().rm_h_half_kern,
+              stereo_settings().rm_v_half_kern,
+              stereo_settings().rm_threshold,
+              stereo_settings().rm_min_matches/100.0),
+                               Lmaskmore, Rmaskmore);
+    else if ( stereo_settings().rm_cleanup_passes == 4 )
+      disparity_map =
+        stereo::disparity_mask(MultipleDisparityCleanUp<input_type,4>()(
+              disparity_input,stereo_settings().rm_h_half_kern,
+              stereo_settings().rm_v_half_kern,
+              stereo_settings().rm_threshold,
+              stereo_settings().rm_min_matches/100.0),
+                               Lmaskmore, Rmaskmore);
+    else if ( stereo_settings().rm_cleanup_passes >= 5 )
+      disparity_map =
+        stereo::disparity_mask(MultipleDisparityCleanUp<input_type,5>()(
+              disparity_input,stereo_settings().rm_h_half_kern,
+              stereo_settings().rm_v_half_kern,
+              stereo_settings().rm_threshold,
+              stereo_settings().rm_min_matches/100.0),
+                               Lmaskmore, Rmaskmore);
+    else
+      disparity_map =
+        stereo::disparity_mask(disparity_input,
+                               Lmaskmore, Rmaskmore);
+
+    return disparity_map;
+  }
+
+  // Write a subsampled preview of which pixels survived filtering.
+  template <class ViewT>
+  void write_good_pixel_map( Options const& opt,
+                             ImageViewBase<ViewT> const& filtered_disparity_map ) {
+    vw_out() << "\t--> Creating \"Good Pixel\" image: "
+             << (opt.out_prefix + "-GoodPixelMap.tif") << "\n";
+
+    // Sub-sampling so that the user can actually view it.
+    float sub_scale = 2048.0 / float( std::min( filtered_disparity_map.impl().cols(),
+                                                filtered_disparity_map.impl().rows() ) );
+    if ( sub_scale > 1 ) sub_scale = 1;
+    // Same model as the preprocessing previews, for a disparity input
+    // and a color output.
+    asp::TilePlan plan =
+      asp::plan_stage_tiles( "Good pixel map",
+                             asp::TileCost( 3.0 * ( sizeof(PixelMask<Vector2f>) + sizeof(PixelRGB<uint8>) ) /
+                                            (sub_scale*sub_scale) ),
+                             opt, vw_settings().default_tile_size() );
+    Options sub_opt = asp::stage_options( opt, plan );
+
+    ImageViewRef<PixelRGB<uint8> > good_pixel =
+      resample(stereo::missing_pixel_image(filtered_disparity_map.impl()),
+               sub_scale);
+    // Always written whole, so nothing is left to resume from. The
+    // thread count goes to the writer, not to the VW default, which
+    // pairs running beside this one in stereo_batch share.
+    std::string good_pixel_file = opt.out_prefix + "-GoodPixelMap.tif";
+    fs::remove( good_pixel_file );
+    fs::remove( asp::TileManifest::manifest_filename( good_pixel_file ) );
+    asp::checkpoint_block_write_gdal_image( good_pixel_file, good_pixel, sub_opt,
+                                            TerminalProgressCallback("asp", "\t    Writing: "),
+                                            plan.num_threads );
+  }
+
+  // Hole filling needs to see the entire filtered disparity map to
+  // find its blobs, so it should be handed something already
+  // rasterized (a DiskImageView or DiskCacheImageView).
+  template <class ViewT>
+  ImageViewRef<PixelMask<Vector2f> >
+  hole_fill_view( ImageViewBase<ViewT> const& filtered_disparity_map ) {
+    if ( !stereo_settings().fill_holes )
+      return filtered_disparity_map.impl();
+
+    vw_out() << "\t--> Filling holes with Inpainting method.\n";
+    BlobIndexThreaded bindex( invert_mask( filtered_disparity_map.impl() ),
+                              stereo_settings().fill_hole_max_size );
+    vw_out() << "\t    * Identified " << bindex.num_blobs() << " holes\n";
+    return asp::InpaintView<ViewT>( filtered_disparity_map.impl(), bindex );
+  }
+
   void stereo_filtering( Options& opt ) {
     vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 3 --> FILTERING \n";
+    asp::TraceScope trace( "Filtering", "stage" );
 
     std::string post_correlation_fname;
     opt.session->pre_filtering_hook(opt.out_prefix+"-RD.tif",
                                     post_correlation_fname);
+    asp::TilePlan plan =
+      asp::plan_stage_tiles( "Filtering", filtering_tile_cost(), opt,
+                             vw_settings().default_tile_size() );
+    Options stage_opt = asp::stage_options( opt, plan );
+    asp::TileJob job( resume_key( opt, "fltr-v1" ).file( post_correlation_fname ).str() );
 
     try {
 
@@ -70,69 +228,9 @@ namespace vw {
       {
         // Apply filtering for high frequencies
         DiskImageView<PixelMask<Vector2f> > disparity_disk_image(post_correlation_fname);
-
-        // Applying additional clipping from the edge. We make new
-        // mask files to avoid a weird and tricky segfault due to
-        // ownership issues.
-        DiskImageView<vw::uint8> left_mask( opt.out_prefix+"-lMask.tif" );
-        DiskImageView<vw::uint8> right_mask( opt.out_prefix+"-rMask.tif" );
-        int mask_buffer = std::max( stereo_settings().subpixel_h_kern,
-                                    stereo_settings().subpixel_v_kern );
-
-        // This is light weight .. don't worry about caching. All cost
-        // is on construction of the edge_mask.
-        ImageViewRef<vw::uint8> Lmaskmore =
-          apply_mask(asp::threaded_edge_mask(left_mask,0,mask_buffer,1024));
-        ImageViewRef<vw::uint8> Rmaskmore =
-          apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024));
-
-        vw_out() << "\t--> Cleaning up disparity map prior to filtering processes (" << stereo_settings().rm_cleanup_passes << " pass).\n";
-        ImageViewRef<PixelMask<Vector2f> > disparity_map;
-        typedef DiskImageView<PixelMask<Vector2f> > input_type;
-        if ( stereo_settings().rm_cleanup_passes == 1 )
-          disparity_map =
-            stereo::disparity_mask(MultipleDisparityCleanUp<input_type,1>()(
-                  disparity_disk_image,stereo_settings().rm_h_half_kern,
-                  stereo_settings().rm_v_half_kern,
-                  stereo_settings().rm_threshold,
-                  stereo_settings().rm_min_matches/100.0),
-                                   Lmaskmore, Rmaskmore);
-        else if ( stereo_settings().rm_cleanup_passes == 2 )
-          disparity_map =
-            stereo::disparity_mask(MultipleDisparityCleanUp<input_type,2>()(
-                  disparity_disk_image,stereo_settings().rm_h_half_kern,
-                  stereo_settings().rm_v_half_kern,
-                  stereo_settings().rm_threshold,
-                  stereo_settings().rm_min_matches/100.0),
-                                   Lmaskmore, Rmaskmore);
-        else if ( stereo_settings().rm_cleanup_passes == 3 )
-          disparity_map =
-            stereo::disparity_mask(MultipleDisparityCleanUp<input_type,3>()(
-                  disparity_disk_image,stereo_settings().rm_h_half_kern,
-                  stereo_settings().rm_v_half_kern,
-                  stereo_settings().rm_threshold,
-                  stereo_settings().rm_min_matches/100.0),
-                                   Lmaskmore, Rmaskmore);
-        else if ( stereo_settings().rm_cleanup_passes == 4 )
-          disparity_map =
-            stereo::disparity_mask(MultipleDisparityCleanUp<input_type,4>()(
-                  disparity_disk_image,stereo_settings().rm_h_half_kern,
-                  stereo_settings().rm_v_half_kern,
-                  stereo_settings().rm_threshold,
-                  stereo_settings().rm_min_matches/100.0),
-                                   Lmaskmore, Rmaskmore);
-        else if ( stereo_settings().rm_cleanup_passes >= 5 )
-          disparity_map =
-            stereo::disparity_mask(MultipleDisparityCleanUp<input_type,5>()(
-                  disparity_disk_image,stereo_settings().rm_h_half_kern,
-                  stereo_settings().rm_v_half_kern,
-                  stereo_settings().rm_threshold,
-                  stereo_settings().rm_min_matches/100.0),
-                                   Lmaskmore, Rmaskmore);
-        else
-          disparity_map =
-            stereo::disparity_mask(disparity_disk_image,
-                                   Lmaskmore, Rmaskmore);
+        ImageViewRef<PixelMask<Vector2f> > disparity_map =
+          filtering_view( opt, asp::trace_read( disparity_disk_image,
+                                                post_correlation_fname ) );
 
         if ( stereo_settings().mask_flatfield ) {
           // This is only turned on for apollo. Blob detection doesn't
@@ -153,73 +251,33 @@ namespace vw {
           ImageViewRef<PixelMask<Vector2f> > erode_disp_map;
           erode_disp_map = ErodeView<DiskCacheImageView<PixelMask<Vector2f> > >(filtered_disp, bindex );
           //erode_disp_map = filtered_disp;
-          asp::block_write_gdal_image( opt.out_prefix+"-FTemp.tif",
-                                       erode_disp_map, opt,
-                                       TerminalProgressCallback("asp", "\t--> Eroding: ") );
+          asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-FTemp.tif",
+                                                  erode_disp_map, stage_opt,
+                                                  TerminalProgressCallback("asp", "\t--> Eroding: "),
+                                                  plan.num_threads, job );
         } else {
-          asp::block_write_gdal_image( opt.out_prefix+"-FTemp.tif",
-                                       disparity_map, opt,
-                                       TerminalProgressCallback("asp", "\t--> Filtering: ") );
+          asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-FTemp.tif",
+                                                  disparity_map, stage_opt,
+                                                  TerminalProgressCallback("asp", "\t--> Filtering: "),
+                                                  plan.num_threads, job );
         }
       }
 
       DiskImageView<PixelMask<Vector2f> > filtered_disparity_map( opt.out_prefix+"-FTemp.tif" );
 
-      { // Write Good Pixel Map
-        vw_out() << "\t--> Creating \"Good Pixel\" image: "
-                 << (opt.out_prefix + "-GoodPixelMap.tif") << "\n";
-        {
-          // Sub-sampling so that the user can actually view it.
-          float sub_scale = 2048.0 / float( std::min( filtered_disparity_map.cols(),
-                                                      filtered_disparity_map.rows() ) );
-          if ( sub_scale > 1 ) sub_scale = 1;
-          // Solving for the number of threads and the tile size to use for
-          // subsampling while only using 500 MiB of memory. (The cache code
-          // is a little slow on releasing so it will probably use 1.5GiB
-          // memory during subsampling) Also tile size must be a power of 2
-          // and greater than or equal to 64 px;
-          uint32 previous_num_threads = vw_settings().default_num_threads();
-          uint32 sub_threads = previous_num_threads + 1;
-          uint32 tile_power = 0;
-          while ( tile_power < 6 && sub_threads > 1) {
-            sub_threads--;
-            tile_power = boost::numeric_cast<uint32>( log10(500e6*sub_scale*sub_scale/(4.0*float(sub_threads)))/(2*log10(2)));
-          }
-          uint32 sub_tile_size = 1 << tile_power;
-          if ( sub_tile_size > vw_settings().default_tile_size() )
-            sub_tile_size = vw_settings().default_tile_size();
-
-          ImageViewRef<PixelRGB<uint8> > good_pixel =
-            resample(stereo::missing_pixel_image(filtered_disparity_map),
-                     sub_scale);
-          vw_settings().set_default_num_threads(sub_threads);
-          DiskImageResourceGDAL good_pixel_rsrc( opt.out_prefix + "-GoodPixelMap.tif",
-                                                 good_pixel.format(),
-                                                 Vector2i(sub_tile_size,
-                                                          sub_tile_size ),
-                                                 opt.gdal_options );
-          block_write_image( good_pixel_rsrc, good_pixel,
-                             TerminalProgressCallback("asp", "\t    Writing: "));
-          vw_settings().set_default_num_threads(previous_num_threads);
-        }
-      }
+      // Write Good Pixel Map
+      write_good_pixel_map( opt, filtered_disparity_map );
 
       // Fill Holes
-      ImageViewRef<PixelMask<Vector2f> > hole_filled_disp_map;
-      if(stereo_settings().fill_holes) {
-        vw_out() << "\t--> Filling holes with Inpainting method.\n";
-        BlobIndexThreaded bindex( invert_mask( filtered_disparity_map ),
-                                  stereo_settings().fill_hole_max_size );
-        vw_out() << "\t    * Identified " << bindex.num_blobs() << " holes\n";
-        hole_filled_disp_map =
-          asp::InpaintView<DiskImageView<PixelMask<Vector2f> > >(filtered_disparity_map, bindex );
-      } else {
-        hole_filled_disp_map = filtered_disparity_map;
-      }
+      ImageViewRef<PixelMask<Vector2f> > hole_filled_disp_map =
+        hole_fill_view( filtered_disparity_map );
 
-      asp::block_write_gdal_image( opt.out_prefix + "-F.tif",
-                                   hole_filled_disp_map, opt,
-                                   TerminalProgressCallback("asp", "\t--> Filtering: ") );
+      asp::checkpoint_block_write_gdal_image( opt.out_prefix + "-F.tif",
+                                              hole_filled_disp_map, stage_opt,
+                                              TerminalProgressCallback("asp", "\t--> Filtering: "),
+                                              plan.num_threads,
+                                              asp::TileJob( resume_key( opt, "fltr-fill-v1" )
+                                                            .file( opt.out_prefix+"-FTemp.tif" ).str() ) );
 
       // Delete temporary file
       std::string temp_file =  opt.out_prefix+"-FTemp.tif";
@@ -0,0 +1,57 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file stereo_fused.cc
+///
+
+#include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_fused.h>
+
+using namespace vw;
+
+namespace vw {
+  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+int main(int argc, char* argv[]) {
+
+  stereo_register_sessions();
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
+
+    // user safety check
+    //---------------------------------------------------------
+    try {
+      boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
+      opt.session->camera_models(camera_model1,camera_model2);
+
+      // Do the cameras appear to be in the same location?
+      if ( norm_2(camera_model1->camera_center(Vector2()) -
+                  camera_model2->camera_center(Vector2())) < 1e-3 )
+        vw_out(WarningMessage,"console")
+          << "Your cameras appear to be in the same location!\n"
+          << "\tYou should double check your given camera\n"
+          << "\tmodels as most likely stereo won't be able\n"
+          << "\tto triangulate or perform epipolar rectification.\n";
+    } catch ( camera::PixelToRayErr const& e ) {
+    } catch ( camera::PointToPixelErr const& e ) {
+      // Silent. Top Left pixel might not be valid on a map
+      // projected image.
+    }
+
+    // Internal Processes
+    //---------------------------------------------------------
+    stereo_fused( opt );
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : FUSED STEREO FINISHED \n";
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -0,0 +1,298 @@
+// __BEGIN_LICENSE__
+// Copyright (C) 2006-2011 United States Government as represented by
+// the Administrator of the National Aeronautics and Space Administration.
+// All Rights Reserved.
+// __END_LICENSE__
+
+
+/// \file stereo_fused.h
+
+#ifndef __ASP_STEREO_FUSED_H__
+#define __ASP_STEREO_FUSED_H__
+
+#include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_correlation.h>
+#include <asp/Tools/stereo_refinement.h>
+#include <asp/Tools/stereo_filtering.h>
+#include <asp/Tools/stereo_triangulation.h>
+#include <asp/Core/TileDag.h>
+
+#include <boost/bind.hpp>
+
+#include <set>
+
+namespace vw {
+
+  // Parse the --fused-outputs list into a set of file suffixes.
+  inline std::set<std::string> fused_output_set( Options const& opt ) {
+    std::vector<std::string> tokens;
+    boost::split( tokens, opt.fused_outputs, boost::is_any_of(", "),
+                  boost::token_compress_on );
+    std::set<std::string> outputs;
+    BOOST_FOREACH( std::string const& token, tokens ) {
+      if ( token.empty() )
+        continue;
+      if ( token != "D" && token != "RD" && token != "F" &&
+           token != "GoodPixelMap" && token != "PC" )
+        vw_throw( ArgumentErr() << "Unknown fused output \"" << token
+                  << "\". Options are: D RD F GoodPixelMap PC\n" );
+      outputs.insert( token );
+    }
+    return outputs;
+  }
+
+  // Key of a fused product: the preprocessed images and masks
+  // everything is computed from.
+  inline asp::TileJob fused_job( Options const& opt, std::string const& product ) {
+    return asp::TileJob( resume_key( opt, "fused-" + product + "-v1" )
+                         .file( opt.out_prefix+"-L.tif" ).file( opt.out_prefix+"-R.tif" )
+                         .file( opt.out_prefix+"-lMask.tif" ).file( opt.out_prefix+"-rMask.tif" )
+                         .str() );
+  }
+
+  // Write a requested intermediate product and carry on from the copy
+  // on disk, so the work behind it is never done twice.
+  inline ImageViewRef<PixelMask<Vector2f> >
+  fused_checkpoint( Options const& opt, std::string const& suffix,
+                    ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                    std::string const& tag ) {
+    asp::checkpoint_block_write_gdal_image( opt.out_prefix + "-" + suffix + ".tif",
+                                            disparity, opt,
+                                            TerminalProgressCallback("asp", "\t--> " + tag + " :"),
+                                            0, fused_job( opt, suffix ) );
+    return DiskImageView<PixelMask<Vector2f> >( opt.out_prefix + "-" + suffix + ".tif" );
+  }
+
+  // Every stage renders a tile at the same time, and finished tiles of
+  // the earlier stages wait in memory for their readers, about two
+  // per stage and thread.
+  inline asp::TileCost fused_tile_cost( Options const& opt ) {
+    asp::TileCost cost = correlation_tile_cost( opt );
+    cost += refinement_tile_cost();
+    cost += filtering_tile_cost();
+    cost += triangulation_tile_cost();
+    cost += asp::TileCost( 3 * 2 * sizeof(PixelMask<Vector2f>) );
+    return cost;
+  }
+
+  // Run correlation, refinement, filtering and triangulation as one
+  // chain of views. Each stage reads its input tiles (plus halo) from
+  // the previous stage through a block cache instead of a file. This
+  // is only used for MASK_FLATFIELD, whose hooks need -RD.tif and
+  // -F.tif on disk between stages.
+  //
+  // Erosion and hole filling need to see the entire disparity map, so
+  // when they are enabled the filtered disparity is rasterized to a
+  // temporary file in CACHE_DIR first.
+  void stereo_fused_lazy( Options& opt, std::set<std::string> const& outputs ) {
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stage 1 --> CORRELATION (fused)\n";
+    ImageViewRef<PixelMask<Vector2f> > disparity = correlation_view( opt );
+    asp::TilePlan plan =
+      asp::plan_stage_tiles( "Fused", fused_tile_cost( opt ), opt, MAX_CORRELATION_TILE );
+    Options stage_opt = asp::stage_options( opt, plan );
+    Vector2i block_size = stage_opt.raster_tile_size;
+    disparity = block_cache( disparity, block_size, 0 );
+    if ( outputs.count("D") )
+      disparity = fused_checkpoint( stage_opt, "D", disparity, "Correlation" );
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stage 2 --> REFINEMENT (fused)\n";
+    disparity = block_cache( refinement_view( opt, disparity ), block_size, 0 );
+    if ( outputs.count("RD") ) {
+      disparity = fused_checkpoint( stage_opt, "RD", disparity, "Refinement" );
+      std::string post_correlation_fname;
+      opt.session->pre_filtering_hook( opt.out_prefix+"-RD.tif",
+                                       post_correlation_fname );
+      disparity = DiskImageView<PixelMask<Vector2f> >( post_correlation_fname );
+    }
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stage 3 --> FILTERING (fused)\n";
+    disparity = filtering_view( opt, disparity );
+    if ( stereo_settings().mask_flatfield || stereo_settings().fill_holes ||
+         outputs.count("GoodPixelMap") ) {
+      vw_out() << "\t--> Rasterizing filtered disparity to "
+               << stereo_settings().cache_dir << " for blob processing.\n";
+      DiskCacheImageView<PixelMask<Vector2f> >
+        filtered_disp( disparity, "tif",
+                       TerminalProgressCallback("asp","\t  Intermediate:"),
+                       stereo_settings().cache_dir );
+      if ( stereo_settings().mask_flatfield ) {
+        BlobIndexThreaded bindex( filtered_disp,
+                                  stereo_settings().erode_max_size );
+        vw_out() << "\t    * Eroding " << bindex.num_blobs() << " islands\n";
+        DiskCacheImageView<PixelMask<Vector2f> >
+          eroded_disp( ErodeView<DiskCacheImageView<PixelMask<Vector2f> > >(filtered_disp, bindex ),
+                       "tif", TerminalProgressCallback("asp","\t  Eroding:"),
+                       stereo_settings().cache_dir );
+        if ( outputs.count("GoodPixelMap") )
+          write_good_pixel_map( opt, eroded_disp );
+        disparity = hole_fill_view( eroded_disp );
+      } else {
+        if ( outputs.count("GoodPixelMap") )
+          write_good_pixel_map( opt, filtered_disp );
+        disparity = hole_fill_view( filtered_disp );
+      }
+    }
+    if ( outputs.count("F") )
+      disparity = fused_checkpoint( stage_opt, "F", disparity, "Filtering" );
+
+    if ( !outputs.count("PC") )
+      return;
+
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stage 4 --> TRIANGULATION (fused)\n";
+    if ( opt.session->has_pointcloud_view_hook() ) {
+      disparity = opt.session->pre_pointcloud_view_hook( disparity );
+    } else {
+      std::string prehook_filename;
+      opt.session->pre_pointcloud_hook( opt.out_prefix+"-F.tif",
+                                        prehook_filename );
+      disparity = DiskImageView<PixelMask<Vector2f> >( prehook_filename );
+    }
+
+    // Triangulation is the last consumer, so the block cache here lets
+    // single threaded ISIS writes still pull disparity tiles from
+    // the earlier stages in parallel.
+    boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
+    stereo::UniverseRadiusFunc universe_radius_func(Vector3(),0,0);
+    ImageViewRef<Vector3> point_cloud =
+      triangulation_view( opt, block_cache( disparity, block_size, 0 ),
+                          camera_model1, camera_model2,
+                          universe_radius_func );
+    write_point_cloud( stage_opt, point_cloud, 0, fused_job( opt, "PC" ) );
+    vw_out() << "\t--> " << universe_radius_func;
+  }
+
+  // Run correlation, refinement, filtering and triangulation without
+  // waiting for each stage to finish the whole image. Correlation,
+  // refinement and filtering are the stages of a TileDag: a tile is
+  // refined as soon as the correlated tiles under it and its halo are
+  // done, and filtered as soon as the refined tiles it needs are. The
+  // point cloud, and any products listed in --fused-outputs, are
+  // written from the finished tiles as they come out.
+  //
+  // Hole filling and the good pixel map need to see the entire
+  // filtered disparity map, so when they are enabled the pipeline
+  // stops at filtering, writes its result to disk and triangulates
+  // afterwards.
+  void stereo_fused( Options& opt ) {
+
+    std::set<std::string> outputs = fused_output_set( opt );
+
+    // The Apollo Metric dust and shadow masking hooks are file based.
+    if ( stereo_settings().mask_flatfield ) {
+      vw_out() << "\t--> MASK_FLATFIELD requires -RD.tif and -F.tif on disk.\n";
+      outputs.insert( "RD" );
+      outputs.insert( "F" );
+      asp::TraceScope trace( "Fused", "stage" );
+      stereo_fused_lazy( opt, outputs );
+      return;
+    }
+    bool view_hook = opt.session->has_pointcloud_view_hook();
+    if ( !view_hook )
+      outputs.insert( "F" );
+    bool blob_processing = stereo_settings().fill_holes || outputs.count("GoodPixelMap");
+    bool triangulate_tiles = outputs.count("PC") && view_hook && !blob_processing;
+
+    asp::TraceScope trace( "Fused", "stage" );
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stages 1-3 --> CORRELATION, REFINEMENT, FILTERING (fused)\n";
+
+    typedef PixelMask<Vector2f> disparity_type;
+    typedef ImageViewRef<disparity_type> disparity_view;
+    disparity_view correlated = correlation_view( opt );
+    asp::TilePlan plan =
+      asp::plan_stage_tiles( "Fused", fused_tile_cost( opt ), opt, MAX_CORRELATION_TILE );
+    Options stage_opt = asp::stage_options( opt, plan );
+    asp::TileDag<disparity_type> dag( correlated, stage_opt.raster_tile_size );
+    size_t refined =
+      dag.add_stage( boost::bind( &refinement_view, boost::cref(opt), _1 ),
+                     refinement_halo() );
+    size_t filtered =
+      dag.add_stage( boost::bind( &filtering_view, boost::cref(opt), _1 ),
+                     filtering_halo() );
+
+    if ( outputs.count("D") )
+      dag.add_tap( 0, asp::TileFileWriter<disparity_view>( opt.out_prefix + "-D.tif",
+                                                           dag.output(0), stage_opt ) );
+    if ( outputs.count("RD") )
+      dag.add_tap( refined, asp::TileFileWriter<disparity_view>( opt.out_prefix + "-RD.tif",
+                                                                 dag.output(refined), stage_opt ) );
+
+    // With hole filling on, -F.tif is written after the holes are
+    // filled, so the unfilled map goes to a temporary file.
+    std::string filtered_filename = opt.out_prefix + "-F.tif";
+    if ( blob_processing && stereo_settings().fill_holes )
+      filtered_filename =
+        ( fs::path( stereo_settings().cache_dir ) /
+          ( fs::path( opt.out_prefix ).filename() + "-F-unfilled.tif" ) ).string();
+    if ( blob_processing || outputs.count("F") )
+      dag.add_tap( filtered, asp::TileFileWriter<disparity_view>( filtered_filename,
+                                                                  dag.output(filtered), stage_opt ) );
+
+    // ISIS camera models aren't thread safe, so their tiles are
+    // triangulated one at a time while the other stages carry on.
+    boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
+    stereo::UniverseRadiusFunc universe_radius_func(Vector3(),0,0);
+    if ( triangulate_tiles ) {
+      ImageViewRef<Vector3> point_cloud =
+        pointcloud_view( opt, dag.output(filtered),
+                         camera_model1, camera_model2, universe_radius_func );
+      dag.add_tap( filtered,
+                   asp::TileFileWriter<ImageViewRef<Vector3> >( opt.out_prefix + "-PC.tif",
+                                                                point_cloud, stage_opt,
+                                                                opt.stereo_session_string == "isis" ) );
+    }
+
+    dag.run( TerminalProgressCallback("asp", "\t--> Fused :"), plan.num_threads );
+
+    if ( triangulate_tiles ) {
+      vw_out() << "\t--> " << universe_radius_func;
+      return;
+    }
+    if ( !blob_processing && !outputs.count("PC") )
+      return;
+
+    {
+      DiskImageView<disparity_type> filtered_disp( filtered_filename );
+      disparity_view disparity = filtered_disp;
+      if ( blob_processing ) {
+        if ( outputs.count("GoodPixelMap") )
+          write_good_pixel_map( opt, filtered_disp );
+        if ( stereo_settings().fill_holes ) {
+          disparity = hole_fill_view( filtered_disp );
+          if ( outputs.count("F") )
+            disparity = fused_checkpoint( stage_opt, "F", disparity, "Filtering" );
+        }
+      }
+
+      if ( outputs.count("PC") ) {
+        vw_out() << "\n[ " << current_posix_time_string()
+                 << " ] : Stage 4 --> TRIANGULATION (fused)\n";
+        ImageViewRef<Vector3> point_cloud;
+        if ( view_hook ) {
+          point_cloud = pointcloud_view( opt, disparity, camera_model1, camera_model2,
+                                         universe_radius_func );
+        } else {
+          std::string prehook_filename;
+          opt.session->pre_pointcloud_hook( opt.out_prefix+"-F.tif",
+                                            prehook_filename );
+          point_cloud =
+            triangulation_view( opt, DiskImageView<disparity_type>( prehook_filename ),
+                                camera_model1, camera_model2, universe_radius_func );
+        }
+        write_point_cloud( stage_opt, point_cloud, plan.num_threads, fused_job( opt, "PC" ) );
+        vw_out() << "\t--> " << universe_radius_func;
+      }
+    }
+
+    if ( filtered_filename != opt.out_prefix + "-F.tif" )
+      fs::remove( filtered_filename );
+  }
+
+} // end namespace vw
+
+#endif//__ASP_STEREO_FUSED_H__
@@ -12,6 +12,7 @@
 
 #include <asp/Tools/stereo.h>
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/StageCache.h>
 
 namespace vw {
 
@@ -19,51 +20,103 @@ namespace vw {
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : Stage 0 --> PREPROCESSING \n";
+    asp::TraceScope trace( "Preprocessing", "stage" );
 
     std::string pre_preprocess_file1, pre_preprocess_file2;
     opt.session->pre_preprocessing_hook(opt.in_file1, opt.in_file2,
                                         pre_preprocess_file1,
                                         pre_preprocess_file2);
 
-    DiskImageView<PixelGray<float> > left_image(pre_preprocess_file1),
-      right_image(pre_preprocess_file2);
-
-    bool rebuild = false;
-    try {
-      vw_log().console_log().rule_set().add_rule(-1,"fileio");
-      DiskImageView<PixelGray<uint8> > testa(opt.out_prefix+"-lMask.tif");
-      DiskImageView<PixelGray<uint8> > testb(opt.out_prefix+"-rMask.tif");
-      vw_settings().reload_config();
-    } catch (vw::IOErr const& e) {
-      vw_settings().reload_config();
-      rebuild = true;
-    } catch (vw::ArgumentErr const& e ) {
-      // Throws on a corrupted file.
-      vw_settings().reload_config();
-      rebuild = true;
+    // Overviews go in before the files are keyed below, so that adding
+    // them doesn't make the other products look out of date. Sessions
+    // that pass the input images through unchanged keep them untouched.
+    if ( stereo_settings().preprocess_pyramid ) {
+      if ( pre_preprocess_file1 != opt.in_file1 )
+        add_pyramid( pre_preprocess_file1 );
+      if ( pre_preprocess_file2 != opt.in_file2 )
+        add_pyramid( pre_preprocess_file2 );
     }
-    if (rebuild) {
+
+    ImageViewRef<PixelGray<float> > left_image = asp::read_float_image(pre_preprocess_file1),
+      right_image = asp::read_float_image(pre_preprocess_file2);
+
+    // Both products depend only on the normalized images.
+    asp::StageKey image_key( "pprc-v1" );
+    image_key.file( pre_preprocess_file1 ).file( pre_preprocess_file2 );
+
+    // With a crop window, only the window and the margin the later
+    // stages read around it are masked. The rest of the left mask is
+    // left invalid.
+    BBox2i left_window = left_crop_window( opt, Vector2i( left_image.cols(), left_image.rows() ) );
+    if ( !opt.left_image_crop_win.empty() ) {
+      int margin = std::max( std::max( stereo_settings().h_kern, stereo_settings().v_kern ),
+                             std::max( stereo_settings().subpixel_h_kern,
+                                       stereo_settings().subpixel_v_kern ) );
+      left_window.expand( margin );
+      left_window.crop( BBox2i( 0, 0, left_image.cols(), left_image.rows() ) );
+      vw_out() << "\t--> Processing left image window " << left_window << "\n";
+    }
+
+    asp::StageCache mask_cache( asp::StageKey( image_key ).value( "product", "masks" )
+                                .value( "window", left_window ),
+                                stereo_settings().stage_cache_dir );
+    mask_cache.output( opt.out_prefix+"-lMask.tif" ).output( opt.out_prefix+"-rMask.tif" );
+    if ( mask_cache.lookup() ) {
+      vw_out() << "\t--> Using cached image masks.\n";
+    } else {
       vw_out() << "\t--> Generating image masks... \n";
 
-      asp::block_write_gdal_image( opt.out_prefix+"-lMask.tif",
-                             apply_mask(copy_mask(constant_view(uint8(255),left_image.cols(),
-                                                                left_image.rows() ),
-                                                  asp::threaded_edge_mask(left_image,0,0,1024))),
-                             opt, TerminalProgressCallback("asp", "\t    Mask L: ") );
-      asp::block_write_gdal_image( opt.out_prefix+"-rMask.tif",
+      ImageViewRef<uint8> left_mask =
+        apply_mask(copy_mask(constant_view(uint8(255),left_window.width(),
+                                           left_window.height() ),
+                             asp::threaded_edge_mask(crop(left_image,left_window),0,0,1024)));
+      asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-lMask.tif",
+                             uncrop_window_view( left_mask, left_window,
+                                                 Vector2i( left_image.cols(), left_image.rows() ) ),
+                             opt, TerminalProgressCallback("asp", "\t    Mask L: "), 0,
+                             asp::TileJob( mask_cache.key().str() ) );
+      asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-rMask.tif",
                              apply_mask(copy_mask(constant_view(uint8(255),right_image.cols(),
                                                                 right_image.rows() ),
                                                   asp::threaded_edge_mask(right_image,0,0,1024))),
-                             opt, TerminalProgressCallback("asp", "\t    Mask R: ") );
+                             opt, TerminalProgressCallback("asp", "\t    Mask R: "), 0,
+                             asp::TileJob( mask_cache.key().str() ) );
+      mask_cache.store();
+    }
+
+    // The filtered images, so that correlation and refinement read
+    // them instead of filtering every tile and its halo again.
+    if ( stereo_settings().prefilter_cache && stereo_settings().pre_filter_mode ) {
+      asp::StageCache filter_cache = filtered_image_cache( opt );
+      if ( filter_cache.lookup() ) {
+        vw_out() << "\t--> Using cached filtered images.\n";
+      } else {
+        vw_out() << "\t--> Filtering images with filter " << stereo_settings().pre_filter_mode
+                 << " and width " << stereo_settings().slogW << ".\n";
+        ImageViewRef<PixelGray<float> > left = asp::read_float_image( opt.out_prefix+"-L.tif" ),
+          right = asp::read_float_image( opt.out_prefix+"-R.tif" );
+        asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-lFiltered.tif",
+                                                preprocessing_filter( left ), opt,
+                                                TerminalProgressCallback("asp", "\t    Filter L: "), 0,
+                                                asp::TileJob( filter_cache.key().str() ) );
+        asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-rFiltered.tif",
+                                                preprocessing_filter( right ), opt,
+                                                TerminalProgressCallback("asp", "\t    Filter R: "), 0,
+                                                asp::TileJob( filter_cache.key().str() ) );
+        if ( stereo_settings().preprocess_pyramid ) {
+          add_pyramid( opt.out_prefix+"-lFiltered.tif" );
+          add_pyramid( opt.out_prefix+"-rFiltered.tif" );
+        }
+        filter_cache.store();
+      }
     }
 
-    try {
-      // This confusing try catch is to see if the subsampled images
-      // actually have content.
-      DiskImageView<PixelGray<float> > testa(opt.out_prefix+"-L_sub.tif");
-      DiskImageView<PixelGray<float> > testb(opt.out_prefix+"-R_sub.tif");
+    asp::StageCache sub_cache( asp::StageKey( image_key ).value( "product", "sub" ),
+                               stereo_settings().stage_cache_dir );
+    sub_cache.output( opt.out_prefix+"-L_sub.tif" ).output( opt.out_prefix+"-R_sub.tif" );
+    if ( sub_cache.lookup() ) {
       vw_out() << "\t--> Using cached subsampled image.\n";
-    } catch (vw::Exception const& e) {
+    } else {
       // Produce subsampled images, these will be used later for Auto
       // search range. They're also a handy debug tool.
       float sub_scale =
@@ -73,37 +126,41 @@ namespace vw {
       sub_scale /= 2;
       if ( sub_scale > 1 ) sub_scale = 1;
 
-      // Solving for the number of threads and the tile size to use for
-      // subsampling while only using 500 MiB of memory. (The cache code
-      // is a little slow on releasing so it will probably use 1.5GiB
-      // memory during subsampling) Also tile size must be a power of 2
-      // and greater than or equal to 64 px;
-      uint32 sub_threads = vw_settings().default_num_threads() + 1;
-      uint32 tile_power = 0;
-      while ( tile_power < 6 && sub_threads > 1) {
-        sub_threads--;
-        tile_power = boost::numeric_cast<uint32>( log10(500e6*sub_scale*sub_scale/(4.0*float(sub_threads)))/(2*log10(2)));
-      }
-      uint32 sub_tile_size = 1u << tile_power;
-      if ( sub_tile_size > vw_settings().default_tile_size() )
-        sub_tile_size = vw_settings().default_tile_size();
-
-      // Change writing parameters to ideal threads and tiles
+      // Resample the smallest pyramid level that is still larger than
+      // the previews. Each output pixel reads 1/level_scale^2 pixels of
+      // it. The block cache is slow to release them, so about three
+      // tiles' worth of input is alive per thread.
+      asp::ImagePyramid left_pyramid = input_pyramid( pre_preprocess_file1 ),
+        right_pyramid = input_pyramid( pre_preprocess_file2 );
+      int32 left_level = left_pyramid.level_for_scale( sub_scale ),
+        right_level = right_pyramid.level_for_scale( sub_scale );
+      Vector2i left_size = left_pyramid.size( left_level ),
+        right_size = right_pyramid.size( right_level );
+      double level_scale = sub_scale * std::min( double( left_image.cols() ) / left_size.x(),
+                                                 double( right_image.cols() ) / right_size.x() );
       vw_out() << "\t--> Creating previews. Subsampling by " << sub_scale
-               << " by using " << sub_tile_size << " tile size and "
-               << sub_threads << " threads.\n";
-      Vector2i previous_tile_size = opt.raster_tile_size;
-      opt.raster_tile_size = Vector2i(sub_tile_size,sub_tile_size);
-      uint32 previous_num_threads = vw_settings().default_num_threads();
-      vw_settings().set_default_num_threads(sub_threads);
-      asp::block_write_gdal_image( opt.out_prefix+"-L_sub.tif",
-                                   resample(left_image, sub_scale), opt,
-                                   TerminalProgressCallback("asp", "\t    Sub L: ") );
-      asp::block_write_gdal_image( opt.out_prefix+"-R_sub.tif",
-                                   resample(right_image, sub_scale), opt,
-                                   TerminalProgressCallback("asp", "\t    Sub R: ") );
-      opt.raster_tile_size = previous_tile_size;
-      vw_settings().set_default_num_threads(previous_num_threads);
+               << " from pyramid levels " << left_level << " and " << right_level << ".\n";
+      asp::TilePlan plan =
+        asp::plan_stage_tiles( "Subsampling",
+                               asp::TileCost( 3.0 * sizeof(PixelGray<float>) / (level_scale*level_scale) ),
+                               opt, vw_settings().default_tile_size() );
+      Options sub_opt = asp::stage_options( opt, plan );
+      // The thread count goes to the writer, not to the VW default,
+      // which pairs running beside this one in stereo_batch share.
+      asp::TileJob sub_job( sub_cache.key().str() );
+      asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-L_sub.tif",
+                                              resample( left_pyramid.level( left_level ),
+                                                        sub_scale * left_image.cols() / left_size.x(),
+                                                        sub_scale * left_image.rows() / left_size.y() ),
+                                              sub_opt, TerminalProgressCallback("asp", "\t    Sub L: "),
+                                              plan.num_threads, sub_job );
+      asp::checkpoint_block_write_gdal_image( opt.out_prefix+"-R_sub.tif",
+                                              resample( right_pyramid.level( right_level ),
+                                                        sub_scale * right_image.cols() / right_size.x(),
+                                                        sub_scale * right_image.rows() / right_size.y() ),
+                                              sub_opt, TerminalProgressCallback("asp", "\t    Sub R: "),
+                                              plan.num_threads, sub_job );
+      sub_cache.store();
     }
   }
 
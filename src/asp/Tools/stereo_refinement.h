@@ -11,96 +11,121 @@
 #define __ASP_STEREO_REFINEMENT_H__
 
 #include <asp/Tools/stereo.h>
+#include <asp/Core/AffineSubpixel.h>
 
 namespace vw {
 
-  void stereo_refinement( Options& opt ) {
+  // How far outside a tile refinement_view reads the integer
+  // disparity. EM mode searches the pyramid, so its window grows with
+  // each level.
+  inline Vector2i refinement_halo() {
+    Vector2i halo( stereo_settings().subpixel_h_kern / 2 + 1,
+                   stereo_settings().subpixel_v_kern / 2 + 1 );
+    if ( stereo_settings().subpixel_mode == 3 )
+      halo *= 1 << stereo_settings().subpixel_pyramid_levels;
+    return halo;
+  }
 
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 2 --> REFINEMENT \n";
+  // Settings for SUBPIXEL_MODE 2.
+  inline asp::AffineSubpixelSettings affine_subpixel_settings() {
+    asp::AffineSubpixelSettings settings;
+    settings.kernel = Vector2i( stereo_settings().subpixel_h_kern,
+                                stereo_settings().subpixel_v_kern );
+    settings.max_iterations = stereo_settings().subpixel_affine_iter;
+    settings.tolerance = stereo_settings().subpixel_affine_tolerance;
+    settings.max_move = stereo_settings().subpixel_affine_max_move;
+    settings.do_h = stereo_settings().do_h_subpixel;
+    settings.do_v = stereo_settings().do_v_subpixel;
+    return settings;
+  }
 
-    try {
-      std::string filename_L = opt.out_prefix+"-L.tif",
-        filename_R  = opt.out_prefix+"-R.tif";
-      /*
-        if (MEDIAN_FILTER == 1){
-        filename_L = out_prefix+"-median-L.tif";
-        filename_R = out_prefix+"-median-R.tif";
-        } else {
-        filename_L = out_prefix+"-L.tif";
-        filename_R = out_prefix+"-R.tif";
-        }
-      */
-      typedef DiskImageView<PixelGray<float> > InnerView;
-      InnerView left_disk_image(filename_L), right_disk_image(filename_R);
-      DiskImageView<PixelMask<Vector2f> > disparity_disk_image(opt.out_prefix + "-D.tif");
-      ImageViewRef<PixelMask<Vector2f> > disparity_map = disparity_disk_image;
-
-      if (stereo_settings().subpixel_mode == 0) {
-        // Do nothing
-      } else if (stereo_settings().subpixel_mode == 1) {
-        // Parabola
-        vw_out() << "\t--> Using parabola subpixel mode.\n";
-        if (stereo_settings().pre_filter_mode == 3) {
-          vw_out() << "\t    SLOG preprocessing width: "
-                   << stereo_settings().slogW << "\n";
-          typedef stereo::SlogStereoPreprocessingFilter PreFilter;
-          disparity_map =
-            stereo::subpixel_refine( disparity_disk_image,
-                                     left_disk_image, right_disk_image,
-                                     stereo_settings().subpixel_h_kern,
-                                     stereo_settings().subpixel_v_kern,
-                                     stereo_settings().do_h_subpixel,
-                                     stereo_settings().do_v_subpixel,
-                                     stereo_settings().subpixel_mode,
-                                     PreFilter(stereo_settings().slogW) );
-        } else if (stereo_settings().pre_filter_mode == 2) {
-          vw_out() << "\t    LOG preprocessing width: "
-                   << stereo_settings().slogW << "\n";
-          typedef stereo::LogStereoPreprocessingFilter PreFilter;
-          disparity_map =
-            stereo::subpixel_refine(disparity_disk_image,
-                                    left_disk_image, right_disk_image,
-                                    stereo_settings().subpixel_h_kern,
-                                    stereo_settings().subpixel_v_kern,
-                                    stereo_settings().do_h_subpixel,
-                                    stereo_settings().do_v_subpixel,
-                                    stereo_settings().subpixel_mode,
-                                    PreFilter(stereo_settings().slogW) );
-        } else if (stereo_settings().pre_filter_mode == 1) {
-          vw_out() << "\t    BLUR preprocessing width: "
-                   << stereo_settings().slogW << "\n";
-          typedef stereo::BlurStereoPreprocessingFilter PreFilter;
-          disparity_map =
-            stereo::subpixel_refine(disparity_disk_image,
-                                    left_disk_image, right_disk_image,
-                                    stereo_settings().subpixel_h_kern,
-                                    stereo_settings().subpixel_v_kern,
-                                    stereo_settings().do_h_subpixel,
-                                    stereo_settings().do_v_subpixel,
-                                    stereo_settings().subpixel_mode,
-                                    PreFilter(stereo_settings().slogW) );
-        } else {
-          vw_out() << "\t    NO preprocessing" << std::endl;
-          typedef stereo::NullStereoPreprocessingFilter PreFilter;
-          disparity_map =
-            stereo::subpixel_refine(disparity_disk_image,
-                                    left_disk_image, right_disk_image,
-                                    stereo_settings().subpixel_h_kern,
-                                    stereo_settings().subpixel_v_kern,
-                                    stereo_settings().do_h_subpixel,
-                                    stereo_settings().do_v_subpixel,
-                                    stereo_settings().subpixel_mode,
-                                    PreFilter() );
-        }
-      } else if (stereo_settings().subpixel_mode == 2) {
-        // Bayes EM
-        vw_out() << "\t--> Using affine adaptive subpixel mode "
-                 << stereo_settings().subpixel_mode << "\n";
-        vw_out() << "\t--> Forcing use of LOG filter with "
-                 << stereo_settings().slogW << " sigma blur.\n";
+  // Working set of one refinement tile: the left and right image
+  // windows and the integer and refined disparities. Affine mode also
+  // keeps the right image gradients, and EM mode pyramids of the
+  // images and of its five channel result.
+  inline asp::TileCost refinement_tile_cost() {
+    Vector2i halo = refinement_halo();
+    double bytes = 2 * sizeof(PixelGray<float>) + 2 * sizeof(PixelMask<Vector2f>);
+    if ( stereo_settings().subpixel_mode == 2 )
+      bytes += 2 * sizeof(float);
+    if ( stereo_settings().subpixel_mode == 3 )
+      bytes = ( 2 * sizeof(PixelGray<float>) + sizeof(PixelMask<Vector<float,5> >) ) * 4.0 / 3.0 +
+        2 * sizeof(PixelMask<Vector2f>);
+    return asp::TileCost( bytes, std::max( halo[0], halo[1] ) );
+  }
+
+  // Spectral radius of the uncertainty of an EM correlator pixel, for
+  // -US.tif.
+  struct EMSpectralUncertaintyFunctor : ReturnFixedType<float> {
+    template <class PixelT>
+    float operator()( PixelT const& pixel ) const {
+      typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+      return EMCorrelator::SpectralRadiusUncertaintyFunctor()
+        ( EMCorrelator::ExtractUncertaintyFunctor()( pixel ) );
+    }
+  };
+
+  // Build the subpixel refined disparity map as a lazy view on top of
+  // an integer disparity map. EM mode's uncertainty channels are
+  // dropped here; stereo_refinement writes those separately. Affine
+  // mode counts the steps of each pixel into histogram, if given.
+  ImageViewRef<PixelMask<Vector2f> >
+  refinement_view( Options const& opt,
+                   ImageViewRef<PixelMask<Vector2f> > const& integer_disparity,
+                   boost::shared_ptr<asp::IterationHistogram> const& histogram =
+                   boost::shared_ptr<asp::IterationHistogram>() ) {
+
+    std::string filename_L = opt.out_prefix+"-L.tif",
+      filename_R  = opt.out_prefix+"-R.tif";
+    /*
+      if (MEDIAN_FILTER == 1){
+      filename_L = out_prefix+"-median-L.tif";
+      filename_R = out_prefix+"-median-R.tif";
+      } else {
+      filename_L = out_prefix+"-L.tif";
+      filename_R = out_prefix+"-R.tif";
+      }
+    */
+    ImageViewRef<PixelGray<float> > left_disk_image = asp::read_float_image(filename_L),
+      right_disk_image = asp::read_float_image(filename_R);
+    apply_crop_window( opt, left_disk_image, right_disk_image );
+    ImageViewRef<PixelMask<Vector2f> > disparity_map = integer_disparity;
+
+    if (stereo_settings().subpixel_mode == 0) {
+      // Do nothing
+    } else if (stereo_settings().subpixel_mode == 1) {
+      // Parabola
+      vw_out() << "\t--> Using parabola subpixel mode.\n";
+      ImageViewRef<PixelGray<float> > left_filtered, right_filtered;
+      if ( open_filtered_images( opt, left_filtered, right_filtered ) ) {
+        disparity_map =
+          stereo::subpixel_refine( integer_disparity,
+                                   left_filtered, right_filtered,
+                                   stereo_settings().subpixel_h_kern,
+                                   stereo_settings().subpixel_v_kern,
+                                   stereo_settings().do_h_subpixel,
+                                   stereo_settings().do_v_subpixel,
+                                   stereo_settings().subpixel_mode,
+                                   stereo::NullStereoPreprocessingFilter() );
+      } else if (stereo_settings().pre_filter_mode == 3) {
+        vw_out() << "\t    SLOG preprocessing width: "
+                 << stereo_settings().slogW << "\n";
+        typedef stereo::SlogStereoPreprocessingFilter PreFilter;
+        disparity_map =
+          stereo::subpixel_refine( integer_disparity,
+                                   left_disk_image, right_disk_image,
+                                   stereo_settings().subpixel_h_kern,
+                                   stereo_settings().subpixel_v_kern,
+                                   stereo_settings().do_h_subpixel,
+                                   stereo_settings().do_v_subpixel,
+                                   stereo_settings().subpixel_mode,
+                                   PreFilter(stereo_settings().slogW) );
+      } else if (stereo_settings().pre_filter_mode == 2) {
+        vw_out() << "\t    LOG preprocessing width: "
+                 << stereo_settings().slogW << "\n";
         typedef stereo::LogStereoPreprocessingFilter PreFilter;
         disparity_map =
-          stereo::subpixel_refine(disparity_disk_image,
+          stereo::subpixel_refine(integer_disparity,
                                   left_disk_image, right_disk_image,
                                   stereo_settings().subpixel_h_kern,
                                   stereo_settings().subpixel_v_kern,
@@ -108,15 +133,109 @@ namespace vw {
                                   stereo_settings().do_v_subpixel,
                                   stereo_settings().subpixel_mode,
                                   PreFilter(stereo_settings().slogW) );
-      } else if (stereo_settings().subpixel_mode == 3) {
-        // Affine and Bayes subpixel refinement always use the
-        // LogPreprocessingFilter...
+      } else if (stereo_settings().pre_filter_mode == 1) {
+        vw_out() << "\t    BLUR preprocessing width: "
+                 << stereo_settings().slogW << "\n";
+        typedef stereo::BlurStereoPreprocessingFilter PreFilter;
+        disparity_map =
+          stereo::subpixel_refine(integer_disparity,
+                                  left_disk_image, right_disk_image,
+                                  stereo_settings().subpixel_h_kern,
+                                  stereo_settings().subpixel_v_kern,
+                                  stereo_settings().do_h_subpixel,
+                                  stereo_settings().do_v_subpixel,
+                                  stereo_settings().subpixel_mode,
+                                  PreFilter(stereo_settings().slogW) );
+      } else {
+        vw_out() << "\t    NO preprocessing" << std::endl;
+        typedef stereo::NullStereoPreprocessingFilter PreFilter;
+        disparity_map =
+          stereo::subpixel_refine(integer_disparity,
+                                  left_disk_image, right_disk_image,
+                                  stereo_settings().subpixel_h_kern,
+                                  stereo_settings().subpixel_v_kern,
+                                  stereo_settings().do_h_subpixel,
+                                  stereo_settings().do_v_subpixel,
+                                  stereo_settings().subpixel_mode,
+                                  PreFilter() );
+      }
+    } else if (stereo_settings().subpixel_mode == 2) {
+      // Affine adaptive window
+      vw_out() << "\t--> Using affine adaptive subpixel mode "
+               << stereo_settings().subpixel_mode << "\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+      // The filtered images from preprocessing will do if they are
+      // LOG filtered too.
+      float width = stereo_settings().slogW;
+      ImageViewRef<PixelGray<float> > left_filtered, right_filtered;
+      if ( stereo_settings().pre_filter_mode != 2 ||
+           !open_filtered_images( opt, left_filtered, right_filtered ) ) {
+        left_filtered = laplacian_filter( gaussian_filter( left_disk_image, width ) );
+        right_filtered = laplacian_filter( gaussian_filter( right_disk_image, width ) );
+      }
+      disparity_map =
+        asp::AffineSubpixelView( integer_disparity, left_filtered, right_filtered,
+                                 affine_subpixel_settings(), histogram );
+    } else if (stereo_settings().subpixel_mode == 3) {
+      // Affine and Bayes subpixel refinement always use the
+      // LogPreprocessingFilter...
+      vw_out() << "\t--> Using EM Subpixel mode "
+               << stereo_settings().subpixel_mode << std::endl;
+      vw_out() << "\t--> Mode 3 does internal preprocessing;"
+               << " settings will be ignored. " << std::endl;
+
+      typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+      EMCorrelator em_correlator(channels_to_planes(left_disk_image),
+                                 channels_to_planes(right_disk_image),
+                                 integer_disparity, -1);
+      em_correlator.set_em_iter_max(stereo_settings().subpixel_em_iter);
+      em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter);
+      em_correlator.set_kernel_size(Vector2i(stereo_settings().subpixel_h_kern,
+                                             stereo_settings().subpixel_v_kern));
+      em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
+
+      disparity_map =
+        per_pixel_filter(em_correlator, EMCorrelator::ExtractDisparityFunctor());
+    } else {
+      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << std::endl;
+      vw_out() << "\t--> Doing nothing\n";
+    }
+
+    return disparity_map;
+  }
+
+  void stereo_refinement( Options& opt ) {
+
+    vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 2 --> REFINEMENT \n";
+    asp::TraceScope trace( "Refinement", "stage" );
+
+    try {
+      DiskImageView<PixelMask<Vector2f> > disparity_disk_image(opt.out_prefix + "-D.tif");
+      ImageViewRef<PixelMask<Vector2f> > disparity_map;
+
+      asp::TilePlan plan =
+        asp::plan_stage_tiles( "Refinement", refinement_tile_cost(), opt,
+                               vw_settings().default_tile_size() );
+      Options stage_opt = asp::stage_options( opt, plan );
+      asp::TileJob job( resume_key( opt, "rfne-v1" ).file( opt.out_prefix + "-D.tif" )
+                        .file( opt.out_prefix + "-L.tif" ).file( opt.out_prefix + "-R.tif" ).str() );
+
+      if (stereo_settings().subpixel_mode == 3) {
+        // EM mode also produces uncertainty images. Each tile of the
+        // correlator is rendered once and split between the files.
         vw_out() << "\t--> Using EM Subpixel mode "
                  << stereo_settings().subpixel_mode << std::endl;
         vw_out() << "\t--> Mode 3 does internal preprocessing;"
                  << " settings will be ignored. " << std::endl;
 
+        ImageViewRef<PixelGray<float> >
+          left_disk_image = asp::read_float_image(opt.out_prefix+"-L.tif"),
+          right_disk_image = asp::read_float_image(opt.out_prefix+"-R.tif");
+        apply_crop_window( opt, left_disk_image, right_disk_image );
+
         typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+        typedef EMCorrelator::pixel_type em_pixel;
         EMCorrelator em_correlator(channels_to_planes(left_disk_image),
                                    channels_to_planes(right_disk_image),
                                    disparity_disk_image, -1);
@@ -126,36 +245,37 @@ namespace vw {
                                                stereo_settings().subpixel_v_kern));
         em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
 
-        DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
-
-        block_write_image(em_disparity_map_rsrc, em_correlator,
-                          TerminalProgressCallback("asp", "\t--> EM Refinement :"));
-
-        DiskImageResource *em_disparity_map_rsrc_2 =
-          DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
-        DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
-
-        ImageViewRef<Vector<float, 3> > disparity_uncertainty =
-          per_pixel_filter(em_disparity_disk_image,
-                           EMCorrelator::ExtractUncertaintyFunctor());
-        ImageViewRef<float> spectral_uncertainty =
-          per_pixel_filter(disparity_uncertainty,
-                           EMCorrelator::SpectralRadiusUncertaintyFunctor());
-        write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
-        write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
-
-        disparity_map =
-          per_pixel_filter(em_disparity_disk_image,
-                           EMCorrelator::ExtractDisparityFunctor());
+        std::vector<boost::shared_ptr<asp::TileSink<em_pixel> > > sinks;
+        sinks.push_back( boost::shared_ptr<asp::TileSink<em_pixel> >
+                         ( new asp::FilteredTileSink<em_pixel, EMCorrelator::ExtractDisparityFunctor>
+                           ( opt.out_prefix + "-RD.tif" ) ) );
+        if ( stereo_settings().subpixel_uncertainty ) {
+          sinks.push_back( boost::shared_ptr<asp::TileSink<em_pixel> >
+                           ( new asp::FilteredTileSink<em_pixel, EMCorrelator::ExtractUncertaintyFunctor>
+                             ( opt.out_prefix + "-U.tif" ) ) );
+          sinks.push_back( boost::shared_ptr<asp::TileSink<em_pixel> >
+                           ( new asp::FilteredTileSink<em_pixel, EMSpectralUncertaintyFunctor>
+                             ( opt.out_prefix + "-US.tif" ) ) );
+        }
+        asp::checkpoint_block_write_gdal_images( em_correlator, sinks, stage_opt,
+                                                 TerminalProgressCallback("asp", "\t--> EM Refinement :"),
+                                                 plan.num_threads, job );
       } else {
-        vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << std::endl;
-        vw_out() << "\t--> Doing nothing\n";
+        boost::shared_ptr<asp::IterationHistogram> histogram;
+        if ( stereo_settings().subpixel_mode == 2 && stereo_settings().subpixel_iter_histogram )
+          histogram.reset( new asp::IterationHistogram() );
+        disparity_map =
+          refinement_view( opt, asp::trace_read( disparity_disk_image,
+                                                 opt.out_prefix + "-D.tif" ), histogram );
+        asp::checkpoint_block_write_gdal_image( opt.out_prefix + "-RD.tif",
+                                                disparity_map, stage_opt,
+                                                TerminalProgressCallback("asp", "\t--> Refinement :"),
+                                                plan.num_threads, job );
+        // Tiles restored from a checkpoint aren't counted.
+        if ( histogram )
+          vw_out() << "\t--> Affine subpixel iterations per pixel:\n" << *histogram;
       }
 
-      asp::block_write_gdal_image( opt.out_prefix + "-RD.tif",
-                                   disparity_map, opt,
-                                   TerminalProgressCallback("asp", "\t--> Refinement :") );
-
     } catch (IOErr const& e) {
       vw_throw( ArgumentErr() << "\nUnable to start at refinement stage -- could not read input files.\n" << e.what() << "\nExiting.\n\n" );
     }
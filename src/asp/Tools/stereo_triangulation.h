@@ -16,94 +16,178 @@
 
 namespace vw {
 
-  void stereo_triangulation( Options const& opt ) {
-    vw_out() << "\n[ " << current_posix_time_string()
-             << " ] : Stage 4 --> TRIANGULATION \n";
-
-    try {
-      std::string prehook_filename;
-      opt.session->pre_pointcloud_hook(opt.out_prefix+"-F.tif",
-                                       prehook_filename);
-      vw_out(VerboseDebugMessage,"asp") << "Disparity Map for Triangulation: "
-                                        << prehook_filename << "\n";
-      DiskImageView<PixelMask<Vector2f> > disparity_map(prehook_filename);
-
-      boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
-      opt.session->camera_models(camera_model1, camera_model2);
+  // Build the point cloud as a lazy view on top of a disparity map
+  // that has already been through the session's pointcloud hook. The
+  // stereo model only keeps raw camera pointers, so the camera models
+  // are handed back and the caller must keep them alive while the
+  // view is in use.
+  ImageViewRef<Vector3>
+  triangulation_view( Options const& opt,
+                      ImageViewRef<PixelMask<Vector2f> > const& disparity_map,
+                      boost::shared_ptr<camera::CameraModel> & camera_model1,
+                      boost::shared_ptr<camera::CameraModel> & camera_model2,
+                      stereo::UniverseRadiusFunc & universe_radius_func ) {
+
+    opt.session->camera_models(camera_model1, camera_model2);
 
 #if HAVE_PKG_VW_BUNDLEADJUSTMENT
-      // If the user has generated a set of position and pose
-      // corrections using the bundle_adjust program, we read them in
-      // here and incorporate them into our camera model.
-      Vector3 position_correction;
-      Quaternion<double> pose_correction;
-      if (fs::exists(fs::path(in_file1).replace_extension("adjust"))) {
-        read_adjustments(fs::path(in_file1).replace_extension("adjust").string(),
-                         position_correction, pose_correction);
-        camera_model1 =
-          boost::shared_ptr<CameraModel>(new AdjustedCameraModel(camera_model1,
-                                                                 position_correction,
-                                                                 pose_correction));
-      }
-      if (fs::exists(fs::path(in_file2).replace_extension("adjust"))) {
-        read_adjustments(fs::path(in_file2).replace_extension("adjust").string(),
-                         position_correction, pose_correction);
-        camera_model2 =
-          boost::shared_ptr<CameraModel>(new AdjustedCameraModel(camera_model2,
-                                                                 position_correction,
-                                                                 pose_correction));
-      }
+    // If the user has generated a set of position and pose
+    // corrections using the bundle_adjust program, we read them in
+    // here and incorporate them into our camera model.
+    Vector3 position_correction;
+    Quaternion<double> pose_correction;
+    if (fs::exists(fs::path(in_file1).replace_extension("adjust"))) {
+      read_adjustments(fs::path(in_file1).replace_extension("adjust").string(),
+                       position_correction, pose_correction);
+      camera_model1 =
+        boost::shared_ptr<CameraModel>(new AdjustedCameraModel(camera_model1,
+                                                               position_correction,
+                                                               pose_correction));
+    }
+    if (fs::exists(fs::path(in_file2).replace_extension("adjust"))) {
+      read_adjustments(fs::path(in_file2).replace_extension("adjust").string(),
+                       position_correction, pose_correction);
+      camera_model2 =
+        boost::shared_ptr<CameraModel>(new AdjustedCameraModel(camera_model2,
+                                                               position_correction,
+                                                               pose_correction));
+    }
 #endif
 
-      // If the distance from the left camera center to a point is
-      // greater than the universe radius, we remove that pixel and
-      // replace it with a zero vector, which is the missing pixel value
-      // in the point_image.
-      //
-      // We apply the universe radius here and then write the result
-      // directly to a file on disk.
-      stereo::UniverseRadiusFunc universe_radius_func(Vector3(),0,0);
-      if ( stereo_settings().universe_center == "CAMERA" ) {
-        universe_radius_func =
-          stereo::UniverseRadiusFunc(camera_model1->camera_center(Vector2()),
-                                     stereo_settings().near_universe_radius,
-                                     stereo_settings().far_universe_radius);
-      } else if ( stereo_settings().universe_center == "ZERO" ) {
-        universe_radius_func =
-          stereo::UniverseRadiusFunc(Vector3(),
-                                     stereo_settings().near_universe_radius,
-                                     stereo_settings().far_universe_radius);
-      }
+    // If the distance from the left camera center to a point is
+    // greater than the universe radius, we remove that pixel and
+    // replace it with a zero vector, which is the missing pixel value
+    // in the point_image.
+    //
+    // We apply the universe radius here and then write the result
+    // directly to a file on disk.
+    universe_radius_func = stereo::UniverseRadiusFunc(Vector3(),0,0);
+    if ( stereo_settings().universe_center == "CAMERA" ) {
+      universe_radius_func =
+        stereo::UniverseRadiusFunc(camera_model1->camera_center(Vector2()),
+                                   stereo_settings().near_universe_radius,
+                                   stereo_settings().far_universe_radius);
+    } else if ( stereo_settings().universe_center == "ZERO" ) {
+      universe_radius_func =
+        stereo::UniverseRadiusFunc(Vector3(),
+                                   stereo_settings().near_universe_radius,
+                                   stereo_settings().far_universe_radius);
+    }
 
-      // Apply radius function and stereo model in one go
-      vw_out() << "\t--> Generating a 3D point cloud.   " << std::endl;
-      ImageViewRef<Vector3> point_cloud;
-      if ( stereo_settings().use_least_squares )
-        point_cloud =
-          per_pixel_filter(stereo::lsq_stereo_triangulate( disparity_map,
-                                                           camera_model1.get(),
-                                                           camera_model2.get() ),
-                           universe_radius_func);
-      else
-        point_cloud =
-          per_pixel_filter(stereo::stereo_triangulate( disparity_map,
-                                                       camera_model1.get(),
-                                                       camera_model2.get() ),
-                           universe_radius_func);
+    // Apply radius function and stereo model in one go
+    vw_out() << "\t--> Generating a 3D point cloud.   " << std::endl;
+    ImageViewRef<Vector3> point_cloud;
+    if ( stereo_settings().use_least_squares )
+      point_cloud =
+        per_pixel_filter(stereo::lsq_stereo_triangulate( disparity_map,
+                                                         camera_model1.get(),
+                                                         camera_model2.get() ),
+                         universe_radius_func);
+    else
+      point_cloud =
+        per_pixel_filter(stereo::stereo_triangulate( disparity_map,
+                                                     camera_model1.get(),
+                                                     camera_model2.get() ),
+                         universe_radius_func);
+
+    return point_cloud;
+  }
 
-      vw_out(VerboseDebugMessage,"asp") << "Writing Point Cloud: "
-                                        << opt.out_prefix + "-PC.tif\n";
+  // Build the point cloud for a disparity map that hasn't been through
+  // the session's pointcloud hook yet, using the view form of the
+  // hook. With a crop window the disparity is moved back into the
+  // frame of the whole left image for the hook and the cameras, and
+  // the point cloud is cropped to the window again.
+  ImageViewRef<Vector3>
+  pointcloud_view( Options const& opt,
+                   ImageViewRef<PixelMask<Vector2f> > const& disparity_map,
+                   boost::shared_ptr<camera::CameraModel> & camera_model1,
+                   boost::shared_ptr<camera::CameraModel> & camera_model2,
+                   stereo::UniverseRadiusFunc & universe_radius_func ) {
+    if ( opt.left_image_crop_win.empty() )
+      return triangulation_view( opt, opt.session->pre_pointcloud_view_hook( disparity_map ),
+                                 camera_model1, camera_model2, universe_radius_func );
+
+    DiskImageView<PixelGray<float> > left_image( opt.out_prefix + "-L.tif" );
+    Vector2i left_size( left_image.cols(), left_image.rows() );
+    BBox2i window = left_crop_window( opt, left_size );
+    vw_out() << "\t--> Triangulating left image window " << window << "\n";
+    ImageViewRef<PixelMask<Vector2f> > full_disparity =
+      uncrop_window_view( disparity_map, window, left_size );
+    ImageViewRef<Vector3> point_cloud =
+      triangulation_view( opt, opt.session->pre_pointcloud_view_hook( full_disparity ),
+                          camera_model1, camera_model2, universe_radius_func );
+    return crop( point_cloud, window );
+  }
 
+  // Working set of one triangulation tile: the disparity and the
+  // points. The camera models don't grow with the tile.
+  inline asp::TileCost triangulation_tile_cost() {
+    return asp::TileCost( sizeof(PixelMask<Vector2f>) + sizeof(Vector3) );
+  }
+
+  // Write the point cloud. ISIS camera models are not thread safe, so
+  // those are written in a single thread. Everything else can resume
+  // from a tile manifest left by the same job.
+  void write_point_cloud( Options const& opt,
+                          ImageViewRef<Vector3> const& point_cloud,
+                          vw::uint32 num_threads = 0,
+                          asp::TileJob const& job = asp::TileJob() ) {
+    vw_out(VerboseDebugMessage,"asp") << "Writing Point Cloud: "
+                                      << opt.out_prefix + "-PC.tif\n";
+
+    if ( opt.stereo_session_string == "isis" ) {
       DiskImageResource* rsrc =
         asp::build_gdal_rsrc( opt.out_prefix + "-PC.tif",
                               point_cloud, opt );
-      if ( opt.stereo_session_string == "isis" )
-        write_image(*rsrc, point_cloud,
-                    TerminalProgressCallback("asp", "\t--> Triangulating: "));
-      else
-        block_write_image(*rsrc, point_cloud,
-                          TerminalProgressCallback("asp", "\t--> Triangulating: "));
+      write_image(*rsrc, point_cloud,
+                  TerminalProgressCallback("asp", "\t--> Triangulating: "));
       delete rsrc;
+    } else {
+      asp::checkpoint_block_write_gdal_image( opt.out_prefix + "-PC.tif",
+                                              point_cloud, opt,
+                                              TerminalProgressCallback("asp", "\t--> Triangulating: "),
+                                              num_threads, job );
+    }
+  }
+
+  void stereo_triangulation( Options& opt ) {
+    vw_out() << "\n[ " << current_posix_time_string()
+             << " ] : Stage 4 --> TRIANGULATION \n";
+    asp::TraceScope trace( "Triangulation", "stage" );
+
+    try {
+      boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
+      stereo::UniverseRadiusFunc universe_radius_func(Vector3(),0,0);
+      ImageViewRef<Vector3> point_cloud;
+
+      if ( opt.left_image_crop_win.empty() ) {
+        std::string prehook_filename;
+        opt.session->pre_pointcloud_hook(opt.out_prefix+"-F.tif",
+                                         prehook_filename);
+        vw_out(VerboseDebugMessage,"asp") << "Disparity Map for Triangulation: "
+                                          << prehook_filename << "\n";
+        DiskImageView<PixelMask<Vector2f> > disparity_map(prehook_filename);
+        point_cloud =
+          triangulation_view( opt, asp::trace_read( disparity_map, prehook_filename ),
+                              camera_model1, camera_model2,
+                              universe_radius_func );
+      } else {
+        // The file based hook assumes the disparity covers the whole
+        // left image, so a cropped one goes through the view form.
+        DiskImageView<PixelMask<Vector2f> > disparity_map(opt.out_prefix+"-F.tif");
+        point_cloud =
+          pointcloud_view( opt, asp::trace_read( disparity_map, opt.out_prefix+"-F.tif" ),
+                           camera_model1, camera_model2,
+                           universe_radius_func );
+      }
+
+      asp::TilePlan plan =
+        asp::plan_stage_tiles( "Triangulation", triangulation_tile_cost(), opt,
+                               vw_settings().default_tile_size() );
+      write_point_cloud( asp::stage_options( opt, plan ), point_cloud, plan.num_threads,
+                         asp::TileJob( resume_key( opt, "tri-v1" )
+                                       .file( opt.out_prefix+"-F.tif" ).str() ) );
       vw_out() << "\t--> " << universe_radius_func;
 
     } catch (IOErr const& e) {